@@ -180,6 +180,12 @@ void SetMemory(NodeExecStats* nt, OpKernelContext* ctx) {
       ctx->device_persistent_memory_allocated());
 }
 
+void SetCounters(NodeExecStats* nt, OpKernelContext* ctx) {
+  for (const auto& counter : ctx->counters()) {
+    (*nt->mutable_counters())[counter.first] = counter.second;
+  }
+}
+
 void SetReferencedTensors(NodeExecStats* nt,
                           const TensorReferenceVector& tensors) {
   // be careful not to increment the reference count on any tensor
@@ -1543,10 +1549,12 @@ void ExecutorState::Process(TaggedNode tagged_node, int64 scheduled_usec) {
     }
 
     params.track_allocations = false;
+    params.collect_counters = false;
     stats = nullptr;
     if (stats_collector_ && !tagged_node.is_dead) {
       // track allocations if and only if we are collecting statistics
       params.track_allocations = true;
+      params.collect_counters = true;
       stats = new NodeExecStats;
       stats->set_node_name(node->name());
       nodestats::SetScheduled(stats, scheduled_usec);
@@ -1615,7 +1623,10 @@ void ExecutorState::Process(TaggedNode tagged_node, int64 scheduled_usec) {
           if (stats) nodestats::SetOpEnd(stats);
           EntryVector outputs;
           Status s = ProcessOutputs(*state->item, &state->ctx, &outputs, stats);
-          if (stats) nodestats::SetMemory(stats, &state->ctx);
+          if (stats) {
+            nodestats::SetMemory(stats, &state->ctx);
+            nodestats::SetCounters(stats, &state->ctx);
+          }
           // Clears inputs.
           const int num_inputs = state->item->num_inputs;
           for (int i = 0; i < num_inputs; ++i) {
@@ -1659,7 +1670,10 @@ void ExecutorState::Process(TaggedNode tagged_node, int64 scheduled_usec) {
           ctx.retrieve_accessed_tensors(&accessed_tensors);
           device_context = ctx.op_device_context();
         }
-        if (stats) nodestats::SetMemory(stats, &ctx);
+        if (stats) {
+          nodestats::SetMemory(stats, &ctx);
+          nodestats::SetCounters(stats, &ctx);
+        }
       }
     }
 
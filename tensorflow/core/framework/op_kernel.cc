@@ -783,6 +783,23 @@ std::vector<int64> OpKernelContext::device_persistent_alloc_ids() const {
                             device_persistent_alloc_ids_.end());
 }
 
+void OpKernelContext::record_counter(StringPiece name, int64 value) {
+  mutex_lock lock(mu_);
+  for (auto& counter : counters_) {
+    if (counter.first == name) {
+      counter.second += value;
+      return;
+    }
+  }
+  counters_.emplace_back(name.ToString(), value);
+}
+
+std::vector<std::pair<string, int64>> OpKernelContext::counters() const {
+  mutex_lock lock(mu_);
+  return std::vector<std::pair<string, int64>>(counters_.begin(),
+                                               counters_.end());
+}
+
 // OpKernel registration ------------------------------------------------------
 
 struct KernelRegistration {
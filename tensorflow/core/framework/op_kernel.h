@@ -513,6 +513,7 @@ class OpKernelContext {
     bool track_allocations = false;
     bool log_memory = false;
     bool record_tensor_accesses = false;
+    bool collect_counters = false;
 
     // Array indexed by output number for this node
     const AllocatorAttributes* output_attr_array = nullptr;
@@ -1063,6 +1064,18 @@ class OpKernelContext {
   std::vector<int64> host_persistent_alloc_ids() const;
   std::vector<int64> device_persistent_alloc_ids() const;
 
+  // Whether the counters recorded by the kernel are reported, in the
+  // NodeExecStats of the node when step stats are collected. Kernels may
+  // skip measuring costly counters, such as timings, otherwise.
+  bool collect_counters() const { return params_->collect_counters; }
+
+  // Adds value to the counter called name, e.g. a number of items
+  // processed by the kernel. Thread-safe.
+  void record_counter(StringPiece name, int64 value);
+
+  // Returns the recorded counters, in the order they were first recorded.
+  std::vector<std::pair<string, int64>> counters() const;
+
   bool input_is_ref(int index) const;
 
  private:
@@ -1113,6 +1126,8 @@ class OpKernelContext {
   int64 host_persistent_memory_allocated_;
   int64 device_persistent_memory_allocated_;
 
+  gtl::InlinedVector<std::pair<string, int64>, 4> counters_ GUARDED_BY(mu_);
+
   TF_DISALLOW_COPY_AND_ASSIGN(OpKernelContext);
 };
 
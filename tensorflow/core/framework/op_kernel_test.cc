@@ -335,6 +335,33 @@ TEST_F(OpKernelTest, SaveTempTrue) {
   delete params.device;
 }
 
+TEST_F(OpKernelTest, RecordCounters) {
+  Env* env = Env::Default();
+  OpKernelContext::Params params;
+  params.collect_counters = true;
+  params.device = new DummyDevice(env, false);
+  Status status;
+  std::unique_ptr<OpKernel> op(
+      CreateOpKernel(DEVICE_CPU, params.device, cpu_allocator(),
+                     CreateNodeDef("Test1", {DT_FLOAT, DT_INT32}),
+                     TF_GRAPH_DEF_VERSION, &status));
+  EXPECT_TRUE(status.ok());
+  params.op_kernel = op.get();
+  OpKernelContext* ctx = new OpKernelContext(&params);
+
+  EXPECT_TRUE(ctx->collect_counters());
+  EXPECT_TRUE(ctx->counters().empty());
+  ctx->record_counter("frames", 3);
+  ctx->record_counter("beams", 10);
+  ctx->record_counter("frames", 4);
+  const std::vector<std::pair<string, int64>> expected = {{"frames", 7},
+                                                          {"beams", 10}};
+  EXPECT_EQ(expected, ctx->counters());
+
+  delete ctx;
+  delete params.device;
+}
+
 TEST_F(OpKernelTest, InputDtype) {
   Env* env = Env::Default();
   OpKernelContext::Params params;
@@ -17,33 +17,71 @@ limitations under the License.
 
 #define EIGEN_USE_THREADS
 
+#include <algorithm>
+#include <atomic>
+#include <functional>
 #include <limits>
+#include <memory>
+#include <numeric>
+#include <unordered_map>
+#include <unordered_set>
 
 #include "tensorflow/core/util/ctc/ctc_beam_search.h"
 #include "tensorflow/core/framework/op.h"
 #include "tensorflow/core/framework/op_kernel.h"
 #include "tensorflow/core/framework/types.h"
+#include "tensorflow/core/kernels/ctc_kenlm_scorer_resource.h"
 #include "tensorflow/core/lib/core/status.h"
+#include "tensorflow/core/lib/core/threadpool.h"
+#include "tensorflow/core/lib/strings/strcat.h"
 #include "tensorflow/core/platform/logging.h"
 #include "tensorflow/core/platform/macros.h"
+#include "tensorflow/core/platform/mutex.h"
 #include "tensorflow/core/util/sparse/sparse_tensor.h"
+#include "tensorflow/core/util/work_sharder.h"
 
 namespace tensorflow {
 
 typedef Eigen::ThreadPoolDevice CPUDevice;
 
-inline float RowMax(const TTypes<float>::UnalignedConstMatrix& m, int r,
-                    int* c) {
-  *c = 0;
-  CHECK_LT(0, m.dimension(1));
-  float p = m(r, 0);
-  for (int i = 1; i < m.dimension(1); ++i) {
-    if (m(r, i) > p) {
-      p = m(r, i);
-      *c = i;
+// Returns the index of the first maximum of row[0, n) and stores the maximum
+// in *max. The row is scanned in blocks whose maxima are computed with SIMD
+// packets; only the winning block is searched again for the index.
+inline int ArgMax(const float* row, int n, float* max) {
+  typedef Eigen::internal::packet_traits<float>::type Packet;
+  static const int kPacketSize = sizeof(Packet) / sizeof(float);
+  static const int kBlockSize = 8 * kPacketSize;
+  CHECK_LT(0, n);
+
+  float best = row[0];
+  int best_index = 0;
+  int best_block = -1;
+  const int vectorized_size = n - n % kBlockSize;
+  for (int block = 0; block < vectorized_size; block += kBlockSize) {
+    Packet m = Eigen::internal::ploadu<Packet>(row + block);
+    for (int i = kPacketSize; i < kBlockSize; i += kPacketSize) {
+      m = Eigen::internal::pmax(
+          m, Eigen::internal::ploadu<Packet>(row + block + i));
+    }
+    const float block_max = Eigen::internal::predux_max(m);
+    if (block_max > best || best_block < 0) {
+      best = block_max;
+      best_block = block;
+    }
+  }
+  if (best_block >= 0) {
+    best_index = best_block;
+    const int block_end = best_block + kBlockSize - 1;
+    while (best_index < block_end && row[best_index] != best) ++best_index;
+  }
+  for (int i = vectorized_size; i < n; ++i) {
+    if (row[i] > best) {
+      best = row[i];
+      best_index = i;
     }
   }
-  return p;
+  *max = best;
+  return best_index;
 }
 
 class CTCDecodeHelper {
@@ -187,7 +225,6 @@ class CTCGreedyDecoderOp : public OpKernel {
 
     const TensorShape& inputs_shape = inputs->shape();
 
-    std::vector<TTypes<float>::UnalignedConstMatrix> input_list_t;
     const int64 max_time = inputs_shape.dim_size(0);
     const int64 batch_size = inputs_shape.dim_size(1);
     const int64 num_classes_raw = inputs_shape.dim_size(2);
@@ -195,13 +232,12 @@ class CTCGreedyDecoderOp : public OpKernel {
         ctx, FastBoundsCheck(num_classes_raw, std::numeric_limits<int>::max()),
         errors::InvalidArgument("num_classes cannot exceed max int"));
     const int num_classes = static_cast<const int>(num_classes_raw);
+    OP_REQUIRES(ctx, num_classes > 0,
+                errors::InvalidArgument("num_classes must be positive, got ",
+                                        num_classes));
 
-    auto inputs_t = inputs->tensor<float, 3>();
-
-    for (std::size_t t = 0; t < max_time; ++t) {
-      input_list_t.emplace_back(inputs_t.data() + t * batch_size * num_classes,
-                                batch_size, num_classes);
-    }
+    // Row (t, b) of the logits is contiguous.
+    const float* inputs_data = inputs->flat<float>().data();
     auto seq_len_t = seq_len->vec<int32>();
     auto log_prob_t = log_prob->matrix<float>();
 
@@ -212,20 +248,33 @@ class CTCGreedyDecoderOp : public OpKernel {
 
     // Perform best path decoding
     std::vector<std::vector<std::vector<int> > > sequences(batch_size);
-    for (int b = 0; b < batch_size; ++b) {
-      sequences[b].resize(1);
-      auto& sequence = sequences[b][0];
-      int prev_indices = -1;
-      for (int t = 0; t < seq_len_t(b); ++t) {
-        int max_class_indices;
-        log_prob_t(b, 0) += -RowMax(input_list_t[t], b, &max_class_indices);
-        if (max_class_indices != blank_index &&
-            !(merge_repeated_ && max_class_indices == prev_indices)) {
-          sequence.push_back(max_class_indices);
+    auto decode = [this, inputs_data, &seq_len_t, &log_prob_t, &sequences,
+                   batch_size, num_classes,
+                   blank_index](int64 start_row, int64 limit_row) {
+      for (int64 b = start_row; b < limit_row; ++b) {
+        sequences[b].resize(1);
+        auto& sequence = sequences[b][0];
+        int prev_indices = -1;
+        for (int t = 0; t < seq_len_t(b); ++t) {
+          float max;
+          const int max_class_indices = ArgMax(
+              inputs_data + (t * batch_size + b) * num_classes, num_classes,
+              &max);
+          log_prob_t(b, 0) += -max;
+          if (max_class_indices != blank_index &&
+              !(merge_repeated_ && max_class_indices == prev_indices)) {
+            sequence.push_back(max_class_indices);
+          }
+          prev_indices = max_class_indices;
         }
-        prev_indices = max_class_indices;
       }
-    }
+    };
+
+    const int64 cost =
+        max_time * num_classes * Eigen::TensorOpCost::AddCost<float>();
+    const DeviceBase::CpuWorkerThreads& workers =
+        *ctx->device()->tensorflow_cpu_worker_threads();
+    Shard(workers.num_threads, workers.workers, batch_size, cost, decode);
 
     OP_REQUIRES_OK(
         ctx, decode_helper_.StoreAllDecodedSequences(
@@ -242,26 +291,611 @@ class CTCGreedyDecoderOp : public OpKernel {
 REGISTER_KERNEL_BUILDER(Name("CTCGreedyDecoder").Device(DEVICE_CPU),
                         CTCGreedyDecoderOp);
 
-// CTC beam search
-class CTCBeamSearchDecoderOp : public OpKernel {
+// Language model weights fed to a beam search decoder kernel.
+struct CTCBeamSearchScorerWeights {
+  float lm_weight;
+  float word_count_weight;
+  float valid_word_count_weight;
+
+  void ApplyTo(ctc::KenLMBeamScorer* scorer) const {
+    scorer->SetLMWeight(lm_weight);
+    scorer->SetWordCountWeight(word_count_weight);
+    scorer->SetValidWordCountWeight(valid_word_count_weight);
+  }
+};
+
+// Columns of the decode_stats output of the beam search decoders: the work
+// done decoding one batch item. The same names are used for the op counters
+// summing them over the batch.
+const char* const kDecodeStatNames[] = {
+    "frames",           "skipped_frames",  "beams_expanded",
+    "children_created", "children_pruned", "lm_queries",
+    "oov_words",        "trie_misses",     "scorer_micros",
+    "beam_update_micros"};
+const int kNumDecodeStats = TF_ARRAYSIZE(kDecodeStatNames);
+
+// Scorer counters, taken before decoding a batch item so that its share of
+// the work can be told apart.
+struct CTCBeamSearchScorerCounts {
+  explicit CTCBeamSearchScorerCounts(const ctc::KenLMBeamScorer& scorer)
+      : lm_queries(scorer.GetLMQueries()),
+        oov_words(scorer.GetOOVWords()),
+        trie_misses(scorer.GetTrieMisses()) {}
+
+  int64 lm_queries;
+  int64 oov_words;
+  int64 trie_misses;
+};
+
+// Fills row, kNumDecodeStats values, with the work done by a decoder since
+// its stats were reset and by its scorer since before was taken.
+void FillDecodeStats(const ctc::CTCBeamSearchStats& stats,
+                     const CTCBeamSearchScorerCounts& before,
+                     const ctc::KenLMBeamScorer& scorer, int64* row) {
+  const int64 values[] = {
+      stats.frames,
+      stats.skipped_frames,
+      stats.beams_expanded,
+      stats.children_created,
+      stats.children_pruned,
+      scorer.GetLMQueries() - before.lm_queries,
+      scorer.GetOOVWords() - before.oov_words,
+      scorer.GetTrieMisses() - before.trie_misses,
+      stats.scorer_nanos / 1000,
+      (stats.decode_nanos - stats.scorer_nanos) / 1000};
+  static_assert(TF_ARRAYSIZE(values) == kNumDecodeStats,
+                "FillDecodeStats must fill every decode stat");
+  std::copy_n(values, kNumDecodeStats, row);
+}
+
+// Attributes and shared language model of the beam search decoder kernels.
+// Kernel is OpKernel or AsyncOpKernel.
+template <typename Kernel>
+class CTCBeamSearchDecoderOpBase : public Kernel {
  public:
   typedef ctc::ctc_beam_search::KenLMBeamState BeamState;
   typedef ctc::KenLMBeamScorer BeamScorer;
 
-  explicit CTCBeamSearchDecoderOp(OpKernelConstruction* ctx) : OpKernel(ctx) {
+  explicit CTCBeamSearchDecoderOpBase(OpKernelConstruction* ctx)
+      : Kernel(ctx) {
     OP_REQUIRES_OK(ctx, ctx->GetAttr("merge_repeated", &merge_repeated_));
     OP_REQUIRES_OK(ctx, ctx->GetAttr("beam_width", &beam_width_));
     int top_paths;
     OP_REQUIRES_OK(ctx, ctx->GetAttr("top_paths", &top_paths));
     decode_helper_.SetTopPaths(top_paths);
-    std::string kenlm_directory_path;
-    OP_REQUIRES_OK(ctx, ctx->GetAttr("kenlm_directory_path", &kenlm_directory_path));
-    const char *c_kenlm_directory_path = kenlm_directory_path.c_str();
-    beam_scorer_ = new BeamScorer(c_kenlm_directory_path);
+    OP_REQUIRES_OK(ctx, ctx->GetAttr("kenlm_directory_path",
+                                     &kenlm_directory_path_));
+    int lm_score_cache_size;
+    OP_REQUIRES_OK(ctx, ctx->GetAttr("lm_score_cache_size",
+                                     &lm_score_cache_size));
+    if (lm_score_cache_size > 0) {
+      score_cache_pool_.reset(
+          new BeamScorer::ScoreCachePool(lm_score_cache_size));
+    }
+    string kenlm_load_method;
+    OP_REQUIRES_OK(ctx, ctx->GetAttr("kenlm_load_method", &kenlm_load_method));
+    OP_REQUIRES_OK(ctx, ctc::KenLMModel::ParseLoadMethod(kenlm_load_method,
+                                                         &load_method_));
+    OP_REQUIRES_OK(ctx, ctx->GetAttr("blank_skip_threshold",
+                                     &blank_skip_threshold_));
+    OP_REQUIRES(ctx, blank_skip_threshold_ >= 0,
+                errors::InvalidArgument("blank_skip_threshold must be >= 0, "
+                                        "got ", blank_skip_threshold_));
+    OP_REQUIRES_OK(ctx, ctx->GetAttr("beam_threshold", &beam_threshold_));
+    OP_REQUIRES(ctx, beam_threshold_ >= 0,
+                errors::InvalidArgument("beam_threshold must be >= 0, got ",
+                                        beam_threshold_));
+    // CTCBeamSearchDecoder has no decode_stats output, its later versions
+    // and the stream decoder do.
+    has_decode_stats_output_ = this->num_outputs() == 3 * top_paths + 2;
+    output_decode_stats_ = false;
+    if (has_decode_stats_output_) {
+      OP_REQUIRES_OK(ctx, ctx->GetAttr("output_decode_stats",
+                                       &output_decode_stats_));
+    }
+    // Nor does it have the strict_lexicon attr or the hotwords inputs.
+    strict_lexicon_ = false;
+    if (this->def().attr().count("strict_lexicon") > 0) {
+      OP_REQUIRES_OK(ctx, ctx->GetAttr("strict_lexicon", &strict_lexicon_));
+    }
+    int start, stop;
+    has_hotwords_inputs_ = this->InputRange("hotwords", &start, &stop).ok();
+  }
+
+  virtual ~CTCBeamSearchDecoderOpBase() {
+    if (scorer_resource_ != nullptr) scorer_resource_->Unref();
+  }
+
+ protected:
+  // One call of a decoder of whole sequences: its inputs, outputs, scorer
+  // and the results of its batch items.
+  struct BatchCall {
+    const Tensor* inputs = nullptr;
+    const Tensor* seq_len = nullptr;
+    Tensor* log_prob = nullptr;
+    OpOutputList decoded_indices;
+    OpOutputList decoded_values;
+    OpOutputList decoded_shape;
+    // The per-call copy shares the loaded model with all kernels using it,
+    // so concurrent calls with different weights do not race. The hotwords
+    // of the call are only seen by this copy and the copies made from it.
+    std::unique_ptr<BeamScorer> scorer;
+    int64 batch_size = 0;
+    int num_classes = 0;
+    bool collect_timings = false;
+    std::vector<std::vector<std::vector<int>>> best_paths;
+    std::vector<Status> batch_status;
+    std::vector<int64> decode_stats;
+  };
+
+  // Validates the inputs of a call to the CTCBeamSearchDecoder interface,
+  // allocates its log_probability and prepares its scorer.
+  Status StartBatchCall(OpKernelContext* ctx, BatchCall* call) {
+    TF_RETURN_IF_ERROR(decode_helper_.ValidateInputsGenerateOutputs(
+        ctx, &call->inputs, &call->seq_len, &call->log_prob,
+        &call->decoded_indices, &call->decoded_values, &call->decoded_shape));
+
+    CTCBeamSearchScorerWeights weights;
+    TF_RETURN_IF_ERROR(GetScorerWeights(ctx, &weights));
+    KenLMScorerResource* scorer_resource;
+    TF_RETURN_IF_ERROR(GetScorerResource(ctx, &scorer_resource));
+    call->scorer.reset(new BeamScorer(scorer_resource->scorer()));
+    weights.ApplyTo(call->scorer.get());
+    call->scorer->SetStrictLexicon(strict_lexicon_);
+    if (has_hotwords_inputs_) {
+      TF_RETURN_IF_ERROR(SetHotwords(ctx, call->scorer.get()));
+    }
+
+    call->batch_size = call->inputs->dim_size(1);
+    const int64 num_classes_raw = call->inputs->dim_size(2);
+    if (!FastBoundsCheck(num_classes_raw, std::numeric_limits<int>::max())) {
+      return errors::InvalidArgument("num_classes cannot exceed max int");
+    }
+    call->num_classes = static_cast<const int>(num_classes_raw);
+    call->collect_timings = CollectTimings(ctx);
+    call->log_prob->matrix<float>().setZero();
+    call->best_paths.resize(call->batch_size);
+    call->batch_status.resize(call->batch_size);
+    call->decode_stats.resize(call->batch_size * kNumDecodeStats);
+    return Status::OK();
   }
 
-  virtual ~CTCBeamSearchDecoderOp() {
-    delete beam_scorer_;
+  // Decodes batch items [start_row, limit_row) of call. Batch items are
+  // decoded independently: each range gets its own decoder (beam tree and
+  // leaves) and scorer copy, which shares the loaded model, so that disjoint
+  // ranges can be decoded concurrently. With a score cache, the range borrows
+  // one from the pool for its duration, so caches stay warm across calls.
+  template <typename T>
+  void DecodeBatchRows(BatchCall* call, int64 start_row,
+                       int64 limit_row) const {
+    const T* inputs_data = call->inputs->flat<T>().data();
+    const auto seq_len_t = call->seq_len->vec<int32>();
+    auto log_prob_t = call->log_prob->matrix<float>();
+    const int64 batch_size = call->batch_size;
+    const int num_classes = call->num_classes;
+    const int top_paths = decode_helper_.GetTopPaths();
+
+    BeamScorer shard_scorer(*call->scorer);
+    std::unique_ptr<BeamScorer::ScoreCache> score_cache;
+    int64 hits_before = 0;
+    int64 misses_before = 0;
+    if (score_cache_pool_) {
+      score_cache = score_cache_pool_->Take();
+      hits_before = score_cache->hits();
+      misses_before = score_cache->misses();
+      shard_scorer.SetScoreCache(score_cache.get());
+    }
+    ctc::CTCBeamSearchDecoder<BeamState> beam_search(
+        num_classes, beam_width_, &shard_scorer, 1 /* batch_size */,
+        merge_repeated_);
+    beam_search.SetBlankSkipThreshold(blank_skip_threshold_);
+    beam_search.SetBeamThreshold(beam_threshold_);
+    beam_search.SetCollectTimings(call->collect_timings);
+    std::vector<float> log_probs;
+
+    // Assumption: the blank index is num_classes - 1
+    for (int64 b = start_row; b < limit_row; ++b) {
+      auto& best_paths_b = call->best_paths[b];
+      best_paths_b.resize(top_paths);
+      beam_search.ResetStats();
+      const CTCBeamSearchScorerCounts scorer_counts(shard_scorer);
+      for (int t = 0; t < seq_len_t(b); ++t) {
+        beam_search.Step(
+            InputRow(inputs_data, t, b, batch_size, num_classes));
+      }
+      FillDecodeStats(beam_search.stats(), scorer_counts, shard_scorer,
+                      &call->decode_stats[b * kNumDecodeStats]);
+      Status& status = call->batch_status[b];
+      status = beam_search.TopPaths(top_paths, &best_paths_b, &log_probs,
+                                    merge_repeated_);
+      beam_search.Reset();
+      if (!status.ok()) continue;
+
+      for (int bp = 0; bp < top_paths; ++bp) {
+        log_prob_t(b, bp) = log_probs[bp];
+      }
+    }
+    if (score_cache) {
+      VLOG(1) << "LM score cache for batch items [" << start_row << ", "
+              << limit_row << "): " << score_cache->hits() - hits_before
+              << " hits, " << score_cache->misses() - misses_before
+              << " misses";
+      score_cache_pool_->Return(std::move(score_cache));
+    }
+  }
+
+  // Checks the batch items of call and outputs its decoded sequences and
+  // decode stats.
+  Status FinishBatchCall(OpKernelContext* ctx, BatchCall* call) const {
+    for (const Status& s : call->batch_status) {
+      TF_RETURN_IF_ERROR(s);
+    }
+    TF_RETURN_IF_ERROR(decode_helper_.StoreAllDecodedSequences(
+        call->best_paths, &call->decoded_indices, &call->decoded_values,
+        &call->decoded_shape));
+    return OutputDecodeStats(ctx, call->batch_size, call->decode_stats);
+  }
+
+  Status GetScorerWeights(OpKernelContext* ctx,
+                          CTCBeamSearchScorerWeights* weights) const {
+    TF_RETURN_IF_ERROR(
+        GetScalarWeight(ctx, "kenlm_weight", &weights->lm_weight));
+    TF_RETURN_IF_ERROR(GetScalarWeight(ctx, "word_count_weight",
+                                       &weights->word_count_weight));
+    TF_RETURN_IF_ERROR(GetScalarWeight(ctx, "valid_word_count_weight",
+                                       &weights->valid_word_count_weight));
+    return Status::OK();
+  }
+
+  // The scorer is shared through the device's ResourceMgr, which is only
+  // reachable from an OpKernelContext: look it up on the first call.
+  Status GetScorerResource(OpKernelContext* ctx,
+                           KenLMScorerResource** resource) {
+    mutex_lock l(mu_);
+    if (scorer_resource_ == nullptr) {
+      TF_RETURN_IF_ERROR(KenLMScorerResource::LookupOrCreate(
+          ctx->resource_manager(), kenlm_directory_path_, load_method_,
+          &scorer_resource_));
+    }
+    *resource = scorer_resource_;
+    return Status::OK();
+  }
+
+  // Whether the decoders should measure the time they spend, see
+  // ctc::CTCBeamSearchDecoder::SetCollectTimings.
+  bool CollectTimings(OpKernelContext* ctx) const {
+    return output_decode_stats_ || ctx->collect_counters();
+  }
+
+  // Records the decode stats of the batch, batch_size rows of
+  // kNumDecodeStats values, as op counters and in the decode_stats output if
+  // the op has one.
+  Status OutputDecodeStats(OpKernelContext* ctx, int64 batch_size,
+                           const std::vector<int64>& decode_stats) const {
+    if (ctx->collect_counters()) {
+      for (int i = 0; i < kNumDecodeStats; ++i) {
+        int64 total = 0;
+        for (int64 b = 0; b < batch_size; ++b) {
+          total += decode_stats[b * kNumDecodeStats + i];
+        }
+        ctx->record_counter(kDecodeStatNames[i], total);
+      }
+    }
+    if (!has_decode_stats_output_) return Status::OK();
+    Tensor* output = nullptr;
+    TF_RETURN_IF_ERROR(ctx->allocate_output(
+        "decode_stats",
+        TensorShape({output_decode_stats_ ? batch_size : 0, kNumDecodeStats}),
+        &output));
+    if (output_decode_stats_) {
+      std::copy_n(decode_stats.begin(), output->NumElements(),
+                  output->flat<int64>().data());
+    }
+    return Status::OK();
+  }
+
+  // Logits of batch item b at time t in the [max_time, batch_size,
+  // num_classes] inputs. The row is contiguous, so the decoder reads it in
+  // place.
+  template <typename T>
+  static Eigen::Map<const Eigen::Array<T, Eigen::Dynamic, 1>> InputRow(
+      const T* inputs, int64 t, int64 b, int64 batch_size, int num_classes) {
+    return Eigen::Map<const Eigen::Array<T, Eigen::Dynamic, 1>>(
+        inputs + (t * batch_size + b) * num_classes, num_classes);
+  }
+
+  // Sets the per-call hotwords given by the "hotwords" and "hotword_boosts"
+  // inputs on scorer.
+  static Status SetHotwords(OpKernelContext* ctx, BeamScorer* scorer) {
+    const Tensor* hotwords;
+    const Tensor* hotword_boosts;
+    TF_RETURN_IF_ERROR(ctx->input("hotwords", &hotwords));
+    TF_RETURN_IF_ERROR(ctx->input("hotword_boosts", &hotword_boosts));
+    if (!TensorShapeUtils::IsVector(hotwords->shape()) ||
+        !TensorShapeUtils::IsVector(hotword_boosts->shape())) {
+      return errors::InvalidArgument(
+          "hotwords and hotword_boosts must be vectors, got shapes ",
+          hotwords->shape().DebugString(), " and ",
+          hotword_boosts->shape().DebugString());
+    }
+    if (hotwords->NumElements() == 0 && hotword_boosts->NumElements() == 0) {
+      return Status::OK();
+    }
+    const auto hotwords_t = hotwords->vec<string>();
+    const auto hotword_boosts_t = hotword_boosts->vec<float>();
+    const std::vector<string> phrases(hotwords_t.data(),
+                                      hotwords_t.data() + hotwords_t.size());
+    const std::vector<float> boosts(
+        hotword_boosts_t.data(),
+        hotword_boosts_t.data() + hotword_boosts_t.size());
+    return scorer->SetHotwords(phrases, boosts);
+  }
+
+  CTCDecodeHelper decode_helper_;
+  bool merge_repeated_;
+  int beam_width_;
+  // LM score caches for the decoding threads, kept across calls. Null when
+  // lm_score_cache_size is 0.
+  std::unique_ptr<BeamScorer::ScoreCachePool> score_cache_pool_;
+  float blank_skip_threshold_;
+  float beam_threshold_;
+  bool has_decode_stats_output_;
+  bool output_decode_stats_;
+  bool strict_lexicon_;
+  bool has_hotwords_inputs_;
+
+ private:
+  static Status GetScalarWeight(OpKernelContext* ctx, const char* name,
+                                float* weight) {
+    const Tensor* t;
+    TF_RETURN_IF_ERROR(ctx->input(name, &t));
+    if (!TensorShapeUtils::IsScalar(t->shape())) {
+      return errors::InvalidArgument(
+          name, " must be a scalar, but received tensor of shape: ",
+          t->shape().DebugString());
+    }
+    *weight = t->scalar<float>()();
+    return Status::OK();
+  }
+
+  string kenlm_directory_path_;
+  util::LoadMethod load_method_;
+  mutex mu_;
+  KenLMScorerResource* scorer_resource_ GUARDED_BY(mu_) = nullptr;
+  TF_DISALLOW_COPY_AND_ASSIGN(CTCBeamSearchDecoderOpBase);
+};
+
+// CTC beam search
+template <typename T>
+class CTCBeamSearchDecoderOp : public CTCBeamSearchDecoderOpBase<OpKernel> {
+ public:
+  explicit CTCBeamSearchDecoderOp(OpKernelConstruction* ctx)
+      : CTCBeamSearchDecoderOpBase<OpKernel>(ctx) {}
+
+  void Compute(OpKernelContext* ctx) override {
+    BatchCall call;
+    OP_REQUIRES_OK(ctx, StartBatchCall(ctx, &call));
+
+    // *Rough* estimate of the cost for one item in the batch: every step
+    // expands up to beam_width beams into num_classes children, each costing
+    // a scorer call (trie walk, possibly an LM lookup) and a heap push.
+    const int64 max_time = call.inputs->dim_size(0);
+    const int64 cost_per_child = 100 * Eigen::TensorOpCost::AddCost<float>();
+    const int64 cost =
+        max_time * beam_width_ * call.num_classes * cost_per_child;
+    const DeviceBase::CpuWorkerThreads& workers =
+        *ctx->device()->tensorflow_cpu_worker_threads();
+    Shard(workers.num_threads, workers.workers, call.batch_size, cost,
+          [this, &call](int64 start_row, int64 limit_row) {
+            DecodeBatchRows<T>(&call, start_row, limit_row);
+          });
+
+    OP_REQUIRES_OK(ctx, FinishBatchCall(ctx, &call));
+  }
+
+ private:
+  TF_DISALLOW_COPY_AND_ASSIGN(CTCBeamSearchDecoderOp);
+};
+
+#define REGISTER_CPU(T)                                                      \
+  REGISTER_KERNEL_BUILDER(                                                   \
+      Name("CTCBeamSearchDecoder").Device(DEVICE_CPU).TypeConstraint<T>("T"), \
+      CTCBeamSearchDecoderOp<T>);                                            \
+  REGISTER_KERNEL_BUILDER(Name("CTCBeamSearchDecoderV2")                     \
+                              .Device(DEVICE_CPU)                            \
+                              .TypeConstraint<T>("T"),                       \
+                          CTCBeamSearchDecoderOp<T>);
+
+REGISTER_CPU(float);
+REGISTER_CPU(Eigen::half);
+
+#undef REGISTER_CPU
+
+// Decoder threads of CTCAsyncBeamSearchDecoder, shared through the
+// ResourceMgr by the kernels naming the same pool: they bound the threads
+// all those kernels decode on together.
+class CTCDecoderThreadPool : public ResourceBase {
+ public:
+  explicit CTCDecoderThreadPool(int num_threads)
+      : num_threads_(num_threads),
+        pool_(Env::Default(), "ctc_decoder", num_threads) {}
+
+  // Looks up the pool named name in rm, creating it with num_threads
+  // threads if needed. On success the caller owns a reference to *pool.
+  static Status LookupOrCreate(ResourceMgr* rm, const string& name,
+                               int num_threads, CTCDecoderThreadPool** pool) {
+    TF_RETURN_IF_ERROR(rm->LookupOrCreate<CTCDecoderThreadPool>(
+        rm->default_container(), strings::StrCat("ctc_decoder_pool:", name),
+        pool, [num_threads](CTCDecoderThreadPool** p) {
+          *p = new CTCDecoderThreadPool(num_threads);
+          return Status::OK();
+        }));
+    if ((*pool)->num_threads() != num_threads) {
+      const int existing = (*pool)->num_threads();
+      (*pool)->Unref();
+      *pool = nullptr;
+      return errors::InvalidArgument("Decoder pool '", name, "' has ",
+                                     existing, " threads, not ", num_threads);
+    }
+    return Status::OK();
+  }
+
+  int num_threads() const { return num_threads_; }
+
+  void Schedule(std::function<void()> fn) { pool_.Schedule(std::move(fn)); }
+
+  string DebugString() override {
+    return strings::StrCat("CTCDecoderThreadPool(", num_threads_,
+                           " threads)");
+  }
+
+ private:
+  const int num_threads_;
+  thread::ThreadPool pool_;
+
+  TF_DISALLOW_COPY_AND_ASSIGN(CTCDecoderThreadPool);
+};
+
+// CTC beam search off the inter-op threads: the batch is split into one
+// contiguous range of items per thread of a CTCDecoderThreadPool, and the op
+// completes when the last range is done. Other ops, e.g. the acoustic models
+// of concurrent steps, run meanwhile.
+template <typename T>
+class CTCAsyncBeamSearchDecoderOp
+    : public CTCBeamSearchDecoderOpBase<AsyncOpKernel> {
+ public:
+  explicit CTCAsyncBeamSearchDecoderOp(OpKernelConstruction* ctx)
+      : CTCBeamSearchDecoderOpBase<AsyncOpKernel>(ctx) {
+    OP_REQUIRES_OK(ctx, ctx->GetAttr("decoder_threads", &decoder_threads_));
+    OP_REQUIRES_OK(ctx, ctx->GetAttr("decoder_pool", &decoder_pool_));
+  }
+
+  ~CTCAsyncBeamSearchDecoderOp() override {
+    if (pool_ != nullptr) pool_->Unref();
+  }
+
+  void ComputeAsync(OpKernelContext* ctx, DoneCallback done) override {
+    CTCDecoderThreadPool* pool;
+    OP_REQUIRES_OK_ASYNC(ctx, GetPool(ctx, &pool), done);
+    // Shared by the tasks; the last one to finish completes the call.
+    std::shared_ptr<BatchCall> call(new BatchCall);
+    OP_REQUIRES_OK_ASYNC(ctx, StartBatchCall(ctx, call.get()), done);
+    if (call->batch_size == 0) {
+      OP_REQUIRES_OK_ASYNC(ctx, FinishBatchCall(ctx, call.get()), done);
+      done();
+      return;
+    }
+
+    // Each task decodes a range of rows with a single decoder and scorer,
+    // as a shard of CTCBeamSearchDecoderOp does, so that their arenas and
+    // score cache are reused from row to row.
+    const int64 rows_per_task =
+        (call->batch_size + pool->num_threads() - 1) / pool->num_threads();
+    const int64 num_tasks =
+        (call->batch_size + rows_per_task - 1) / rows_per_task;
+    auto pending = std::make_shared<std::atomic<int64>>(num_tasks);
+    for (int64 start = 0; start < call->batch_size; start += rows_per_task) {
+      const int64 limit = std::min(start + rows_per_task, call->batch_size);
+      pool->Schedule([this, ctx, call, pending, done, start, limit]() {
+        DecodeBatchRows<T>(call.get(), start, limit);
+        if (pending->fetch_sub(1) != 1) return;
+        OP_REQUIRES_OK_ASYNC(ctx, FinishBatchCall(ctx, call.get()), done);
+        done();
+      });
+    }
+  }
+
+ private:
+  // The pool is shared through the device's ResourceMgr, which is only
+  // reachable from an OpKernelContext: look it up on the first call.
+  Status GetPool(OpKernelContext* ctx, CTCDecoderThreadPool** pool) {
+    mutex_lock l(pool_mu_);
+    if (pool_ == nullptr) {
+      TF_RETURN_IF_ERROR(CTCDecoderThreadPool::LookupOrCreate(
+          ctx->resource_manager(), decoder_pool_, decoder_threads_, &pool_));
+    }
+    *pool = pool_;
+    return Status::OK();
+  }
+
+  int decoder_threads_;
+  string decoder_pool_;
+  mutex pool_mu_;
+  CTCDecoderThreadPool* pool_ GUARDED_BY(pool_mu_) = nullptr;
+
+  TF_DISALLOW_COPY_AND_ASSIGN(CTCAsyncBeamSearchDecoderOp);
+};
+
+#define REGISTER_CPU(T)                                   \
+  REGISTER_KERNEL_BUILDER(Name("CTCAsyncBeamSearchDecoder")   \
+                              .Device(DEVICE_CPU)             \
+                              .TypeConstraint<T>("T"),        \
+                          CTCAsyncBeamSearchDecoderOp<T>);
+
+REGISTER_CPU(float);
+REGISTER_CPU(Eigen::half);
+
+#undef REGISTER_CPU
+
+// Beam search state of one stream of CTCBeamSearchStreamDecoder. Streams are
+// kept in the ResourceMgr between calls.
+class CTCBeamSearchStream : public ResourceBase {
+ public:
+  typedef ctc::ctc_beam_search::KenLMBeamState BeamState;
+  typedef ctc::KenLMBeamScorer BeamScorer;
+
+  CTCBeamSearchStream(const BeamScorer& scorer, int num_classes,
+                      int beam_width, bool merge_repeated)
+      : scorer_(scorer),
+        num_classes_(num_classes),
+        decoder_(num_classes, beam_width, &scorer_, 1 /* batch_size */,
+                 merge_repeated) {}
+
+  mutex* mu() { return &mu_; }
+
+  // Guarded by mu().
+  BeamScorer* scorer() { return &scorer_; }
+  ctc::CTCBeamSearchDecoder<BeamState>* decoder() { return &decoder_; }
+  int64 frames() const { return frames_; }
+  void AddFrames(int64 n) { frames_ += n; }
+  bool finalized() const { return finalized_; }
+  void set_finalized() { finalized_ = true; }
+  uint64 last_use_micros() const { return last_use_micros_; }
+  void set_last_use_micros(uint64 micros) { last_use_micros_ = micros; }
+
+  int num_classes() const { return num_classes_; }
+
+  string DebugString() override {
+    mutex_lock l(mu_);
+    return strings::StrCat("CTCBeamSearchStream(", frames_, " frames)");
+  }
+
+ private:
+  mutex mu_;
+  BeamScorer scorer_;  // Used by decoder_.
+  const int num_classes_;
+  ctc::CTCBeamSearchDecoder<BeamState> decoder_;
+  int64 frames_ = 0;
+  bool finalized_ = false;
+  uint64 last_use_micros_ = 0;
+
+  TF_DISALLOW_COPY_AND_ASSIGN(CTCBeamSearchStream);
+};
+
+// Streaming CTC beam search. Each batch item continues the stream named by
+// its stream id; streams are finalized (end-of-sentence scored) and
+// discarded when their finalize flag is set, or when they have been idle for
+// stream_idle_timeout_secs.
+template <typename T>
+class CTCBeamSearchStreamDecoderOp
+    : public CTCBeamSearchDecoderOpBase<OpKernel> {
+ public:
+  explicit CTCBeamSearchStreamDecoderOp(OpKernelConstruction* ctx)
+      : CTCBeamSearchDecoderOpBase<OpKernel>(ctx) {
+    int stream_idle_timeout_secs;
+    OP_REQUIRES_OK(ctx, ctx->GetAttr("stream_idle_timeout_secs",
+                                     &stream_idle_timeout_secs));
+    idle_timeout_micros_ = stream_idle_timeout_secs * 1000000ULL;
   }
 
   void Compute(OpKernelContext* ctx) override {
@@ -275,96 +909,515 @@ class CTCBeamSearchDecoderOp : public OpKernel {
                             ctx, &inputs, &seq_len, &log_prob, &decoded_indices,
                             &decoded_values, &decoded_shape));
 
-    const Tensor& lm_weight = ctx->input(2);
-    OP_REQUIRES(ctx, TensorShapeUtils::IsScalar(lm_weight.shape()),
-                errors::InvalidArgument(
-                    "kenlm_weight must be a scalar, but received tensor of shape: ",
-                    lm_weight.shape().DebugString()));
+    const int64 max_time = inputs->dim_size(0);
+    const int64 batch_size = inputs->dim_size(1);
+    const int64 num_classes_raw = inputs->dim_size(2);
+    OP_REQUIRES(
+        ctx, FastBoundsCheck(num_classes_raw, std::numeric_limits<int>::max()),
+        errors::InvalidArgument("num_classes cannot exceed max int"));
+    const int num_classes = static_cast<const int>(num_classes_raw);
 
-    const Tensor& word_count_weight = ctx->input(3);
-    OP_REQUIRES(ctx, TensorShapeUtils::IsScalar(word_count_weight.shape()),
+    const Tensor* stream_ids;
+    OP_REQUIRES_OK(ctx, ctx->input("stream_ids", &stream_ids));
+    OP_REQUIRES(ctx, TensorShapeUtils::IsVector(stream_ids->shape()) &&
+                         stream_ids->dim_size(0) == batch_size,
                 errors::InvalidArgument(
-                    "word_count_weight must be a scalar, but received tensor of shape: ",
-                    word_count_weight.shape().DebugString()));
-
-    const Tensor& valid_word_count_weight = ctx->input(4);
-    OP_REQUIRES(ctx, TensorShapeUtils::IsScalar(valid_word_count_weight.shape()),
+                    "stream_ids must be a vector of size batch_size, got ",
+                    stream_ids->shape().DebugString()));
+    const Tensor* finalize;
+    OP_REQUIRES_OK(ctx, ctx->input("finalize", &finalize));
+    OP_REQUIRES(ctx, TensorShapeUtils::IsVector(finalize->shape()) &&
+                         finalize->dim_size(0) == batch_size,
                 errors::InvalidArgument(
-                    "valid_word_count_weight must be a scalar, but received tensor of shape: ",
-                    valid_word_count_weight.shape().DebugString()));
+                    "finalize must be a vector of size batch_size, got ",
+                    finalize->shape().DebugString()));
+    auto stream_ids_t = stream_ids->vec<string>();
+    auto finalize_t = finalize->vec<bool>();
+    std::unordered_set<string> unique_ids;
+    for (int64 b = 0; b < batch_size; ++b) {
+      OP_REQUIRES(ctx, unique_ids.insert(stream_ids_t(b)).second,
+                  errors::InvalidArgument("Duplicate stream id ",
+                                          stream_ids_t(b), " in batch"));
+    }
+
+    CTCBeamSearchScorerWeights weights;
+    OP_REQUIRES_OK(ctx, GetScorerWeights(ctx, &weights));
 
-    beam_scorer_->SetLMWeight(lm_weight.flat<float>()(0));
-    beam_scorer_->SetWordCountWeight(word_count_weight.flat<float>()(0));
-    beam_scorer_->SetValidWordCountWeight(valid_word_count_weight.flat<float>()(0));
+    KenLMScorerResource* scorer_resource;
+    OP_REQUIRES_OK(ctx, GetScorerResource(ctx, &scorer_resource));
+    BeamScorer beam_scorer(scorer_resource->scorer());
+    beam_scorer.SetStrictLexicon(strict_lexicon_);
 
-    auto inputs_t = inputs->tensor<float, 3>();
+    ResourceMgr* rm = ctx->resource_manager();
+    const uint64 now_micros = ctx->env()->NowMicros();
+    ExpireIdleStreams(rm, now_micros);
+
+    const T* inputs_data = inputs->flat<T>().data();
     auto seq_len_t = seq_len->vec<int32>();
     auto log_prob_t = log_prob->matrix<float>();
+    log_prob_t.setZero();
 
-    const TensorShape& inputs_shape = inputs->shape();
+    std::vector<std::vector<std::vector<int> > > best_paths(batch_size);
+    std::vector<Status> batch_status(batch_size);
+    std::vector<int64> decode_stats(batch_size * kNumDecodeStats);
+    const int top_paths = decode_helper_.GetTopPaths();
+    const bool collect_timings = CollectTimings(ctx);
+
+    auto decode_batch = [this, rm, now_micros, &beam_scorer, &weights,
+                         inputs_data, &seq_len_t, &stream_ids_t, &finalize_t,
+                         &log_prob_t, &best_paths, &batch_status,
+                         &decode_stats, batch_size, num_classes, top_paths,
+                         collect_timings](int64 start_row, int64 limit_row) {
+      // The shard's LM score cache is lent to each stream while it steps.
+      std::unique_ptr<BeamScorer::ScoreCache> score_cache;
+      if (score_cache_pool_) score_cache = score_cache_pool_->Take();
+      std::vector<float> log_probs;
+
+      for (int64 b = start_row; b < limit_row; ++b) {
+        const string stream_name = StreamName(stream_ids_t(b));
+        CTCBeamSearchStream* stream;
+        batch_status[b] = rm->LookupOrCreate<CTCBeamSearchStream>(
+            rm->default_container(), stream_name, &stream,
+            [this, &beam_scorer, num_classes](CTCBeamSearchStream** s) {
+              *s = new CTCBeamSearchStream(beam_scorer, num_classes,
+                                           beam_width_, merge_repeated_);
+              (*s)->decoder()->SetBlankSkipThreshold(blank_skip_threshold_);
+              (*s)->decoder()->SetBeamThreshold(beam_threshold_);
+              return Status::OK();
+            });
+        if (!batch_status[b].ok()) continue;
+        core::ScopedUnref unref_stream(stream);
+
+        mutex_lock l(*stream->mu());
+        if (stream->finalized()) {
+          batch_status[b] = errors::FailedPrecondition(
+              "Stream ", stream_ids_t(b), " was finalized concurrently");
+          continue;
+        }
+        if (stream->num_classes() != num_classes) {
+          batch_status[b] = errors::InvalidArgument(
+              "Stream ", stream_ids_t(b), " was started with ",
+              stream->num_classes(), " classes, got ", num_classes);
+          continue;
+        }
+        stream->set_last_use_micros(now_micros);
+        TrackStream(stream_name, stream);
+        weights.ApplyTo(stream->scorer());
+        stream->scorer()->SetScoreCache(score_cache.get());
+        ctc::CTCBeamSearchDecoder<BeamState>* beam_search = stream->decoder();
+        beam_search->SetCollectTimings(collect_timings);
+        beam_search->ResetStats();
+        const CTCBeamSearchScorerCounts scorer_counts(*stream->scorer());
+        for (int t = 0; t < seq_len_t(b); ++t) {
+          beam_search->Step(
+              InputRow(inputs_data, t, b, batch_size, num_classes));
+        }
+        stream->AddFrames(seq_len_t(b));
+        if (finalize_t(b)) beam_search->ExpandStateEnd();
+        stream->scorer()->SetScoreCache(nullptr);
+
+        if (finalize_t(b)) {
+          // The stream lives on until unref_stream releases our reference.
+          batch_status[b] = DiscardStream(rm, stream_name, stream);
+          if (!batch_status[b].ok()) continue;
+        }
+        FillDecodeStats(beam_search->stats(), scorer_counts, *stream->scorer(),
+                        &decode_stats[b * kNumDecodeStats]);
+
+        auto& best_paths_b = best_paths[b];
+        best_paths_b.resize(top_paths);
+        batch_status[b] = beam_search->TopPaths(top_paths, &best_paths_b,
+                                                &log_probs, merge_repeated_);
+        if (!batch_status[b].ok()) continue;
+        for (int bp = 0; bp < top_paths; ++bp) {
+          log_prob_t(b, bp) = log_probs[bp];
+        }
+      }
+      if (score_cache) score_cache_pool_->Return(std::move(score_cache));
+    };
+
+    // Same estimate as CTCBeamSearchDecoderOp, for one chunk.
+    const int64 cost_per_child = 100 * Eigen::TensorOpCost::AddCost<float>();
+    const int64 cost = max_time * beam_width_ * num_classes * cost_per_child;
+    const DeviceBase::CpuWorkerThreads& workers =
+        *ctx->device()->tensorflow_cpu_worker_threads();
+    Shard(workers.num_threads, workers.workers, batch_size, cost, decode_batch);
+
+    for (const Status& s : batch_status) {
+      OP_REQUIRES_OK(ctx, s);
+    }
 
-    const int64 max_time = inputs_shape.dim_size(0);
-    const int64 batch_size = inputs_shape.dim_size(1);
-    const int64 num_classes_raw = inputs_shape.dim_size(2);
-    OP_REQUIRES(
-        ctx, FastBoundsCheck(num_classes_raw, std::numeric_limits<int>::max()),
-        errors::InvalidArgument("num_classes cannot exceed max int"));
-    const int num_classes = static_cast<const int>(num_classes_raw);
+    OP_REQUIRES_OK(ctx, decode_helper_.StoreAllDecodedSequences(
+                            best_paths, &decoded_indices, &decoded_values,
+                            &decoded_shape));
+    OP_REQUIRES_OK(ctx, OutputDecodeStats(ctx, batch_size, decode_stats));
+  }
 
-    log_prob_t.setZero();
+ private:
+  // Streams are private to the node that decodes them.
+  string StreamName(const string& stream_id) const {
+    return strings::StrCat("ctc_beam_search_stream:", name(), ":", stream_id);
+  }
 
-    std::vector<TTypes<float>::UnalignedConstMatrix> input_list_t;
+  // Records a live stream for ExpireIdleStreams. Requires stream->mu().
+  void TrackStream(const string& stream_name, CTCBeamSearchStream* stream) {
+    mutex_lock l(streams_mu_);
+    streams_[stream_name] = stream;
+  }
 
-    for (std::size_t t = 0; t < max_time; ++t) {
-      input_list_t.emplace_back(inputs_t.data() + t * batch_size * num_classes,
-                                batch_size, num_classes);
+  // Finalizes the stream and removes it from the ResourceMgr; the last
+  // reference frees it. Requires stream->mu().
+  Status DiscardStream(ResourceMgr* rm, const string& stream_name,
+                       CTCBeamSearchStream* stream) {
+    stream->set_finalized();
+    {
+      mutex_lock l(streams_mu_);
+      auto it = streams_.find(stream_name);
+      if (it != streams_.end() && it->second == stream) streams_.erase(it);
     }
+    return rm->Delete<CTCBeamSearchStream>(rm->default_container(),
+                                           stream_name);
+  }
 
-    ctc::CTCBeamSearchDecoder<BeamState>
-                              beam_search(num_classes, beam_width_,
-                                            beam_scorer_, 1 /* batch_size */,
-                                            merge_repeated_);
-    Tensor input_chip(DT_FLOAT, TensorShape({num_classes}));
-    auto input_chip_t = input_chip.flat<float>();
+  // Discards the streams of this node that have not been fed for the idle
+  // timeout. Scans at most twice per timeout.
+  void ExpireIdleStreams(ResourceMgr* rm, uint64 now_micros) {
+    if (idle_timeout_micros_ == 0) return;
+    std::vector<std::pair<string, CTCBeamSearchStream*>> streams;
+    {
+      mutex_lock l(streams_mu_);
+      if (now_micros < next_expiry_scan_micros_) return;
+      next_expiry_scan_micros_ = now_micros + idle_timeout_micros_ / 2;
+      streams.assign(streams_.begin(), streams_.end());
+    }
+    for (const auto& entry : streams) {
+      CTCBeamSearchStream* stream;
+      if (!rm->Lookup(rm->default_container(), entry.first, &stream).ok()) {
+        continue;
+      }
+      core::ScopedUnref unref_stream(stream);
+      mutex_lock l(*stream->mu());
+      if (stream != entry.second || stream->finalized() ||
+          stream->last_use_micros() + idle_timeout_micros_ > now_micros) {
+        continue;
+      }
+      VLOG(1) << "Discarding idle stream " << entry.first;
+      DiscardStream(rm, entry.first, stream).IgnoreError();
+    }
+  }
 
-    std::vector<std::vector<std::vector<int> > > best_paths(batch_size);
-    std::vector<float> log_probs;
+  uint64 idle_timeout_micros_;
+  mutex streams_mu_;
+  // Live streams by name. The pointers identify the streams, they hold no
+  // reference.
+  std::unordered_map<string, CTCBeamSearchStream*> streams_
+      GUARDED_BY(streams_mu_);
+  uint64 next_expiry_scan_micros_ GUARDED_BY(streams_mu_) = 0;
 
-    // Assumption: the blank index is num_classes - 1
-    for (int b = 0; b < batch_size; ++b) {
-      auto& best_paths_b = best_paths[b];
-      best_paths_b.resize(decode_helper_.GetTopPaths());
-      for (int t = 0; t < seq_len_t(b); ++t) {
-        input_chip_t = input_list_t[t].chip(b, 0);
-        auto input_bi =
-            Eigen::Map<const Eigen::ArrayXf>(input_chip_t.data(), num_classes);
-        beam_search.Step(input_bi);
-      }
-      OP_REQUIRES_OK(
-          ctx, beam_search.TopPaths(decode_helper_.GetTopPaths(), &best_paths_b,
-                                    &log_probs, merge_repeated_));
+  TF_DISALLOW_COPY_AND_ASSIGN(CTCBeamSearchStreamDecoderOp);
+};
 
-      beam_search.Reset();
+#define REGISTER_CPU(T)                                   \
+  REGISTER_KERNEL_BUILDER(Name("CTCBeamSearchStreamDecoder")  \
+                              .Device(DEVICE_CPU)             \
+                              .TypeConstraint<T>("T"),        \
+                          CTCBeamSearchStreamDecoderOp<T>);
 
-      for (int bp = 0; bp < decode_helper_.GetTopPaths(); ++bp) {
-        log_prob_t(b, bp) = log_probs[bp];
+REGISTER_CPU(float);
+REGISTER_CPU(Eigen::half);
+
+#undef REGISTER_CPU
+
+// Rescores the N best hypotheses of a beam search decoder with a KenLM model,
+// see CTCNBestRescore in ../ops/ctc_ops.cc.
+class CTCNBestRescoreOp : public OpKernel {
+ public:
+  explicit CTCNBestRescoreOp(OpKernelConstruction* ctx) : OpKernel(ctx) {
+    int top_paths;
+    OP_REQUIRES_OK(ctx, ctx->GetAttr("top_paths", &top_paths));
+    decode_helper_.SetTopPaths(top_paths);
+    OP_REQUIRES_OK(ctx, ctx->GetAttr("kenlm_model_path", &model_path_));
+    OP_REQUIRES_OK(ctx, ctx->GetAttr("vocabulary_path", &vocabulary_path_));
+    OP_REQUIRES_OK(ctx, ctx->GetAttr("first_pass_kenlm_directory_path",
+                                     &first_pass_kenlm_directory_path_));
+    string kenlm_load_method;
+    OP_REQUIRES_OK(ctx, ctx->GetAttr("kenlm_load_method", &kenlm_load_method));
+    OP_REQUIRES_OK(ctx, ctc::KenLMModel::ParseLoadMethod(kenlm_load_method,
+                                                         &load_method_));
+    OP_REQUIRES_OK(ctx, ctx->GetAttr("first_pass_kenlm_load_method",
+                                     &kenlm_load_method));
+    OP_REQUIRES_OK(ctx, ctc::KenLMModel::ParseLoadMethod(
+                            kenlm_load_method, &first_pass_load_method_));
+  }
+
+  ~CTCNBestRescoreOp() override {
+    if (rescorer_resource_ != nullptr) rescorer_resource_->Unref();
+    if (scorer_resource_ != nullptr) scorer_resource_->Unref();
+  }
+
+  void Compute(OpKernelContext* ctx) override {
+    const int top_paths = decode_helper_.GetTopPaths();
+    OpInputList hypothesis_indices;
+    OpInputList hypothesis_values;
+    OpInputList hypothesis_shape;
+    const Tensor* hypothesis_log_prob;
+    OP_REQUIRES_OK(ctx,
+                   ctx->input_list("hypothesis_indices", &hypothesis_indices));
+    OP_REQUIRES_OK(ctx,
+                   ctx->input_list("hypothesis_values", &hypothesis_values));
+    OP_REQUIRES_OK(ctx, ctx->input_list("hypothesis_shape", &hypothesis_shape));
+    OP_REQUIRES_OK(ctx, ctx->input("hypothesis_log_probability",
+                                   &hypothesis_log_prob));
+    OP_REQUIRES(ctx,
+                TensorShapeUtils::IsMatrix(hypothesis_log_prob->shape()) &&
+                    hypothesis_log_prob->dim_size(1) == top_paths,
+                errors::InvalidArgument(
+                    "hypothesis_log_probability must be a batch_size x ",
+                    top_paths, " matrix, got shape ",
+                    hypothesis_log_prob->shape().DebugString()));
+    const int64 batch_size = hypothesis_log_prob->dim_size(0);
+
+    float kenlm_weight;
+    float word_count_weight;
+    float valid_word_count_weight;
+    OP_REQUIRES_OK(ctx, GetScalarWeight(ctx, "kenlm_weight", &kenlm_weight));
+    OP_REQUIRES_OK(
+        ctx, GetScalarWeight(ctx, "word_count_weight", &word_count_weight));
+    OP_REQUIRES_OK(ctx, GetScalarWeight(ctx, "valid_word_count_weight",
+                                        &valid_word_count_weight));
+    CTCBeamSearchScorerWeights first_pass_weights;
+    OP_REQUIRES_OK(ctx, GetScalarWeight(ctx, "first_pass_kenlm_weight",
+                                        &first_pass_weights.lm_weight));
+    OP_REQUIRES_OK(ctx,
+                   GetScalarWeight(ctx, "first_pass_word_count_weight",
+                                   &first_pass_weights.word_count_weight));
+    OP_REQUIRES_OK(
+        ctx, GetScalarWeight(ctx, "first_pass_valid_word_count_weight",
+                             &first_pass_weights.valid_word_count_weight));
+
+    // hypotheses[b][p] are the labels of hypothesis p of batch item b.
+    std::vector<std::vector<std::vector<int>>> hypotheses(
+        batch_size, std::vector<std::vector<int>>(top_paths));
+    for (int p = 0; p < top_paths; ++p) {
+      OP_REQUIRES_OK(ctx, GatherHypotheses(p, hypothesis_indices[p],
+                                           hypothesis_values[p],
+                                           hypothesis_shape[p], &hypotheses));
+    }
+
+    KenLMRescorerResource* rescorer_resource;
+    OP_REQUIRES_OK(ctx, GetRescorerResource(ctx, &rescorer_resource));
+    const ctc::NBestRescorer& rescorer = rescorer_resource->rescorer();
+    // The scorer of the first pass, to take its score out of the first pass
+    // log-probabilities.
+    std::unique_ptr<ctc::KenLMBeamScorer> first_pass_scorer;
+    if (!first_pass_kenlm_directory_path_.empty()) {
+      KenLMScorerResource* scorer_resource;
+      OP_REQUIRES_OK(ctx, GetScorerResource(ctx, &scorer_resource));
+      first_pass_scorer.reset(
+          new ctc::KenLMBeamScorer(scorer_resource->scorer()));
+      first_pass_weights.ApplyTo(first_pass_scorer.get());
+    }
+
+    // Hypotheses are independent: score all batch_size * top_paths of them
+    // in parallel.
+    const auto log_prob_in = hypothesis_log_prob->matrix<float>();
+    std::vector<float> lm_scores(batch_size * top_paths);
+    std::vector<float> scores(batch_size * top_paths);
+    std::vector<Status> hypothesis_status(batch_size * top_paths);
+    int64 max_length = 0;
+    for (const auto& batch_hypotheses : hypotheses) {
+      for (const auto& hypothesis : batch_hypotheses) {
+        max_length = std::max<int64>(max_length, hypothesis.size());
       }
     }
+    auto score_hypotheses = [&](int64 start, int64 limit) {
+      // The first pass scorer keeps per-sequence state: replay the
+      // hypotheses of the shard on a copy.
+      std::unique_ptr<ctc::KenLMBeamScorer> shard_scorer;
+      if (first_pass_scorer != nullptr) {
+        shard_scorer.reset(new ctc::KenLMBeamScorer(*first_pass_scorer));
+      }
+      ctc::NBestRescorer::SentenceScore score;
+      for (int64 i = start; i < limit; ++i) {
+        const int64 b = i / top_paths;
+        const int p = i % top_paths;
+        const std::vector<int>& labels = hypotheses[b][p];
+        hypothesis_status[i] =
+            rescorer.Score(labels.data(), labels.size(), &score);
+        if (!hypothesis_status[i].ok()) continue;
+        float first_pass_score = 0.0f;
+        if (shard_scorer != nullptr) {
+          hypothesis_status[i] = shard_scorer->GetSequenceExpansionScore(
+              labels.data(), labels.size(), &first_pass_score);
+          if (!hypothesis_status[i].ok()) continue;
+        }
+        lm_scores[i] = score.lm_score;
+        scores[i] = log_prob_in(b, p) - first_pass_score +
+                    kenlm_weight * score.lm_score +
+                    word_count_weight * score.num_words +
+                    valid_word_count_weight *
+                        (score.num_words - score.num_oov_words);
+      }
+    };
+    // *Rough* estimate of the cost of one hypothesis: a word of a few labels
+    // per LM lookup, each a handful of hash probes in a model that may not
+    // be in memory yet.
+    const int64 cost = std::max<int64>(max_length, 1) * 200 *
+                       Eigen::TensorOpCost::AddCost<float>();
+    const DeviceBase::CpuWorkerThreads& workers =
+        *ctx->device()->tensorflow_cpu_worker_threads();
+    Shard(workers.num_threads, workers.workers, batch_size * top_paths, cost,
+          score_hypotheses);
+    for (const Status& s : hypothesis_status) {
+      OP_REQUIRES_OK(ctx, s);
+    }
 
+    Tensor* log_prob = nullptr;
+    Tensor* lm_score = nullptr;
+    Tensor* path_index = nullptr;
+    const TensorShape output_shape({batch_size, top_paths});
+    OP_REQUIRES_OK(ctx,
+                   ctx->allocate_output("log_probability", output_shape,
+                                        &log_prob));
+    OP_REQUIRES_OK(ctx,
+                   ctx->allocate_output("lm_score", output_shape, &lm_score));
+    OP_REQUIRES_OK(ctx, ctx->allocate_output("path_index", output_shape,
+                                             &path_index));
+    auto log_prob_t = log_prob->matrix<float>();
+    auto lm_score_t = lm_score->matrix<float>();
+    auto path_index_t = path_index->matrix<int32>();
+
+    // Best first; ties keep the order of the first pass.
+    std::vector<std::vector<std::vector<int>>> reordered(batch_size);
+    std::vector<int> order(top_paths);
+    for (int64 b = 0; b < batch_size; ++b) {
+      const float* batch_scores = &scores[b * top_paths];
+      std::iota(order.begin(), order.end(), 0);
+      std::stable_sort(order.begin(), order.end(),
+                       [batch_scores](int x, int y) {
+                         return batch_scores[x] > batch_scores[y];
+                       });
+      reordered[b].resize(top_paths);
+      for (int p = 0; p < top_paths; ++p) {
+        const int from = order[p];
+        reordered[b][p].swap(hypotheses[b][from]);
+        log_prob_t(b, p) = batch_scores[from];
+        lm_score_t(b, p) = lm_scores[b * top_paths + from];
+        path_index_t(b, p) = from;
+      }
+    }
+
+    OpOutputList decoded_indices;
+    OpOutputList decoded_values;
+    OpOutputList decoded_shape;
+    OP_REQUIRES_OK(ctx, ctx->output_list("decoded_indices", &decoded_indices));
+    OP_REQUIRES_OK(ctx, ctx->output_list("decoded_values", &decoded_values));
+    OP_REQUIRES_OK(ctx, ctx->output_list("decoded_shape", &decoded_shape));
     OP_REQUIRES_OK(ctx, decode_helper_.StoreAllDecodedSequences(
-                            best_paths, &decoded_indices, &decoded_values,
+                            reordered, &decoded_indices, &decoded_values,
                             &decoded_shape));
   }
 
  private:
+  static Status GetScalarWeight(OpKernelContext* ctx, const char* name,
+                                float* weight) {
+    const Tensor* t;
+    TF_RETURN_IF_ERROR(ctx->input(name, &t));
+    if (!TensorShapeUtils::IsScalar(t->shape())) {
+      return errors::InvalidArgument(
+          name, " must be a scalar, but received tensor of shape: ",
+          t->shape().DebugString());
+    }
+    *weight = t->scalar<float>()();
+    return Status::OK();
+  }
+
+  // Appends the labels of path p, in the sparse layout of the decoders'
+  // outputs, to (*hypotheses)[b][p].
+  static Status GatherHypotheses(
+      int p, const Tensor& indices, const Tensor& values, const Tensor& shape,
+      std::vector<std::vector<std::vector<int>>>* hypotheses) {
+    const int64 batch_size = hypotheses->size();
+    if (!TensorShapeUtils::IsMatrix(indices.shape()) ||
+        indices.dim_size(1) != 2 ||
+        !TensorShapeUtils::IsVector(values.shape()) ||
+        values.dim_size(0) != indices.dim_size(0) ||
+        !TensorShapeUtils::IsVector(shape.shape()) || shape.dim_size(0) != 2) {
+      return errors::InvalidArgument(
+          "Hypothesis ", p, " is not a 2-D SparseTensor: indices ",
+          indices.shape().DebugString(), ", values ",
+          values.shape().DebugString(), ", shape ",
+          shape.shape().DebugString());
+    }
+    if (shape.vec<int64>()(0) > batch_size) {
+      return errors::InvalidArgument("Hypothesis ", p, " has ",
+                                     shape.vec<int64>()(0),
+                                     " batch items, log_probability has ",
+                                     batch_size);
+    }
+    const auto indices_t = indices.matrix<int64>();
+    const auto values_t = values.vec<int64>();
+    for (int64 i = 0; i < indices.dim_size(0); ++i) {
+      const int64 b = indices_t(i, 0);
+      if (b < 0 || b >= batch_size) {
+        return errors::InvalidArgument("Hypothesis ", p, " has batch index ",
+                                       b, " not in [0, ", batch_size, ")");
+      }
+      std::vector<int>& labels = (*hypotheses)[b][p];
+      // The decoders emit the labels of a sequence in order.
+      if (indices_t(i, 1) != static_cast<int64>(labels.size())) {
+        return errors::InvalidArgument(
+            "Hypothesis ", p, " is not in row-major order at index ", i);
+      }
+      if (!FastBoundsCheck(values_t(i), std::numeric_limits<int>::max())) {
+        return errors::InvalidArgument("Hypothesis ", p, " has label ",
+                                       values_t(i), " at index ", i);
+      }
+      labels.push_back(values_t(i));
+    }
+    return Status::OK();
+  }
+
+  // See CTCBeamSearchDecoderOpBase::GetScorerResource.
+  Status GetRescorerResource(OpKernelContext* ctx,
+                             KenLMRescorerResource** resource) {
+    mutex_lock l(mu_);
+    if (rescorer_resource_ == nullptr) {
+      TF_RETURN_IF_ERROR(KenLMRescorerResource::LookupOrCreate(
+          ctx->resource_manager(), model_path_, vocabulary_path_,
+          load_method_, &rescorer_resource_));
+    }
+    *resource = rescorer_resource_;
+    return Status::OK();
+  }
+
+  // Same for the first pass scorer.
+  Status GetScorerResource(OpKernelContext* ctx,
+                           KenLMScorerResource** resource) {
+    mutex_lock l(mu_);
+    if (scorer_resource_ == nullptr) {
+      TF_RETURN_IF_ERROR(KenLMScorerResource::LookupOrCreate(
+          ctx->resource_manager(), first_pass_kenlm_directory_path_,
+          first_pass_load_method_, &scorer_resource_));
+    }
+    *resource = scorer_resource_;
+    return Status::OK();
+  }
+
   CTCDecodeHelper decode_helper_;
-  BeamScorer *beam_scorer_;
-  bool merge_repeated_;
-  int beam_width_;
-  TF_DISALLOW_COPY_AND_ASSIGN(CTCBeamSearchDecoderOp);
+  string model_path_;
+  string vocabulary_path_;
+  string first_pass_kenlm_directory_path_;
+  util::LoadMethod load_method_;
+  util::LoadMethod first_pass_load_method_;
+  mutex mu_;
+  KenLMRescorerResource* rescorer_resource_ GUARDED_BY(mu_) = nullptr;
+  KenLMScorerResource* scorer_resource_ GUARDED_BY(mu_) = nullptr;
+
+  TF_DISALLOW_COPY_AND_ASSIGN(CTCNBestRescoreOp);
 };
 
-REGISTER_KERNEL_BUILDER(Name("CTCBeamSearchDecoder").Device(DEVICE_CPU),
-                        CTCBeamSearchDecoderOp);
+REGISTER_KERNEL_BUILDER(Name("CTCNBestRescore").Device(DEVICE_CPU),
+                        CTCNBestRescoreOp);
 
 }  // end namespace tensorflow
@@ -0,0 +1,132 @@
+/* Copyright 2017 The TensorFlow Authors. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#include <vector>
+
+#include "tensorflow/core/common_runtime/kernel_benchmark_testlib.h"
+#include "tensorflow/core/framework/fake_input.h"
+#include "tensorflow/core/framework/node_def_builder.h"
+#include "tensorflow/core/framework/tensor.h"
+#include "tensorflow/core/framework/tensor_testutil.h"
+#include "tensorflow/core/graph/node_builder.h"
+#include "tensorflow/core/kernels/ops_testutil.h"
+#include "tensorflow/core/lib/random/simple_philox.h"
+#include "tensorflow/core/platform/test.h"
+#include "tensorflow/core/platform/test_benchmark.h"
+
+namespace tensorflow {
+
+class CTCGreedyDecoderOpTest : public OpsTestBase {
+ protected:
+  void MakeOp(bool merge_repeated) {
+    TF_ASSERT_OK(NodeDefBuilder("ctc_greedy_decoder", "CTCGreedyDecoder")
+                     .Input(FakeInput(DT_FLOAT))
+                     .Input(FakeInput(DT_INT32))
+                     .Attr("merge_repeated", merge_repeated)
+                     .Finalize(node_def()));
+    TF_ASSERT_OK(InitOp());
+  }
+};
+
+TEST_F(CTCGreedyDecoderOpTest, MatchesScalarArgMax) {
+  // Enough classes for several SIMD blocks and a scalar tail.
+  const int max_time = 6;
+  const int batch_size = 3;
+  const int num_classes = 1003;
+  const int blank = num_classes - 1;
+  // Position of the maximum of each (t, b) row; -1 rows have their maximum
+  // tied at 5 and 700, the first of which must win.
+  const int argmax[max_time][batch_size] = {{0, 64, 1001},  {0, -1, 999},
+                                            {blank, 63, 7}, {517, 65, 7},
+                                            {1000, -1, 8},  {3, 3, blank}};
+  const std::vector<int> seq_len = {6, 5, 4};
+
+  random::PhiloxRandom philox(301, 17);
+  random::SimplePhilox rnd(&philox);
+  std::vector<float> logits(max_time * batch_size * num_classes);
+  for (float& l : logits) l = -10.0f * rnd.RandFloat();
+  for (int t = 0; t < max_time; ++t) {
+    for (int b = 0; b < batch_size; ++b) {
+      float* row = &logits[(t * batch_size + b) * num_classes];
+      if (argmax[t][b] < 0) {
+        row[5] = row[700] = 1.0f;
+      } else {
+        row[argmax[t][b]] = 1.0f;
+      }
+    }
+  }
+
+  MakeOp(true /* merge_repeated */);
+  AddInputFromArray<float>(TensorShape({max_time, batch_size, num_classes}),
+                           logits);
+  AddInputFromArray<int32>(TensorShape({batch_size}), seq_len);
+  TF_ASSERT_OK(RunOpKernel());
+
+  // Expected values, batch major: repeats merged, blanks removed. Batch item
+  // 2 decodes to 1001 999 7, its repeated 7 being merged.
+  Tensor expected_values(DT_INT64, TensorShape({12}));
+  test::FillValues<int64>(&expected_values,
+                          {0, 517, 1000, 3, 64, 5, 63, 65, 5, 1001, 999, 7});
+  test::ExpectTensorEqual<int64>(expected_values, *GetOutput(1));
+  Tensor expected_shape(DT_INT64, TensorShape({2}));
+  test::FillValues<int64>(&expected_shape, {batch_size, 5});
+  test::ExpectTensorEqual<int64>(expected_shape, *GetOutput(2));
+  Tensor expected_log_prob(DT_FLOAT, TensorShape({batch_size, 1}));
+  test::FillValues<float>(&expected_log_prob, {-6.0f, -5.0f, -4.0f});
+  test::ExpectTensorEqual<float>(expected_log_prob, *GetOutput(3));
+}
+
+TEST_F(CTCGreedyDecoderOpTest, RejectsZeroClasses) {
+  MakeOp(true /* merge_repeated */);
+  AddInputFromArray<float>(TensorShape({2, 1, 0}), {});
+  AddInputFromArray<int32>(TensorShape({1}), {2});
+  Status s = RunOpKernel();
+  ASSERT_FALSE(s.ok());
+  EXPECT_TRUE(
+      StringPiece(s.ToString()).contains("num_classes must be positive"))
+      << s;
+}
+
+static Graph* CTCGreedyDecoder(int max_time, int batch_size,
+                               int num_classes) {
+  Graph* g = new Graph(OpRegistry::Global());
+  Tensor inputs(DT_FLOAT, TensorShape({max_time, batch_size, num_classes}));
+  inputs.flat<float>().setRandom();
+  Tensor seq_len(DT_INT32, TensorShape({batch_size}));
+  seq_len.flat<int32>().setConstant(max_time);
+  Node* ret;
+  TF_CHECK_OK(NodeBuilder(g->NewName("n"), "CTCGreedyDecoder")
+                  .Input(test::graph::Constant(g, inputs))
+                  .Input(test::graph::Constant(g, seq_len))
+                  .Attr("merge_repeated", true)
+                  .Finalize(g, &ret));
+  return g;
+}
+
+#define BM_CTCGreedyDecoderDev(T, B, C)                                     \
+  static void BM_CTCGreedyDecoder_##T##_##B##_##C(int iters) {              \
+    testing::ItemsProcessed(static_cast<int64>(iters) * T * B);             \
+    testing::BytesProcessed(static_cast<int64>(iters) * T * B * C *         \
+                            sizeof(float));                                 \
+    test::Benchmark("cpu", CTCGreedyDecoder(T, B, C)).Run(iters);           \
+  }                                                                         \
+  BENCHMARK(BM_CTCGreedyDecoder_##T##_##B##_##C);
+
+BM_CTCGreedyDecoderDev(100, 1, 29);
+BM_CTCGreedyDecoderDev(500, 16, 29);
+BM_CTCGreedyDecoderDev(100, 1, 5000);
+BM_CTCGreedyDecoderDev(500, 16, 5000);
+
+}  // namespace tensorflow
@@ -0,0 +1,147 @@
+/* Copyright 2017 The TensorFlow Authors. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#include "tensorflow/core/kernels/ctc_kenlm_scorer_resource.h"
+
+#include <functional>
+#include <unordered_map>
+#include <vector>
+
+#include "tensorflow/core/lib/strings/strcat.h"
+#include "tensorflow/core/platform/env.h"
+#include "tensorflow/core/platform/logging.h"
+#include "tensorflow/core/platform/mutex.h"
+
+namespace tensorflow {
+
+namespace {
+
+typedef KenLMScorerResource::BeamScorer BeamScorer;
+typedef KenLMRescorerResource::Rescorer Rescorer;
+
+// Builds the key identifying one version of the files at paths, prefixed by
+// name.
+Status MakeKey(const string& name, util::LoadMethod load_method,
+               const std::vector<string>& paths, string* key) {
+  *key = strings::StrCat(name, ";", load_method);
+  for (const string& path : paths) {
+    FileStatistics stat;
+    TF_RETURN_IF_ERROR(Env::Default()->Stat(path, &stat));
+    strings::StrAppend(key, ";", stat.mtime_nsec, ":", stat.length);
+  }
+  return Status::OK();
+}
+
+// Returns the object loaded for key, loading it with load unless some
+// session still holds it. Each type T has its own map of loaded objects.
+template <typename T>
+Status GetOrLoad(const string& key,
+                 const std::function<Status(std::unique_ptr<T>*)>& load,
+                 std::shared_ptr<const T>* object) {
+  static mutex mu(LINKER_INITIALIZED);
+  static auto* loaded =
+      new std::unordered_map<string, std::weak_ptr<const T>>;
+  // Loading under the lock keeps concurrent kernels from loading the same
+  // model twice.
+  mutex_lock l(mu);
+  auto it = loaded->find(key);
+  if (it != loaded->end()) {
+    *object = it->second.lock();
+    if (*object) return Status::OK();
+  }
+  for (auto i = loaded->begin(); i != loaded->end();) {
+    if (i->second.expired()) {
+      i = loaded->erase(i);
+    } else {
+      ++i;
+    }
+  }
+  std::unique_ptr<T> result;
+  TF_RETURN_IF_ERROR(load(&result));
+  object->reset(result.release());
+  (*loaded)[key] = *object;
+  return Status::OK();
+}
+
+}  // namespace
+
+Status KenLMScorerResource::LookupOrCreate(ResourceMgr* rm,
+                                           const string& kenlm_directory_path,
+                                           util::LoadMethod load_method,
+                                           KenLMScorerResource** resource) {
+  string key;
+  TF_RETURN_IF_ERROR(MakeKey(
+      kenlm_directory_path, load_method,
+      {strings::StrCat(kenlm_directory_path, "/", BeamScorer::ModelFileName()),
+       strings::StrCat(kenlm_directory_path, "/",
+                       BeamScorer::VocabularyFileName()),
+       strings::StrCat(kenlm_directory_path, "/", BeamScorer::TrieFileName())},
+      &key));
+  return rm->LookupOrCreate<KenLMScorerResource>(
+      rm->default_container(), strings::StrCat("ctc_kenlm_scorer:", key),
+      resource,
+      [&key, &kenlm_directory_path, load_method](KenLMScorerResource** r) {
+        std::shared_ptr<const BeamScorer> scorer;
+        TF_RETURN_IF_ERROR(GetOrLoad<BeamScorer>(
+            key,
+            [&kenlm_directory_path,
+             load_method](std::unique_ptr<BeamScorer>* result) {
+              TF_RETURN_IF_ERROR(BeamScorer::Create(kenlm_directory_path,
+                                                    load_method, result));
+              VLOG(1) << "Loaded KenLM scorer from " << kenlm_directory_path;
+              return Status::OK();
+            },
+            &scorer));
+        *r = new KenLMScorerResource(key, std::move(scorer));
+        return Status::OK();
+      });
+}
+
+string KenLMScorerResource::DebugString() {
+  return strings::StrCat("KenLMScorerResource(", key_, ")");
+}
+
+Status KenLMRescorerResource::LookupOrCreate(
+    ResourceMgr* rm, const string& model_path, const string& vocabulary_path,
+    util::LoadMethod load_method, KenLMRescorerResource** resource) {
+  string key;
+  TF_RETURN_IF_ERROR(
+      MakeKey(strings::StrCat(model_path, ";", vocabulary_path), load_method,
+              {model_path, vocabulary_path}, &key));
+  return rm->LookupOrCreate<KenLMRescorerResource>(
+      rm->default_container(), strings::StrCat("ctc_kenlm_rescorer:", key),
+      resource, [&key, &model_path, &vocabulary_path,
+                 load_method](KenLMRescorerResource** r) {
+        std::shared_ptr<const Rescorer> rescorer;
+        TF_RETURN_IF_ERROR(GetOrLoad<Rescorer>(
+            key,
+            [&model_path, &vocabulary_path,
+             load_method](std::unique_ptr<Rescorer>* result) {
+              TF_RETURN_IF_ERROR(Rescorer::Create(model_path, vocabulary_path,
+                                                  load_method, result));
+              VLOG(1) << "Loaded KenLM rescorer from " << model_path;
+              return Status::OK();
+            },
+            &rescorer));
+        *r = new KenLMRescorerResource(key, std::move(rescorer));
+        return Status::OK();
+      });
+}
+
+string KenLMRescorerResource::DebugString() {
+  return strings::StrCat("KenLMRescorerResource(", key_, ")");
+}
+
+}  // namespace tensorflow
@@ -0,0 +1,98 @@
+/* Copyright 2017 The TensorFlow Authors. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#ifndef TENSORFLOW_CORE_KERNELS_CTC_KENLM_SCORER_RESOURCE_H_
+#define TENSORFLOW_CORE_KERNELS_CTC_KENLM_SCORER_RESOURCE_H_
+
+#include <memory>
+
+#include "tensorflow/core/framework/resource_mgr.h"
+#include "tensorflow/core/lib/core/status.h"
+#include "tensorflow/core/platform/macros.h"
+#include "tensorflow/core/util/ctc/ctc_beam_scorer.h"
+#include "tensorflow/core/util/ctc/ctc_nbest_rescorer.h"
+
+namespace tensorflow {
+
+// A loaded KenLM model, vocabulary and trie, shared by all the kernels that
+// decode with the same KenLM directory.
+//
+// Resources are registered in the default container of the device's
+// ResourceMgr under a name derived from the directory, the load method and
+// the modification times of the three files, so that kernels of one session
+// share a resource and a rewritten model is picked up by new kernels. The
+// loaded data itself is also shared between sessions (and thus between
+// ResourceMgrs) for as long as any of them holds it.
+class KenLMScorerResource : public ResourceBase {
+ public:
+  typedef ctc::KenLMBeamScorer BeamScorer;
+
+  // Looks up the resource for kenlm_directory_path in rm, loading the files
+  // if needed. On success the caller owns a reference to *resource.
+  static Status LookupOrCreate(ResourceMgr* rm,
+                               const string& kenlm_directory_path,
+                               util::LoadMethod load_method,
+                               KenLMScorerResource** resource);
+
+  // Decoders should work on copies of the prototype scorer; copies are cheap
+  // and share the loaded data.
+  const BeamScorer& scorer() const { return *scorer_; }
+
+  string DebugString() override;
+
+ private:
+  KenLMScorerResource(const string& key,
+                      std::shared_ptr<const BeamScorer> scorer)
+      : key_(key), scorer_(std::move(scorer)) {}
+
+  const string key_;
+  const std::shared_ptr<const BeamScorer> scorer_;
+
+  TF_DISALLOW_COPY_AND_ASSIGN(KenLMScorerResource);
+};
+
+// A loaded KenLM model and vocabulary for rescoring whole transcriptions,
+// shared like KenLMScorerResource: the key is made of the two paths, the
+// load method and the modification times of the files.
+class KenLMRescorerResource : public ResourceBase {
+ public:
+  typedef ctc::NBestRescorer Rescorer;
+
+  // Looks up the resource for the model and vocabulary in rm, loading them
+  // if needed. On success the caller owns a reference to *resource.
+  static Status LookupOrCreate(ResourceMgr* rm, const string& model_path,
+                               const string& vocabulary_path,
+                               util::LoadMethod load_method,
+                               KenLMRescorerResource** resource);
+
+  // Thread-safe.
+  const Rescorer& rescorer() const { return *rescorer_; }
+
+  string DebugString() override;
+
+ private:
+  KenLMRescorerResource(const string& key,
+                        std::shared_ptr<const Rescorer> rescorer)
+      : key_(key), rescorer_(std::move(rescorer)) {}
+
+  const string key_;
+  const std::shared_ptr<const Rescorer> rescorer_;
+
+  TF_DISALLOW_COPY_AND_ASSIGN(KenLMRescorerResource);
+};
+
+}  // namespace tensorflow
+
+#endif  // TENSORFLOW_CORE_KERNELS_CTC_KENLM_SCORER_RESOURCE_H_
@@ -44,6 +44,11 @@ class CTCLossOp : public OpKernel {
                    ctx->GetAttr("ctc_merge_repeated", &ctc_merge_repeated_));
     OP_REQUIRES_OK(ctx, ctx->GetAttr("ignore_longer_outputs_than_inputs",
                                      &ignore_longer_outputs_than_inputs_));
+    string algorithm;
+    OP_REQUIRES_OK(ctx, ctx->GetAttr("algorithm", &algorithm));
+    OP_REQUIRES_OK(ctx, ctc::CTCLossCalculator::ParseAlgorithm(algorithm,
+                                                              &algorithm_));
+    OP_REQUIRES_OK(ctx, ctx->GetAttr("low_memory", &low_memory_));
   }
 
   void Compute(OpKernelContext* ctx) override {
@@ -146,7 +151,8 @@ class CTCLossOp : public OpKernel {
     gradient_t.setZero();
 
     // Assumption: the blank index is num_classes - 1
-    ctc::CTCLossCalculator ctc_loss_calculator(num_classes - 1, 0);
+    ctc::CTCLossCalculator ctc_loss_calculator(num_classes - 1, 0,
+                                               algorithm_, low_memory_);
     DeviceBase::CpuWorkerThreads workers =
         *ctx->device()->tensorflow_cpu_worker_threads();
     OP_REQUIRES_OK(ctx, ctc_loss_calculator.CalculateLoss(
@@ -160,6 +166,8 @@ class CTCLossOp : public OpKernel {
   bool preprocess_collapse_repeated_;
   bool ctc_merge_repeated_;
   bool ignore_longer_outputs_than_inputs_;
+  ctc::CTCLossCalculator::Algorithm algorithm_;
+  bool low_memory_;
 
   TF_DISALLOW_COPY_AND_ASSIGN(CTCLossOp);
 };
@@ -17,7 +17,9 @@ limitations under the License.
 
 #define EIGEN_USE_THREADS
 
+#include <algorithm>
 #include <limits>
+#include <type_traits>
 
 #include <vector>
 #include "tensorflow/core/common_runtime/device.h"
@@ -30,6 +32,7 @@ limitations under the License.
 #include "tensorflow/core/platform/logging.h"
 #include "tensorflow/core/platform/macros.h"
 #include "tensorflow/core/util/sparse/sparse_tensor.h"
+#include "tensorflow/core/util/work_sharder.h"
 
 namespace tensorflow {
 
@@ -91,6 +94,33 @@ Status ValidateShapes(OpKernelContext* ctx, const Tensor& hypothesis_indices,
   return Status::OK();
 }
 
+// Below this length of the shorter sequence, the scalar dynamic program beats
+// the setup of the bit-parallel one, see the benchmarks in
+// lib/gtl/edit_distance_test.cc.
+const int64 kMinBitParallelLength = 16;
+
+// The bit-parallel distance needs a total order consistent with equality:
+// integer types and strings.
+template <typename T>
+struct HasBitParallelLevenshteinDistance
+    : std::integral_constant<bool, std::is_integral<T>::value ||
+                                       std::is_same<T, string>::value> {};
+
+template <typename T>
+int64 SequenceDistance(const gtl::ArraySlice<T>& s,
+                       const gtl::ArraySlice<T>& t, std::true_type) {
+  if (std::min<int64>(s.size(), t.size()) >= kMinBitParallelLength) {
+    return gtl::BitParallelLevenshteinDistance(s, t);
+  }
+  return gtl::LevenshteinDistance(s, t, std::equal_to<T>());
+}
+
+template <typename T>
+int64 SequenceDistance(const gtl::ArraySlice<T>& s,
+                       const gtl::ArraySlice<T>& t, std::false_type) {
+  return gtl::LevenshteinDistance(s, t, std::equal_to<T>());
+}
+
 }  // namespace
 
 template <typename T>
@@ -166,7 +196,16 @@ class EditDistanceOp : public OpKernel {
     auto hypothesis_iter = hypothesis_grouper.begin();
     auto truth_iter = truth_grouper.begin();
 
-    auto cmp = std::equal_to<T>();
+    // Pairs of sequences to compare, computed once the groups are matched.
+    // The sequences point into the values of the inputs.
+    struct SequencePair {
+      int64 loc;
+      gtl::ArraySlice<T> truth;
+      gtl::ArraySlice<T> hypothesis;
+    };
+    std::vector<SequencePair> pairs;
+    int64 total_truth_size = 0;
+    int64 total_hypothesis_size = 0;
 
     while (hypothesis_iter != hypothesis_grouper.end() &&
            truth_iter != truth_grouper.end()) {
@@ -180,9 +219,12 @@ class EditDistanceOp : public OpKernel {
       if (g_truth == g_hypothesis) {
         auto loc = std::inner_product(g_truth.begin(), g_truth.end(),
                                       output_strides.begin(), int64{0});
-        output_t(loc) =
-            gtl::LevenshteinDistance<T>(truth_seq, hypothesis_seq, cmp);
-        if (normalize_) output_t(loc) /= truth_seq.size();
+        pairs.push_back(
+            {loc, gtl::ArraySlice<T>(truth_seq.data(), truth_seq.size()),
+             gtl::ArraySlice<T>(hypothesis_seq.data(),
+                                hypothesis_seq.size())});
+        total_truth_size += truth_seq.size();
+        total_hypothesis_size += hypothesis_seq.size();
 
         ++hypothesis_iter;
         ++truth_iter;
@@ -222,6 +264,28 @@ class EditDistanceOp : public OpKernel {
       output_t(loc) = (normalize_) ? 1.0 : truth_seq.size();
       ++truth_iter;
     }
+
+    // The pairs are independent: compare them in parallel.
+    auto compare = [this, &pairs, &output_t](int64 start, int64 limit) {
+      for (int64 i = start; i < limit; ++i) {
+        const SequencePair& pair = pairs[i];
+        output_t(pair.loc) =
+            SequenceDistance<T>(pair.truth, pair.hypothesis,
+                                HasBitParallelLevenshteinDistance<T>());
+        if (normalize_) output_t(pair.loc) /= pair.truth.size();
+      }
+    };
+    if (!pairs.empty()) {
+      // *Rough* estimate of the cost of a pair of average lengths: the
+      // dynamic program visits every pair of elements.
+      const int64 num_pairs = pairs.size();
+      const int64 cost = std::max<int64>(total_truth_size / num_pairs, 1) *
+                         std::max<int64>(total_hypothesis_size / num_pairs, 1) *
+                         5 * Eigen::TensorOpCost::AddCost<int64>();
+      const DeviceBase::CpuWorkerThreads& workers =
+          *ctx->device()->tensorflow_cpu_worker_threads();
+      Shard(workers.num_threads, workers.workers, num_pairs, cost, compare);
+    }
   }
 
  private:
@@ -17,6 +17,8 @@ limitations under the License.
 
 #include <math.h>
 
+#include <algorithm>
+
 #include "third_party/fft2d/fft.h"
 #include "tensorflow/core/lib/core/bits.h"
 
@@ -34,6 +36,15 @@ void GetPeriodicHann(int window_length, std::vector<double>* window) {
     (*window)[i] = 0.5 - 0.5 * cos((2 * pi * i) / window_length);
   }
 }
+
+// Returns the low log2(n) bits of i in reverse order, n being a power of two.
+int ReverseBits(int i, int n) {
+  int reversed = 0;
+  for (int bit = 1; bit < n; bit <<= 1) {
+    reversed = (reversed << 1) | ((i & bit) ? 1 : 0);
+  }
+  return reversed;
+}
 }  // namespace
 
 bool Spectrogram::Initialize(int window_length, int step_length) {
@@ -76,10 +87,44 @@ bool Spectrogram::Initialize(const std::vector<double>& window,
   fft_integer_working_area_[0] = 0;
   input_queue_.clear();
   samples_to_next_step_ = window_length_;
+  InitializeFloatFFT();
   initialized_ = true;
   return true;
 }
 
+void Spectrogram::InitializeFloatFFT() {
+  const double pi = std::atan(1) * 4;
+  float_window_.assign(window_.begin(), window_.end());
+  float_queue_.clear();
+  float_samples_to_skip_ = 0;
+
+  const int half_fft_length = fft_length_ / 2;
+  fft_bit_reversal_.resize(half_fft_length);
+  for (int i = 0; i < half_fft_length; ++i) {
+    fft_bit_reversal_[i] = ReverseBits(i, half_fft_length);
+  }
+  // The factors are computed in double precision, so that their error does
+  // not grow with the length of the transform.
+  fft_twiddle_real_.resize(std::max(half_fft_length - 1, 0));
+  fft_twiddle_imag_.resize(fft_twiddle_real_.size());
+  for (int half = 1; half < half_fft_length; half *= 2) {
+    for (int j = 0; j < half; ++j) {
+      const double angle = -pi * j / half;
+      fft_twiddle_real_[half - 1 + j] = cos(angle);
+      fft_twiddle_imag_[half - 1 + j] = sin(angle);
+    }
+  }
+  fft_split_real_.resize(half_fft_length);
+  fft_split_imag_.resize(half_fft_length);
+  for (int k = 0; k < half_fft_length; ++k) {
+    const double angle = -2 * pi * k / fft_length_;
+    fft_split_real_[k] = cos(angle);
+    fft_split_imag_[k] = sin(angle);
+  }
+  fft_real_.assign(half_fft_length, 0.0f);
+  fft_imag_.assign(half_fft_length, 0.0f);
+}
+
 template <class InputSample, class OutputSample>
 bool Spectrogram::ComputeComplexSpectrogram(
     const std::vector<InputSample>& input,
@@ -163,6 +208,48 @@ template bool Spectrogram::ComputeSquaredMagnitudeSpectrogram(
 template bool Spectrogram::ComputeSquaredMagnitudeSpectrogram(
     const std::vector<double>& input, std::vector<std::vector<double>>*);
 
+bool Spectrogram::ComputeSquaredMagnitudeSpectrogram(
+    const float* input, int64 input_length, int64 input_stride,
+    std::vector<float>* output) {
+  if (!initialized_) {
+    LOG(ERROR) << "ComputeSquaredMagnitudeSpectrogram() called before "
+               << "successful call to Initialize().";
+    return false;
+  }
+  CHECK(output);
+  output->clear();
+  // Samples that no frame covers are dropped as they arrive.
+  const int64 skipped = std::min(float_samples_to_skip_, input_length);
+  float_samples_to_skip_ -= skipped;
+  const int64 queued = float_queue_.size();
+  float_queue_.resize(queued + input_length - skipped);
+  float* queue_end = float_queue_.data() + queued;
+  for (int64 i = skipped; i < input_length; ++i) {
+    *queue_end++ = input[i * input_stride];
+  }
+
+  const int64 available = float_queue_.size();
+  const int64 frames =
+      available < window_length_
+          ? 0
+          : 1 + (available - window_length_) / step_length_;
+  output->resize(frames * output_frequency_channels_);
+  for (int64 frame = 0; frame < frames; ++frame) {
+    ProcessCoreFloatFFT(frame * step_length_,
+                        output->data() + frame * output_frequency_channels_);
+  }
+
+  // Keep the samples from the start of the next frame on.
+  const int64 consumed = frames * step_length_;
+  if (consumed >= available) {
+    float_samples_to_skip_ += consumed - available;
+    float_queue_.clear();
+  } else {
+    float_queue_.erase(float_queue_.begin(), float_queue_.begin() + consumed);
+  }
+  return true;
+}
+
 // Return true if a full window of samples is prepared; manage the queue.
 template <class InputSample>
 bool Spectrogram::GetNextWindowOfSamples(const std::vector<InputSample>& input,
@@ -209,4 +296,74 @@ void Spectrogram::ProcessCoreFFT() {
   fft_input_output_[1] = 0;
 }
 
+void Spectrogram::ProcessCoreFloatFFT(int64 start, float* output) {
+  const int half_fft_length = fft_length_ / 2;
+  const float* samples = float_queue_.data() + start;
+  const float* window = float_window_.data();
+  const int* bit_reversal = fft_bit_reversal_.data();
+  float* real = fft_real_.data();
+  float* imag = fft_imag_.data();
+
+  // Even samples make the real parts and odd samples the imaginary parts of
+  // the complex input, stored in bit-reversed order for the in-place
+  // decimation in time below. The tail past the window is zero-padded.
+  std::fill(real, real + half_fft_length, 0.0f);
+  std::fill(imag, imag + half_fft_length, 0.0f);
+  int j = 0;
+  for (; j + 1 < window_length_; j += 2) {
+    const int k = bit_reversal[j / 2];
+    real[k] = samples[j] * window[j];
+    imag[k] = samples[j + 1] * window[j + 1];
+  }
+  if (j < window_length_) {
+    real[bit_reversal[j / 2]] = samples[j] * window[j];
+  }
+
+  // Radix-2 butterflies. Each pass runs over contiguous arrays with a
+  // contiguous twiddle table, which the compiler vectorizes.
+  for (int half = 1; half < half_fft_length; half *= 2) {
+    const float* twiddle_real = fft_twiddle_real_.data() + half - 1;
+    const float* twiddle_imag = fft_twiddle_imag_.data() + half - 1;
+    for (int block = 0; block < half_fft_length; block += 2 * half) {
+      float* a_real = real + block;
+      float* a_imag = imag + block;
+      float* b_real = a_real + half;
+      float* b_imag = a_imag + half;
+      for (int i = 0; i < half; ++i) {
+        const float t_real =
+            twiddle_real[i] * b_real[i] - twiddle_imag[i] * b_imag[i];
+        const float t_imag =
+            twiddle_real[i] * b_imag[i] + twiddle_imag[i] * b_real[i];
+        b_real[i] = a_real[i] - t_real;
+        b_imag[i] = a_imag[i] - t_imag;
+        a_real[i] += t_real;
+        a_imag[i] += t_imag;
+      }
+    }
+  }
+
+  // Split the transform Z of the complex input, of length h, into the
+  // transform X of the real input: X[k] = E[k] + W^k O[k], with E and O the
+  // transforms of the even and odd samples, E[k] = (Z[k] + conj(Z[h - k])) / 2
+  // and O[k] = (Z[k] - conj(Z[h - k])) / 2i.
+  const float dc = real[0] + imag[0];
+  const float nyquist = real[0] - imag[0];
+  output[0] = dc * dc;
+  output[half_fft_length] = nyquist * nyquist;
+  const float* split_real = fft_split_real_.data();
+  const float* split_imag = fft_split_imag_.data();
+  for (int k = 1; k < half_fft_length; ++k) {
+    const int m = half_fft_length - k;
+    const float even_real = 0.5f * (real[k] + real[m]);
+    const float even_imag = 0.5f * (imag[k] - imag[m]);
+    const float odd_real = 0.5f * (imag[k] + imag[m]);
+    const float odd_imag = 0.5f * (real[m] - real[k]);
+    const float x_real =
+        even_real + split_real[k] * odd_real - split_imag[k] * odd_imag;
+    const float x_imag =
+        even_imag + split_real[k] * odd_imag + split_imag[k] * odd_real;
+    output[k] = x_real * x_real + x_imag * x_imag;
+  }
+}
+
 }  // namespace tensorflow
@@ -77,6 +77,23 @@ class Spectrogram {
       const std::vector<InputSample>& input,
       std::vector<std::vector<OutputSample>>* output);
 
+  // Single-precision variant of ComputeSquaredMagnitudeSpectrogram, for
+  // callers that do not need the double-precision FFT. The error relative to
+  // the largest power of a frame is below 1e-6.
+  //
+  // Reads input[0], input[input_stride], ...,
+  // input[(input_length - 1) * input_stride], so that a channel of
+  // interleaved audio can be read in place, and replaces output with the
+  // frames laid out one after the other, output_frequency_channels() values
+  // each.
+  //
+  // The samples buffered by this function and by the functions above are
+  // kept apart: an instance should only be fed through one of them.
+  bool ComputeSquaredMagnitudeSpectrogram(const float* input,
+                                          int64 input_length,
+                                          int64 input_stride,
+                                          std::vector<float>* output);
+
   // Return reference to the window function used internally.
   const std::vector<double>& GetWindow() const { return window_; }
 
@@ -88,6 +105,10 @@ class Spectrogram {
   bool GetNextWindowOfSamples(const std::vector<InputSample>& input,
                               int* input_start);
   void ProcessCoreFFT();
+  void InitializeFloatFFT();
+  // Single-precision real FFT of float_window_ * float_queue_[start, start +
+  // window_length_), as squared magnitudes written to output.
+  void ProcessCoreFloatFFT(int64 start, float* output);
 
   int fft_length_;
   int output_frequency_channels_;
@@ -104,6 +125,25 @@ class Spectrogram {
   std::vector<int> fft_integer_working_area_;
   std::vector<double> fft_double_working_area_;
 
+  // State of the single-precision path. The real input of length
+  // fft_length_ is transformed as a complex sequence of half the length, in
+  // split real and imaginary arrays so that the butterflies vectorize.
+  std::vector<float> float_window_;
+  // Samples from the start of the next frame on.
+  std::vector<float> float_queue_;
+  // Input samples to drop before the next frame, when the step is longer
+  // than the window.
+  int64 float_samples_to_skip_;
+  std::vector<int> fft_bit_reversal_;
+  // Twiddle factors of the butterflies of half-size h at [h - 1, 2 * h - 1).
+  std::vector<float> fft_twiddle_real_;
+  std::vector<float> fft_twiddle_imag_;
+  // Twiddle factors splitting the complex transform into the real one.
+  std::vector<float> fft_split_real_;
+  std::vector<float> fft_split_imag_;
+  std::vector<float> fft_real_;
+  std::vector<float> fft_imag_;
+
   TF_DISALLOW_COPY_AND_ASSIGN(Spectrogram);
 };
 
@@ -15,16 +15,117 @@ limitations under the License.
 
 // See docs in ../ops/audio_ops.cc
 
+#include <algorithm>
+#include <memory>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
 #include "tensorflow/core/framework/op_kernel.h"
 #include "tensorflow/core/framework/register_types.h"
+#include "tensorflow/core/framework/resource_mgr.h"
 #include "tensorflow/core/framework/tensor.h"
 #include "tensorflow/core/framework/tensor_shape.h"
 #include "tensorflow/core/framework/types.h"
 #include "tensorflow/core/kernels/spectrogram.h"
+#include "tensorflow/core/lib/core/bits.h"
 #include "tensorflow/core/lib/core/status.h"
+#include "tensorflow/core/lib/strings/strcat.h"
+#include "tensorflow/core/platform/logging.h"
+#include "tensorflow/core/platform/mutex.h"
+#include "tensorflow/core/util/work_sharder.h"
 
 namespace tensorflow {
 
+namespace {
+
+Status InitializeSpectrograms(
+    int64 channel_count, int32 window_size, int32 stride,
+    std::vector<std::unique_ptr<Spectrogram>>* spectrograms) {
+  spectrograms->resize(channel_count);
+  for (auto& spectrogram : *spectrograms) {
+    spectrogram.reset(new Spectrogram);
+    if (!spectrogram->Initialize(window_size, stride)) {
+      return errors::InvalidArgument(
+          "Spectrogram initialization failed for window size ", window_size,
+          " and stride ", stride);
+    }
+  }
+  return Status::OK();
+}
+
+// Feeds channel c of the [samples, channels] audio input to
+// (*spectrograms)[c], on the intra-op threads, and stores the frames it
+// produces in (*frames)[c]. All the channels produce the same number of
+// frames, since their spectrograms are fed alike.
+Status ComputeChannelSpectrograms(
+    OpKernelContext* context, const Tensor& input, bool magnitude_squared,
+    std::vector<std::unique_ptr<Spectrogram>>* spectrograms,
+    std::vector<std::vector<float>>* frames) {
+  const int64 sample_count = input.dim_size(0);
+  const int64 channel_count = input.dim_size(1);
+  const float* input_data = input.flat<float>().data();
+  frames->resize(channel_count);
+  std::vector<uint8> channel_ok(channel_count, 0);
+  auto compute_channels = [&](int64 start_channel, int64 limit_channel) {
+    for (int64 channel = start_channel; channel < limit_channel; ++channel) {
+      std::vector<float>* channel_frames = &(*frames)[channel];
+      channel_ok[channel] =
+          (*spectrograms)[channel]->ComputeSquaredMagnitudeSpectrogram(
+              input_data + channel, sample_count, channel_count,
+              channel_frames);
+      if (!magnitude_squared) {
+        for (float& value : *channel_frames) {
+          value = sqrtf(value);
+        }
+      }
+    }
+  };
+  if (channel_count == 0) return Status::OK();
+  // Rough cost of a channel: with frames overlapping by half, the FFTs take
+  // about 10 log2(fft_length) operations per sample.
+  const int fft_length =
+      2 * ((*spectrograms)[0]->output_frequency_channels() - 1);
+  const int64 cost_per_sample =
+      10 * Log2Floor(fft_length) * Eigen::TensorOpCost::AddCost<float>();
+  const DeviceBase::CpuWorkerThreads& workers =
+      *context->device()->tensorflow_cpu_worker_threads();
+  Shard(workers.num_threads, workers.workers, channel_count,
+        sample_count * cost_per_sample, compute_channels);
+  for (int64 channel = 0; channel < channel_count; ++channel) {
+    if (!channel_ok[channel]) {
+      return errors::InvalidArgument("Spectrogram compute failed");
+    }
+    if ((*frames)[channel].size() != (*frames)[0].size()) {
+      return errors::Internal("Channel ", channel, " produced ",
+                              (*frames)[channel].size(), " values, channel 0 ",
+                              (*frames)[0].size());
+    }
+  }
+  return Status::OK();
+}
+
+// Copies the frames of the channels to a new [channels, height, width]
+// output.
+Status OutputChannelSpectrograms(
+    OpKernelContext* context, int64 output_height, int64 output_width,
+    const std::vector<std::vector<float>>& frames) {
+  const int64 channel_count = frames.size();
+  const int64 channel_size = output_height * output_width;
+  Tensor* output_tensor = nullptr;
+  TF_RETURN_IF_ERROR(context->allocate_output(
+      0, TensorShape({channel_count, output_height, output_width}),
+      &output_tensor));
+  float* output_flat = output_tensor->flat<float>().data();
+  for (int64 channel = 0; channel < channel_count; ++channel) {
+    std::copy(frames[channel].begin(), frames[channel].end(),
+              output_flat + channel * channel_size);
+  }
+  return Status::OK();
+}
+
+}  // namespace
+
 // Create a spectrogram frequency visualization from audio data.
 class AudioSpectrogramOp : public OpKernel {
  public:
@@ -41,18 +142,22 @@ class AudioSpectrogramOp : public OpKernel {
     OP_REQUIRES(context, input.dims() == 2,
                 errors::InvalidArgument("input must be 2-dimensional",
                                         input.shape().DebugString()));
-    Spectrogram spectrogram;
-    OP_REQUIRES(context, spectrogram.Initialize(window_size_, stride_),
-                errors::InvalidArgument(
-                    "Spectrogram initialization failed for window size ",
-                    window_size_, " and stride ", stride_));
-
-    const auto input_as_matrix = input.matrix<float>();
-
     const int64 sample_count = input.dim_size(0);
     const int64 channel_count = input.dim_size(1);
 
-    const int64 output_width = spectrogram.output_frequency_channels();
+    // Each channel has its own spectrogram, so that they can be computed in
+    // parallel and none starts with the samples left over by another.
+    std::vector<std::unique_ptr<Spectrogram>> spectrograms;
+    OP_REQUIRES_OK(context, InitializeSpectrograms(channel_count, window_size_,
+                                                   stride_, &spectrograms));
+
+    std::vector<std::vector<float>> frames;
+    OP_REQUIRES_OK(context,
+                   ComputeChannelSpectrograms(context, input,
+                                              magnitude_squared_,
+                                              &spectrograms, &frames));
+
+    const int64 output_width = 1 + NextPowerOfTwo(window_size_) / 2;
     const int64 length_minus_window = (sample_count - window_size_);
     int64 output_height;
     if (length_minus_window < 0) {
@@ -60,54 +165,16 @@ class AudioSpectrogramOp : public OpKernel {
     } else {
       output_height = 1 + (length_minus_window / stride_);
     }
-    const int64 output_slices = channel_count;
-
-    Tensor* output_tensor = nullptr;
-    OP_REQUIRES_OK(
+    const int64 output_size = output_height * output_width;
+    OP_REQUIRES(
         context,
-        context->allocate_output(
-            0, TensorShape({output_slices, output_height, output_width}),
-            &output_tensor));
-    auto output_flat = output_tensor->flat<float>().data();
-
-    std::vector<float> input_for_channel(sample_count);
-    for (int64 channel = 0; channel < channel_count; ++channel) {
-      float* output_slice =
-          output_flat + (channel * output_height * output_width);
-      for (int i = 0; i < sample_count; ++i) {
-        input_for_channel[i] = input_as_matrix(i, channel);
-      }
-      std::vector<std::vector<float>> spectrogram_output;
-      OP_REQUIRES(context,
-                  spectrogram.ComputeSquaredMagnitudeSpectrogram(
-                      input_for_channel, &spectrogram_output),
-                  errors::InvalidArgument("Spectrogram compute failed"));
-      OP_REQUIRES(context, (spectrogram_output.size() == output_height),
-                  errors::InvalidArgument(
-                      "Spectrogram size calculation failed: Expected height ",
-                      output_height, " but got ", spectrogram_output.size()));
-      OP_REQUIRES(context,
-                  spectrogram_output.empty() ||
-                      (spectrogram_output[0].size() == output_width),
-                  errors::InvalidArgument(
-                      "Spectrogram size calculation failed: Expected width ",
-                      output_width, " but got ", spectrogram_output[0].size()));
-      for (int row_index = 0; row_index < output_height; ++row_index) {
-        const std::vector<float>& spectrogram_row =
-            spectrogram_output[row_index];
-        DCHECK_EQ(spectrogram_row.size(), output_width);
-        float* output_row = output_slice + (row_index * output_width);
-        if (magnitude_squared_) {
-          for (int i = 0; i < output_width; ++i) {
-            output_row[i] = spectrogram_row[i];
-          }
-        } else {
-          for (int i = 0; i < output_width; ++i) {
-            output_row[i] = sqrtf(spectrogram_row[i]);
-          }
-        }
-      }
-    }
+        frames.empty() || static_cast<int64>(frames[0].size()) == output_size,
+        errors::InvalidArgument(
+            "Spectrogram size calculation failed: Expected ", output_size,
+            " values but got ", frames[0].size()));
+    OP_REQUIRES_OK(context,
+                   OutputChannelSpectrograms(context, output_height,
+                                             output_width, frames));
   }
 
  private:
@@ -118,4 +185,207 @@ class AudioSpectrogramOp : public OpKernel {
 REGISTER_KERNEL_BUILDER(Name("AudioSpectrogram").Device(DEVICE_CPU),
                         AudioSpectrogramOp);
 
+// Spectrograms of the channels of one stream of AudioSpectrogramStream,
+// with the samples they buffer. Streams are kept in the ResourceMgr between
+// calls.
+class AudioSpectrogramStream : public ResourceBase {
+ public:
+  AudioSpectrogramStream() {}
+
+  Status Initialize(int64 channel_count, int32 window_size, int32 stride) {
+    return InitializeSpectrograms(channel_count, window_size, stride,
+                                  &spectrograms_);
+  }
+
+  mutex* mu() { return &mu_; }
+
+  // Guarded by mu().
+  std::vector<std::unique_ptr<Spectrogram>>* spectrograms() {
+    return &spectrograms_;
+  }
+  int64 samples() const { return samples_; }
+  void AddSamples(int64 n) { samples_ += n; }
+  bool finalized() const { return finalized_; }
+  void set_finalized() { finalized_ = true; }
+  uint64 last_use_micros() const { return last_use_micros_; }
+  void set_last_use_micros(uint64 micros) { last_use_micros_ = micros; }
+
+  string DebugString() override {
+    mutex_lock l(mu_);
+    return strings::StrCat("AudioSpectrogramStream(", spectrograms_.size(),
+                           " channels, ", samples_, " samples)");
+  }
+
+ private:
+  mutex mu_;
+  std::vector<std::unique_ptr<Spectrogram>> spectrograms_;
+  int64 samples_ = 0;
+  bool finalized_ = false;
+  uint64 last_use_micros_ = 0;
+
+  TF_DISALLOW_COPY_AND_ASSIGN(AudioSpectrogramStream);
+};
+
+// Streaming AudioSpectrogram. Each call continues the stream named by its
+// stream id; the stream is discarded when finalize is set, when a chunk
+// fails, or when it has been idle for stream_idle_timeout_secs.
+class AudioSpectrogramStreamOp : public OpKernel {
+ public:
+  explicit AudioSpectrogramStreamOp(OpKernelConstruction* context)
+      : OpKernel(context) {
+    OP_REQUIRES_OK(context, context->GetAttr("window_size", &window_size_));
+    OP_REQUIRES_OK(context, context->GetAttr("stride", &stride_));
+    OP_REQUIRES_OK(context,
+                   context->GetAttr("magnitude_squared", &magnitude_squared_));
+    int stream_idle_timeout_secs;
+    OP_REQUIRES_OK(context, context->GetAttr("stream_idle_timeout_secs",
+                                             &stream_idle_timeout_secs));
+    idle_timeout_micros_ = stream_idle_timeout_secs * 1000000ULL;
+  }
+
+  void Compute(OpKernelContext* context) override {
+    const Tensor& input = context->input(0);
+    OP_REQUIRES(context, input.dims() == 2,
+                errors::InvalidArgument("input must be 2-dimensional",
+                                        input.shape().DebugString()));
+    const Tensor& stream_id = context->input(1);
+    OP_REQUIRES(context, TensorShapeUtils::IsScalar(stream_id.shape()),
+                errors::InvalidArgument("stream_id must be a scalar, got ",
+                                        stream_id.shape().DebugString()));
+    const Tensor& finalize = context->input(2);
+    OP_REQUIRES(context, TensorShapeUtils::IsScalar(finalize.shape()),
+                errors::InvalidArgument("finalize must be a scalar, got ",
+                                        finalize.shape().DebugString()));
+    const int64 sample_count = input.dim_size(0);
+    const int64 channel_count = input.dim_size(1);
+    OP_REQUIRES(context, channel_count > 0,
+                errors::InvalidArgument("input must have channels"));
+
+    ResourceMgr* rm = context->resource_manager();
+    const uint64 now_micros = context->env()->NowMicros();
+    ExpireIdleStreams(rm, now_micros);
+
+    const string& id = stream_id.scalar<string>()();
+    const string stream_name = StreamName(id);
+    AudioSpectrogramStream* stream;
+    OP_REQUIRES_OK(context,
+                   rm->LookupOrCreate<AudioSpectrogramStream>(
+                       rm->default_container(), stream_name, &stream,
+                       [this, channel_count](AudioSpectrogramStream** s) {
+                         *s = new AudioSpectrogramStream;
+                         Status status = (*s)->Initialize(
+                             channel_count, window_size_, stride_);
+                         if (!status.ok()) {
+                           (*s)->Unref();
+                           *s = nullptr;
+                         }
+                         return status;
+                       }));
+    core::ScopedUnref unref_stream(stream);
+
+    mutex_lock l(*stream->mu());
+    OP_REQUIRES(context, !stream->finalized(),
+                errors::FailedPrecondition("Stream ", id,
+                                           " was finalized concurrently"));
+    std::vector<std::unique_ptr<Spectrogram>>* spectrograms =
+        stream->spectrograms();
+    OP_REQUIRES(context,
+                static_cast<int64>(spectrograms->size()) == channel_count,
+                errors::InvalidArgument(
+                    "Stream ", id, " was started with ", spectrograms->size(),
+                    " channels, got ", channel_count));
+    stream->set_last_use_micros(now_micros);
+    TrackStream(stream_name, stream);
+    std::vector<std::vector<float>> frames;
+    Status status = ComputeChannelSpectrograms(context, input,
+                                               magnitude_squared_,
+                                               spectrograms, &frames);
+    if (!status.ok()) {
+      // The channels may have consumed different parts of the chunk, so the
+      // stream cannot be continued.
+      DiscardStream(rm, stream_name, stream).IgnoreError();
+      context->SetStatus(status);
+      return;
+    }
+    stream->AddSamples(sample_count);
+
+    if (finalize.scalar<bool>()()) {
+      // The stream lives on until unref_stream releases our reference.
+      OP_REQUIRES_OK(context, DiscardStream(rm, stream_name, stream));
+    }
+    const int64 output_width = 1 + NextPowerOfTwo(window_size_) / 2;
+    OP_REQUIRES_OK(context, OutputChannelSpectrograms(
+                                context, frames[0].size() / output_width,
+                                output_width, frames));
+  }
+
+ private:
+  // Streams are private to the node that computes them.
+  string StreamName(const string& stream_id) const {
+    return strings::StrCat("audio_spectrogram_stream:", name(), ":",
+                           stream_id);
+  }
+
+  // Records a live stream for ExpireIdleStreams. Requires stream->mu().
+  void TrackStream(const string& stream_name,
+                   AudioSpectrogramStream* stream) {
+    mutex_lock l(streams_mu_);
+    streams_[stream_name] = stream;
+  }
+
+  // Finalizes the stream and removes it from the ResourceMgr; the last
+  // reference frees it. Requires stream->mu().
+  Status DiscardStream(ResourceMgr* rm, const string& stream_name,
+                       AudioSpectrogramStream* stream) {
+    stream->set_finalized();
+    {
+      mutex_lock l(streams_mu_);
+      auto it = streams_.find(stream_name);
+      if (it != streams_.end() && it->second == stream) streams_.erase(it);
+    }
+    return rm->Delete<AudioSpectrogramStream>(rm->default_container(),
+                                              stream_name);
+  }
+
+  // Discards the streams of this node that have not been fed for the idle
+  // timeout. Scans at most twice per timeout.
+  void ExpireIdleStreams(ResourceMgr* rm, uint64 now_micros) {
+    if (idle_timeout_micros_ == 0) return;
+    std::vector<std::pair<string, AudioSpectrogramStream*>> streams;
+    {
+      mutex_lock l(streams_mu_);
+      if (now_micros < next_expiry_scan_micros_) return;
+      next_expiry_scan_micros_ = now_micros + idle_timeout_micros_ / 2;
+      streams.assign(streams_.begin(), streams_.end());
+    }
+    for (const auto& entry : streams) {
+      AudioSpectrogramStream* stream;
+      if (!rm->Lookup(rm->default_container(), entry.first, &stream).ok()) {
+        continue;
+      }
+      core::ScopedUnref unref_stream(stream);
+      mutex_lock l(*stream->mu());
+      if (stream != entry.second || stream->finalized() ||
+          stream->last_use_micros() + idle_timeout_micros_ > now_micros) {
+        continue;
+      }
+      VLOG(1) << "Discarding idle stream " << entry.first;
+      DiscardStream(rm, entry.first, stream).IgnoreError();
+    }
+  }
+
+  int32 window_size_;
+  int32 stride_;
+  bool magnitude_squared_;
+  uint64 idle_timeout_micros_;
+  mutex streams_mu_;
+  // Live streams by name. The pointers identify the streams, they hold no
+  // reference.
+  std::unordered_map<string, AudioSpectrogramStream*> streams_
+      GUARDED_BY(streams_mu_);
+  uint64 next_expiry_scan_micros_ GUARDED_BY(streams_mu_) = 0;
+};
+REGISTER_KERNEL_BUILDER(Name("AudioSpectrogramStream").Device(DEVICE_CPU),
+                        AudioSpectrogramStreamOp);
+
 }  // namespace tensorflow
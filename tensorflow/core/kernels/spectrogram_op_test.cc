@@ -20,6 +20,7 @@ limitations under the License.
 #include <vector>
 
 #include "tensorflow/cc/client/client_session.h"
+#include "tensorflow/cc/ops/array_ops.h"
 #include "tensorflow/cc/ops/audio_ops.h"
 #include "tensorflow/cc/ops/const_op.h"
 #include "tensorflow/cc/ops/math_ops.h"
@@ -101,4 +102,52 @@ TEST(SpectrogramOpTest, SquaredTest) {
       test::AsTensor<float>({0, 1, 4, 1, 0}, TensorShape({1, 1, 5})), 1e-3);
 }
 
+TEST(SpectrogramOpTest, StreamTest) {
+  Scope root = Scope::NewRootScope();
+
+  // Two channels, the second one reversed.
+  const std::vector<float> samples = {-1.0f, 0.0f, 1.0f, 0.0f, -1.0f, 0.0f,
+                                      1.0f,  0.0f, 0.5f, 0.0f, -0.5f, 0.0f};
+  Tensor audio_tensor(DT_FLOAT, TensorShape({12, 2}));
+  auto audio = audio_tensor.matrix<float>();
+  for (int i = 0; i < samples.size(); ++i) {
+    audio(i, 0) = samples[i];
+    audio(i, 1) = samples[samples.size() - 1 - i];
+  }
+  Output audio_const_op = Const(root.WithOpName("audio_const_op"),
+                                Input::Initializer(audio_tensor));
+  AudioSpectrogram spectrogram_op =
+      AudioSpectrogram(root.WithOpName("spectrogram_op"), audio_const_op, 8, 4);
+
+  auto chunk = Placeholder(root.WithOpName("chunk"), DT_FLOAT);
+  auto finalize = Placeholder(root.WithOpName("finalize"), DT_BOOL);
+  AudioSpectrogramStream stream_op = AudioSpectrogramStream(
+      root.WithOpName("stream_op"), chunk, string("stream"), finalize, 8, 4);
+
+  TF_ASSERT_OK(root.status());
+
+  ClientSession session(root);
+  std::vector<Tensor> outputs;
+  TF_EXPECT_OK(session.Run(ClientSession::FeedType(),
+                           {spectrogram_op.spectrogram}, &outputs));
+  const Tensor expected = outputs[0];
+  EXPECT_EQ(2, expected.dim_size(1));
+
+  // The first half does not complete a window.
+  TF_EXPECT_OK(session.Run({{chunk, audio_tensor.Slice(0, 6)},
+                            {finalize, false}},
+                           {stream_op.spectrogram}, &outputs));
+  EXPECT_EQ(TensorShape({2, 0, 5}), outputs[0].shape());
+  TF_EXPECT_OK(session.Run({{chunk, audio_tensor.Slice(6, 12)},
+                            {finalize, true}},
+                           {stream_op.spectrogram}, &outputs));
+  test::ExpectTensorNear<float>(expected, outputs[0], 1e-3);
+
+  // After finalize, the same id starts a new stream.
+  TF_EXPECT_OK(session.Run({{chunk, audio_tensor.Slice(0, 8)},
+                            {finalize, true}},
+                           {stream_op.spectrogram}, &outputs));
+  EXPECT_EQ(TensorShape({2, 1, 5}), outputs[0].shape());
+}
+
 }  // namespace tensorflow
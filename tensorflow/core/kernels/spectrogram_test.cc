@@ -17,7 +17,9 @@ limitations under the License.
 
 #include "tensorflow/core/kernels/spectrogram.h"
 
+#include <algorithm>
 #include <complex>
+#include <utility>
 #include <vector>
 
 #include "tensorflow/core/kernels/spectrogram_test_utils.h"
@@ -316,6 +318,85 @@ TEST(SpectrogramTest, ComputedFloatSquaredMagnitudeDataAgreeWithMatlab) {
   CompareMagnitudeData(expected_output, output, 2e-4);
 }
 
+TEST(SpectrogramTest, ComputedSinglePrecisionDataAgreeWithMatlab) {
+  const int kInputDataLength = 45870;
+  Spectrogram sgram;
+  sgram.Initialize(512, 256);
+  std::vector<double> double_input;
+  CHECK(ReadWaveFileToVector(
+      tensorflow::io::JoinPath(testing::TensorFlowSrcRoot(), kInputFilename),
+      &double_input));
+  EXPECT_EQ(kInputDataLength, double_input.size());
+  std::vector<float> input;
+  input.assign(double_input.begin(), double_input.end());
+  std::vector<std::vector<complex<double>>> expected_output;
+  ASSERT_TRUE(ReadRawFloatFileToComplexVector(
+      tensorflow::io::JoinPath(testing::TensorFlowSrcRoot(), kExpectedFilename),
+      kDataVectorLength, &expected_output));
+  EXPECT_EQ(kNumberOfFramesInTestData, expected_output.size());
+  std::vector<float> frames;
+  ASSERT_TRUE(sgram.ComputeSquaredMagnitudeSpectrogram(
+      input.data(), input.size(), 1, &frames));
+  ASSERT_EQ(kNumberOfFramesInTestData * kDataVectorLength, frames.size());
+  std::vector<std::vector<float>> output;
+  for (int i = 0; i < kNumberOfFramesInTestData; ++i) {
+    output.emplace_back(frames.begin() + i * kDataVectorLength,
+                        frames.begin() + (i + 1) * kDataVectorLength);
+  }
+  // The FFT itself is in single precision: with a max square of about 3200,
+  // 2e-3 is still within 1e-6 of it.
+  CompareMagnitudeData(expected_output, output, 2e-3);
+}
+
+TEST(SpectrogramTest, SinglePrecisionChunksAgreeWithDoublePrecision) {
+  // Two interleaved channels, fed to the single precision path in chunks
+  // that do not line up with the frames.
+  std::vector<double> left;
+  std::vector<double> right;
+  SineWave(44100, 1000.0, 0.1, &left);
+  SineWave(44100, 3000.0, 0.1, &right);
+  ASSERT_EQ(left.size(), right.size());
+  std::vector<float> interleaved;
+  for (int i = 0; i < left.size(); ++i) {
+    interleaved.push_back(left[i]);
+    interleaved.push_back(right[i]);
+  }
+  const int64 sample_count = left.size();
+  for (const std::pair<int, int>& window_and_step :
+       {std::make_pair(400, 160), std::make_pair(200, 400),
+        std::make_pair(256, 256), std::make_pair(3, 1)}) {
+    const int window_length = window_and_step.first;
+    const int step_length = window_and_step.second;
+    Spectrogram expected_sgram;
+    ASSERT_TRUE(expected_sgram.Initialize(window_length, step_length));
+    std::vector<std::vector<double>> expected_output;
+    expected_sgram.ComputeSquaredMagnitudeSpectrogram(right, &expected_output);
+    const double tolerance = 1e-6 * GetMaximumAbsolute(expected_output);
+
+    Spectrogram sgram;
+    ASSERT_TRUE(sgram.Initialize(window_length, step_length));
+    const int width = sgram.output_frequency_channels();
+    std::vector<std::vector<float>> output;
+    std::vector<float> frames;
+    for (int64 start = 0; start < sample_count; start += 77) {
+      const int64 length = std::min<int64>(77, sample_count - start);
+      ASSERT_TRUE(sgram.ComputeSquaredMagnitudeSpectrogram(
+          interleaved.data() + 2 * start + 1, length, 2, &frames));
+      ASSERT_EQ(0, frames.size() % width);
+      for (int i = 0; i < frames.size(); i += width) {
+        output.emplace_back(frames.begin() + i, frames.begin() + i + width);
+      }
+    }
+    ASSERT_EQ(expected_output.size(), output.size());
+    for (int i = 0; i < output.size(); ++i) {
+      for (int j = 0; j < width; ++j) {
+        ASSERT_NEAR(expected_output[i][j], output[i][j], tolerance)
+            << ": where i=" << i << " and j=" << j << ".";
+      }
+    }
+  }
+}
+
 TEST(SpectrogramTest, ComputedNonPowerOfTwoComplexDataAgreeWithMatlab) {
   const int kInputDataLength = 45870;
   Spectrogram sgram;
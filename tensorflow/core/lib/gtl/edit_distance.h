@@ -16,10 +16,12 @@ limitations under the License.
 #ifndef TENSORFLOW_LIB_GTL_EDIT_DISTANCE_H_
 #define TENSORFLOW_LIB_GTL_EDIT_DISTANCE_H_
 
+#include <algorithm>
 #include <numeric>
 
 #include "tensorflow/core/lib/gtl/array_slice.h"
 #include "tensorflow/core/lib/gtl/inlined_vector.h"
+#include "tensorflow/core/platform/types.h"
 
 namespace tensorflow {
 namespace gtl {
@@ -102,6 +104,133 @@ inline int64 LevenshteinDistance(const Container1& s, const Container2& t,
       cmp);
 }
 
+namespace internal {
+
+// Advances one 64-row block of the bit-vector column of
+// BitParallelLevenshteinDistance by a text element, see Myers, "A fast
+// bit-vector algorithm for approximate string matching based on dynamic
+// programming", J. ACM 46(3), 1999. pv and mv hold the positive and negative
+// vertical deltas of the block, eq the rows matching the text element and
+// h_in the horizontal delta entering the block's top row. last_bit is the
+// block's last row. Returns the horizontal delta leaving the last row.
+inline int AdvanceLevenshteinBlock(uint64 eq, int h_in, uint64 last_bit,
+                                   uint64* pv, uint64* mv) {
+  const uint64 xv = eq | *mv;
+  if (h_in < 0) eq |= 1;
+  const uint64 xh = (((eq & *pv) + *pv) ^ *pv) | eq;
+  uint64 ph = *mv | ~(xh | *pv);
+  uint64 mh = *pv & xh;
+  int h_out = 0;
+  if (ph & last_bit) h_out = 1;
+  if (mh & last_bit) h_out = -1;
+  ph <<= 1;
+  mh <<= 1;
+  if (h_in < 0) {
+    mh |= 1;
+  } else if (h_in > 0) {
+    ph |= 1;
+  }
+  *pv = mh | ~(xv | ph);
+  *mv = ph & xv;
+  return h_out;
+}
+
+}  // namespace internal
+
+// Calculates the same distance as LevenshteinDistance with
+// std::equal_to<T>, using the bit-vector algorithm of Myers (1999) in the
+// block-based formulation of Hyyro (2003): the DP column of the shorter
+// sequence is kept as bit vectors of 64 rows and advanced with a handful of
+// word operations per block and element of the longer sequence.
+//
+// With m := min(|s|, |t|) and n := max(|s|, |t|), this implementation has
+// time complexity O((ceil(m / 64) + log(m)) * n + m * log(m)), the log
+// terms indexing the shorter sequence, and space complexity O(m). Sequences
+// of up to 64 elements take a single block.
+//
+// T must be totally ordered by operator<, consistently with operator==,
+// e.g. an integer type or string.
+template <typename T>
+inline int64 BitParallelLevenshteinDistance(const gtl::ArraySlice<T>& s,
+                                            const gtl::ArraySlice<T>& t) {
+  const int64 s_size = s.size();
+  const int64 t_size = t.size();
+
+  // The shorter sequence, t, is the pattern whose elements are the rows.
+  if (t_size > s_size) return BitParallelLevenshteinDistance(t, s);
+
+  if (t_size == 0) return s_size;
+  if (s == t) return 0;
+
+  const T* s_data = s.data();
+  const T* t_data = t.data();
+  const int64 num_blocks = (t_size + 63) / 64;
+
+  // The distinct elements of t, as the position of their first occurrence,
+  // in increasing order. The rows matching distinct element k are the bits
+  // of peq[k * num_blocks, (k + 1) * num_blocks); the last num_blocks words
+  // of peq, all zero, are the rows matching elements absent from t.
+  gtl::InlinedVector<int64, 64> order(t_size);
+  std::iota(order.begin(), order.end(), 0);
+  std::stable_sort(order.begin(), order.end(), [t_data](int64 a, int64 b) {
+    return t_data[a] < t_data[b];
+  });
+  gtl::InlinedVector<int64, 64> symbols;
+  gtl::InlinedVector<uint64, 64> peq;
+  for (const int64 row : order) {
+    if (symbols.empty() || t_data[symbols.back()] < t_data[row]) {
+      symbols.push_back(row);
+      peq.resize(peq.size() + num_blocks, 0);
+    }
+    peq[(symbols.size() - 1) * num_blocks + row / 64] |= uint64{1}
+                                                          << (row % 64);
+  }
+  peq.resize(peq.size() + num_blocks, 0);
+  const int64* symbols_begin = symbols.data();
+  const int64* symbols_end = symbols_begin + symbols.size();
+  const uint64* no_match = peq.data() + symbols.size() * num_blocks;
+
+  // Every block starts with +1 vertical deltas: column 0 is 0, 1, ..., |t|.
+  gtl::InlinedVector<uint64, 4> pv_holder(num_blocks, ~uint64{0});
+  gtl::InlinedVector<uint64, 4> mv_holder(num_blocks, 0);
+  uint64* pv = pv_holder.data();
+  uint64* mv = mv_holder.data();
+  const uint64 kLastRow = uint64{1} << 63;
+  const uint64 last_block_last_row = uint64{1} << ((t_size - 1) % 64);
+  const int64 last_block = num_blocks - 1;
+  int64 distance = t_size;  // = cost(|t|, 0)
+  for (int64 j = 0; j < s_size; ++j) {
+    const T& element = s_data[j];
+    const int64* symbol = std::lower_bound(
+        symbols_begin, symbols_end, element,
+        [t_data](int64 row, const T& value) { return t_data[row] < value; });
+    const uint64* eq = no_match;
+    if (symbol != symbols_end && !(element < t_data[*symbol])) {
+      eq = peq.data() + (symbol - symbols_begin) * num_blocks;
+    }
+    // Row 0 is the distance from the empty prefix of t: the horizontal
+    // delta entering the first block is always +1.
+    int h = 1;
+    for (int64 b = 0; b < last_block; ++b) {
+      h = internal::AdvanceLevenshteinBlock(eq[b], h, kLastRow, &pv[b],
+                                            &mv[b]);
+    }
+    h = internal::AdvanceLevenshteinBlock(eq[last_block], h,
+                                          last_block_last_row,
+                                          &pv[last_block], &mv[last_block]);
+    distance += h;  // = cost(|t|, j + 1)
+  }
+  return distance;
+}
+
+template <typename Container1, typename Container2>
+inline int64 BitParallelLevenshteinDistance(const Container1& s,
+                                            const Container2& t) {
+  return BitParallelLevenshteinDistance(
+      gtl::ArraySlice<typename Container1::value_type>(s.data(), s.size()),
+      gtl::ArraySlice<typename Container1::value_type>(t.data(), t.size()));
+}
+
 }  // namespace gtl
 }  // namespace tensorflow
 
@@ -16,6 +16,7 @@ limitations under the License.
 #include "tensorflow/core/lib/gtl/edit_distance.h"
 
 #include <cctype>
+#include <random>
 #include <vector>
 #include "tensorflow/core/platform/logging.h"
 #include "tensorflow/core/platform/test.h"
@@ -109,7 +110,47 @@ TEST_F(LevenshteinDistanceTest, Vectors) {
       6);
 }
 
-static void BM_EditDistanceHelper(int n, int len, bool completely_different) {
+TEST_F(LevenshteinDistanceTest, BitParallel) {
+  ASSERT_EQ(BitParallelLevenshteinDistance(empty_, empty_), 0);
+  ASSERT_EQ(BitParallelLevenshteinDistance(ebab_, abcd_), 3);
+  ASSERT_EQ(BitParallelLevenshteinDistance(abcd_, ebab_), 3);
+  ASSERT_EQ(BitParallelLevenshteinDistance(s1234_, std::string()), 4);
+  ASSERT_EQ(BitParallelLevenshteinDistance(std::string(), s567_), 3);
+  ASSERT_EQ(BitParallelLevenshteinDistance(s1234_, s1_), 3);
+  ASSERT_EQ(BitParallelLevenshteinDistance(kilo_, kilogram_), 4);
+  ASSERT_EQ(BitParallelLevenshteinDistance(grandmother_, mother_), 5);
+  ASSERT_EQ(BitParallelLevenshteinDistance(lower_, upper_), 5);
+  ASSERT_EQ(BitParallelLevenshteinDistance(std::string("algorithm"),
+                                           std::string("altruistic")),
+            6);
+  const std::vector<string> words1 = {"the", "cat", "sat"};
+  const std::vector<string> words2 = {"a", "cat", "sat", "down"};
+  ASSERT_EQ(BitParallelLevenshteinDistance(words1, words2), 2);
+}
+
+TEST_F(LevenshteinDistanceTest, BitParallelMatchesAcrossBlocks) {
+  // Lengths around the 64-element blocks, over small alphabets so that the
+  // sequences share many elements.
+  std::mt19937 rng(301);
+  const int lengths[] = {0, 1, 2, 31, 63, 64, 65, 100, 127, 128, 129, 200};
+  for (const int s_size : lengths) {
+    for (const int t_size : lengths) {
+      for (const int alphabet_size : {2, 4, 30}) {
+        std::vector<int64> s(s_size);
+        std::vector<int64> t(t_size);
+        for (int64& x : s) x = rng() % alphabet_size;
+        for (int64& x : t) x = rng() % alphabet_size;
+        ASSERT_EQ(LevenshteinDistance(s, t, std::equal_to<int64>()),
+                  BitParallelLevenshteinDistance(s, t))
+            << s_size << " x " << t_size << ", " << alphabet_size
+            << " symbols";
+      }
+    }
+  }
+}
+
+static void BM_EditDistanceHelper(int n, int len, bool completely_different,
+                                  bool bit_parallel) {
   string a =
       "The quick brown fox jumped over the lazy dog and on and on and on"
       " Every good boy deserves fudge.  In fact, this is a very long sentence  "
@@ -124,17 +165,28 @@ static void BM_EditDistanceHelper(int n, int len, bool completely_different) {
     }
   }
   while (n-- > 0) {
-    LevenshteinDistance(gtl::ArraySlice<char>(a.data(), len),
-                        gtl::ArraySlice<char>(b.data(), len),
-                        std::equal_to<char>());
+    if (bit_parallel) {
+      BitParallelLevenshteinDistance(gtl::ArraySlice<char>(a.data(), len),
+                                     gtl::ArraySlice<char>(b.data(), len));
+    } else {
+      LevenshteinDistance(gtl::ArraySlice<char>(a.data(), len),
+                          gtl::ArraySlice<char>(b.data(), len),
+                          std::equal_to<char>());
+    }
   }
 }
 
 static void BM_EditDistanceSame(int n, int len) {
-  BM_EditDistanceHelper(n, len, false);
+  BM_EditDistanceHelper(n, len, false, false);
 }
 static void BM_EditDistanceDiff(int n, int len) {
-  BM_EditDistanceHelper(n, len, true);
+  BM_EditDistanceHelper(n, len, true, false);
+}
+static void BM_BitParallelEditDistanceSame(int n, int len) {
+  BM_EditDistanceHelper(n, len, false, true);
+}
+static void BM_BitParallelEditDistanceDiff(int n, int len) {
+  BM_EditDistanceHelper(n, len, true, true);
 }
 
 BENCHMARK(BM_EditDistanceSame)->Arg(5);
@@ -145,6 +197,14 @@ BENCHMARK(BM_EditDistanceDiff)->Arg(5);
 BENCHMARK(BM_EditDistanceDiff)->Arg(50);
 BENCHMARK(BM_EditDistanceDiff)->Arg(200);
 BENCHMARK(BM_EditDistanceDiff)->Arg(1000);
+BENCHMARK(BM_BitParallelEditDistanceSame)->Arg(5);
+BENCHMARK(BM_BitParallelEditDistanceSame)->Arg(50);
+BENCHMARK(BM_BitParallelEditDistanceSame)->Arg(200);
+BENCHMARK(BM_BitParallelEditDistanceSame)->Arg(1000);
+BENCHMARK(BM_BitParallelEditDistanceDiff)->Arg(5);
+BENCHMARK(BM_BitParallelEditDistanceDiff)->Arg(50);
+BENCHMARK(BM_BitParallelEditDistanceDiff)->Arg(200);
+BENCHMARK(BM_BitParallelEditDistanceDiff)->Arg(1000);
 
 }  // namespace
 }  // namespace gtl
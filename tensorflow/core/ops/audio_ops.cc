@@ -100,6 +100,23 @@ Status SpectrogramShapeFn(InferenceContext* c) {
   return Status::OK();
 }
 
+Status SpectrogramStreamShapeFn(InferenceContext* c) {
+  ShapeHandle input;
+  TF_RETURN_IF_ERROR(c->WithRank(c->input(0), 2, &input));
+  ShapeHandle unused;
+  TF_RETURN_IF_ERROR(c->WithRank(c->input(1), 0, &unused));
+  TF_RETURN_IF_ERROR(c->WithRank(c->input(2), 0, &unused));
+  int32 window_size;
+  TF_RETURN_IF_ERROR(c->GetAttr("window_size", &window_size));
+
+  // The number of frames depends on the samples buffered by the stream.
+  DimensionHandle output_channels =
+      c->MakeDim(1 + NextPowerOfTwo(window_size) / 2);
+  c->set_output(0, c->MakeShape({c->Dim(input, 1), c->UnknownDim(),
+                                 output_channels}));
+  return Status::OK();
+}
+
 Status MfccShapeFn(InferenceContext* c) {
   ShapeHandle spectrogram;
   TF_RETURN_IF_ERROR(c->WithRank(c->input(0), 3, &spectrogram));
@@ -220,6 +237,51 @@ magnitude_squared: Whether to return the squared magnitude or just the
 spectrogram: 3D representation of the audio frequencies as an image.
 )doc");
 
+REGISTER_OP("AudioSpectrogramStream")
+    .Input("input: float")
+    .Input("stream_id: string")
+    .Input("finalize: bool")
+    .Attr("window_size: int")
+    .Attr("stride: int")
+    .Attr("magnitude_squared: bool = false")
+    .Attr("stream_idle_timeout_secs: int >= 0 = 600")
+    .Output("spectrogram: float")
+    .SetIsStateful()
+    .SetShapeFn(SpectrogramStreamShapeFn)
+    .Doc(R"doc(
+Produces the spectrogram of successive chunks of audio data.
+
+This op computes the same slices as AudioSpectrogram, for audio that arrives in
+chunks, e.g. from a microphone. Each call continues the stream named by
+`stream_id`: the samples of a chunk that do not complete a window are kept by
+the op until the next chunk of the stream, so the slices returned by the
+successive calls are those AudioSpectrogram returns for the whole audio. When
+`finalize` is set, the samples left over after the chunk are dropped and the
+stream is discarded; the next chunk with the same id starts a new stream.
+
+Streams are private to the op node that computes them. A stream that is never
+finalized is discarded once it has not been fed for `stream_idle_timeout_secs`,
+and at the latest when the session is closed. A stream is also discarded when a
+chunk fails. In both cases, a later chunk with its id starts a new stream. The
+number of channels is fixed when a stream starts. The channels are computed in
+parallel.
+
+input: Float representation of the next chunk of audio data, 2-D with shape
+  `[length, channels]`.
+stream_id: Scalar. The id of the stream the chunk continues.
+finalize: Scalar. True for the last chunk of a stream.
+window_size: How wide the input window is in samples. For the highest efficiency
+  this should be a power of two, but other values are accepted.
+stride: How widely apart the center of adjacent sample windows should be.
+magnitude_squared: Whether to return the squared magnitude or just the
+  magnitude. Using squared magnitude can avoid extra calculations.
+stream_idle_timeout_secs: Seconds after its last chunk at which a stream that
+  was not finalized is discarded. 0 keeps such streams until the session is
+  closed.
+spectrogram: 3-D with shape `[channels, slices, window_size / 2 + 1]` (the
+  window size rounded up to a power of two), the slices completed by the chunk.
+)doc");
+
 REGISTER_OP("Mfcc")
     .Input("spectrogram: float")
     .Input("sample_rate: int32")
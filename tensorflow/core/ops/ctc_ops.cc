@@ -32,6 +32,8 @@ REGISTER_OP("CTCLoss")
     .Attr("preprocess_collapse_repeated: bool = false")
     .Attr("ctc_merge_repeated: bool = true")
     .Attr("ignore_longer_outputs_than_inputs: bool = false")
+    .Attr("algorithm: {'log_space', 'scaled'} = 'log_space'")
+    .Attr("low_memory: bool = false")
     .Output("loss: float")
     .Output("gradient: float")
     .SetShapeFn([](InferenceContext* c) {
@@ -79,6 +81,14 @@ ctc_merge_repeated: Scalar.  If set to false, *during* CTC calculation
 ignore_longer_outputs_than_inputs: Scalar. If set to true, during CTC
   calculation items have longer input sequences than output sequences
   are ignored by returning zero-gradient for those items.
+algorithm: How the forward and backward variables are computed. "log_space"
+  works on log-probabilities. "scaled" works on probabilities rescaled at
+  every time step, which avoids most exp and log evaluations; items whose
+  rescaled probabilities underflow nonetheless are computed in log space.
+low_memory: If true, each batch item takes memory proportional to the label
+  sequence length times the square root of its sequence length, instead of
+  to the number of classes plus the label sequence length times the sequence
+  length, for about one more forward pass.
 loss: A vector (batch) containing log-probabilities.
 gradient: The gradient of `loss`.  3-D, shape:
   `(max_time x batch_size x num_classes)`.
@@ -137,8 +147,59 @@ log_probability: Matrix, size `(batch_size x 1)`, containing sequence
   log-probabilities.
 )doc");
 
+static Status CTCBeamSearchDecoderShapeFn(InferenceContext* c) {
+  ShapeHandle inputs;
+  ShapeHandle sequence_length;
+
+  TF_RETURN_IF_ERROR(c->WithRank(c->input(0), 3, &inputs));
+  TF_RETURN_IF_ERROR(c->WithRank(c->input(1), 1, &sequence_length));
+
+  // Get batch size from inputs and sequence_length.
+  DimensionHandle batch_size;
+  TF_RETURN_IF_ERROR(
+      c->Merge(c->Dim(inputs, 1), c->Dim(sequence_length, 0), &batch_size));
+
+  int32 top_paths;
+  TF_RETURN_IF_ERROR(c->GetAttr("top_paths", &top_paths));
+
+  // Outputs.
+  int out_idx = 0;
+  for (int i = 0; i < top_paths; ++i) {  // decoded_indices
+    c->set_output(out_idx++, c->Matrix(InferenceContext::kUnknownDim, 2));
+  }
+  for (int i = 0; i < top_paths; ++i) {  // decoded_values
+    c->set_output(out_idx++, c->Vector(InferenceContext::kUnknownDim));
+  }
+  ShapeHandle shape_v = c->Vector(2);
+  for (int i = 0; i < top_paths; ++i) {  // decoded_shape
+    c->set_output(out_idx++, shape_v);
+  }
+  c->set_output(out_idx++, c->Matrix(batch_size, top_paths));
+  if (out_idx < c->num_outputs()) {  // decode_stats
+    bool output_decode_stats;
+    TF_RETURN_IF_ERROR(
+        c->GetAttr("output_decode_stats", &output_decode_stats));
+    // One row of 10 counters per batch item, see CTCBeamSearchDecoderV2.
+    c->set_output(out_idx++,
+                  c->Matrix(output_decode_stats ? batch_size : c->MakeDim(0),
+                            10));
+  }
+  return Status::OK();
+}
+
+// Shape function of the decoders taking hotwords and hotword_boosts as inputs
+// 5 and 6.
+static Status CTCBeamSearchDecoderWithHotwordsShapeFn(InferenceContext* c) {
+  ShapeHandle hotwords;
+  ShapeHandle hotword_boosts;
+  TF_RETURN_IF_ERROR(c->WithRank(c->input(5), 1, &hotwords));
+  TF_RETURN_IF_ERROR(c->WithRank(c->input(6), 1, &hotword_boosts));
+  TF_RETURN_IF_ERROR(c->Merge(hotwords, hotword_boosts, &hotwords));
+  return CTCBeamSearchDecoderShapeFn(c);
+}
+
 REGISTER_OP("CTCBeamSearchDecoder")
-    .Input("inputs: float")
+    .Input("inputs: T")
     .Input("sequence_length: int32")
     .Input("kenlm_weight: float")
     .Input("word_count_weight: float")
@@ -147,40 +208,17 @@ REGISTER_OP("CTCBeamSearchDecoder")
     .Attr("beam_width: int >= 1")
     .Attr("top_paths: int >= 1")
     .Attr("merge_repeated: bool = true")
+    .Attr("lm_score_cache_size: int >= 0 = 0")
+    .Attr("kenlm_load_method: {'lazy', 'populate_or_lazy', 'populate_or_read', "
+          "'read', 'parallel_read'} = 'populate_or_read'")
+    .Attr("blank_skip_threshold: float = 0.0")
+    .Attr("beam_threshold: float = 0.0")
+    .Attr("T: {float, half} = DT_FLOAT")
     .Output("decoded_indices: top_paths * int64")
     .Output("decoded_values: top_paths * int64")
     .Output("decoded_shape: top_paths * int64")
     .Output("log_probability: float")
-    .SetShapeFn([](InferenceContext* c) {
-      ShapeHandle inputs;
-      ShapeHandle sequence_length;
-
-      TF_RETURN_IF_ERROR(c->WithRank(c->input(0), 3, &inputs));
-      TF_RETURN_IF_ERROR(c->WithRank(c->input(1), 1, &sequence_length));
-
-      // Get batch size from inputs and sequence_length.
-      DimensionHandle batch_size;
-      TF_RETURN_IF_ERROR(
-          c->Merge(c->Dim(inputs, 1), c->Dim(sequence_length, 0), &batch_size));
-
-      int32 top_paths;
-      TF_RETURN_IF_ERROR(c->GetAttr("top_paths", &top_paths));
-
-      // Outputs.
-      int out_idx = 0;
-      for (int i = 0; i < top_paths; ++i) {  // decoded_indices
-        c->set_output(out_idx++, c->Matrix(InferenceContext::kUnknownDim, 2));
-      }
-      for (int i = 0; i < top_paths; ++i) {  // decoded_values
-        c->set_output(out_idx++, c->Vector(InferenceContext::kUnknownDim));
-      }
-      ShapeHandle shape_v = c->Vector(2);
-      for (int i = 0; i < top_paths; ++i) {  // decoded_shape
-        c->set_output(out_idx++, shape_v);
-      }
-      c->set_output(out_idx++, c->Matrix(batch_size, top_paths));
-      return Status::OK();
-    })
+    .SetShapeFn(CTCBeamSearchDecoderShapeFn)
     .Doc(R"doc(
 Performs beam search decoding on the logits given in input.
 
@@ -190,15 +228,37 @@ the first of these is emitted.  That is, when the top path is "A B B B B",
 "A B" is returned if merge_repeated = True but "A B B B B" is
 returned if merge_repeated = False.
 
+When the step stats are collected (e.g. for a timeline), the node's stats hold
+counters of the work done decoding the batch, see CTCBeamSearchDecoderV2.
+
 inputs: 3-D, shape: `(max_time x batch_size x num_classes)`, the logits.
+  The logits are read in place; `half` logits are converted to float one
+  frame at a time, halving the memory traffic of large vocabularies.
 sequence_length: A vector containing sequence lengths, size `(batch)`.
 kenlm_weight: A scalar that weights the significance of the language model.
 word_count_weight: A scalar that weights the significance of the transcription word count.
 valid_word_count_weight: A scalar that weights the significance of the valid transcription word count.
 kenlm_directory_path: String. Directory path to KenLM language model files `kenlm-model.binary`, `vocabulary`, `trie`.
+  `kenlm-model.binary` may be any KenLM binary model type (probing, trie,
+  quantized or array compressed trie); the type is read from its header.
 beam_width: A scalar >= 0 (beam search beam width).
 top_paths: A scalar >= 0, <= beam_width (controls output size).
 merge_repeated: If true, merge repeated classes in output.
+lm_score_cache_size: Number of language model scores to cache per decoding
+  thread, keyed by LM context and word. The caches are kept across calls.
+  0 disables the cache.
+kenlm_load_method: How the KenLM model is brought into memory. 'lazy' maps
+  the file and pages it in on demand, sharing the page cache between
+  processes; 'populate_or_read' (the default) loads it up front.
+blank_skip_threshold: If > 0, frames whose most likely label is the blank,
+  with a log-probability above `-blank_skip_threshold`, only update the
+  current beams: no new labels are considered and the language model is not
+  queried. E.g. 0.05 skips frames with a blank probability above 0.95. 0
+  (the default) decodes every frame in full.
+beam_threshold: If > 0, beams whose log-probability falls more than
+  `beam_threshold` below the best beam are dropped, so that fewer than
+  `beam_width` beams are carried on easy frames. 0 (the default) keeps
+  `beam_width` beams.
 decoded_indices: A list (length: top_paths) of indices matrices.  Matrix j,
   size `(total_decoded_outputs[j] x 2)`, has indices of a
   `SparseTensor<int64, 2>`.  The rows store: [batch, time].
@@ -212,4 +272,353 @@ log_probability: A matrix, shaped: `(batch_size x top_paths)`.  The
   sequence log-probabilities.
 )doc");
 
+REGISTER_OP("CTCBeamSearchDecoderV2")
+    .Input("inputs: T")
+    .Input("sequence_length: int32")
+    .Input("kenlm_weight: float")
+    .Input("word_count_weight: float")
+    .Input("valid_word_count_weight: float")
+    .Input("hotwords: string")
+    .Input("hotword_boosts: float")
+    .Attr("kenlm_directory_path: string")
+    .Attr("beam_width: int >= 1")
+    .Attr("top_paths: int >= 1")
+    .Attr("merge_repeated: bool = true")
+    .Attr("lm_score_cache_size: int >= 0 = 0")
+    .Attr("kenlm_load_method: {'lazy', 'populate_or_lazy', 'populate_or_read', "
+          "'read', 'parallel_read'} = 'populate_or_read'")
+    .Attr("blank_skip_threshold: float = 0.0")
+    .Attr("beam_threshold: float = 0.0")
+    .Attr("T: {float, half} = DT_FLOAT")
+    .Attr("output_decode_stats: bool = false")
+    .Attr("strict_lexicon: bool = false")
+    .Output("decoded_indices: top_paths * int64")
+    .Output("decoded_values: top_paths * int64")
+    .Output("decoded_shape: top_paths * int64")
+    .Output("log_probability: float")
+    .Output("decode_stats: int64")
+    .SetShapeFn(CTCBeamSearchDecoderWithHotwordsShapeFn)
+    .Doc(R"doc(
+Performs beam search decoding on the logits given in input.
+
+Like CTCBeamSearchDecoder, and can also boost phrases for a single call and
+output the work done decoding each batch item, so that the beam width, label
+selection and language model weights can be tuned on real traffic.
+
+inputs: See CTCBeamSearchDecoder.
+sequence_length: See CTCBeamSearchDecoder.
+kenlm_weight: See CTCBeamSearchDecoder.
+word_count_weight: See CTCBeamSearchDecoder.
+valid_word_count_weight: See CTCBeamSearchDecoder.
+hotwords: A vector of phrases to boost for this call, UTF-8 words of the
+  vocabulary separated by single spaces. A phrase starts at the beginning
+  of a word and must be followed by a space or the end of the sentence.
+  Each beam spelling a phrase earns its boost label by label, and loses it
+  again if it leaves the phrase before its end. The language model is not
+  changed. May be empty.
+hotword_boosts: A vector of log-probabilities >= 0, size `len(hotwords)`,
+  the boost of each phrase. It is not weighted by `kenlm_weight`.
+kenlm_directory_path: See CTCBeamSearchDecoder.
+beam_width: See CTCBeamSearchDecoder.
+top_paths: See CTCBeamSearchDecoder.
+merge_repeated: See CTCBeamSearchDecoder.
+lm_score_cache_size: See CTCBeamSearchDecoder.
+kenlm_load_method: See CTCBeamSearchDecoder.
+blank_skip_threshold: See CTCBeamSearchDecoder.
+beam_threshold: See CTCBeamSearchDecoder.
+output_decode_stats: If true, decode_stats holds the work done decoding each
+  batch item. Timings are measured only then, or when the step stats are
+  collected (e.g. for a timeline), whose NodeExecStats hold the counters
+  summed over the batch.
+strict_lexicon: If true, only words of the `trie` known to the language
+  model are decoded: beams are never grown with a label that leaves the
+  trie, or with a space that does not end a word, instead of merely being
+  penalized. For closed vocabularies, this cuts the children of each beam
+  from the alphabet size to the fan-out of the trie.
+decoded_indices: See CTCBeamSearchDecoder.
+decoded_values: See CTCBeamSearchDecoder.
+decoded_shape: See CTCBeamSearchDecoder.
+log_probability: See CTCBeamSearchDecoder.
+decode_stats: A matrix of counters, shaped `(batch_size x 10)` if
+  `output_decode_stats` is set and `(0 x 10)` otherwise. The columns are
+  the frames decoded, the frames skipped (see `blank_skip_threshold`), the
+  beams expanded, the children expanded by the language model scorer, the
+  children pruned by label selection or `strict_lexicon`, the language
+  model queries (cache hits excluded), the words scored as out of
+  vocabulary, the labels spelling a word out of the trie, and the
+  microseconds spent in the scorer and in the rest of the beam update.
+)doc");
+
+REGISTER_OP("CTCAsyncBeamSearchDecoder")
+    .Input("inputs: T")
+    .Input("sequence_length: int32")
+    .Input("kenlm_weight: float")
+    .Input("word_count_weight: float")
+    .Input("valid_word_count_weight: float")
+    .Input("hotwords: string")
+    .Input("hotword_boosts: float")
+    .Attr("kenlm_directory_path: string")
+    .Attr("beam_width: int >= 1")
+    .Attr("top_paths: int >= 1")
+    .Attr("merge_repeated: bool = true")
+    .Attr("lm_score_cache_size: int >= 0 = 0")
+    .Attr("kenlm_load_method: {'lazy', 'populate_or_lazy', 'populate_or_read', "
+          "'read', 'parallel_read'} = 'populate_or_read'")
+    .Attr("blank_skip_threshold: float = 0.0")
+    .Attr("beam_threshold: float = 0.0")
+    .Attr("T: {float, half} = DT_FLOAT")
+    .Attr("output_decode_stats: bool = false")
+    .Attr("strict_lexicon: bool = false")
+    .Attr("decoder_threads: int >= 1 = 4")
+    .Attr("decoder_pool: string = ''")
+    .Output("decoded_indices: top_paths * int64")
+    .Output("decoded_values: top_paths * int64")
+    .Output("decoded_shape: top_paths * int64")
+    .Output("log_probability: float")
+    .Output("decode_stats: int64")
+    .SetShapeFn(CTCBeamSearchDecoderWithHotwordsShapeFn)
+    .Doc(R"doc(
+Performs beam search decoding on the logits given in input, off the inter-op
+threads.
+
+Same as CTCBeamSearchDecoderV2, except that the batch items are decoded on a
+dedicated pool of `decoder_threads` threads rather than on the thread running
+the op and the intra-op pool. The op completes once all the batch items are
+decoded, and until then the inter-op threads are free to run other ops, e.g.
+the acoustic models of concurrent steps, which thus overlap with decoding.
+
+All the ops of a device naming the same `decoder_pool` share its threads, so
+the pool bounds the threads decoding at any time, whatever the number of
+concurrent steps. Batch items queue up when all the threads are busy.
+
+inputs: See CTCBeamSearchDecoder.
+sequence_length: See CTCBeamSearchDecoder.
+kenlm_weight: See CTCBeamSearchDecoder.
+word_count_weight: See CTCBeamSearchDecoder.
+valid_word_count_weight: See CTCBeamSearchDecoder.
+hotwords: See CTCBeamSearchDecoderV2.
+hotword_boosts: See CTCBeamSearchDecoderV2.
+kenlm_directory_path: See CTCBeamSearchDecoder.
+beam_width: See CTCBeamSearchDecoder.
+top_paths: See CTCBeamSearchDecoder.
+merge_repeated: See CTCBeamSearchDecoder.
+lm_score_cache_size: See CTCBeamSearchDecoder.
+kenlm_load_method: See CTCBeamSearchDecoder.
+blank_skip_threshold: See CTCBeamSearchDecoder.
+beam_threshold: See CTCBeamSearchDecoder.
+output_decode_stats: See CTCBeamSearchDecoderV2.
+strict_lexicon: See CTCBeamSearchDecoderV2.
+decoder_threads: The number of threads of the decoder pool. Every op naming
+  the pool must give the same number.
+decoder_pool: The name of the decoder pool, shared by the ops of the device
+  naming it.
+decoded_indices: See CTCBeamSearchDecoder.
+decoded_values: See CTCBeamSearchDecoder.
+decoded_shape: See CTCBeamSearchDecoder.
+log_probability: See CTCBeamSearchDecoder.
+decode_stats: See CTCBeamSearchDecoderV2.
+)doc");
+
+REGISTER_OP("CTCBeamSearchStreamDecoder")
+    .Input("inputs: T")
+    .Input("sequence_length: int32")
+    .Input("stream_ids: string")
+    .Input("finalize: bool")
+    .Input("kenlm_weight: float")
+    .Input("word_count_weight: float")
+    .Input("valid_word_count_weight: float")
+    .Attr("kenlm_directory_path: string")
+    .Attr("beam_width: int >= 1")
+    .Attr("top_paths: int >= 1")
+    .Attr("merge_repeated: bool = true")
+    .Attr("lm_score_cache_size: int >= 0 = 0")
+    .Attr("kenlm_load_method: {'lazy', 'populate_or_lazy', 'populate_or_read', "
+          "'read', 'parallel_read'} = 'populate_or_read'")
+    .Attr("stream_idle_timeout_secs: int >= 0 = 600")
+    .Attr("blank_skip_threshold: float = 0.0")
+    .Attr("beam_threshold: float = 0.0")
+    .Attr("T: {float, half} = DT_FLOAT")
+    .Attr("output_decode_stats: bool = false")
+    .Attr("strict_lexicon: bool = false")
+    .Output("decoded_indices: top_paths * int64")
+    .Output("decoded_values: top_paths * int64")
+    .Output("decoded_shape: top_paths * int64")
+    .Output("log_probability: float")
+    .Output("decode_stats: int64")
+    .SetIsStateful()
+    .SetShapeFn([](InferenceContext* c) {
+      ShapeHandle unused;
+      TF_RETURN_IF_ERROR(c->WithRank(c->input(2), 1, &unused));
+      TF_RETURN_IF_ERROR(c->WithRank(c->input(3), 1, &unused));
+      return CTCBeamSearchDecoderShapeFn(c);
+    })
+    .Doc(R"doc(
+Performs beam search decoding on successive chunks of logits.
+
+Each batch item continues the decoding of the stream named by its entry in
+`stream_ids`: the beams and language model state of a stream are kept by the
+op between calls, so each call only costs the frames of the new chunk. The
+outputs are the current best hypotheses of each stream. When `finalize` is
+set for a batch item, the incomplete last word and the end of sentence are
+scored before the hypotheses are returned, and the stream is discarded; the
+next chunk with the same id starts a new stream.
+
+Streams are private to the op node that decodes them. A stream that is never
+finalized is discarded once it has not been fed for
+`stream_idle_timeout_secs`, and at the latest when the session is closed; a
+later chunk with its id starts a new stream. The weights may change from chunk
+to chunk; all the other settings are fixed when a stream starts.
+
+inputs: 3-D, shape: `(max_time x batch_size x num_classes)`, the logits of
+  the next chunk of each stream.
+sequence_length: A vector containing the chunk lengths, size `(batch)`. A
+  length may be 0, e.g. to finalize a stream without new frames.
+stream_ids: A vector of distinct stream ids, size `(batch)`.
+finalize: A vector, size `(batch)`. True for the last chunk of a stream.
+kenlm_weight: A scalar that weights the significance of the language model.
+word_count_weight: A scalar that weights the significance of the transcription word count.
+valid_word_count_weight: A scalar that weights the significance of the valid transcription word count.
+kenlm_directory_path: String. Directory path to KenLM language model files `kenlm-model.binary`, `vocabulary`, `trie`.
+beam_width: A scalar >= 0 (beam search beam width).
+top_paths: A scalar >= 0, <= beam_width (controls output size).
+merge_repeated: If true, merge repeated classes in output.
+lm_score_cache_size: Number of language model scores to cache per decoding
+  thread, keyed by LM context and word. The caches are kept across calls and
+  shared by the streams. 0 disables the cache.
+kenlm_load_method: How the KenLM model is brought into memory, see
+  CTCBeamSearchDecoder.
+stream_idle_timeout_secs: Seconds after its last chunk at which a stream that
+  was not finalized is discarded. 0 keeps such streams until the session is
+  closed.
+blank_skip_threshold: See CTCBeamSearchDecoder.
+beam_threshold: See CTCBeamSearchDecoder.
+output_decode_stats: See CTCBeamSearchDecoderV2.
+strict_lexicon: See CTCBeamSearchDecoderV2.
+decoded_indices: A list (length: top_paths) of indices matrices.  Matrix j,
+  size `(total_decoded_outputs[j] x 2)`, has indices of a
+  `SparseTensor<int64, 2>`.  The rows store: [batch, time].
+decoded_values: A list (length: top_paths) of values vectors.  Vector j,
+  size `(length total_decoded_outputs[j])`, has the values of a
+  `SparseTensor<int64, 2>`.  The vector stores the decoded classes for beam j.
+decoded_shape: A list (length: top_paths) of shape vector.  Vector j,
+  size `(2)`, stores the shape of the decoded `SparseTensor[j]`.
+  Its values are: `[batch_size, max_decoded_length[j]]`.
+log_probability: A matrix, shaped: `(batch_size x top_paths)`.  The
+  sequence log-probabilities of the streams so far.
+decode_stats: The work done decoding the chunk of each stream, see
+  CTCBeamSearchDecoderV2.
+)doc");
+
+REGISTER_OP("CTCNBestRescore")
+    .Input("hypothesis_indices: top_paths * int64")
+    .Input("hypothesis_values: top_paths * int64")
+    .Input("hypothesis_shape: top_paths * int64")
+    .Input("hypothesis_log_probability: float")
+    .Input("kenlm_weight: float")
+    .Input("word_count_weight: float")
+    .Input("valid_word_count_weight: float")
+    .Input("first_pass_kenlm_weight: float")
+    .Input("first_pass_word_count_weight: float")
+    .Input("first_pass_valid_word_count_weight: float")
+    .Attr("kenlm_model_path: string")
+    .Attr("vocabulary_path: string")
+    .Attr("first_pass_kenlm_directory_path: string")
+    .Attr("top_paths: int >= 1")
+    .Attr("kenlm_load_method: {'lazy', 'populate_or_lazy', 'populate_or_read', "
+          "'read', 'parallel_read'} = 'lazy'")
+    .Attr("first_pass_kenlm_load_method: {'lazy', 'populate_or_lazy', "
+          "'populate_or_read', 'read', 'parallel_read'} = 'populate_or_read'")
+    .Output("decoded_indices: top_paths * int64")
+    .Output("decoded_values: top_paths * int64")
+    .Output("decoded_shape: top_paths * int64")
+    .Output("log_probability: float")
+    .Output("lm_score: float")
+    .Output("path_index: int32")
+    .SetShapeFn([](InferenceContext* c) {
+      int32 top_paths;
+      TF_RETURN_IF_ERROR(c->GetAttr("top_paths", &top_paths));
+      ShapeHandle log_probability;
+      TF_RETURN_IF_ERROR(
+          c->WithRank(c->input(3 * top_paths), 2, &log_probability));
+      DimensionHandle unused;
+      TF_RETURN_IF_ERROR(
+          c->WithValue(c->Dim(log_probability, 1), top_paths, &unused));
+      for (int i = 0; i < 6; ++i) {
+        ShapeHandle weight;
+        TF_RETURN_IF_ERROR(
+            c->WithRank(c->input(3 * top_paths + 1 + i), 0, &weight));
+      }
+      int out_idx = 0;
+      for (int i = 0; i < top_paths; ++i) {  // decoded_indices
+        c->set_output(out_idx++, c->Matrix(InferenceContext::kUnknownDim, 2));
+      }
+      for (int i = 0; i < top_paths; ++i) {  // decoded_values
+        c->set_output(out_idx++, c->Vector(InferenceContext::kUnknownDim));
+      }
+      ShapeHandle shape_v = c->Vector(2);
+      for (int i = 0; i < top_paths; ++i) {  // decoded_shape
+        c->set_output(out_idx++, shape_v);
+      }
+      for (int i = 0; i < 3; ++i) {  // log_probability, lm_score, path_index
+        c->set_output(out_idx++, log_probability);
+      }
+      return Status::OK();
+    })
+    .Doc(R"doc(
+Rescores the N best hypotheses of a CTC decoder with a KenLM model.
+
+Meant as the second pass of a two-pass decoder: `CTCBeamSearchDecoder`
+decodes with a language model small enough to be queried on every beam
+expansion, and this op scores the whole sentences it returns with a larger
+one. The hypotheses of each batch item are scored in parallel and returned
+best first.
+
+The first pass log-probability of a hypothesis already holds the score of
+the first pass language model and word bonuses. That score is recomputed
+from `first_pass_kenlm_directory_path` and the `first_pass_*` weights, which
+must be those of the decoder, and replaced by
+`kenlm_weight * lm_score + word_count_weight * words +
+valid_word_count_weight * words_in_vocabulary`. The boosts of hotwords
+given to the decoder are kept. With `merge_repeated`, a hypothesis that
+dropped a repeated label is replayed without it, so the score taken out is
+then approximate.
+
+The model is loaded once and shared by all the kernels using the same
+files, in any session; 'lazy' (the default) memory maps it, so that only the
+pages actually queried are read.
+
+hypothesis_indices: The decoded_indices of CTCBeamSearchDecoder.
+hypothesis_values: The decoded_values of CTCBeamSearchDecoder.
+hypothesis_shape: The decoded_shape of CTCBeamSearchDecoder.
+hypothesis_log_probability: The log_probability of CTCBeamSearchDecoder,
+  shaped `(batch_size x top_paths)`.
+kenlm_weight: A scalar that weights the significance of the language model.
+word_count_weight: A scalar that weights the significance of the transcription word count.
+valid_word_count_weight: A scalar that weights the significance of the valid transcription word count.
+first_pass_kenlm_weight: The kenlm_weight of the decoder.
+first_pass_word_count_weight: The word_count_weight of the decoder.
+first_pass_valid_word_count_weight: The valid_word_count_weight of the
+  decoder.
+kenlm_model_path: Path of the KenLM model, any KenLM binary model type.
+vocabulary_path: Path of the vocabulary of the labels, as in the KenLM
+  directory of CTCBeamSearchDecoder.
+first_pass_kenlm_directory_path: The kenlm_directory_path of the decoder.
+  Empty if the first pass did not use a language model, in which case
+  nothing is taken out.
+top_paths: The number of hypotheses per batch item.
+kenlm_load_method: How the KenLM model is brought into memory, see
+  CTCBeamSearchDecoder.
+first_pass_kenlm_load_method: The kenlm_load_method of the decoder, so that
+  the first pass model it loaded is shared rather than loaded again.
+decoded_indices: The hypotheses reordered, see CTCBeamSearchDecoder.
+decoded_values: The hypotheses reordered, see CTCBeamSearchDecoder.
+decoded_shape: The hypotheses reordered, see CTCBeamSearchDecoder.
+log_probability: A matrix, shaped `(batch_size x top_paths)`. The rescored
+  sequence log-probabilities, in decreasing order for each batch item.
+lm_score: A matrix, shaped `(batch_size x top_paths)`. The log10
+  probability of each reordered hypothesis under the model.
+path_index: A matrix, shaped `(batch_size x top_paths)`. The index among
+  the input hypotheses of each reordered hypothesis.
+)doc");
+
 }  // namespace tensorflow
@@ -95,4 +95,92 @@ TEST(CtcOpsTest, CTCBeamSearchDecoder_ShapeFn) {
   INFER_OK(op, "?;?", "[?,2];[?,2];[?];[?];[2];[2];[?,2]");
 }
 
+TEST(CtcOpsTest, CTCBeamSearchDecoderV2_ShapeFn) {
+  ShapeInferenceTestOp op("CTCBeamSearchDecoderV2");
+  auto set_top_paths = [&op](int top_paths, bool output_decode_stats) {
+    TF_ASSERT_OK(NodeDefBuilder("test", "CTCBeamSearchDecoderV2")
+                     .Input({"a", 0, DT_FLOAT})
+                     .Input({"b", 0, DT_INT32})
+                     .Input({"c", 0, DT_FLOAT})
+                     .Input({"d", 0, DT_FLOAT})
+                     .Input({"e", 0, DT_FLOAT})
+                     .Input({"f", 0, DT_STRING})
+                     .Input({"g", 0, DT_FLOAT})
+                     .Attr("top_paths", top_paths)
+                     .Attr("output_decode_stats", output_decode_stats)
+                     .Finalize(&op.node_def));
+  };
+  set_top_paths(1, false);
+
+  // Inputs are those of CTCBeamSearchDecoder, hotwords and hotword_boosts.
+  // Outputs are those of CTCBeamSearchDecoder plus an empty decode_stats.
+  INFER_ERROR("must be rank 3", op, "[];?;?;?;?;[?];[?]");
+  INFER_OK(op, "[?,?,?];[?];?;?;?;[?];[?]",
+           "[?,2];[?];[2];[d0_1|d1_0,1];[0,10]");
+  INFER_OK(op, "[?,1,?];[1];?;?;?;[?];[?]",
+           "[?,2];[?];[2];[d0_1|d1_0,1];[0,10]");
+  INFER_ERROR("must be equal", op, "[?,1,?];[2];?;?;?;[?];[?]");
+  INFER_ERROR("must be rank 1", op, "[?,1,?];[1];?;?;?;[];[?]");  // hotwords
+  INFER_ERROR("must be equal", op, "[?,1,?];[1];?;?;?;[2];[3]");
+
+  set_top_paths(2, false);
+  INFER_OK(op, "?;?;?;?;?;[?];[?]", "[?,2];[?,2];[?];[?];[2];[2];[?,2];[0,10]");
+
+  // decode_stats has a row per batch item when requested.
+  set_top_paths(1, true);
+  INFER_OK(op, "[?,1,?];[?];?;?;?;[?];[?]", "[?,2];[?];[2];[d0_1,1];[d0_1,10]");
+}
+
+TEST(CtcOpsTest, CTCAsyncBeamSearchDecoder_ShapeFn) {
+  // Same shapes as CTCBeamSearchDecoderV2.
+  ShapeInferenceTestOp op("CTCAsyncBeamSearchDecoder");
+  TF_ASSERT_OK(NodeDefBuilder("test", "CTCAsyncBeamSearchDecoder")
+                   .Input({"a", 0, DT_FLOAT})
+                   .Input({"b", 0, DT_INT32})
+                   .Input({"c", 0, DT_FLOAT})
+                   .Input({"d", 0, DT_FLOAT})
+                   .Input({"e", 0, DT_FLOAT})
+                   .Input({"f", 0, DT_STRING})
+                   .Input({"g", 0, DT_FLOAT})
+                   .Attr("top_paths", 1)
+                   .Attr("decoder_threads", 2)
+                   .Finalize(&op.node_def));
+  INFER_OK(op, "[?,1,?];[?];?;?;?;[?];[?]", "[?,2];[?];[2];[d0_1,1];[0,10]");
+  INFER_ERROR("must be rank 3", op, "[];?;?;?;?;[?];[?]");
+  INFER_ERROR("must be equal", op, "[?,1,?];[1];?;?;?;[2];[3]");
+}
+
+TEST(CtcOpsTest, CTCNBestRescore_ShapeFn) {
+  ShapeInferenceTestOp op("CTCNBestRescore");
+  std::vector<NodeDefBuilder::NodeOut> paths = {{"a", 0, DT_INT64},
+                                                {"a", 1, DT_INT64}};
+  TF_ASSERT_OK(NodeDefBuilder("test", "CTCNBestRescore")
+                   .Input(paths)
+                   .Input(paths)
+                   .Input(paths)
+                   .Input({"b", 0, DT_FLOAT})
+                   .Input({"c", 0, DT_FLOAT})
+                   .Input({"d", 0, DT_FLOAT})
+                   .Input({"e", 0, DT_FLOAT})
+                   .Input({"f", 0, DT_FLOAT})
+                   .Input({"g", 0, DT_FLOAT})
+                   .Input({"h", 0, DT_FLOAT})
+                   .Attr("kenlm_model_path", "model")
+                   .Attr("vocabulary_path", "vocabulary")
+                   .Attr("first_pass_kenlm_directory_path", "")
+                   .Attr("top_paths", 2)
+                   .Finalize(&op.node_def));
+
+  // Inputs are the indices, values and shapes of the 2 paths, their
+  // log_probability, the three weights and the three first pass weights.
+  INFER_OK(op, "?;?;?;?;?;?;[?,2];[];[];[];[];[];[]",
+           "[?,2];[?,2];[?];[?];[2];[2];in6;in6;in6");
+  INFER_OK(op, "?;?;?;?;?;?;?;?;?;?;?;?;?",
+           "[?,2];[?,2];[?];[?];[2];[2];[?,2];[?,2];[?,2]");
+  INFER_ERROR("must be rank 2", op, "?;?;?;?;?;?;[2];?;?;?;?;?;?");
+  INFER_ERROR("must be 2", op, "?;?;?;?;?;?;[?,3];?;?;?;?;?;?");
+  INFER_ERROR("must be rank 0", op, "?;?;?;?;?;?;[?,2];?;[1];?;?;?;?");
+  INFER_ERROR("must be rank 0", op, "?;?;?;?;?;?;[?,2];?;?;?;?;[1];?");
+}
+
 }  // end namespace tensorflow
@@ -17,6 +17,7 @@ limitations under the License.
 #define TENSORFLOW_CORE_UTIL_CTC_CTC_BEAM_ENTRY_H_
 
 #include <algorithm>
+#include <new>
 #include <vector>
 
 #include "third_party/eigen3/Eigen/Core"
@@ -24,7 +25,7 @@ limitations under the License.
 #include "tensorflow/core/platform/macros.h"
 #include "tensorflow/core/platform/types.h"
 #include "tensorflow/core/util/ctc/ctc_loss_util.h"
-#include "tensorflow/core/util/ctc/ctc_trie_node.h"
+#include "tensorflow/core/util/ctc/ctc_compact_trie.h"
 #include "lm/model.hh"
 
 namespace tensorflow {
@@ -44,9 +45,16 @@ struct KenLMBeamState {
   float language_model_score;
   float score;
   float delta_score;
-  std::wstring incomplete_word;
-  TrieNode *incomplete_word_trie_node;
-  lm::ngram::ProbingModel::State model_state;
+  // Trie node of the word spelled since the last space, nullptr once it
+  // left the lexicon.
+  const CompactTrieNode *incomplete_word_trie_node;
+  lm::ngram::State model_state;
+  // Position in the hotword trie of the scorer, if it has one, the boost of
+  // the hotwords completed, and the change of the hotword score brought by
+  // the last expansion.
+  int32 hotword_node;
+  float hotword_score;
+  float hotword_delta;
 };
 
 struct BeamProbability {
@@ -63,36 +71,26 @@ struct BeamProbability {
 
 template <class CTCBeamState = EmptyBeamState>
 struct BeamEntry {
-  // Default constructor does not create a vector of children.
-  BeamEntry() : parent(nullptr), label(-1) {}
-  // Constructor giving parent, label, and number of children does
-  // create a vector of children.  The object pointed to by p
-  // cannot be copied and should not be moved, otherwise parent will
-  // become invalid.
-  BeamEntry(BeamEntry* p, int l, int L, int t) : parent(p), label(l) {
-    PopulateChildren(L);
-  }
+  BeamEntry() : parent(nullptr), label(-1), children(nullptr) {}
+  // The object pointed to by p cannot be copied and should not be moved,
+  // otherwise parent will become invalid.
+  BeamEntry(BeamEntry* p, int l) : parent(p), label(l), children(nullptr) {}
   inline bool Active() const { return newp.total != kLogZero; }
-  inline bool HasChildren() const { return !children.empty(); }
-  void PopulateChildren(int L) {
+  inline bool HasChildren() const { return children != nullptr; }
+  // Children are looked up by label in a table of num_classes - 1 pointers,
+  // assigned when the beam is first expanded. Entries are only created for
+  // labels that were actually scored, the others stay nullptr.
+  void PopulateChildren(BeamEntry** table) {
     CHECK(!HasChildren());
-    children = std::vector<BeamEntry>(L);
-    int ci = 0;
-    for (auto& c : children) {
-      // The current object cannot be copied, and should not be moved.
-      // Otherwise the child's parent will become invalid.
-      c.parent = this;
-      c.label = ci;
-      ++ci;
-    }
+    children = table;
   }
-  inline std::vector<BeamEntry>* Children() {
-    CHECK(HasChildren());
-    return &children;
+  inline BeamEntry* GetChild(int l) const {
+    DCHECK(HasChildren());
+    return children[l];
   }
-  inline const std::vector<BeamEntry>* Children() const {
-    CHECK(HasChildren());
-    return &children;
+  inline void SetChild(int l, BeamEntry* c) {
+    DCHECK(HasChildren());
+    children[l] = c;
   }
   std::vector<int> LabelSeq(bool merge_repeated) const {
     std::vector<int> labels;
@@ -111,7 +109,7 @@ struct BeamEntry {
 
   BeamEntry<CTCBeamState>* parent;
   int label;
-  std::vector<BeamEntry<CTCBeamState>> children;
+  BeamEntry<CTCBeamState>** children;
   BeamProbability oldp;
   BeamProbability newp;
   CTCBeamState state;
@@ -120,6 +118,141 @@ struct BeamEntry {
   TF_DISALLOW_COPY_AND_ASSIGN(BeamEntry);
 };
 
+// BeamArena hands out objects of type T from fixed-size blocks. Clear()
+// destroys every object but keeps the blocks, so a decoder that is Reset()
+// between utterances reaches a steady state without any heap traffic for its
+// beam tree.
+template <class T>
+class BeamArena {
+ public:
+  explicit BeamArena(int64 block_size)
+      : block_size_(block_size), block_(0), used_(0) {}
+
+  ~BeamArena() {
+    Clear();
+    for (T* block : blocks_) {
+      ::operator delete(block);
+    }
+  }
+
+  // Returns n contiguous value-initialized objects. n must not exceed the
+  // block size.
+  T* NewArray(int64 n) {
+    DCHECK_LE(n, block_size_);
+    if (block_ < blocks_.size() && used_ + n > block_size_) {
+      block_used_[block_] = used_;
+      ++block_;
+      used_ = 0;
+    }
+    if (block_ == blocks_.size()) {
+      blocks_.push_back(
+          static_cast<T*>(::operator new(block_size_ * sizeof(T))));
+      block_used_.push_back(0);
+    }
+    T* result = blocks_[block_] + used_;
+    for (int64 i = 0; i < n; ++i) {
+      new (result + i) T();
+    }
+    used_ += n;
+    return result;
+  }
+
+  T* New() { return NewArray(1); }
+
+  // Destroys the most recently allocated object and gives its storage back.
+  void PopBack() {
+    DCHECK_GT(used_, 0);
+    --used_;
+    (blocks_[block_] + used_)->~T();
+  }
+
+  // Destroys all objects, keeping the blocks for reuse.
+  void Clear() {
+    if (block_ < block_used_.size()) {
+      block_used_[block_] = used_;
+    }
+    for (size_t b = 0; b < block_used_.size() && b <= block_; ++b) {
+      for (int64 i = 0; i < block_used_[b]; ++i) {
+        (blocks_[b] + i)->~T();
+      }
+      block_used_[b] = 0;
+    }
+    block_ = 0;
+    used_ = 0;
+  }
+
+ private:
+  const int64 block_size_;
+  std::vector<T*> blocks_;
+  std::vector<int64> block_used_;  // Only up to date for blocks < block_.
+  size_t block_;
+  int64 used_;
+
+  TF_DISALLOW_COPY_AND_ASSIGN(BeamArena);
+};
+
+// BeamHeap keeps the limit greatest elements pushed into it (per Cmp, a
+// greater-than comparison), like gtl::TopN, but in storage reserved up front:
+// the elements are kept as a heap with the lowest one on top, which is the
+// one the decoder peeks at when pushing, and are sorted in place by Extract.
+template <class T, class Cmp>
+class BeamHeap {
+ public:
+  explicit BeamHeap(size_t limit, const Cmp& cmp = Cmp())
+      : limit_(limit), cmp_(cmp) {
+    elements_.reserve(limit_);
+  }
+
+  size_t limit() const { return limit_; }
+  size_t size() const { return elements_.size(); }
+  bool empty() const { return elements_.empty(); }
+
+  // Pushes v. Once limit elements are held, v replaces the lowest one if it
+  // is greater, and is dropped otherwise.
+  void push(const T& v) {
+    if (elements_.size() < limit_) {
+      elements_.push_back(v);
+      std::push_heap(elements_.begin(), elements_.end(), cmp_);
+    } else if (limit_ > 0 && cmp_(v, elements_.front())) {
+      std::pop_heap(elements_.begin(), elements_.end(), cmp_);
+      elements_.back() = v;
+      std::push_heap(elements_.begin(), elements_.end(), cmp_);
+    }
+  }
+
+  // The lowest element.
+  const T& peek_bottom() const {
+    DCHECK(!empty());
+    return elements_.front();
+  }
+
+  // Moves the elements, sorted in descending order, to *out and empties the
+  // heap, which takes over the storage of *out. Extracting into the same
+  // vector on every step thus swaps two buffers without allocating.
+  void Extract(std::vector<T>* out) {
+    std::sort_heap(elements_.begin(), elements_.end(), cmp_);
+    out->swap(elements_);
+    elements_.clear();
+    elements_.reserve(limit_);
+  }
+
+  void Reset() { elements_.clear(); }
+
+  typename std::vector<T>::const_iterator unsorted_begin() const {
+    return elements_.begin();
+  }
+  typename std::vector<T>::const_iterator unsorted_end() const {
+    return elements_.end();
+  }
+
+ private:
+  const size_t limit_;
+  Cmp cmp_;
+  std::vector<T> elements_;
+
+  TF_DISALLOW_COPY_AND_ASSIGN(BeamHeap);
+};
+
 // BeamComparer is the default beam comparer provided in CTCBeamSearch.
 template <class CTCBeamState = EmptyBeamState>
 class BeamComparer {
@@ -24,13 +24,22 @@ limitations under the License.
 #ifndef TENSORFLOW_CORE_UTIL_CTC_CTC_BEAM_SCORER_H_
 #define TENSORFLOW_CORE_UTIL_CTC_CTC_BEAM_SCORER_H_
 
+#include "tensorflow/core/lib/hash/hash.h"
+#include "tensorflow/core/platform/env.h"
 #include "tensorflow/core/util/ctc/ctc_beam_entry.h"
+#include "tensorflow/core/util/ctc/ctc_compact_trie.h"
+#include "tensorflow/core/util/ctc/ctc_hotword_trie.h"
+#include "tensorflow/core/util/ctc/ctc_kenlm_model.h"
+#include "tensorflow/core/util/ctc/ctc_lm_score_cache.h"
 #include "tensorflow/core/util/ctc/ctc_vocabulary.h"
 #include "lm/model.hh"
 #include "utf8.h"
 
+#include <algorithm>
 #include <iostream>
 #include <fstream>
+#include <memory>
+#include <vector>
 
 namespace tensorflow {
 namespace ctc {
@@ -52,6 +61,28 @@ class BaseBeamScorer {
   // expansion is done.
   virtual void ExpandState(const CTCBeamState& from_state, int from_label,
                            CTCBeamState* to_state, int to_label) const {}
+  // Scorers whose ExpandState does expensive lookups, such as language model
+  // queries, can batch them by returning true from BatchesExpansions. Each
+  // decoding step that grows children then first calls PrepareExpansion for
+  // every child it may expand, in the order of the ExpandState calls that
+  // follow, and ResolveExpansions once after the last of them. The ExpandState
+  // calls of the step then expand a subsequence of the prepared children,
+  // rarely plus a child that was not prepared. from_state stays at the same
+  // address and unchanged until the end of the step.
+  virtual bool BatchesExpansions() const { return false; }
+  virtual void PrepareExpansion(const CTCBeamState& from_state, int from_label,
+                                int to_label) const {}
+  virtual void ResolveExpansions() const {}
+  // Scorers that rule some label sequences out altogether, such as those
+  // restricted to a lexicon, return true from ValidatesExpansions. The decoder
+  // then asks IsValidExpansion before creating a child, and drops the child
+  // without calling ExpandState or GetStateExpansionScore if it is invalid.
+  // IsValidExpansion must be cheap: it is called for every child considered.
+  virtual bool ValidatesExpansions() const { return false; }
+  virtual bool IsValidExpansion(const CTCBeamState& from_state, int from_label,
+                                int to_label) const {
+    return true;
+  }
   // ExpandStateEnd is called after decoding has finished. Its purpose is to
   // allow a final scoring of the beam in its current state, before resorting
   // and retrieving the TopN requested candidates. Called at most once per beam.
@@ -77,44 +108,89 @@ class BaseBeamScorer {
   }
 };
 
+// KenLMBeamScorer scores beams with a KenLM language model, restricted to the
+// words of a prefix trie built by ctc_generate_trie.
+//
+// The model, vocabulary and trie are immutable once loaded and are shared by
+// copies of the scorer, so that a single load can serve several decoders
+// running in parallel. The weights and the optional LM score cache are
+// per-copy: give each concurrently running decoder its own copy, and its own
+// cache.
+//
+// The word being spelled is tracked only as its position in the trie, whose
+// nodes carry the KenLM index of the word ending there. Expanding a beam thus
+// never builds strings or allocates: a word boundary costs one FullScore call.
+// Words that are not in the trie are scored as <unk>.
+//
+// The FullScore calls of one decoding step are batched, see
+// BaseBeamScorer::BatchesExpansions: the queries of all the word boundaries
+// of the step are collected first, duplicates are merged, the score cache
+// slots they probe are prefetched, and the remaining queries are issued back
+// to back, so that their cache misses in large models overlap instead of
+// stalling the decoder one at a time.
+//
+// Hotwords, see SetHotwords, are tracked alongside the trie position and
+// add their boost to the expansion scores, unweighted by the LM weight.
+//
+// By default a label leaving the trie is only penalized. With
+// SetStrictLexicon, such labels are invalid expansions instead, so that the
+// decoder only ever grows beams along the trie and the number of children of
+// a beam is the fan-out of its trie node rather than the alphabet size.
 class KenLMBeamScorer : public BaseBeamScorer<KenLMBeamState> {
  public:
-  typedef lm::ngram::ProbingModel Model;
-
-  virtual ~KenLMBeamScorer() {
-    delete model;
-    delete trieRoot;
-    delete vocabulary;
+  typedef KenLMModel Model;
+  typedef LMScoreCache<Model::State> ScoreCache;
+  typedef LMScoreCachePool<Model::State> ScoreCachePool;
+
+  virtual ~KenLMBeamScorer() {}
+  // Any KenLM binary model type is accepted, see KenLMModel::Load. Dies if
+  // the files cannot be loaded; use Create to get an error Status instead.
+  KenLMBeamScorer(const char *kenlm_directory_path,
+                  util::LoadMethod load_method = util::POPULATE_OR_READ)
+                    : KenLMBeamScorer() {
+    TF_CHECK_OK(Load(kenlm_directory_path, load_method));
   }
-  KenLMBeamScorer(const char *kenlm_directory_path)
-                    : lm_weight(1.0f),
-                      word_count_weight(0.0f) {
-
-    std::string directory_path(kenlm_directory_path);
-    const std::string model_path = directory_path + "/kenlm-model.binary";
-    const std::string vocabulary_path = directory_path + "/vocabulary";
-    const std::string trie_path = directory_path + "/trie";
-
-    lm::ngram::Config config;
-    config.load_method = util::POPULATE_OR_READ;
-    model = new Model(model_path.c_str(), config);
-
-    vocabulary = new Vocabulary(vocabulary_path.c_str());
-
-    std::ifstream in;
-    in.open(trie_path.c_str(), std::ios::in);
-    TrieNode::ReadFromStream(in, trieRoot, vocabulary->GetSize());
-    in.close();
+  // Loads kenlm-model.binary, vocabulary and trie from kenlm_directory_path.
+  static Status Create(const string& kenlm_directory_path,
+                       util::LoadMethod load_method,
+                       std::unique_ptr<KenLMBeamScorer>* scorer) {
+    std::unique_ptr<KenLMBeamScorer> result(new KenLMBeamScorer);
+    TF_RETURN_IF_ERROR(result->Load(kenlm_directory_path, load_method));
+    *scorer = std::move(result);
+    return Status::OK();
   }
+  // Copies share the loaded model, vocabulary, trie and hotwords. The score
+  // cache is not shared: a copy starts without one.
+  KenLMBeamScorer(const KenLMBeamScorer& other)
+      : vocabulary(other.vocabulary),
+        trie(other.trie),
+        model(other.model),
+        hotwords(other.hotwords),
+        lm_weight(other.lm_weight),
+        word_count_weight(other.word_count_weight),
+        valid_word_count_weight(other.valid_word_count_weight),
+        score_cache(nullptr),
+        batch_expansions(other.batch_expansions),
+        strict_lexicon(other.strict_lexicon),
+        pending_scores_resolved(true),
+        next_pending_score(0),
+        lm_queries(0),
+        oov_words(0),
+        trie_misses(0) {}
 
   // State initialization.
   void InitializeState(KenLMBeamState* root) const {
     root->language_model_score = 0.0f;
     root->score = 0.0f;
     root->delta_score = 0.0f;
-    root->incomplete_word.clear();
-    root->incomplete_word_trie_node = trieRoot;
+    root->incomplete_word_trie_node = trie->Root();
     root->model_state = model->BeginSentenceState();
+    root->hotword_node = HotwordTrie::kRoot;
+    root->hotword_score = 0.0f;
+    root->hotword_delta = 0.0f;
+    // A new sequence: the pending scores point to beams of the last one.
+    pending_scores.clear();
+    pending_scores_resolved = true;
   }
   // ExpandState is called when expanding a beam to one of its children.
   // Called at most once per child beam. In the simplest case, no state
@@ -122,10 +198,15 @@ class KenLMBeamScorer : public BaseBeamScorer<KenLMBeamState> {
   void ExpandState(const KenLMBeamState& from_state, int from_label,
                            KenLMBeamState* to_state, int to_label) const {
     CopyState(from_state, to_state);
+    if (hotwords) {
+      to_state->hotword_node = hotwords->Next(
+          from_state.hotword_node, to_label, &to_state->hotword_score);
+      to_state->hotword_delta = HotwordScore(*to_state) -
+                                HotwordScore(from_state);
+    }
 
     if (!vocabulary->IsSpaceLabel(to_label)) {
-      to_state->incomplete_word += vocabulary->GetCharacterFromLabel(to_label);
-      TrieNode *trie_node = from_state.incomplete_word_trie_node;
+      const CompactTrieNode *trie_node = from_state.incomplete_word_trie_node;
 
       // TODO replace with OOV unigram prob?
       // If we have no valid prefix we assume a very low log probability
@@ -137,6 +218,8 @@ class KenLMBeamScorer : public BaseBeamScorer<KenLMBeamState> {
 
         if (trie_node != nullptr) {
           min_unigram_score = trie_node->GetMinUnigramScore();
+        } else {
+          ++trie_misses;
         }
       }
       // TODO try two options
@@ -146,34 +229,107 @@ class KenLMBeamScorer : public BaseBeamScorer<KenLMBeamState> {
       to_state->delta_score = to_state->score - from_state.score;
 
     } else {
-      float lm_score_delta = ScoreIncompleteWord(from_state.model_state,
-                            to_state->incomplete_word,
-                            to_state->model_state);
+      const lm::WordIndex word = IncompleteWordIndex(*to_state);
+      float lm_score_delta;
+      if (!TakeResolvedScore(from_state.model_state, word,
+                             &to_state->model_state, &lm_score_delta)) {
+        lm_score_delta = ScoreWord(from_state.model_state, word,
+                                   &to_state->model_state);
+      }
       // Give fixed word bonus
-      if (!IsOOV(to_state->incomplete_word)) {
+      if (!IsOOV(word)) {
         to_state->language_model_score += valid_word_count_weight;
+      } else {
+        ++oov_words;
       }
       to_state->language_model_score += word_count_weight;
       UpdateWithLMScore(to_state, lm_score_delta);
       ResetIncompleteWord(to_state);
     }
   }
+  bool BatchesExpansions() const { return batch_expansions; }
+  bool ValidatesExpansions() const { return strict_lexicon; }
+  // In strict lexicon mode, a label must continue a word of the trie, and a
+  // space must end one.
+  bool IsValidExpansion(const KenLMBeamState& from_state, int from_label,
+                        int to_label) const {
+    const CompactTrieNode *trie_node = from_state.incomplete_word_trie_node;
+    if (trie_node == nullptr) return false;
+    if (vocabulary->IsSpaceLabel(to_label)) {
+      return !IsOOV(trie_node->GetWordIndex());
+    }
+    return trie_node->GetChildAt(to_label) != nullptr;
+  }
+  // Collects the language model query of a child ending a word.
+  void PrepareExpansion(const KenLMBeamState& from_state, int from_label,
+                        int to_label) const {
+    if (pending_scores_resolved) {
+      pending_scores.clear();
+      pending_scores_resolved = false;
+    }
+    if (!vocabulary->IsSpaceLabel(to_label)) return;
+    PendingScore pending;
+    pending.in_state = &from_state.model_state;
+    pending.word = IncompleteWordIndex(from_state);
+    pending.hash = Hash64Combine(hash_value(from_state.model_state),
+                                 pending.word);
+    pending_scores.push_back(pending);
+  }
+  // Scores the queries collected since the last call.
+  void ResolveExpansions() const {
+    if (pending_scores_resolved) pending_scores.clear();
+    pending_scores_resolved = true;
+    next_pending_score = 0;
+    if (score_cache) {
+      for (const PendingScore& pending : pending_scores) {
+        score_cache->Prefetch(*pending.in_state, pending.word);
+      }
+    }
+    // Duplicates end up next to each other, the first one being scored.
+    pending_score_order.resize(pending_scores.size());
+    for (int i = 0; i < pending_score_order.size(); ++i) {
+      pending_score_order[i] = i;
+    }
+    std::sort(pending_score_order.begin(), pending_score_order.end(),
+              [this](int a, int b) {
+                return pending_scores[a].hash < pending_scores[b].hash;
+              });
+    const PendingScore* previous = nullptr;
+    for (int i : pending_score_order) {
+      PendingScore* pending = &pending_scores[i];
+      if (previous != nullptr && previous->hash == pending->hash &&
+          previous->word == pending->word &&
+          *previous->in_state == *pending->in_state) {
+        pending->out_state = previous->out_state;
+        pending->prob = previous->prob;
+      } else {
+        pending->prob =
+            ScoreWord(*pending->in_state, pending->word, &pending->out_state);
+      }
+      previous = pending;
+    }
+  }
   // ExpandStateEnd is called after decoding has finished. Its purpose is to
   // allow a final scoring of the beam in its current state, before resorting
   // and retrieving the TopN requested candidates. Called at most once per beam.
   void ExpandStateEnd(KenLMBeamState* state) const {
+    if (hotwords) {
+      const float previous_hotword_score = HotwordScore(*state);
+      state->hotword_score += hotwords->End(state->hotword_node);
+      state->hotword_node = HotwordTrie::kNoNode;
+      state->hotword_delta = state->hotword_score - previous_hotword_score;
+    }
     float lm_score_delta = 0.0f;
     Model::State out;
-    if (state->incomplete_word.size() > 0) {
-      lm_score_delta += ScoreIncompleteWord(state->model_state,
-                                            state->incomplete_word,
-                                            out);
+    if (state->incomplete_word_trie_node != trie->Root()) {
+      const lm::WordIndex word = IncompleteWordIndex(*state);
+      if (IsOOV(word)) ++oov_words;
+      lm_score_delta += ScoreWord(state->model_state, word, &out);
       ResetIncompleteWord(state);
       state->model_state = out;
     }
-    lm_score_delta += model->FullScore(state->model_state,
-                                      model->GetVocabulary().EndSentence(),
-                                      out).prob;
+    lm_score_delta += ScoreWord(state->model_state,
+                                model->EndSentence(), &out);
     UpdateWithLMScore(state, lm_score_delta);
   }
   // GetStateExpansionScore should be an inexpensive method to retrieve the
@@ -185,7 +341,8 @@ class KenLMBeamScorer : public BaseBeamScorer<KenLMBeamState> {
   // there's no state expansion logic, the expansion score is zero.
   float GetStateExpansionScore(const KenLMBeamState& state,
                                        float previous_score) const {
-    return lm_weight * state.delta_score + previous_score;
+    return lm_weight * state.delta_score + state.hotword_delta +
+           previous_score;
   }
   // GetStateEndExpansionScore should be an inexpensive method to retrieve the
   // (cached) expansion score computed within ExpandStateEnd. The score is
@@ -193,7 +350,33 @@ class KenLMBeamScorer : public BaseBeamScorer<KenLMBeamState> {
   //
   // The score returned should be a log-probability.
   float GetStateEndExpansionScore(const KenLMBeamState& state) const {
-    return lm_weight * state.delta_score;
+    return lm_weight * state.delta_score + state.hotword_delta;
+  }
+  // The sum of the expansion scores of a beam spelling labels[0, num_labels),
+  // from InitializeState to ExpandStateEnd: what this scorer added to the
+  // log-probability of the sequence when decoding it. Rescoring takes it out
+  // before adding the score of a second language model, see CTCNBestRescore.
+  Status GetSequenceExpansionScore(const int* labels, int64 num_labels,
+                                   float* score) const {
+    KenLMBeamState states[2];
+    int current = 0;
+    InitializeState(&states[current]);
+    *score = 0.0f;
+    int from_label = -1;
+    for (int64 i = 0; i < num_labels; ++i) {
+      const int label = labels[i];
+      if (label < 0 || label >= vocabulary->GetSize()) {
+        return errors::InvalidArgument("Label ", label, " is not in [0, ",
+                                       vocabulary->GetSize(), ")");
+      }
+      ExpandState(states[current], from_label, &states[1 - current], label);
+      current = 1 - current;
+      *score += GetStateExpansionScore(states[current], 0.0f);
+      from_label = label;
+    }
+    ExpandStateEnd(&states[current]);
+    *score += GetStateEndExpansionScore(states[current]);
+    return Status::OK();
   }
 
   void SetLMWeight(float lm_weight) {
@@ -208,13 +391,187 @@ class KenLMBeamScorer : public BaseBeamScorer<KenLMBeamState> {
     this->valid_word_count_weight = valid_word_count_weight;
   }
 
+  // Routes LM queries through cache, which is not owned and must outlive its
+  // use by this scorer. Null, the default, disables caching.
+  void SetScoreCache(ScoreCache* cache) {
+    score_cache = cache;
+  }
+
+  // Boosts the log-probability of the beams spelling one of phrases, UTF-8
+  // strings of words separated by single spaces, by the matching boost, a
+  // log-probability >= 0. Replaces the hotwords of this copy only: the loaded
+  // model and trie are left alone, so that every request can bring its own.
+  // An empty list of phrases removes the hotwords.
+  Status SetHotwords(const std::vector<string>& phrases,
+                     const std::vector<float>& boosts) {
+    if (phrases.size() != boosts.size()) {
+      return errors::InvalidArgument("Got ", phrases.size(),
+                                     " hotwords but ", boosts.size(),
+                                     " boosts");
+    }
+    if (phrases.empty()) {
+      hotwords.reset();
+      return Status::OK();
+    }
+    int space_label = -1;
+    for (int label = 0; label < vocabulary->GetSize(); ++label) {
+      if (vocabulary->IsSpaceLabel(label)) space_label = label;
+    }
+    std::unique_ptr<HotwordTrie> trie(
+        new HotwordTrie(vocabulary->GetSize(), space_label));
+    std::wstring wide_phrase;
+    std::vector<int> labels;
+    for (size_t i = 0; i < phrases.size(); ++i) {
+      const string& phrase = phrases[i];
+      wide_phrase.clear();
+      try {
+        utf8::utf8to16(phrase.begin(), phrase.end(),
+                       std::back_inserter(wide_phrase));
+      } catch (const utf8::exception&) {
+        return errors::InvalidArgument("Hotword ", i, " is not valid UTF-8");
+      }
+      labels.clear();
+      for (const wchar_t c : wide_phrase) {
+        if (!vocabulary->HasCharacter(c)) {
+          return errors::InvalidArgument("Hotword \"", phrase,
+                                         "\" has characters out of the "
+                                         "vocabulary");
+        }
+        labels.push_back(vocabulary->GetLabelFromCharacter(c));
+      }
+      TF_RETURN_IF_ERROR(trie->AddPhrase(labels, boosts[i]));
+    }
+    trie->Finalize();
+    hotwords.reset(trie.release());
+    return Status::OK();
+  }
+
+  // Restricts decoding to the words of the trie, see IsValidExpansion. Words
+  // of the trie the language model does not know can not be completed. Off
+  // by default.
+  void SetStrictLexicon(bool strict_lexicon) {
+    this->strict_lexicon = strict_lexicon;
+  }
+
+  // Batches the language model queries of each decoding step, the default.
+  void SetBatchExpansions(bool batch_expansions) {
+    this->batch_expansions = batch_expansions;
+  }
+
+  // Work counters of this copy, since it was created: the FullScore calls
+  // made (cache hits excluded), the words scored as <unk>, and the labels
+  // that spelled a word out of the trie.
+  int64 GetLMQueries() const { return lm_queries; }
+  int64 GetOOVWords() const { return oov_words; }
+  int64 GetTrieMisses() const { return trie_misses; }
+
+  // The files read by Create, relative to the KenLM directory.
+  static const char* ModelFileName() { return "kenlm-model.binary"; }
+  static const char* VocabularyFileName() { return "vocabulary"; }
+  static const char* TrieFileName() { return "trie"; }
+
  private:
-  Vocabulary *vocabulary;
-  TrieNode *trieRoot;
-  Model *model;
+  KenLMBeamScorer()
+      : lm_weight(1.0f),
+        word_count_weight(0.0f),
+        valid_word_count_weight(0.0f),
+        score_cache(nullptr),
+        batch_expansions(true),
+        strict_lexicon(false),
+        pending_scores_resolved(true),
+        next_pending_score(0),
+        lm_queries(0),
+        oov_words(0),
+        trie_misses(0) {}
+
+  // A language model query of the current decoding step, see
+  // PrepareExpansion.
+  struct PendingScore {
+    const Model::State* in_state;
+    lm::WordIndex word;
+    uint64 hash;
+    Model::State out_state;
+    float prob;
+  };
+
+  Status Load(const string& kenlm_directory_path,
+              util::LoadMethod load_method) {
+    const string model_path =
+        kenlm_directory_path + "/" + ModelFileName();
+    const string vocabulary_path =
+        kenlm_directory_path + "/" + VocabularyFileName();
+    const string trie_path = kenlm_directory_path + "/" + TrieFileName();
+
+    std::unique_ptr<Model> loaded_model;
+    TF_RETURN_IF_ERROR(Model::Load(model_path, load_method, &loaded_model));
+    model.reset(loaded_model.release());
+
+    TF_RETURN_IF_ERROR(Env::Default()->FileExists(vocabulary_path));
+    vocabulary.reset(new Vocabulary(vocabulary_path.c_str()));
+
+    std::unique_ptr<CompactTrie> loaded_trie;
+    TF_RETURN_IF_ERROR(CompactTrie::Load(
+        Env::Default(), trie_path, vocabulary->GetSize(),
+        [this](const std::vector<int>& labels) { return LookupWord(labels); },
+        &loaded_trie));
+    trie.reset(loaded_trie.release());
+    return Status::OK();
+  }
+
+  std::shared_ptr<const Vocabulary> vocabulary;
+  std::shared_ptr<const CompactTrie> trie;
+  std::shared_ptr<const Model> model;
+  std::shared_ptr<const HotwordTrie> hotwords;
   float lm_weight;
   float word_count_weight;
   float valid_word_count_weight;
+  ScoreCache* score_cache;
+  bool batch_expansions;
+  bool strict_lexicon;
+  // The queries of the current decoding step, in the order they were
+  // prepared; they keep their capacity from step to step.
+  mutable std::vector<PendingScore> pending_scores;
+  mutable std::vector<int> pending_score_order;
+  // Whether pending_scores were resolved, which the next PrepareExpansion
+  // starts over from.
+  mutable bool pending_scores_resolved;
+  // ExpandState takes the resolved scores in order, starting from this one.
+  mutable size_t next_pending_score;
+  // See GetLMQueries.
+  mutable int64 lm_queries;
+  mutable int64 oov_words;
+  mutable int64 trie_misses;
+
+  float ScoreWord(const Model::State& in_state, lm::WordIndex word,
+                  Model::State* out_state) const {
+    float prob;
+    if (score_cache && score_cache->Lookup(in_state, word, out_state, &prob)) {
+      return prob;
+    }
+    prob = model->FullScore(in_state, word, out_state);
+    ++lm_queries;
+    if (score_cache) {
+      score_cache->Insert(in_state, word, *out_state, prob);
+    }
+    return prob;
+  }
+
+  // On success, takes the score of (in_state, word) resolved for the current
+  // decoding step. in_state must be the state it was prepared with.
+  bool TakeResolvedScore(const Model::State& in_state, lm::WordIndex word,
+                         Model::State* out_state, float* prob) const {
+    if (!pending_scores_resolved) return false;
+    for (size_t i = next_pending_score; i < pending_scores.size(); ++i) {
+      const PendingScore& pending = pending_scores[i];
+      if (pending.in_state == &in_state && pending.word == word) {
+        next_pending_score = i + 1;
+        *out_state = pending.out_state;
+        *prob = pending.prob;
+        return true;
+      }
+    }
+    return false;
+  }
 
   void UpdateWithLMScore(KenLMBeamState *state, float lm_score_delta) const {
     float previous_score = state->score;
@@ -223,37 +580,40 @@ class KenLMBeamScorer : public BaseBeamScorer<KenLMBeamState> {
     state->delta_score = state->language_model_score - previous_score;
   }
 
+  // The boost of the hotwords completed plus the credit of the one being
+  // spelled.
+  float HotwordScore(const KenLMBeamState& state) const {
+    return state.hotword_score + hotwords->Potential(state.hotword_node);
+  }
+
   void ResetIncompleteWord(KenLMBeamState *state) const {
-    state->incomplete_word.clear();
-    state->incomplete_word_trie_node = trieRoot;
+    state->incomplete_word_trie_node = trie->Root();
   }
 
-  bool IsOOV(const std::wstring& word) const {
-    std::string encoded_word;
-    utf8::utf16to8(word.begin(), word.end(), std::back_inserter(encoded_word));
-    auto &vocabulary = model->GetVocabulary();
-    return vocabulary.Index(encoded_word) == vocabulary.NotFound();
+  bool IsOOV(lm::WordIndex word) const {
+    return word == model->NotFound();
   }
 
-  float ScoreIncompleteWord(const Model::State& model_state,
-                            const std::wstring& word,
-                            Model::State& out) const {
-    lm::FullScoreReturn full_score_return;
-    lm::WordIndex vocab;
+  // KenLM index of the word spelled so far, <unk> if it is not in the trie.
+  lm::WordIndex IncompleteWordIndex(const KenLMBeamState& state) const {
+    const CompactTrieNode *trie_node = state.incomplete_word_trie_node;
+    return trie_node == nullptr ? model->NotFound()
+                                : trie_node->GetWordIndex();
+  }
+
+  // Only used while loading tries in the legacy text format.
+  lm::WordIndex LookupWord(const std::vector<int>& labels) const {
+    std::wstring word;
+    for (int label : labels) {
+      word += vocabulary->GetCharacterFromLabel(label);
+    }
     std::string encoded_word;
     utf8::utf16to8(word.begin(), word.end(), std::back_inserter(encoded_word));
-    vocab = model->GetVocabulary().Index(encoded_word);
-    full_score_return = model->FullScore(model_state, vocab, out);
-    return full_score_return.prob;
+    return model->Index(encoded_word);
   }
 
   void CopyState(const KenLMBeamState& from, KenLMBeamState* to) const {
-    to->language_model_score = from.language_model_score;
-    to->score = from.score;
-    to->delta_score = from.delta_score;
-    to->incomplete_word = from.incomplete_word;
-    to->incomplete_word_trie_node = from.incomplete_word_trie_node;
-    to->model_state = from.model_state;
+    *to = from;
   }
 
 };
@@ -16,6 +16,7 @@ limitations under the License.
 #ifndef TENSORFLOW_CORE_UTIL_CTC_CTC_BEAM_SEARCH_H_
 #define TENSORFLOW_CORE_UTIL_CTC_CTC_BEAM_SEARCH_H_
 
+#include <chrono>
 #include <cmath>
 #include <memory>
 
@@ -33,6 +34,53 @@ limitations under the License.
 namespace tensorflow {
 namespace ctc {
 
+// Work done by a CTCBeamSearchDecoder since it was created or its stats were
+// reset, for tuning the beam width, label selection and scorer weights.
+struct CTCBeamSearchStats {
+  // Steps, and those of them that only updated the beams, see
+  // SetBlankSkipThreshold.
+  int64 frames = 0;
+  int64 skipped_frames = 0;
+  // Beams grown into children.
+  int64 beams_expanded = 0;
+  // Children expanded by the beam scorer, and children label selection or the
+  // scorer (see BaseBeamScorer::ValidatesExpansions) kept from being
+  // expanded.
+  int64 children_created = 0;
+  int64 children_pruned = 0;
+  // Time spent in Step and ExpandStateEnd, of which scorer_nanos in the state
+  // expansions of the beam scorer. Only measured when timing, see
+  // SetCollectTimings.
+  int64 decode_nanos = 0;
+  int64 scorer_nanos = 0;
+};
+
+namespace ctc_beam_search {
+
+// Adds the lifetime of the timer to *nanos, unless nanos is null.
+class ScopedNanosTimer {
+ public:
+  explicit ScopedNanosTimer(int64* nanos)
+      : nanos_(nanos),
+        start_(nanos == nullptr ? std::chrono::steady_clock::time_point()
+                                : std::chrono::steady_clock::now()) {}
+  ~ScopedNanosTimer() {
+    if (nanos_ != nullptr) {
+      *nanos_ += std::chrono::duration_cast<std::chrono::nanoseconds>(
+                     std::chrono::steady_clock::now() - start_)
+                     .count();
+    }
+  }
+
+ private:
+  int64* const nanos_;
+  const std::chrono::steady_clock::time_point start_;
+
+  TF_DISALLOW_COPY_AND_ASSIGN(ScopedNanosTimer);
+};
+
+}  // namespace ctc_beam_search
+
 template <typename CTCBeamState = ctc_beam_search::EmptyBeamState,
           typename CTCBeamComparer =
               ctc_beam_search::BeamComparer<CTCBeamState>>
@@ -86,7 +134,13 @@ class CTCBeamSearchDecoder : public CTCDecoder {
       : CTCDecoder(num_classes, batch_size, merge_repeated),
         beam_width_(beam_width),
         leaves_(beam_width),
+        input_(num_classes),
+        entries_(kEntriesPerBlock),
+        child_tables_(kChildTablesPerBlock * (num_classes - 1)),
+        beam_root_(nullptr),
         beam_scorer_(CHECK_NOTNULL(scorer)) {
+    branches_.reserve(beam_width);
+    label_selection_input_.reserve(num_classes);
     Reset();
   }
 
@@ -99,6 +153,9 @@ class CTCBeamSearchDecoder : public CTCDecoder {
                 CTCDecoder::ScoreOutput* scores) override;
 
   // Calculate the next step of the beam search and update the internal state.
+  // log_input_t may be any Eigen vector expression of num_classes
+  // log-probabilities, e.g. a Map of float or Eigen::half logits read in
+  // place; it is converted to float once, while being normalized.
   template <typename Vector>
   void Step(const Vector& log_input_t);
 
@@ -113,14 +170,53 @@ class CTCBeamSearchDecoder : public CTCDecoder {
     label_selection_margin_ = label_selection_margin;
   }
 
+  // Frames whose best label is the blank, with a log-probability above
+  // -blank_skip_threshold, only update the beams already in the beam search:
+  // no children are grown, so the scorer is never asked to expand a state.
+  // Such frames almost surely extend the best paths with a blank, and most
+  // frames of a typical model are. Zero, the default, disables skipping.
+  void SetBlankSkipThreshold(float blank_skip_threshold) {
+    blank_skip_threshold_ = blank_skip_threshold;
+  }
+
+  // Beams whose probability falls more than beam_threshold (in log space)
+  // below the best beam are dropped, and children that would start that far
+  // below are not added, even if there is room left within beam_width. With a
+  // threshold, beam_width only bounds the number of beams kept on hard frames.
+  // Zero, the default, disables the threshold.
+  void SetBeamThreshold(float beam_threshold) {
+    beam_threshold_ = beam_threshold;
+  }
+
+  // Also measures the time spent decoding and in the beam scorer, see
+  // CTCBeamSearchStats. Off by default: timing costs two clock reads per
+  // expanded child.
+  void SetCollectTimings(bool collect_timings) {
+    collect_timings_ = collect_timings;
+  }
+
+  // The work done since the decoder was created or ResetStats was called.
+  // Reset does not clear the stats.
+  const CTCBeamSearchStats& stats() const { return stats_; }
+  void ResetStats() { stats_ = CTCBeamSearchStats(); }
+
   // Reset the beam search
   void Reset();
 
+  // Gives the scorer a last chance to score every leaf, see
+  // BaseBeamScorer::ExpandStateEnd. Call once after the last Step of a
+  // sequence, before TopPaths; the decoder must be Reset before stepping again.
+  void ExpandStateEnd();
+
   // Extract the top n paths at current time step
   Status TopPaths(int n, std::vector<std::vector<int>>* paths,
                   std::vector<float>* log_probs, bool merge_repeated) const;
 
  private:
+  // Arena block sizes, in beam entries and in child tables.
+  static const int64 kEntriesPerBlock = 1024;
+  static const int64 kChildTablesPerBlock = 64;
+
   int beam_width_;
 
   // Label selection is designed to avoid possibly very expensive scorer calls,
@@ -136,8 +232,26 @@ class CTCBeamSearchDecoder : public CTCDecoder {
   int label_selection_size_ = 0;       // zero means unlimited
   float label_selection_margin_ = -1;  // -1 means unlimited.
 
-  gtl::TopN<BeamEntry*, CTCBeamComparer> leaves_;
-  std::unique_ptr<BeamEntry> beam_root_;
+  // See SetBlankSkipThreshold.
+  float blank_skip_threshold_ = 0;  // zero means never skip.
+
+  // See SetBeamThreshold.
+  float beam_threshold_ = 0;  // zero means unlimited.
+
+  bool collect_timings_ = false;
+  CTCBeamSearchStats stats_;
+
+  ctc_beam_search::BeamHeap<BeamEntry*, CTCBeamComparer> leaves_;
+  // Scratch buffers of Step, kept so that stepping doesn't allocate: the
+  // normalized input, the input sorted for label selection, and the beams of
+  // the previous step.
+  Eigen::ArrayXf input_;
+  std::vector<float> label_selection_input_;
+  std::vector<BeamEntry*> branches_;
+  // Storage for the beam tree and the per-beam child lookup tables.
+  ctc_beam_search::BeamArena<BeamEntry> entries_;
+  ctc_beam_search::BeamArena<BeamEntry*> child_tables_;
+  BeamEntry* beam_root_;
   BaseBeamScorer<CTCBeamState>* beam_scorer_;
 
   TF_DISALLOW_COPY_AND_ASSIGN(CTCBeamSearchDecoder);
@@ -173,16 +287,7 @@ Status CTCBeamSearchDecoder<CTCBeamState, CTCBeamComparer>::Decode(
       Step(input[t].row(b));
     }  // for (int t...
 
-    // O(n * log(n))
-    std::unique_ptr<std::vector<BeamEntry*>> branches(leaves_.Extract());
-    leaves_.Reset();
-    for (int i = 0; i < branches->size(); ++i) {
-      BeamEntry* entry = (*branches)[i];
-      beam_scorer_->ExpandStateEnd(&entry->state);
-      entry->newp.total +=
-          beam_scorer_->GetStateEndExpansionScore(entry->state);
-      leaves_.push(entry);
-    }
+    ExpandStateEnd();
 
     Status status =
         TopPaths(top_n, &beams, &beam_log_probabilities, merge_repeated_);
@@ -206,14 +311,26 @@ template <typename CTCBeamState, typename CTCBeamComparer>
 template <typename Vector>
 void CTCBeamSearchDecoder<CTCBeamState, CTCBeamComparer>::Step(
     const Vector& raw_input) {
-  Eigen::ArrayXf input = raw_input;
+  ctc_beam_search::ScopedNanosTimer step_timer(
+      collect_timings_ ? &stats_.decode_nanos : nullptr);
+  int64* const scorer_nanos = collect_timings_ ? &stats_.scorer_nanos : nullptr;
+  ++stats_.frames;
+  Eigen::ArrayXf& input = input_;
+  input = raw_input.template cast<float>();
   // Remove the max for stability when performing log-prob calculations.
   input -= input.maxCoeff();
 
+  // The blank log-probability is only normalized for frames led by the blank.
+  const bool skip_frame =
+      blank_skip_threshold_ > 0 && input(blank_index_) == 0 &&
+      -std::log(input.exp().sum()) > -blank_skip_threshold_;
+
   // Minimum allowed input value for label selection:
   float label_selection_input_min = -std::numeric_limits<float>::infinity();
-  if (label_selection_size_ > 0 && label_selection_size_ < input.size()) {
-    std::vector<float> input_copy(input.data(), input.data() + input.size());
+  if (!skip_frame && label_selection_size_ > 0 &&
+      label_selection_size_ < input.size()) {
+    std::vector<float>& input_copy = label_selection_input_;
+    input_copy.assign(input.data(), input.data() + input.size());
     std::nth_element(input_copy.begin(),
                      input_copy.begin() + label_selection_size_ - 1,
                      input_copy.end(), [](float a, float b) { return a > b; });
@@ -228,15 +345,18 @@ void CTCBeamSearchDecoder<CTCBeamState, CTCBeamComparer>::Step(
   // Extract the beams sorted in decreasing new probability
   CHECK_EQ(num_classes_, input.size());
 
-  std::unique_ptr<std::vector<BeamEntry*>> branches(leaves_.Extract());
-  leaves_.Reset();
+  std::vector<BeamEntry*>& branches = branches_;
+  leaves_.Extract(&branches);
 
-  for (BeamEntry* b : *branches) {
+  for (BeamEntry* b : branches) {
     // P(.. @ t) becomes the new P(.. @ t-1)
     b->oldp = b->newp;
   }
 
-  for (BeamEntry* b : *branches) {
+  // Best total probability in the beam at this step, see beam_threshold_.
+  float best_total = kLogZero;
+
+  for (BeamEntry* b : branches) {
     if (b->parent != nullptr) {  // if not the root
       if (b->parent->Active()) {
         // If last two sequence characters are identical:
@@ -258,73 +378,161 @@ void CTCBeamSearchDecoder<CTCBeamState, CTCBeamComparer>::Step(
     b->newp.blank = b->oldp.total + input(blank_index_);
     // P(l=abc @ t=6) = Plabel(l=abc @ t=6) + Pblank(l=abc @ t=6)
     b->newp.total = LogSumExp(b->newp.blank, b->newp.label);
+    best_total = std::max(best_total, b->newp.total);
+  }
 
+  for (BeamEntry* b : branches) {
+    if (beam_threshold_ > 0 && b->newp.total < best_total - beam_threshold_) {
+      // Out of the beam: signal it's no longer in the beam search, and keep
+      // it from growing new leaves below.
+      b->oldp.Reset();
+      b->newp.Reset();
+      continue;
+    }
     // Push the entry back to the top paths list.
     // Note, this will always fill leaves back up in sorted order.
     leaves_.push(b);
   }
 
+  if (skip_frame) {
+    ++stats_.skipped_frames;
+    return;
+  }
+
+  // Labels label selection lets through, counted to report the pruned
+  // children.
+  int num_selected_labels = num_classes_ - 1;
+  if (label_selection_input_min > -std::numeric_limits<float>::infinity()) {
+    num_selected_labels = 0;
+    for (int label = 0; label < num_classes_ - 1; ++label) {
+      if (input(label) >= label_selection_input_min) ++num_selected_labels;
+    }
+  }
+
   // we need to resort branches in descending oldp order.
 
   // branches is in descending oldp order because it was
   // originally in descending newp order and we copied newp to oldp.
 
-  // Grow new leaves
-  for (BeamEntry* b : *branches) {
-    // A new leaf (represented by its BeamProbability) is a candidate
-    // iff its total probability is nonzero and either the beam list
-    // isn't full, or the lowest probability entry in the beam has a
-    // lower probability than the leaf.
-    auto is_candidate = [this](const BeamProbability& prob) {
-      return (prob.total > kLogZero &&
-              (leaves_.size() < beam_width_ ||
-               prob.total > leaves_.peek_bottom()->newp.total));
-    };
+  // A new leaf (represented by its BeamProbability) is a candidate
+  // iff its total probability is nonzero and either the beam list
+  // isn't full, or the lowest probability entry in the beam has a
+  // lower probability than the leaf.
+  auto is_candidate = [this, &best_total](const BeamProbability& prob) {
+    return (prob.total > kLogZero &&
+            (beam_threshold_ <= 0 ||
+             prob.total >= best_total - beam_threshold_) &&
+            (leaves_.size() < beam_width_ ||
+             prob.total > leaves_.peek_bottom()->newp.total));
+  };
+
+  const bool validates_expansions = beam_scorer_->ValidatesExpansions();
+
+  if (beam_scorer_->BatchesExpansions()) {
+    ctc_beam_search::ScopedNanosTimer scorer_timer(scorer_nanos);
+    // Announce the children the loop below may expand. The beam only gets
+    // harder to enter as it grows, so these are a superset of the expanded
+    // ones, except for children dropped from the beam meanwhile.
+    for (BeamEntry* b : branches) {
+      if (!is_candidate(b->oldp)) {
+        continue;
+      }
+      for (int label = 0; label < num_classes_ - 1; ++label) {
+        if (input(label) < label_selection_input_min) {
+          continue;
+        }
+        const BeamEntry* c = b->HasChildren() ? b->GetChild(label) : nullptr;
+        if (c == nullptr && validates_expansions &&
+            !beam_scorer_->IsValidExpansion(b->state, b->label, label)) {
+          continue;
+        }
+        if (c == nullptr || !c->Active()) {
+          beam_scorer_->PrepareExpansion(b->state, b->label, label);
+        }
+      }
+    }
+    beam_scorer_->ResolveExpansions();
+  }
 
+  // Grow new leaves. The children are counted locally, out of the way of the
+  // scorer calls.
+  int64 children_created = 0;
+  int64 children_invalid = 0;
+  for (BeamEntry* b : branches) {
     if (!is_candidate(b->oldp)) {
       continue;
     }
-
-    if (!b->HasChildren()) {
-      b->PopulateChildren(num_classes_ - 1);
-    }
-
-    for (BeamEntry& c : *b->Children()) {
-      if (!c.Active()) {
-        // Perform label selection: if input for this label looks very
-        // unpromising, never evaluate it with a scorer.
-        if (input(c.label) < label_selection_input_min) {
+    ++stats_.beams_expanded;
+    stats_.children_pruned += num_classes_ - 1 - num_selected_labels;
+
+    for (int label = 0; label < num_classes_ - 1; ++label) {
+      // Perform label selection: if input for this label looks very
+      // unpromising, never evaluate it with a scorer.
+      if (input(label) < label_selection_input_min) {
+        continue;
+      }
+      if (!b->HasChildren()) {
+        b->PopulateChildren(child_tables_.NewArray(num_classes_ - 1));
+      }
+      BeamEntry* c = b->GetChild(label);
+      const bool is_new_child = (c == nullptr);
+      if (is_new_child) {
+        // Children only exist once they were found valid.
+        if (validates_expansions &&
+            !beam_scorer_->IsValidExpansion(b->state, b->label, label)) {
+          ++children_invalid;
           continue;
         }
+        // Only allocated for good if it makes it into the beam, see below.
+        c = entries_.New();
+        c->parent = b;
+        c->label = label;
+      }
+      if (!c->Active()) {
         //   Pblank(l=abcd @ t=6) = 0
-        c.newp.blank = kLogZero;
+        c->newp.blank = kLogZero;
         // If new child label is identical to beam label:
         //   Plabel(l=abcc @ t=6) = Pblank(l=abc @ t=5) * P(c @ 6)
         // Otherwise:
         //   Plabel(l=abcd @ t=6) = P(l=abc @ t=5) * P(d @ 6)
-        beam_scorer_->ExpandState(b->state, b->label, &c.state, c.label);
-        float previous = (c.label == b->label) ? b->oldp.blank : b->oldp.total;
-        c.newp.label = input(c.label) +
-                       beam_scorer_->GetStateExpansionScore(c.state, previous);
+        if (scorer_nanos == nullptr) {
+          beam_scorer_->ExpandState(b->state, b->label, &c->state, c->label);
+        } else {
+          ctc_beam_search::ScopedNanosTimer scorer_timer(scorer_nanos);
+          beam_scorer_->ExpandState(b->state, b->label, &c->state, c->label);
+        }
+        ++children_created;
+        float previous = (c->label == b->label) ? b->oldp.blank : b->oldp.total;
+        c->newp.label = input(c->label) +
+                        beam_scorer_->GetStateExpansionScore(c->state, previous);
         // P(l=abcd @ t=6) = Plabel(l=abcd @ t=6)
-        c.newp.total = c.newp.label;
+        c->newp.total = c->newp.label;
 
-        if (is_candidate(c.newp)) {
+        if (is_candidate(c->newp)) {
+          if (is_new_child) {
+            b->SetChild(label, c);
+          }
+          best_total = std::max(best_total, c->newp.total);
           BeamEntry* bottom = leaves_.peek_bottom();
-          leaves_.push(&c);
+          leaves_.push(c);
           if (leaves_.size() == beam_width_) {
             // Bottom is no longer in the beam search.  Reset
             // its probability; signal it's no longer in the beam search.
             bottom->newp.Reset();
           }
+        } else if (is_new_child) {
+          // Never entered the beam, give its storage back.
+          entries_.PopBack();
         } else {
           // Deactivate child (signal it's not in the beam)
-          c.oldp.Reset();
-          c.newp.Reset();
+          c->oldp.Reset();
+          c->newp.Reset();
         }
-      }  // if (!c.Active()) ...
-    }    // for (BeamEntry& c in children...
+      }  // if (!c->Active()) ...
+    }    // for (int label...
   }      // for (BeamEntry* b...
+  stats_.children_created += children_created;
+  stats_.children_pruned += children_invalid;
 }
 
 template <typename CTCBeamState, typename CTCBeamComparer>
@@ -332,18 +540,37 @@ void CTCBeamSearchDecoder<CTCBeamState, CTCBeamComparer>::Reset() {
   leaves_.Reset();
 
   // This beam root, and all of its children, will be in memory until
-  // the next reset.
-  beam_root_.reset(new BeamEntry(nullptr, -1, num_classes_ - 1, -1));
+  // the next reset. The arenas keep their blocks for the next utterance.
+  entries_.Clear();
+  child_tables_.Clear();
+  beam_root_ = entries_.New();
   beam_root_->newp.total = 0.0;  // ln(1)
   beam_root_->newp.blank = 0.0;  // ln(1)
 
   // Add the root as the initial leaf.
-  leaves_.push(beam_root_.get());
+  leaves_.push(beam_root_);
 
   // Call initialize state on the root object.
   beam_scorer_->InitializeState(&beam_root_->state);
 }
 
+template <typename CTCBeamState, typename CTCBeamComparer>
+void CTCBeamSearchDecoder<CTCBeamState, CTCBeamComparer>::ExpandStateEnd() {
+  ctc_beam_search::ScopedNanosTimer timer(
+      collect_timings_ ? &stats_.decode_nanos : nullptr);
+  int64* const scorer_nanos = collect_timings_ ? &stats_.scorer_nanos : nullptr;
+  // O(n * log(n))
+  leaves_.Extract(&branches_);
+  for (BeamEntry* entry : branches_) {
+    {
+      ctc_beam_search::ScopedNanosTimer scorer_timer(scorer_nanos);
+      beam_scorer_->ExpandStateEnd(&entry->state);
+    }
+    entry->newp.total += beam_scorer_->GetStateEndExpansionScore(entry->state);
+    leaves_.push(entry);
+  }
+}
+
 template <typename CTCBeamState, typename CTCBeamComparer>
 Status CTCBeamSearchDecoder<CTCBeamState, CTCBeamComparer>::TopPaths(
     int n, std::vector<std::vector<int>>* paths, std::vector<float>* log_probs,
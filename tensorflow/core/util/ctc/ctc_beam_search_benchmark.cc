@@ -0,0 +1,329 @@
+/* Copyright 2017 The TensorFlow Authors. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+// Benchmarks of CTCBeamSearchDecoder with the default scorer and with the
+// KenLM scorer on the test model in testdata/, and of building its trie.
+// Run with
+//
+//   bazel run -c opt //tensorflow/core/util/ctc:ctc_beam_search_benchmark -- \
+//       --benchmarks=all
+//
+// Items are frames, so the items/s column reads as frames per second. The
+// label of the decoding benchmarks reports the heap allocations and the
+// ExpandState calls per frame; BM_KenLMExpandState reports the time per
+// ExpandState call. The trie benchmarks count words as items.
+
+#include <atomic>
+#include <cstdlib>
+#include <memory>
+#include <new>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "tensorflow/core/lib/core/threadpool.h"
+#include "tensorflow/core/lib/random/simple_philox.h"
+#include "tensorflow/core/lib/strings/stringprintf.h"
+#include "tensorflow/core/platform/env.h"
+#include "tensorflow/core/platform/logging.h"
+#include "tensorflow/core/platform/test.h"
+#include "tensorflow/core/platform/test_benchmark.h"
+#include "tensorflow/core/util/ctc/ctc_beam_entry.h"
+#include "tensorflow/core/util/ctc/ctc_beam_scorer.h"
+#include "tensorflow/core/util/ctc/ctc_beam_search.h"
+#include "tensorflow/core/util/ctc/ctc_compact_trie.h"
+#include "tensorflow/core/util/ctc/ctc_trie_builder.h"
+#include "tensorflow/core/util/ctc/ctc_trie_node.h"
+#include "tensorflow/core/util/ctc/ctc_vocabulary.h"
+
+// Counts the heap allocations of the whole binary.
+static std::atomic<tensorflow::int64> num_allocations(0);
+
+void* operator new(size_t size) {
+  num_allocations.fetch_add(1, std::memory_order_relaxed);
+  void* p = malloc(size == 0 ? 1 : size);
+  if (p == nullptr) throw std::bad_alloc();
+  return p;
+}
+
+void operator delete(void* p) noexcept { free(p); }
+
+void* operator new[](size_t size) { return operator new(size); }
+
+void operator delete[](void* p) noexcept { operator delete(p); }
+
+namespace tensorflow {
+namespace ctc {
+namespace {
+
+using ctc_beam_search::EmptyBeamState;
+using ctc_beam_search::KenLMBeamState;
+
+typedef Eigen::Matrix<float, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor>
+    Logits;
+
+const char kKenLMDirectoryPath[] = "tensorflow/core/util/ctc/testdata";
+const char kVocabularyPath[] = "tensorflow/core/util/ctc/testdata/vocabulary";
+
+// Default scorer counting its ExpandState calls.
+class CountingBeamScorer : public BaseBeamScorer<EmptyBeamState> {
+ public:
+  void ExpandState(const EmptyBeamState& from_state, int from_label,
+                   EmptyBeamState* to_state, int to_label) const override {
+    ++num_expansions;
+  }
+
+  mutable int64 num_expansions = 0;
+};
+
+// KenLM scorer counting its ExpandState calls.
+class CountingKenLMBeamScorer : public KenLMBeamScorer {
+ public:
+  explicit CountingKenLMBeamScorer(const KenLMBeamScorer& scorer)
+      : KenLMBeamScorer(scorer) {}
+
+  void ExpandState(const KenLMBeamState& from_state, int from_label,
+                   KenLMBeamState* to_state, int to_label) const override {
+    ++num_expansions;
+    KenLMBeamScorer::ExpandState(from_state, from_label, to_state, to_label);
+  }
+
+  mutable int64 num_expansions = 0;
+};
+
+const KenLMBeamScorer& SharedKenLMBeamScorer() {
+  static KenLMBeamScorer* scorer = new KenLMBeamScorer(kKenLMDirectoryPath);
+  return *scorer;
+}
+
+// Synthetic log-probabilities of seq_len frames over num_classes labels
+// (the last one being the blank), following the label sequence path: every
+// frame favours the next label of path or the blank, like a trained acoustic
+// model does.
+Logits SyntheticLogits(int seq_len, int num_classes,
+                       const std::vector<int>& path) {
+  random::PhiloxRandom philox(301, 17);
+  random::SimplePhilox rnd(&philox);
+  Logits logits(seq_len, num_classes);
+  for (int t = 0; t < seq_len; ++t) {
+    for (int c = 0; c < num_classes; ++c) {
+      logits(t, c) = -8.0f * rnd.RandFloat();
+    }
+    const int label = (t % 2 == 0 && !path.empty())
+                          ? path[(t / 2) % path.size()]
+                          : num_classes - 1;
+    logits(t, label) = -0.1f * rnd.RandFloat();
+  }
+  return logits;
+}
+
+// Labels spelling a few words of the test language model.
+std::vector<int> KenLMPath() {
+  Vocabulary vocabulary(kVocabularyPath);
+  std::vector<int> path;
+  for (const wchar_t c : std::wstring(L"tomorrow it will rain ")) {
+    path.push_back(vocabulary.GetLabelFromCharacter(c));
+  }
+  return path;
+}
+
+template <typename State>
+void RunDecoder(int iters, const Logits& logits, int top_paths,
+                CTCBeamSearchDecoder<State>* decoder,
+                const int64* num_expansions) {
+  std::vector<std::vector<int>> paths;
+  std::vector<float> log_probs;
+  const int64 allocations_before = num_allocations.load();
+  const int64 expansions_before = *num_expansions;
+  testing::StartTiming();
+  for (int i = 0; i < iters; ++i) {
+    decoder->Reset();
+    for (int t = 0; t < logits.rows(); ++t) {
+      decoder->Step(logits.row(t));
+    }
+    decoder->ExpandStateEnd();
+    TF_CHECK_OK(decoder->TopPaths(top_paths, &paths, &log_probs, true));
+  }
+  testing::StopTiming();
+  const int64 frames = static_cast<int64>(iters) * logits.rows();
+  testing::ItemsProcessed(frames);
+  testing::SetLabel(strings::Printf(
+      "allocs/frame=%.2f expand_state/frame=%.1f",
+      static_cast<double>(num_allocations.load() - allocations_before) /
+          frames,
+      static_cast<double>(*num_expansions - expansions_before) / frames));
+}
+
+// Default scorer: sweeps beam_width and num_classes, 100 frames.
+void BM_BeamSearchDefault(int iters, int beam_width, int num_classes) {
+  testing::StopTiming();
+  const Logits logits = SyntheticLogits(100, num_classes, {0, 1, 2});
+  CountingBeamScorer scorer;
+  CTCBeamSearchDecoder<> decoder(num_classes, beam_width, &scorer);
+  RunDecoder(iters, logits, 1, &decoder, &scorer.num_expansions);
+}
+BENCHMARK(BM_BeamSearchDefault)
+    ->ArgPair(8, 29)
+    ->ArgPair(32, 29)
+    ->ArgPair(128, 29)
+    ->ArgPair(32, 100)
+    ->ArgPair(32, 1000)
+    ->ArgPair(32, 5000);
+
+// KenLM scorer: sweeps beam_width and the sequence length.
+void BM_BeamSearchKenLM(int iters, int beam_width, int seq_len) {
+  testing::StopTiming();
+  CountingKenLMBeamScorer scorer(SharedKenLMBeamScorer());
+  const std::vector<int> path = KenLMPath();
+  const int num_classes = Vocabulary(kVocabularyPath).GetSize() + 1;
+  const Logits logits = SyntheticLogits(seq_len, num_classes, path);
+  CTCBeamSearchDecoder<KenLMBeamState> decoder(num_classes, beam_width,
+                                               &scorer);
+  RunDecoder(iters, logits, 1, &decoder, &scorer.num_expansions);
+}
+BENCHMARK(BM_BeamSearchKenLM)
+    ->ArgPair(8, 200)
+    ->ArgPair(32, 200)
+    ->ArgPair(128, 200)
+    ->ArgPair(32, 50)
+    ->ArgPair(32, 800);
+
+// KenLM scorer with label selection: sweeps the label selection size and the
+// margin in tenths of a log-probability (0 disables either), beam_width 32
+// and 200 frames.
+void BM_BeamSearchKenLMLabelSelection(int iters, int size, int margin_tenths) {
+  testing::StopTiming();
+  CountingKenLMBeamScorer scorer(SharedKenLMBeamScorer());
+  const std::vector<int> path = KenLMPath();
+  const int num_classes = Vocabulary(kVocabularyPath).GetSize() + 1;
+  const Logits logits = SyntheticLogits(200, num_classes, path);
+  CTCBeamSearchDecoder<KenLMBeamState> decoder(num_classes, 32, &scorer);
+  decoder.SetLabelSelectionParameters(
+      size, margin_tenths == 0 ? -1.0f : margin_tenths / 10.0f);
+  RunDecoder(iters, logits, 1, &decoder, &scorer.num_expansions);
+}
+BENCHMARK(BM_BeamSearchKenLMLabelSelection)
+    ->ArgPair(0, 0)
+    ->ArgPair(10, 0)
+    ->ArgPair(5, 0)
+    ->ArgPair(0, 80)
+    ->ArgPair(0, 40)
+    ->ArgPair(5, 40);
+
+// Time per KenLMBeamScorer::ExpandState call, spelling the words of the test
+// sentence (one LM query per word).
+void BM_KenLMExpandState(int iters) {
+  testing::StopTiming();
+  const KenLMBeamScorer& scorer = SharedKenLMBeamScorer();
+  const std::vector<int> path = KenLMPath();
+  std::vector<KenLMBeamState> states(path.size() + 1);
+  scorer.InitializeState(&states[0]);
+  testing::StartTiming();
+  for (int i = 0; i < iters;) {
+    for (int j = 0; j < path.size() && i < iters; ++j, ++i) {
+      scorer.ExpandState(states[j], j == 0 ? -1 : path[j - 1], &states[j + 1],
+                         path[j]);
+    }
+  }
+  testing::StopTiming();
+  testing::ItemsProcessed(iters);
+}
+BENCHMARK(BM_KenLMExpandState);
+
+// num_words random words of 2 to 12 labels out of 28, with made up unigram
+// scores.
+std::vector<std::vector<int>> SyntheticLexicon(int num_words) {
+  random::PhiloxRandom philox(301, 17);
+  random::SimplePhilox rnd(&philox);
+  std::vector<std::vector<int>> words(num_words);
+  for (std::vector<int>& word : words) {
+    word.resize(2 + rnd.Uniform(11));
+    for (int& label : word) label = rnd.Uniform(28);
+  }
+  return words;
+}
+
+float SyntheticUnigramScore(lm::WordIndex word) {
+  return -1.0f - (word % 997) / 100.0f;
+}
+
+// CompactTrieBuilder, scoring on num_threads threads (0 scores inline).
+void BM_BuildTrie(int iters, int num_words, int num_threads) {
+  testing::StopTiming();
+  const std::vector<std::vector<int>> words = SyntheticLexicon(num_words);
+  std::unique_ptr<thread::ThreadPool> pool;
+  if (num_threads > 0) {
+    pool.reset(new thread::ThreadPool(Env::Default(), "bm", num_threads));
+  }
+  const int64 allocations_before = num_allocations.load();
+  int64 bytes = 0;
+  testing::StartTiming();
+  for (int i = 0; i < iters; ++i) {
+    CompactTrieBuilder builder(28);
+    for (int w = 0; w < num_words; ++w) {
+      TF_CHECK_OK(builder.AddWord(words[w], w + 1));
+    }
+    std::ostringstream out;
+    TF_CHECK_OK(builder.Write(SyntheticUnigramScore, pool.get(), &out));
+    bytes = out.tellp();
+  }
+  testing::StopTiming();
+  testing::ItemsProcessed(static_cast<int64>(iters) * num_words);
+  testing::SetLabel(strings::Printf(
+      "allocs/word=%.2f trie_bytes=%lld",
+      static_cast<double>(num_allocations.load() - allocations_before) /
+          (static_cast<double>(iters) * num_words),
+      static_cast<long long>(bytes)));
+}
+BENCHMARK(BM_BuildTrie)
+    ->ArgPair(10000, 0)
+    ->ArgPair(100000, 0)
+    ->ArgPair(1000000, 0)
+    ->ArgPair(1000000, 4);
+
+// The pointer-based TrieNode converted by CompactTrieWriter, as
+// ctc_generate_trie used to build tries, for reference.
+void BM_BuildTrieWithTrieNode(int iters, int num_words) {
+  testing::StopTiming();
+  const std::vector<std::vector<int>> words = SyntheticLexicon(num_words);
+  std::vector<std::wstring> spellings;
+  for (const std::vector<int>& word : words) {
+    // Labels spelled as characters that translate back to themselves.
+    spellings.emplace_back(word.begin(), word.end());
+    for (wchar_t& c : spellings.back()) ++c;
+  }
+  const int64 allocations_before = num_allocations.load();
+  testing::StartTiming();
+  for (int i = 0; i < iters; ++i) {
+    TrieNode root(28);
+    for (int w = 0; w < num_words; ++w) {
+      root.Insert(spellings[w].c_str(), [](wchar_t c) { return c - 1; },
+                  w + 1, SyntheticUnigramScore(w + 1));
+    }
+    std::ostringstream out;
+    CompactTrieWriter::Convert(&root, &out);
+  }
+  testing::StopTiming();
+  testing::ItemsProcessed(static_cast<int64>(iters) * num_words);
+  testing::SetLabel(strings::Printf(
+      "allocs/word=%.2f",
+      static_cast<double>(num_allocations.load() - allocations_before) /
+          (static_cast<double>(iters) * num_words)));
+}
+BENCHMARK(BM_BuildTrieWithTrieNode)->Arg(10000)->Arg(100000)->Arg(1000000);
+
+}  // namespace
+}  // namespace ctc
+}  // namespace tensorflow
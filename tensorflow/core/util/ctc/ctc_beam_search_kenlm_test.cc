@@ -13,15 +13,38 @@ See the License for the specific language governing permissions and
 limitations under the License.
 ==============================================================================*/
 
+#include <fstream>
+#include <sstream>
+
+#include "tensorflow/core/lib/core/status_test_util.h"
+#include "tensorflow/core/lib/core/threadpool.h"
+#include "tensorflow/core/lib/io/path.h"
+#include "tensorflow/core/platform/env.h"
 #include "tensorflow/core/platform/test.h"
 #include "tensorflow/core/util/ctc/ctc_beam_entry.h"
 #include "tensorflow/core/util/ctc/ctc_beam_scorer.h"
+#include "tensorflow/core/util/ctc/ctc_compact_trie.h"
+#include "tensorflow/core/util/ctc/ctc_hotword_trie.h"
+#include "tensorflow/core/util/ctc/ctc_kenlm_model.h"
+#include "tensorflow/core/util/ctc/ctc_lm_score_cache.h"
+#include "tensorflow/core/util/ctc/ctc_nbest_rescorer.h"
+#include "tensorflow/core/util/ctc/ctc_trie_builder.h"
 #include "tensorflow/core/util/ctc/ctc_vocabulary.h"
 #include "lm/model.hh"
 
 namespace {
 
+using tensorflow::ctc::CompactTrie;
+using tensorflow::ctc::CompactTrieBuilder;
+using tensorflow::ctc::CompactTrieNode;
+using tensorflow::ctc::CompactTrieWriter;
+using tensorflow::ctc::HotwordTrie;
 using tensorflow::ctc::KenLMBeamScorer;
+using tensorflow::ctc::KenLMModel;
+using tensorflow::ctc::LMScoreCache;
+using tensorflow::ctc::LMScoreCachePool;
+using tensorflow::ctc::NBestRescorer;
+using tensorflow::ctc::TrieNode;
 using tensorflow::ctc::ctc_beam_search::KenLMBeamState;
 using tensorflow::ctc::Vocabulary;
 
@@ -54,6 +77,7 @@ const int test_labels_typo[] = {19,19,19,19,28,28,14,28,28,12,12,12,28,14,14,14,
 const char *kenlm_directory_path = "./tensorflow/core/util/ctc/testdata";
 const char *vocabulary_path = "./tensorflow/core/util/ctc/testdata/vocabulary";
 const char *model_path = "./tensorflow/core/util/ctc/testdata/kenlm-model.binary";
+const char *trie_path = "./tensorflow/core/util/ctc/testdata/trie";
 
 KenLMBeamScorer *createKenLMBeamScorer() {
   return new KenLMBeamScorer(kenlm_directory_path);
@@ -142,25 +166,279 @@ TEST(KenLMBeamSearch, KenLMModelWithUtf16) {
   EXPECT_NEAR(-4.21812, score, 0.0001);
 }
 
-float ScoreBeam(KenLMBeamScorer *scorer, const int labels[], const int label_count) {
+const CompactTrieNode *WalkTrie(const CompactTrieNode *node,
+                                const std::wstring &word,
+                                const Vocabulary &vocabulary) {
+  for (wchar_t c : word) {
+    if (node == nullptr) break;
+    int label = -1;
+    for (int i = 0; i < vocabulary.GetSize(); i++) {
+      if (vocabulary.GetCharacterFromLabel(i) == c) label = i;
+    }
+    node = node->GetChildAt(label);
+  }
+  return node;
+}
+
+TEST(KenLMBeamSearch, CreateReportsMissingFiles) {
+  tensorflow::Env* env = tensorflow::Env::Default();
+  const tensorflow::string dir =
+      tensorflow::io::JoinPath(tensorflow::testing::TmpDir(), "no_trie");
+  TF_ASSERT_OK(env->RecursivelyCreateDir(dir));
+  for (const char* name : {KenLMBeamScorer::ModelFileName(),
+                           KenLMBeamScorer::VocabularyFileName()}) {
+    tensorflow::string contents;
+    TF_ASSERT_OK(tensorflow::ReadFileToString(
+        env, tensorflow::io::JoinPath(kenlm_directory_path, name), &contents));
+    TF_ASSERT_OK(tensorflow::WriteStringToFile(
+        env, tensorflow::io::JoinPath(dir, name), contents));
+  }
+
+  std::unique_ptr<KenLMBeamScorer> scorer;
+  tensorflow::Status s =
+      KenLMBeamScorer::Create(dir, util::POPULATE_OR_READ, &scorer);
+  EXPECT_EQ(tensorflow::error::NOT_FOUND, s.code()) << s;
+  EXPECT_EQ(nullptr, scorer);
+
+  TF_EXPECT_OK(KenLMBeamScorer::Create(kenlm_directory_path,
+                                       util::POPULATE_OR_READ, &scorer));
+  EXPECT_NE(nullptr, scorer);
+}
+
+TEST(KenLMBeamSearch, CompactTrieRoundTrip) {
+  const wchar_t char_list[] = L"abcdefghijklmnopqrstuvwxyz' ";
+  Vocabulary vocabulary(char_list, 28);
+  auto translator = [&vocabulary](wchar_t c) {
+    return vocabulary.GetLabelFromCharacter(c);
+  };
+
+  TrieNode root(vocabulary.GetSize());
+  root.Insert(L"rain", translator, 1, -2.0f);
+  root.Insert(L"rail", translator, 2, -3.0f);
+  root.Insert(L"it", translator, 3, -1.0f);
+
+  const std::string path =
+      tensorflow::io::JoinPath(tensorflow::testing::TmpDir(), "compact_trie");
+  {
+    std::ofstream out(path.c_str(), std::ios::out | std::ios::binary);
+    CompactTrieWriter::Convert(&root, &out);
+  }
+
+  std::unique_ptr<CompactTrie> trie;
+  TF_ASSERT_OK(CompactTrie::Load(tensorflow::Env::Default(), path,
+                                 vocabulary.GetSize(), nullptr, &trie));
+  // Root, "r", "ra", "rai", "rain", "rail", "i", "it".
+  EXPECT_EQ(8, trie->NumNodes());
+  EXPECT_EQ(3, trie->Root()->GetFrequency());
+  EXPECT_EQ(2, trie->Root()->GetNumChildren());
+
+  const CompactTrieNode *rai = WalkTrie(trie->Root(), L"rai", vocabulary);
+  ASSERT_NE(nullptr, rai);
+  EXPECT_EQ(2, rai->GetFrequency());
+  EXPECT_EQ(-3.0f, rai->GetMinUnigramScore());
+  EXPECT_EQ(2, rai->GetMinScoreWordIndex());
+  EXPECT_EQ(0, rai->GetWordIndex());
+  EXPECT_EQ(1, WalkTrie(trie->Root(), L"rain", vocabulary)->GetWordIndex());
+  EXPECT_EQ(2, WalkTrie(trie->Root(), L"rail", vocabulary)->GetWordIndex());
+
+  const CompactTrieNode *it = WalkTrie(trie->Root(), L"it", vocabulary);
+  ASSERT_NE(nullptr, it);
+  EXPECT_EQ(-1.0f, it->GetMinUnigramScore());
+  EXPECT_EQ(3, it->GetWordIndex());
+  EXPECT_EQ(0, it->GetNumChildren());
+
+  EXPECT_EQ(nullptr, WalkTrie(trie->Root(), L"rat", vocabulary));
+
+  // A trie built for a different alphabet is rejected.
+  EXPECT_FALSE(CompactTrie::Load(tensorflow::Env::Default(), path,
+                                 vocabulary.GetSize() + 1, nullptr,
+                                 &trie).ok());
+  EXPECT_FALSE(CompactTrie::Load(tensorflow::Env::Default(), path, -1,
+                                 nullptr, &trie).ok());
+
+  // A root record claiming more children than fit before the trailer, or an
+  // edge pointing out of the nodes, is rejected.
+  std::string contents;
+  {
+    std::ifstream in(path.c_str(), std::ios::in | std::ios::binary);
+    std::ostringstream buffer;
+    buffer << in.rdbuf();
+    contents = buffer.str();
+  }
+  tensorflow::ctc::CompactTrieTrailer trailer;
+  memcpy(&trailer, contents.data() + contents.size() - sizeof(trailer),
+         sizeof(trailer));
+  const size_t num_children_offset =
+      trailer.root_offset + sizeof(CompactTrieNode) - sizeof(uint32_t);
+  const size_t distance_offset = trailer.root_offset +
+                                 sizeof(CompactTrieNode) + sizeof(int32_t);
+  const uint32_t many_children = 1000;
+  const uint32_t far_distance = trailer.root_offset + 4;
+  const std::pair<size_t, uint32_t> corruptions[] = {
+      {num_children_offset, many_children}, {distance_offset, far_distance}};
+  for (const auto& corruption : corruptions) {
+    std::string corrupt = contents;
+    memcpy(&corrupt[corruption.first], &corruption.second, sizeof(uint32_t));
+    {
+      std::ofstream out(path.c_str(), std::ios::out | std::ios::binary);
+      out << corrupt;
+    }
+    EXPECT_EQ(tensorflow::error::DATA_LOSS,
+              CompactTrie::Load(tensorflow::Env::Default(), path,
+                                vocabulary.GetSize(), nullptr, &trie)
+                  .code());
+  }
+}
+
+TEST(KenLMBeamSearch, CompactTrieFromLegacyText) {
+  Vocabulary vocabulary(vocabulary_path);
+
+  // The text format does not store word indices, they are looked up.
+  auto lookup = [](const std::vector<int>& labels) {
+    return static_cast<lm::WordIndex>(100 + labels.size());
+  };
+  std::unique_ptr<CompactTrie> trie;
+  TF_ASSERT_OK(CompactTrie::Load(tensorflow::Env::Default(), trie_path,
+                                 vocabulary.GetSize(), lookup, &trie));
+  const CompactTrieNode *tomorrow =
+      WalkTrie(trie->Root(), L"tomorrow", vocabulary);
+  ASSERT_NE(nullptr, tomorrow);
+  EXPECT_EQ(108, tomorrow->GetWordIndex());
+  const CompactTrieNode *rain = WalkTrie(trie->Root(), L"rain", vocabulary);
+  ASSERT_NE(nullptr, rain);
+  EXPECT_EQ(104, rain->GetWordIndex());
+  EXPECT_EQ(0, WalkTrie(trie->Root(), L"tomo", vocabulary)->GetWordIndex());
+  EXPECT_EQ(nullptr, WalkTrie(trie->Root(), L"tomorow", vocabulary));
+}
+
+TEST(KenLMBeamSearch, CompactTrieBuilderMatchesConvert) {
+  const wchar_t char_list[] = L"abcdefghijklmnopqrstuvwxyz' ";
+  Vocabulary vocabulary(char_list, 28);
+  auto translator = [&vocabulary](wchar_t c) {
+    return vocabulary.GetLabelFromCharacter(c);
+  };
+  // Sorted, so that both tries break ties between equal scores alike.
+  const std::vector<std::wstring> words = {
+      L"a", L"i", L"in", L"it", L"rai", L"rail", L"rain", L"rains", L"raw"};
+  const float scores[] = {-1.5f, -1.0f, -2.0f, -1.0f, -4.0f,
+                          -3.0f, -2.0f, -3.0f, -2.5f};
+
+  TrieNode root(vocabulary.GetSize());
+  CompactTrieBuilder builder(vocabulary.GetSize());
+  // Added out of order and with a duplicate, which must be dropped.
+  for (int i = words.size() - 1; i >= 0; --i) {
+    root.Insert(words[i].c_str(), translator, i + 1, scores[i]);
+    std::vector<int> labels;
+    for (wchar_t c : words[i]) labels.push_back(translator(c));
+    TF_ASSERT_OK(builder.AddWord(labels, i + 1));
+    if (i == 5) TF_ASSERT_OK(builder.AddWord(labels, 100));
+  }
+  TF_ASSERT_OK(builder.AddWord({}, 101));
+  EXPECT_FALSE(builder.AddWord({28}, 102).ok());
+  EXPECT_EQ(10, builder.NumWords());
+
+  std::ostringstream expected;
+  CompactTrieWriter::Convert(&root, &expected);
+  tensorflow::thread::ThreadPool pool(tensorflow::Env::Default(), "test", 3);
+  std::ostringstream built;
+  TF_ASSERT_OK(builder.Write(
+      [&scores](lm::WordIndex word) { return scores[word - 1]; }, &pool,
+      &built));
+  EXPECT_EQ(expected.str(), built.str());
+  EXPECT_EQ(1, builder.NumDuplicates());
+  // Root, "a", "i", "in", "it", "r", "ra", "rai", "rail", "rain", "rains",
+  // "raw".
+  EXPECT_EQ(12, builder.NumNodes());
+}
+
+TEST(KenLMBeamSearch, KenLMModelWords) {
+  std::unique_ptr<KenLMModel> model;
+  std::vector<std::string> words;
+  TF_ASSERT_OK(
+      KenLMModel::Load(model_path, util::POPULATE_OR_READ, &model, &words));
+  for (const char *word : {"tomorrow", "it", "will", "rain"}) {
+    const lm::WordIndex index = model->Index(word);
+    ASSERT_NE(model->NotFound(), index);
+    ASSERT_LT(index, words.size());
+    EXPECT_EQ(word, words[index]);
+  }
+  EXPECT_EQ("</s>", words[model->EndSentence()]);
+}
+
+TEST(KenLMBeamSearch, LMScoreCache) {
+  typedef lm::ngram::State State;
+  LMScoreCache<State> cache(100);
+  EXPECT_EQ(128, cache.capacity());
+
+  State context;
+  context.length = 1;
+  context.words[0] = 7;
+  State next;
+  next.length = 2;
+  next.words[0] = 3;
+  next.words[1] = 7;
+
+  State out;
+  float prob;
+  EXPECT_FALSE(cache.Lookup(context, 3, &out, &prob));
+  cache.Insert(context, 3, next, -1.5f);
+  ASSERT_TRUE(cache.Lookup(context, 3, &out, &prob));
+  EXPECT_EQ(-1.5f, prob);
+  EXPECT_TRUE(out == next);
+  EXPECT_FALSE(cache.Lookup(context, 4, &out, &prob));
+  EXPECT_FALSE(cache.Lookup(next, 3, &out, &prob));
+
+  EXPECT_EQ(1, cache.hits());
+  EXPECT_EQ(3, cache.misses());
+}
+
+TEST(KenLMBeamSearch, LMScoreCachePool) {
+  typedef lm::ngram::State State;
+  LMScoreCachePool<State> pool(16);
+  std::unique_ptr<LMScoreCache<State>> first = pool.Take();
+  std::unique_ptr<LMScoreCache<State>> second = pool.Take();
+  EXPECT_NE(first.get(), second.get());
+  EXPECT_EQ(16, first->capacity());
+
+  // A returned cache is handed out again with its contents.
+  State context;
+  context.length = 0;
+  first->Insert(context, 3, context, -1.5f);
+  LMScoreCache<State>* const first_ptr = first.get();
+  pool.Return(std::move(first));
+  std::unique_ptr<LMScoreCache<State>> again = pool.Take();
+  EXPECT_EQ(first_ptr, again.get());
+  State out;
+  float prob;
+  EXPECT_TRUE(again->Lookup(context, 3, &out, &prob));
+}
+
+// With batched, every expansion is prepared and resolved first, like the
+// decoder does for scorers batching their expansions.
+float ScoreBeam(KenLMBeamScorer *scorer, const int labels[], const int label_count,
+                bool batched = false) {
   KenLMBeamState states[2];
   scorer->InitializeState(&states[0]);
 
   int from_label = -1;
   float score = 0.0f;
-  std::wstring incomplete_word;
+  const tensorflow::ctc::CompactTrieNode *trie_node = nullptr;
   for (int i = 0; i < label_count; i++) {
     int to_label = labels[i];
     KenLMBeamState &from_state = states[i % 2];
     KenLMBeamState &to_state = states[(i + 1) % 2];
     
+    if (batched) {
+      scorer->PrepareExpansion(from_state, from_label, to_label);
+      scorer->ResolveExpansions();
+    }
     scorer->ExpandState(from_state, from_label, &to_state, to_label);
     float new_score = scorer->GetStateExpansionScore(to_state, score);
     EXPECT_NEAR(new_score, to_state.score, 0.0001);
-    if (incomplete_word == to_state.incomplete_word) {
+    if (trie_node == to_state.incomplete_word_trie_node) {
       EXPECT_NEAR(score, new_score, 0.0001);
     }
-    incomplete_word = to_state.incomplete_word;
+    trie_node = to_state.incomplete_word_trie_node;
     score = new_score;
     
     // Update from_label for next iteration
@@ -208,4 +486,231 @@ TEST(KenLMBeamSearch, ExpandState) {
   EXPECT_NEAR(-4.21812, log_prob, 0.0001);
 }
 
+TEST(KenLMBeamSearch, ExpandStateWithScoreCache) {
+  KenLMBeamScorer *scorer = createKenLMBeamScorer();
+  LMScoreCache<KenLMBeamScorer::Model::State> cache(1024);
+  scorer->SetScoreCache(&cache);
+
+  float log_prob = ScoreBeam(scorer, test_labels, test_labels_count);
+  EXPECT_NEAR(-4.21812, log_prob, 0.0001);
+  EXPECT_GT(cache.misses(), 0);
+
+  // Scoring the same beam again is served from the cache, also through a
+  // scorer copy using the same cache.
+  const tensorflow::int64 misses = cache.misses();
+  KenLMBeamScorer copy(*scorer);
+  copy.SetScoreCache(&cache);
+  EXPECT_NEAR(log_prob, ScoreBeam(&copy, test_labels, test_labels_count),
+              0.0001);
+  EXPECT_EQ(misses, cache.misses());
+  EXPECT_GT(cache.hits(), 0);
+
+  delete scorer;
+}
+
+TEST(KenLMBeamSearch, ExpandStateBatched) {
+  KenLMBeamScorer *scorer = createKenLMBeamScorer();
+  EXPECT_TRUE(scorer->BatchesExpansions());
+
+  EXPECT_NEAR(-4.21812, ScoreBeam(scorer, test_labels, test_labels_count, true),
+              0.0001);
+  // Batched scores go through the score cache too.
+  LMScoreCache<KenLMBeamScorer::Model::State> cache(1024);
+  scorer->SetScoreCache(&cache);
+  EXPECT_NEAR(-4.21812, ScoreBeam(scorer, test_labels, test_labels_count, true),
+              0.0001);
+  EXPECT_GT(cache.misses(), 0);
+
+  delete scorer;
+}
+
+TEST(KenLMBeamSearch, HotwordTrie) {
+  // Labels of "a", "ab", "ab c" and "ab cd", the space being label 3.
+  HotwordTrie trie(5, 3);
+  TF_ASSERT_OK(trie.AddPhrase({0, 1}, 1.0f));
+  TF_ASSERT_OK(trie.AddPhrase({0, 1, 3, 2, 4}, 5.0f));
+  EXPECT_FALSE(trie.AddPhrase({}, 1.0f).ok());
+  EXPECT_FALSE(trie.AddPhrase({3, 0}, 1.0f).ok());
+  EXPECT_FALSE(trie.AddPhrase({0, 5}, 1.0f).ok());
+  EXPECT_FALSE(trie.AddPhrase({0}, -1.0f).ok());
+  trie.Finalize();
+  EXPECT_EQ(6, trie.NumNodes());
+
+  // "ab cd" earns its boost label by label.
+  float completed = 0.0f;
+  tensorflow::int32 node = HotwordTrie::kRoot;
+  for (int label : {0, 1, 3, 2}) {
+    node = trie.Next(node, label, &completed);
+    ASSERT_NE(HotwordTrie::kNoNode, node);
+  }
+  EXPECT_EQ(0.0f, completed);
+  EXPECT_NEAR(4.0f, trie.Potential(node), 1e-6);
+  node = trie.Next(node, 4, &completed);
+  EXPECT_EQ(5.0f, trie.End(node));
+  EXPECT_EQ(HotwordTrie::kRoot, trie.Next(node, 3, &completed));
+  EXPECT_EQ(5.0f, completed);
+
+  // "ab ca" keeps the boost of "ab" and starts over at the next word.
+  completed = 0.0f;
+  node = HotwordTrie::kRoot;
+  for (int label : {0, 1, 3, 2, 0}) {
+    node = trie.Next(node, label, &completed);
+  }
+  EXPECT_EQ(HotwordTrie::kNoNode, node);
+  EXPECT_EQ(1.0f, completed);
+  EXPECT_EQ(0.0f, trie.Potential(node));
+  EXPECT_EQ(HotwordTrie::kRoot, trie.Next(node, 3, &completed));
+
+  // Phrases only start at the beginning of a word: "bab" matches nothing.
+  completed = 0.0f;
+  node = trie.Next(HotwordTrie::kRoot, 1, &completed);
+  EXPECT_EQ(HotwordTrie::kNoNode, node);
+  node = trie.Next(trie.Next(node, 0, &completed), 1, &completed);
+  EXPECT_EQ(HotwordTrie::kNoNode, node);
+  EXPECT_EQ(0.0f, completed + trie.End(node));
+}
+
+// Expands the beam spelling sentence one character at a time, as the
+// decoder does, and returns its total expansion score.
+float ScoreSentence(KenLMBeamScorer *scorer, const std::wstring& sentence) {
+  Vocabulary vocabulary(vocabulary_path);
+  KenLMBeamState states[2];
+  scorer->InitializeState(&states[0]);
+  int from_label = -1;
+  float score = 0.0f;
+  for (size_t i = 0; i < sentence.size(); ++i) {
+    const int to_label = vocabulary.GetLabelFromCharacter(sentence[i]);
+    scorer->ExpandState(states[i % 2], from_label, &states[(i + 1) % 2],
+                        to_label);
+    score = scorer->GetStateExpansionScore(states[(i + 1) % 2], score);
+    from_label = to_label;
+  }
+  KenLMBeamState &end_state = states[sentence.size() % 2];
+  scorer->ExpandStateEnd(&end_state);
+  return score + scorer->GetStateEndExpansionScore(end_state);
+}
+
+TEST(KenLMBeamSearch, Hotwords) {
+  std::unique_ptr<KenLMBeamScorer> scorer(createKenLMBeamScorer());
+  const std::wstring sentence = L"tomorrow it will rain";
+  const float log_prob = ScoreSentence(scorer.get(), sentence);
+
+  // Completed phrases add their boost, whether they end with a space or the
+  // sentence; phrases left midway add nothing.
+  TF_ASSERT_OK(scorer->SetHotwords({"will rain", "tomorrowland", "it"},
+                                   {1.5f, 2.0f, 0.5f}));
+  EXPECT_NEAR(log_prob + 2.0f, ScoreSentence(scorer.get(), sentence), 1e-4);
+
+  // Copies share the hotwords, the scorer they were set on is left alone.
+  KenLMBeamScorer copy(*scorer);
+  TF_ASSERT_OK(copy.SetHotwords({"tomorrow"}, {3.0f}));
+  EXPECT_NEAR(log_prob + 3.0f, ScoreSentence(&copy, sentence), 1e-4);
+  EXPECT_NEAR(log_prob + 2.0f, ScoreSentence(scorer.get(), sentence), 1e-4);
+
+  EXPECT_FALSE(scorer->SetHotwords({"rain"}, {}).ok());
+  EXPECT_FALSE(scorer->SetHotwords({"rain!"}, {1.0f}).ok());
+  TF_ASSERT_OK(scorer->SetHotwords({}, {}));
+  EXPECT_NEAR(log_prob, ScoreSentence(scorer.get(), sentence), 1e-4);
+}
+
+TEST(KenLMBeamSearch, StrictLexicon) {
+  std::unique_ptr<KenLMBeamScorer> scorer(createKenLMBeamScorer());
+  EXPECT_FALSE(scorer->ValidatesExpansions());
+  scorer->SetStrictLexicon(true);
+  EXPECT_TRUE(scorer->ValidatesExpansions());
+  EXPECT_TRUE(KenLMBeamScorer(*scorer).ValidatesExpansions());
+
+  Vocabulary vocabulary(vocabulary_path);
+  const int space = vocabulary.GetLabelFromCharacter(' ');
+  auto label = [&vocabulary](wchar_t c) {
+    return vocabulary.GetLabelFromCharacter(c);
+  };
+  KenLMBeamState states[2];
+  scorer->InitializeState(&states[0]);
+  // Spelling "will", none of whose prefixes is a word, the empty one
+  // included.
+  const std::wstring word = L"will";
+  int from_label = -1;
+  for (size_t i = 0; i < word.size(); ++i) {
+    const KenLMBeamState& from_state = states[i % 2];
+    EXPECT_FALSE(scorer->IsValidExpansion(from_state, from_label, space));
+    EXPECT_FALSE(scorer->IsValidExpansion(from_state, from_label, label('q')));
+    ASSERT_TRUE(
+        scorer->IsValidExpansion(from_state, from_label, label(word[i])));
+    scorer->ExpandState(from_state, from_label, &states[(i + 1) % 2],
+                        label(word[i]));
+    from_label = label(word[i]);
+  }
+  EXPECT_TRUE(scorer->IsValidExpansion(states[word.size() % 2], from_label,
+                                       space));
+}
+
+TEST(KenLMBeamSearch, NBestRescorer) {
+  std::unique_ptr<NBestRescorer> rescorer;
+  TF_ASSERT_OK(NBestRescorer::Create(model_path, vocabulary_path,
+                                     util::LAZY, &rescorer));
+  const Vocabulary &vocabulary = rescorer->vocabulary();
+  auto labels = [&vocabulary](const std::wstring &sentence) {
+    std::vector<int> result;
+    for (const wchar_t c : sentence) {
+      result.push_back(vocabulary.GetLabelFromCharacter(c));
+    }
+    return result;
+  };
+
+  // Scored as in KenLMModel, repeated and surrounding spaces aside.
+  NBestRescorer::SentenceScore score;
+  std::vector<int> sentence = labels(L" tomorrow it  will rain ");
+  TF_ASSERT_OK(rescorer->Score(sentence.data(), sentence.size(), &score));
+  EXPECT_NEAR(-4.21812, score.lm_score, 0.0001);
+  EXPECT_EQ(4, score.num_words);
+  EXPECT_EQ(0, score.num_oov_words);
+
+  // Labels of any integer type, as the int64 values of the decoder outputs.
+  const std::vector<int> typo_labels = labels(L"tomorow it will rain");
+  const std::vector<tensorflow::int64> typo(typo_labels.begin(),
+                                            typo_labels.end());
+  TF_ASSERT_OK(rescorer->Score(typo.data(), typo.size(), &score));
+  EXPECT_GT(-4.21812, score.lm_score);
+  EXPECT_EQ(4, score.num_words);
+  EXPECT_EQ(1, score.num_oov_words);
+
+  TF_ASSERT_OK(rescorer->Score(sentence.data(), 0, &score));
+  EXPECT_EQ(0, score.num_words);
+
+  sentence.push_back(vocabulary.GetSize());
+  EXPECT_FALSE(
+      rescorer->Score(sentence.data(), sentence.size(), &score).ok());
+}
+
+TEST(KenLMBeamSearch, SequenceExpansionScore) {
+  std::unique_ptr<NBestRescorer> rescorer;
+  TF_ASSERT_OK(NBestRescorer::Create(model_path, vocabulary_path,
+                                     util::LAZY, &rescorer));
+  const Vocabulary &vocabulary = rescorer->vocabulary();
+  std::vector<int> sentence;
+  for (const wchar_t c : std::wstring(L"tomorrow it will rain")) {
+    sentence.push_back(vocabulary.GetLabelFromCharacter(c));
+  }
+
+  // The expansion scores of a beam add up to the weighted sentence score.
+  std::unique_ptr<KenLMBeamScorer> scorer(createKenLMBeamScorer());
+  float score;
+  TF_ASSERT_OK(scorer->GetSequenceExpansionScore(sentence.data(),
+                                                 sentence.size(), &score));
+  EXPECT_NEAR(-4.21812, score, 0.0001);
+
+  scorer->SetLMWeight(0.5);
+  scorer->SetValidWordCountWeight(1.0);
+  TF_ASSERT_OK(scorer->GetSequenceExpansionScore(sentence.data(),
+                                                 sentence.size(), &score));
+  EXPECT_NEAR(0.5 * (-4.21812 + 4), score, 0.0001);
+
+  sentence.push_back(vocabulary.GetSize());
+  EXPECT_FALSE(scorer
+                   ->GetSequenceExpansionScore(sentence.data(),
+                                               sentence.size(), &score)
+                   .ok());
+}
+
 }  // namespace
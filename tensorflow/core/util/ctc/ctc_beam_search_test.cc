@@ -18,7 +18,9 @@ limitations under the License.
 // words.
 #include "tensorflow/core/util/ctc/ctc_beam_search.h"
 
+#include <algorithm>
 #include <cmath>
+#include <utility>
 #include "tensorflow/core/lib/strings/strcat.h"
 #include "tensorflow/core/platform/test.h"
 
@@ -26,6 +28,7 @@ namespace {
 
 typedef std::vector<std::vector<std::vector<float>>> TestData;
 using tensorflow::ctc::CTCBeamSearchDecoder;
+using tensorflow::ctc::CTCBeamSearchStats;
 using tensorflow::ctc::CTCDecoder;
 
 // The HistoryBeamState is used to keep track of the current candidate and
@@ -300,4 +303,431 @@ TEST(CtcBeamSearch, LabelSelection) {
   }
 }
 
+TEST(CtcBeamSearch, StepwiseDecodingMatchesDecode) {
+  const int batch_size = 1;
+  const int timesteps = 5;
+  const int top_paths = 3;
+  const int num_classes = 6;
+
+  DictionaryBeamScorer dictionary_scorer;
+  CTCBeamSearchDecoder<HistoryBeamState> decoder(num_classes, top_paths,
+                                                 &dictionary_scorer);
+
+  int sequence_lengths[batch_size] = {timesteps};
+  float input_data_mat[timesteps][batch_size][num_classes] = {
+      {{0, 0.6, 0, 0.4, 0, 0}},
+      {{0, 0.5, 0, 0.5, 0, 0}},
+      {{0, 0.4, 0, 0.6, 0, 0}},
+      {{0, 0.4, 0, 0.6, 0, 0}},
+      {{0, 0.4, 0, 0.6, 0, 0}}};
+  for (int t = 0; t < timesteps; ++t) {
+    for (int c = 0; c < num_classes; ++c) {
+      input_data_mat[t][0][c] = std::log(input_data_mat[t][0][c]);
+    }
+  }
+
+  Eigen::Map<const Eigen::ArrayXi> seq_len(&sequence_lengths[0], batch_size);
+  std::vector<Eigen::Map<const Eigen::MatrixXf>> inputs;
+  for (int t = 0; t < timesteps; ++t) {
+    inputs.emplace_back(&input_data_mat[t][0][0], batch_size, num_classes);
+  }
+  std::vector<CTCDecoder::Output> outputs(top_paths);
+  for (CTCDecoder::Output& output : outputs) {
+    output.resize(batch_size);
+  }
+  float score[batch_size][top_paths] = {{0.0}};
+  Eigen::Map<Eigen::MatrixXf> scores(&score[0][0], batch_size, top_paths);
+  EXPECT_TRUE(decoder.Decode(seq_len, inputs, &outputs, &scores).ok());
+
+  // Feed the same input one step at a time, looking at the partial results
+  // as a streaming client would.
+  decoder.Reset();
+  std::vector<std::vector<int>> paths;
+  std::vector<float> log_probs;
+  for (int t = 0; t < timesteps; ++t) {
+    decoder.Step(inputs[t].row(0));
+    EXPECT_TRUE(decoder.TopPaths(top_paths, &paths, &log_probs, true).ok());
+    EXPECT_EQ(top_paths, paths.size());
+  }
+  decoder.ExpandStateEnd();
+  EXPECT_TRUE(decoder.TopPaths(top_paths, &paths, &log_probs, true).ok());
+  for (int path = 0; path < top_paths; ++path) {
+    EXPECT_EQ(outputs[path][0], paths[path]);
+    EXPECT_FLOAT_EQ(-score[0][path], log_probs[path]);
+  }
+}
+
+// Default scorer counting the states it expands.
+class CountingBeamScorer : public CTCBeamSearchDecoder<>::DefaultBeamScorer {
+ public:
+  void ExpandState(const tensorflow::ctc::ctc_beam_search::EmptyBeamState&,
+                   int,
+                   tensorflow::ctc::ctc_beam_search::EmptyBeamState*,
+                   int) const override {
+    ++num_expansions;
+  }
+
+  mutable int num_expansions = 0;
+};
+
+TEST(CtcBeamSearch, BlankSkipping) {
+  const int timesteps = 20;
+  const int num_classes = 4;
+  const int blank = num_classes - 1;
+  const int top_paths = 1;
+
+  // Blank frames with a blank probability of 0.97, except for three frames
+  // spelling 1 2 1.
+  std::vector<float> input_data(timesteps * num_classes);
+  for (int t = 0; t < timesteps; ++t) {
+    int label = blank;
+    float p = 0.97;
+    if (t == 3 || t == 15) label = 1;
+    if (t == 10) label = 2;
+    if (label != blank) p = 0.9;
+    for (int c = 0; c < num_classes; ++c) {
+      input_data[t * num_classes + c] =
+          std::log(c == label ? p : (1 - p) / (num_classes - 1));
+    }
+  }
+
+  std::vector<std::vector<int>> paths[2];
+  std::vector<float> log_probs[2];
+  int num_expansions[2];
+  for (int skip = 0; skip < 2; ++skip) {
+    CountingBeamScorer scorer;
+    CTCBeamSearchDecoder<> decoder(num_classes, 8, &scorer);
+    decoder.SetBlankSkipThreshold(skip ? 0.05 : 0);
+    for (int t = 0; t < timesteps; ++t) {
+      decoder.Step(Eigen::Map<const Eigen::ArrayXf>(
+          &input_data[t * num_classes], num_classes));
+    }
+    EXPECT_TRUE(
+        decoder.TopPaths(top_paths, &paths[skip], &log_probs[skip], true).ok());
+    num_expansions[skip] = scorer.num_expansions;
+  }
+
+  EXPECT_EQ(std::vector<int>({1, 2, 1}), paths[0][0]);
+  EXPECT_EQ(paths[0], paths[1]);
+  // Skipping only drops alignments that emit a label at a blank frame.
+  EXPECT_NEAR(log_probs[0][0], log_probs[1][0], 0.1);
+  EXPECT_LE(log_probs[1][0], log_probs[0][0]);
+  // Only the three label frames expand states.
+  EXPECT_LT(num_expansions[1] * 4, num_expansions[0]);
+}
+
+TEST(CtcBeamSearch, BeamThreshold) {
+  const int timesteps = 12;
+  const int num_classes = 6;
+  const int blank = num_classes - 1;
+  const int top_paths = 1;
+
+  // Confident frames spelling 1 2 3, separated by blanks.
+  std::vector<float> input_data(timesteps * num_classes);
+  for (int t = 0; t < timesteps; ++t) {
+    const int label = (t % 4 == 1) ? 1 + t / 4 : blank;
+    for (int c = 0; c < num_classes; ++c) {
+      input_data[t * num_classes + c] =
+          std::log(c == label ? 0.9 : 0.1 / (num_classes - 1));
+    }
+  }
+
+  std::vector<std::vector<int>> paths[2];
+  std::vector<float> log_probs[2];
+  int num_expansions[2];
+  for (int pruned = 0; pruned < 2; ++pruned) {
+    CountingBeamScorer scorer;
+    CTCBeamSearchDecoder<> decoder(num_classes, 16, &scorer);
+    decoder.SetBeamThreshold(pruned ? 3 : 0);
+    for (int t = 0; t < timesteps; ++t) {
+      decoder.Step(Eigen::Map<const Eigen::ArrayXf>(
+          &input_data[t * num_classes], num_classes));
+    }
+    EXPECT_TRUE(decoder
+                    .TopPaths(top_paths, &paths[pruned], &log_probs[pruned],
+                              true)
+                    .ok());
+    num_expansions[pruned] = scorer.num_expansions;
+  }
+
+  EXPECT_EQ(std::vector<int>({1, 2, 3}), paths[0][0]);
+  EXPECT_EQ(paths[0], paths[1]);
+  EXPECT_NEAR(log_probs[0][0], log_probs[1][0], 0.1);
+  // The unlikely beams, which fill the beam without a threshold, are not
+  // expanded.
+  EXPECT_LT(num_expansions[1] * 4, num_expansions[0]);
+}
+
+// Default scorer batching its expansions, checking that the decoder
+// prepares the children it expands.
+class BatchingBeamScorer : public CTCBeamSearchDecoder<>::DefaultBeamScorer {
+ public:
+  typedef tensorflow::ctc::ctc_beam_search::EmptyBeamState State;
+
+  explicit BatchingBeamScorer(bool batch) : batch_(batch) {}
+
+  bool BatchesExpansions() const override { return batch_; }
+
+  void PrepareExpansion(const State& from_state, int from_label,
+                        int to_label) const override {
+    if (resolved_) {
+      prepared_.clear();
+      resolved_ = false;
+    }
+    prepared_.emplace_back(&from_state, to_label);
+  }
+
+  void ResolveExpansions() const override {
+    if (resolved_) prepared_.clear();
+    resolved_ = true;
+    next_ = 0;
+    ++num_resolves;
+  }
+
+  void ExpandState(const State& from_state, int from_label, State* to_state,
+                   int to_label) const override {
+    ++num_expansions;
+    EXPECT_TRUE(resolved_);
+    auto it = std::find(prepared_.begin() + next_, prepared_.end(),
+                        std::make_pair(&from_state, to_label));
+    if (it == prepared_.end()) {
+      ++num_unprepared;
+    } else {
+      next_ = it - prepared_.begin() + 1;
+    }
+  }
+
+  mutable int num_resolves = 0;
+  mutable int num_expansions = 0;
+  mutable int num_unprepared = 0;
+
+ private:
+  const bool batch_;
+  mutable std::vector<std::pair<const State*, int>> prepared_;
+  mutable bool resolved_ = true;
+  mutable int next_ = 0;
+};
+
+TEST(CtcBeamSearch, BatchedExpansions) {
+  const int timesteps = 30;
+  const int num_classes = 8;
+  const int top_paths = 3;
+
+  // Arbitrary, but deterministic, log-probabilities.
+  std::vector<float> input_data(timesteps * num_classes);
+  for (int t = 0; t < timesteps; ++t) {
+    for (int c = 0; c < num_classes; ++c) {
+      input_data[t * num_classes + c] =
+          -2.0f * (1.0f + std::sin(0.7f * t + 1.9f * c + 0.1f * t * c));
+    }
+  }
+
+  std::vector<std::vector<int>> paths[2];
+  std::vector<float> log_probs[2];
+  for (int batch = 0; batch < 2; ++batch) {
+    BatchingBeamScorer scorer(batch);
+    CTCBeamSearchDecoder<> decoder(num_classes, 10, &scorer);
+    for (int t = 0; t < timesteps; ++t) {
+      decoder.Step(Eigen::Map<const Eigen::ArrayXf>(
+          &input_data[t * num_classes], num_classes));
+    }
+    EXPECT_TRUE(
+        decoder.TopPaths(top_paths, &paths[batch], &log_probs[batch], true)
+            .ok());
+    if (batch) {
+      EXPECT_EQ(timesteps, scorer.num_resolves);
+      EXPECT_GT(scorer.num_expansions, 0);
+      EXPECT_LE(scorer.num_unprepared * 10, scorer.num_expansions);
+    } else {
+      EXPECT_EQ(0, scorer.num_resolves);
+    }
+  }
+
+  // Batching does not change the decoding.
+  EXPECT_EQ(paths[0], paths[1]);
+  EXPECT_EQ(log_probs[0], log_probs[1]);
+}
+
+// Default scorer ruling label 2 out, and checking that the decoder never
+// expands it.
+class ValidatingBeamScorer : public CTCBeamSearchDecoder<>::DefaultBeamScorer {
+ public:
+  typedef tensorflow::ctc::ctc_beam_search::EmptyBeamState State;
+
+  bool ValidatesExpansions() const override { return true; }
+
+  bool IsValidExpansion(const State& from_state, int from_label,
+                        int to_label) const override {
+    if (to_label != 2) return true;
+    ++num_invalid;
+    return false;
+  }
+
+  void ExpandState(const State& from_state, int from_label, State* to_state,
+                   int to_label) const override {
+    EXPECT_NE(2, to_label);
+    ++num_expansions;
+  }
+
+  mutable int num_invalid = 0;
+  mutable int num_expansions = 0;
+};
+
+TEST(CtcBeamSearch, InvalidExpansions) {
+  const int timesteps = 12;
+  const int num_classes = 4;
+  const int blank = num_classes - 1;
+
+  // Confident frames spelling 1 2 1, separated by blanks.
+  std::vector<float> input_data(timesteps * num_classes);
+  for (int t = 0; t < timesteps; ++t) {
+    const int label = (t == 1 || t == 9) ? 1 : (t == 5 ? 2 : blank);
+    for (int c = 0; c < num_classes; ++c) {
+      input_data[t * num_classes + c] =
+          std::log(c == label ? 0.9 : 0.1 / (num_classes - 1));
+    }
+  }
+
+  ValidatingBeamScorer scorer;
+  CTCBeamSearchDecoder<> decoder(num_classes, 8, &scorer);
+  for (int t = 0; t < timesteps; ++t) {
+    decoder.Step(Eigen::Map<const Eigen::ArrayXf>(
+        &input_data[t * num_classes], num_classes));
+  }
+  std::vector<std::vector<int>> paths;
+  std::vector<float> log_probs;
+  EXPECT_TRUE(decoder.TopPaths(1, &paths, &log_probs, true).ok());
+  // With 2 ruled out, the frame spelling it is read as a blank.
+  EXPECT_EQ(std::vector<int>({1, 1}), paths[0]);
+
+  // Invalid children are pruned without being expanded.
+  const CTCBeamSearchStats& stats = decoder.stats();
+  EXPECT_EQ(scorer.num_expansions, stats.children_created);
+  EXPECT_GT(scorer.num_invalid, 0);
+  EXPECT_EQ(scorer.num_invalid, stats.children_pruned);
+}
+
+TEST(CtcBeamSearch, Stats) {
+  const int timesteps = 12;
+  const int num_classes = 6;
+  const int label_selection_size = 2;
+
+  std::vector<float> input_data(timesteps * num_classes);
+  for (int t = 0; t < timesteps; ++t) {
+    for (int c = 0; c < num_classes; ++c) {
+      // Distinct values, so that label selection keeps exactly two labels.
+      input_data[t * num_classes + c] =
+          -1.0f - 0.01f * c - std::abs(std::sin(0.9f * t + 1.3f * c));
+    }
+    // Every third frame is almost surely blank, and skipped; the blank is
+    // unlikely on the others, so that label selection keeps two labels.
+    float* blank = &input_data[t * num_classes + num_classes - 1];
+    if (t % 3 == 2) {
+      for (int c = 0; c < num_classes - 1; ++c) {
+        input_data[t * num_classes + c] -= 10.0f;
+      }
+      *blank = 0.0f;
+    } else {
+      *blank = -20.0f;
+    }
+  }
+
+  CountingBeamScorer scorer;
+  CTCBeamSearchDecoder<> decoder(num_classes, 5, &scorer);
+  decoder.SetLabelSelectionParameters(label_selection_size, -1);
+  decoder.SetBlankSkipThreshold(0.01f);
+  for (int timing = 0; timing < 2; ++timing) {
+    decoder.SetCollectTimings(timing);
+    decoder.ResetStats();
+    decoder.Reset();
+    scorer.num_expansions = 0;
+    for (int t = 0; t < timesteps; ++t) {
+      decoder.Step(Eigen::Map<const Eigen::ArrayXf>(
+          &input_data[t * num_classes], num_classes));
+    }
+    decoder.ExpandStateEnd();
+
+    const CTCBeamSearchStats& stats = decoder.stats();
+    EXPECT_EQ(timesteps, stats.frames);
+    EXPECT_EQ(timesteps / 3, stats.skipped_frames);
+    EXPECT_GT(stats.beams_expanded, 0);
+    EXPECT_EQ(scorer.num_expansions, stats.children_created);
+    EXPECT_EQ(stats.beams_expanded * (num_classes - 1 - label_selection_size),
+              stats.children_pruned);
+    if (timing) {
+      EXPECT_GT(stats.decode_nanos, 0);
+      EXPECT_LE(stats.scorer_nanos, stats.decode_nanos);
+    } else {
+      EXPECT_EQ(0, stats.decode_nanos);
+      EXPECT_EQ(0, stats.scorer_nanos);
+    }
+  }
+
+  // Reset keeps the stats.
+  decoder.Reset();
+  EXPECT_EQ(timesteps, decoder.stats().frames);
+}
+
+TEST(CtcBeamSearch, StepOnHalfAndStridedInputs) {
+  const int timesteps = 20;
+  const int batch_size = 3;
+  const int num_classes = 6;
+  const int top_paths = 2;
+
+  // Time-major [timesteps, batch_size, num_classes] logits, as fed by the
+  // decoder ops, rounded to half precision so that all the variants below
+  // decode the same values.
+  std::vector<Eigen::half> half_data(timesteps * batch_size * num_classes);
+  std::vector<float> float_data(half_data.size());
+  for (int i = 0; i < half_data.size(); ++i) {
+    half_data[i] = Eigen::half(-3.0f * (1.0f + std::sin(0.37f * i)));
+    float_data[i] = static_cast<float>(half_data[i]);
+  }
+  const int b = 1;
+  const int row_offset = b * num_classes;
+  const int time_stride = batch_size * num_classes;
+
+  // The logits of item b transposed to [num_classes, timesteps], read through
+  // a strided view: class c of step t lives at c * timesteps + t.
+  std::vector<float> transposed(num_classes * timesteps);
+  for (int t = 0; t < timesteps; ++t) {
+    for (int c = 0; c < num_classes; ++c) {
+      transposed[c * timesteps + t] =
+          float_data[t * time_stride + row_offset + c];
+    }
+  }
+
+  typedef Eigen::Map<const Eigen::Array<Eigen::half, Eigen::Dynamic, 1>>
+      HalfRow;
+  typedef Eigen::Map<const Eigen::ArrayXf, 0, Eigen::InnerStride<>>
+      StridedRow;
+
+  std::vector<std::vector<int>> paths[3];
+  std::vector<float> log_probs[3];
+  for (int variant = 0; variant < 3; ++variant) {
+    CTCBeamSearchDecoder<>::DefaultBeamScorer scorer;
+    CTCBeamSearchDecoder<> decoder(num_classes, 4, &scorer);
+    for (int t = 0; t < timesteps; ++t) {
+      const int offset = t * time_stride + row_offset;
+      if (variant == 0) {
+        decoder.Step(Eigen::Map<const Eigen::ArrayXf>(&float_data[offset],
+                                                      num_classes));
+      } else if (variant == 1) {
+        decoder.Step(HalfRow(&half_data[offset], num_classes));
+      } else {
+        decoder.Step(StridedRow(&transposed[t], num_classes,
+                                Eigen::InnerStride<>(timesteps)));
+      }
+    }
+    EXPECT_TRUE(
+        decoder.TopPaths(top_paths, &paths[variant], &log_probs[variant], true)
+            .ok());
+  }
+
+  EXPECT_EQ(paths[0], paths[1]);
+  EXPECT_EQ(log_probs[0], log_probs[1]);
+  EXPECT_EQ(paths[0], paths[2]);
+  EXPECT_EQ(log_probs[0], log_probs[2]);
+}
+
 }  // namespace
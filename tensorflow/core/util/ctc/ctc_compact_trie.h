@@ -0,0 +1,340 @@
+/* Copyright 2017 The TensorFlow Authors. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+// Compact, read-only prefix trie used by the KenLM beam scorer.
+//
+// The binary format is designed to be memory mapped and used in place,
+// without any parsing:
+//
+//   header:  char magic[8] = "CTCTRIE", uint32 version, uint32 vocab_size
+//   nodes:   node records, each child written before its parent
+//   trailer: uint64 num_nodes, uint64 root_offset
+//
+// A node record is a CompactTrieNode followed by num_children
+// CompactTrieEdges sorted by label. An edge stores the distance in bytes from
+// the child back to its parent, so nodes can be walked without knowing the
+// base address of the mapping. Because children always precede their parent,
+// a trie can be written in a single streaming pass over sorted words.
+//
+// All fields are 4-byte aligned and stored in host byte order.
+
+#ifndef TENSORFLOW_CORE_UTIL_CTC_CTC_COMPACT_TRIE_H_
+#define TENSORFLOW_CORE_UTIL_CTC_CTC_COMPACT_TRIE_H_
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <memory>
+#include <ostream>
+#include <sstream>
+#include <vector>
+
+#include "tensorflow/core/lib/core/errors.h"
+#include "tensorflow/core/lib/core/status.h"
+#include "tensorflow/core/platform/env.h"
+#include "tensorflow/core/platform/logging.h"
+#include "tensorflow/core/platform/macros.h"
+#include "tensorflow/core/platform/types.h"
+#include "tensorflow/core/util/ctc/ctc_trie_node.h"
+#include "lm/model.hh"
+
+namespace tensorflow {
+namespace ctc {
+
+const char kCompactTrieMagic[8] = {'C', 'T', 'C', 'T', 'R', 'I', 'E', '\0'};
+const uint32 kCompactTrieVersion = 2;
+
+struct CompactTrieHeader {
+  char magic[8];
+  uint32 version;
+  uint32 vocab_size;
+};
+
+struct CompactTrieTrailer {
+  uint64 num_nodes;
+  uint64 root_offset;
+};
+
+struct CompactTrieEdge {
+  int32 label;
+  uint32 distance;
+};
+
+class CompactTrieNode {
+ public:
+  int GetFrequency() const { return prefix_count_; }
+
+  // KenLM index of the word ending at this node, 0 (<unk>) if no word of the
+  // lexicon ends here.
+  lm::WordIndex GetWordIndex() const { return word_index_; }
+
+  lm::WordIndex GetMinScoreWordIndex() const { return min_score_word_; }
+
+  float GetMinUnigramScore() const { return min_unigram_score_; }
+
+  int GetNumChildren() const { return num_children_; }
+
+  // Returns the child reached through vocabIndex, or nullptr if no word of
+  // the lexicon continues with that label.
+  const CompactTrieNode* GetChildAt(int vocabIndex) const {
+    const CompactTrieEdge* begin = edges();
+    const CompactTrieEdge* end = begin + num_children_;
+    const CompactTrieEdge* edge = std::lower_bound(
+        begin, end, vocabIndex,
+        [](const CompactTrieEdge& e, int label) { return e.label < label; });
+    if (edge == end || edge->label != vocabIndex) {
+      return nullptr;
+    }
+    return reinterpret_cast<const CompactTrieNode*>(
+        reinterpret_cast<const char*>(this) - edge->distance);
+  }
+
+  // Size in bytes of a node record with num_children edges.
+  static size_t RecordSize(size_t num_children) {
+    return sizeof(CompactTrieNode) + num_children * sizeof(CompactTrieEdge);
+  }
+
+ private:
+  friend class CompactTrie;
+  friend class CompactTrieWriter;
+
+  const CompactTrieEdge* edges() const {
+    return reinterpret_cast<const CompactTrieEdge*>(this + 1);
+  }
+
+  int32 prefix_count_;
+  uint32 word_index_;
+  uint32 min_score_word_;
+  float min_unigram_score_;
+  uint32 num_children_;
+};
+
+static_assert(sizeof(CompactTrieHeader) == 16, "unexpected header padding");
+static_assert(sizeof(CompactTrieTrailer) == 16, "unexpected trailer padding");
+static_assert(sizeof(CompactTrieNode) == 20, "unexpected node padding");
+static_assert(sizeof(CompactTrieEdge) == 8, "unexpected edge padding");
+
+// Streams a compact trie to an ostream. Nodes must be added bottom-up: every
+// child has to be added before its parent, and the root last.
+class CompactTrieWriter {
+ public:
+  struct Child {
+    int label;
+    uint64 offset;  // As returned by AddNode.
+  };
+
+  CompactTrieWriter(std::ostream* os, int vocab_size)
+      : os_(os), offset_(0), num_nodes_(0) {
+    CompactTrieHeader header;
+    memcpy(header.magic, kCompactTrieMagic, sizeof(header.magic));
+    header.version = kCompactTrieVersion;
+    header.vocab_size = vocab_size;
+    Write(&header, sizeof(header));
+  }
+
+  // Appends a node and returns its offset. children need not be sorted.
+  uint64 AddNode(int prefix_count, lm::WordIndex word_index,
+                 lm::WordIndex min_score_word, float min_unigram_score,
+                 std::vector<Child>* children) {
+    std::sort(children->begin(), children->end(),
+              [](const Child& a, const Child& b) { return a.label < b.label; });
+    const uint64 offset = offset_;
+    CompactTrieNode node;
+    node.prefix_count_ = prefix_count;
+    node.word_index_ = word_index;
+    node.min_score_word_ = min_score_word;
+    node.min_unigram_score_ = min_unigram_score;
+    node.num_children_ = children->size();
+    Write(&node, sizeof(node));
+    for (const Child& child : *children) {
+      CHECK_LT(child.offset, offset) << "children must be added first";
+      CHECK_LE(offset - child.offset, std::numeric_limits<uint32>::max())
+          << "trie too large for 32-bit edge distances";
+      CompactTrieEdge edge;
+      edge.label = child.label;
+      edge.distance = static_cast<uint32>(offset - child.offset);
+      Write(&edge, sizeof(edge));
+    }
+    ++num_nodes_;
+    return offset;
+  }
+
+  // Writes the trailer. root_offset is the offset of the last node added.
+  void Finish(uint64 root_offset) {
+    CompactTrieTrailer trailer;
+    trailer.num_nodes = num_nodes_;
+    trailer.root_offset = root_offset;
+    Write(&trailer, sizeof(trailer));
+    os_->flush();
+  }
+
+  // Converts a pointer-based trie, as built by TrieNode::Insert.
+  static void Convert(TrieNode* root, std::ostream* os) {
+    CompactTrieWriter writer(os, root->GetVocabSize());
+    writer.Finish(writer.AddSubtree(root));
+  }
+
+ private:
+  void Write(const void* data, size_t size) {
+    os_->write(reinterpret_cast<const char*>(data), size);
+    offset_ += size;
+  }
+
+  uint64 AddSubtree(TrieNode* node) {
+    std::vector<Child> children;
+    for (int i = 0; i < node->GetVocabSize(); ++i) {
+      TrieNode* child = node->GetChildAt(i);
+      if (child != nullptr) {
+        children.push_back({i, AddSubtree(child)});
+      }
+    }
+    return AddNode(node->GetFrequency(), node->GetWordIndex(),
+                   node->GetMinScoreWordIndex(), node->GetMinUnigramScore(),
+                   &children);
+  }
+
+  std::ostream* os_;
+  uint64 offset_;
+  uint64 num_nodes_;
+
+  TF_DISALLOW_COPY_AND_ASSIGN(CompactTrieWriter);
+};
+
+// A loaded compact trie. Files in the compact format are memory mapped
+// read-only, so the pages are shared between all processes using the same
+// trie. Files in the legacy text format written by TrieNode::WriteToStream
+// are still accepted and converted in memory; as that format does not store
+// the word ending at each node, legacy_lookup is used to recover it.
+//
+// Trie files are trusted like the KenLM model they are built for: Load checks
+// the header, the trailer and the root record, but the nodes below the root
+// are walked without bounds checks.
+class CompactTrie {
+ public:
+  static Status Load(Env* env, const string& path, int vocab_size,
+                     const TrieNode::WordLookup& legacy_lookup,
+                     std::unique_ptr<CompactTrie>* trie) {
+    std::unique_ptr<ReadOnlyMemoryRegion> region;
+    TF_RETURN_IF_ERROR(env->NewReadOnlyMemoryRegionFromFile(path, &region));
+    const char* data = static_cast<const char*>(region->data());
+    const uint64 length = region->length();
+
+    std::unique_ptr<CompactTrie> result(new CompactTrie);
+    if (length >= sizeof(CompactTrieHeader) &&
+        memcmp(data, kCompactTrieMagic, sizeof(kCompactTrieMagic)) == 0) {
+      result->region_ = std::move(region);
+    } else {
+      LOG(WARNING) << "Trie " << path << " is in the legacy text format, "
+                   << "regenerate it with ctc_generate_trie to load it "
+                   << "without parsing.";
+      std::ifstream in(path.c_str(), std::ios::in);
+      TrieNode* root = nullptr;
+      TrieNode::ReadFromStream(in, root, vocab_size);
+      if (root == nullptr) {
+        return errors::DataLoss("Cannot parse trie ", path);
+      }
+      std::unique_ptr<TrieNode> root_owner(root);
+      if (legacy_lookup) {
+        root->ResolveWordIndices(legacy_lookup);
+      }
+      std::ostringstream os;
+      CompactTrieWriter::Convert(root, &os);
+      // std::string storage is at least 8-byte aligned for heap buffers.
+      result->buffer_ = os.str();
+      data = result->buffer_.data();
+    }
+    TF_RETURN_IF_ERROR(result->Init(path, data, vocab_size));
+    *trie = std::move(result);
+    return Status::OK();
+  }
+
+  const CompactTrieNode* Root() const { return root_; }
+
+  uint64 NumNodes() const { return num_nodes_; }
+
+ private:
+  CompactTrie() : root_(nullptr), num_nodes_(0) {}
+
+  Status Init(const string& path, const char* data, int vocab_size) {
+    const uint64 length =
+        region_ ? region_->length() : static_cast<uint64>(buffer_.size());
+    if (length < sizeof(CompactTrieHeader) + sizeof(CompactTrieTrailer)) {
+      return errors::DataLoss("Trie ", path, " is truncated");
+    }
+    const CompactTrieHeader* header =
+        reinterpret_cast<const CompactTrieHeader*>(data);
+    if (header->version != kCompactTrieVersion) {
+      return errors::InvalidArgument("Trie ", path, " has version ",
+                                     header->version, ", expected ",
+                                     kCompactTrieVersion);
+    }
+    if (vocab_size < 0) {
+      return errors::InvalidArgument("Invalid vocabulary size ", vocab_size,
+                                     " for trie ", path);
+    }
+    if (header->vocab_size != static_cast<uint32>(vocab_size)) {
+      return errors::InvalidArgument("Trie ", path, " was built for ",
+                                     header->vocab_size,
+                                     " labels, vocabulary has ", vocab_size);
+    }
+    const CompactTrieTrailer* trailer =
+        reinterpret_cast<const CompactTrieTrailer*>(
+            data + length - sizeof(CompactTrieTrailer));
+    const uint64 nodes_end = length - sizeof(CompactTrieTrailer);
+    const uint64 root_offset = trailer->root_offset;
+    if (root_offset < sizeof(CompactTrieHeader) ||
+        root_offset % alignof(CompactTrieNode) != 0 ||
+        root_offset > nodes_end ||
+        nodes_end - root_offset < sizeof(CompactTrieNode)) {
+      return errors::DataLoss("Trie ", path, " has an invalid root offset");
+    }
+    const CompactTrieNode* root =
+        reinterpret_cast<const CompactTrieNode*>(data + root_offset);
+    const uint64 max_children =
+        (nodes_end - root_offset - sizeof(CompactTrieNode)) /
+        sizeof(CompactTrieEdge);
+    if (root->num_children_ > max_children) {
+      return errors::DataLoss("Trie ", path, " has a truncated root node");
+    }
+    // Every child of the root has to be a whole node record between the
+    // header and the root.
+    const CompactTrieEdge* edges = root->edges();
+    for (uint32 i = 0; i < root->num_children_; ++i) {
+      const uint32 distance = edges[i].distance;
+      if (distance < sizeof(CompactTrieNode) ||
+          distance % alignof(CompactTrieNode) != 0 ||
+          distance > root_offset - sizeof(CompactTrieHeader)) {
+        return errors::DataLoss("Trie ", path, " has an invalid edge ",
+                                edges[i].label, " at the root");
+      }
+    }
+    root_ = root;
+    num_nodes_ = trailer->num_nodes;
+    return Status::OK();
+  }
+
+  std::unique_ptr<ReadOnlyMemoryRegion> region_;
+  string buffer_;
+  const CompactTrieNode* root_;
+  uint64 num_nodes_;
+
+  TF_DISALLOW_COPY_AND_ASSIGN(CompactTrie);
+};
+
+}  // namespace ctc
+}  // namespace tensorflow
+
+#endif  // TENSORFLOW_CORE_UTIL_CTC_CTC_COMPACT_TRIE_H_
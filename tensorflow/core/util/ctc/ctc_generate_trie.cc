@@ -13,60 +13,175 @@ See the License for the specific language governing permissions and
 limitations under the License.
 ==============================================================================*/
 
-#include "tensorflow/core/util/ctc/ctc_trie_node.h"
+// Builds the trie of the KenLM beam scorer in the compact binary format.
+//
+//   ctc_generate_trie [--words=<path>] [--output=<path>] [--num_threads=<n>]
+//       <kenlm_file_path> <vocabulary_path>
+//
+// The lexicon is the vocabulary of the KenLM model unless --words names a
+// file of whitespace separated words ("-" for stdin). Words spelled with
+// characters outside the vocabulary file are skipped.
+
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "tensorflow/core/lib/core/threadpool.h"
+#include "tensorflow/core/platform/cpu_info.h"
+#include "tensorflow/core/platform/env.h"
+#include "tensorflow/core/platform/init_main.h"
+#include "tensorflow/core/util/command_line_flags.h"
+#include "tensorflow/core/util/ctc/ctc_kenlm_model.h"
+#include "tensorflow/core/util/ctc/ctc_trie_builder.h"
 #include "tensorflow/core/util/ctc/ctc_vocabulary.h"
 #include "lm/model.hh"
 #include "utf8.h"
 
-using namespace tensorflow::ctc;
+namespace tensorflow {
+namespace ctc {
+namespace {
 
-typedef lm::ngram::ProbingModel Model;
+typedef KenLMModel Model;
 
-lm::WordIndex GetWordIndex(const Model& model, const std::string& word) {
-  lm::WordIndex vocab;
-  vocab = model.GetVocabulary().Index(word);
-  return vocab;
+// Spells word with the labels of vocabulary. Returns false if the word is
+// not valid UTF-8 or uses a character outside the vocabulary.
+bool GetLabels(const string& word, Vocabulary* vocabulary,
+               std::vector<int>* labels) {
+  std::wstring wide_word;
+  try {
+    utf8::utf8to16(word.begin(), word.end(), std::back_inserter(wide_word));
+  } catch (const utf8::exception&) {
+    return false;
+  }
+  labels->clear();
+  for (const wchar_t c : wide_word) {
+    if (!vocabulary->HasCharacter(c)) return false;
+    labels->push_back(vocabulary->GetLabelFromCharacter(c));
+  }
+  return true;
 }
 
-float ScoreWord(const Model& model, lm::WordIndex vocab) {
-  Model::State in_state = model.NullContextState();
-  Model::State out;
-  lm::FullScoreReturn full_score_return;
-  full_score_return = model.FullScore(in_state, vocab, out);
-  return full_score_return.prob;
+bool IsSentenceMarker(const string& word) {
+  return word == "<s>" || word == "</s>" || word == "<unk>";
 }
 
-int main(int argc, char *argv[]) {
-  if (argc != 3) {
-    std::cerr << "Usage " << argv[0]
-              << " <kenlm_file_path>"
-              << " <vocabulary_path>"
-              << std::endl;
+int Run(const string& kenlm_file_path, const string& vocabulary_path,
+        const string& words_path, const string& output_path,
+        int num_threads) {
+  std::unique_ptr<Model> model;
+  std::vector<string> model_words;
+  Status status =
+      Model::Load(kenlm_file_path, util::POPULATE_OR_READ, &model,
+                  words_path.empty() ? &model_words : nullptr);
+  if (!status.ok()) {
+    std::cerr << status.ToString() << std::endl;
     return 1;
   }
 
-  const char *kenlm_file_path = argv[1];
-  const char *vocabulary_path = argv[2];
+  Vocabulary vocabulary(vocabulary_path.c_str());
+  CompactTrieBuilder builder(vocabulary.GetSize());
+  int64 num_skipped = 0;
+  std::vector<int> labels;
+  auto add_word = [&](const string& word, lm::WordIndex word_index) {
+    if (!GetLabels(word, &vocabulary, &labels)) {
+      ++num_skipped;
+      return Status::OK();
+    }
+    return builder.AddWord(labels, word_index);
+  };
 
-  lm::ngram::Config config;
-  config.load_method = util::POPULATE_OR_READ;
-  Model model(kenlm_file_path, config);
-
-  Vocabulary vocabulary(vocabulary_path);
-
-  TrieNode root(vocabulary.GetSize());
+  if (words_path.empty()) {
+    for (size_t i = 0; i < model_words.size(); ++i) {
+      if (IsSentenceMarker(model_words[i])) continue;
+      status.Update(add_word(model_words[i], i));
+    }
+    model_words.clear();
+  } else {
+    std::ifstream file;
+    if (words_path != "-") {
+      file.open(words_path.c_str(), std::ios::in);
+      if (!file) {
+        std::cerr << "Cannot open " << words_path << std::endl;
+        return 1;
+      }
+    }
+    std::istream& in = words_path == "-" ? std::cin : file;
+    string word;
+    while (status.ok() && in >> word) {
+      status.Update(add_word(word, model->Index(word)));
+    }
+  }
+  if (!status.ok()) {
+    std::cerr << status.ToString() << std::endl;
+    return 1;
+  }
 
-  std::string word;
-  while (std::cin >> word) {
-    lm::WordIndex vocab = GetWordIndex(model, word);
-    float unigram_score = ScoreWord(model, vocab);
-    std::wstring wide_word;
-    utf8::utf8to16(word.begin(), word.end(), std::back_inserter(wide_word));
-    root.Insert(wide_word.c_str(), [&vocabulary](wchar_t c) { 
-                  return vocabulary.GetLabelFromCharacter(c);
-                }, vocab, unigram_score);
+  std::ofstream file;
+  if (!output_path.empty()) {
+    file.open(output_path.c_str(),
+              std::ios::out | std::ios::binary | std::ios::trunc);
+    if (!file) {
+      std::cerr << "Cannot open " << output_path << std::endl;
+      return 1;
+    }
   }
+  std::ostream& out = output_path.empty() ? std::cout : file;
 
-  root.WriteToStream(std::cout);
+  const int64 num_words = builder.NumWords();
+  std::unique_ptr<thread::ThreadPool> pool;
+  if (num_threads > 1) {
+    pool.reset(
+        new thread::ThreadPool(Env::Default(), "ctc_generate_trie",
+                               num_threads));
+  }
+  // KenLM models are safe to query from several threads.
+  const Model& scoring_model = *model;
+  status = builder.Write(
+      [&scoring_model](lm::WordIndex word_index) {
+        Model::State out_state;
+        return scoring_model.FullScore(scoring_model.NullContextState(),
+                                       word_index, &out_state);
+      },
+      pool.get(), &out);
+  if (!status.ok()) {
+    std::cerr << status.ToString() << std::endl;
+    return 1;
+  }
+  std::cerr << "Wrote " << builder.NumNodes() << " nodes for "
+            << num_words - builder.NumDuplicates() << " words ("
+            << builder.NumDuplicates() << " duplicates, " << num_skipped
+            << " skipped)" << std::endl;
   return 0;
 }
+
+}  // namespace
+}  // namespace ctc
+}  // namespace tensorflow
+
+int main(int argc, char* argv[]) {
+  using tensorflow::Flag;
+  using tensorflow::Flags;
+  tensorflow::string words_path;
+  tensorflow::string output_path;
+  tensorflow::int32 num_threads = tensorflow::port::NumSchedulableCPUs();
+  std::vector<Flag> flag_list = {
+      Flag("words", &words_path,
+           "file of whitespace separated words to build the trie of, \"-\" "
+           "for stdin; defaults to the vocabulary of the model"),
+      Flag("output", &output_path, "file to write the trie to, or stdout"),
+      Flag("num_threads", &num_threads, "threads scoring the words"),
+  };
+  const tensorflow::string usage = Flags::Usage(
+      tensorflow::string(argv[0]) + " <kenlm_file_path> <vocabulary_path>",
+      flag_list);
+  const bool parsed_flags = Flags::Parse(&argc, argv, flag_list);
+  tensorflow::port::InitMain(usage.c_str(), &argc, &argv);
+  if (!parsed_flags || argc != 3) {
+    std::cerr << usage;
+    return 1;
+  }
+  return tensorflow::ctc::Run(argv[1], argv[2], words_path, output_path,
+                              num_threads);
+}
@@ -0,0 +1,180 @@
+/* Copyright 2017 The TensorFlow Authors. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#ifndef TENSORFLOW_CORE_UTIL_CTC_CTC_HOTWORD_TRIE_H_
+#define TENSORFLOW_CORE_UTIL_CTC_CTC_HOTWORD_TRIE_H_
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include "tensorflow/core/lib/core/errors.h"
+#include "tensorflow/core/lib/core/status.h"
+#include "tensorflow/core/platform/macros.h"
+#include "tensorflow/core/platform/types.h"
+
+namespace tensorflow {
+namespace ctc {
+
+// A small trie of boosted phrases ("hotwords"), overlaid on the lexicon of a
+// beam scorer to bias decoding towards them without touching the language
+// model. It is meant to be built for every request: building costs one node
+// per label of the phrases and no preprocessing of the language model.
+//
+// A beam tracks its position in the trie as a node id. A phrase can only
+// start at the beginning of a word, and is complete once its last label is
+// followed by a space or the end of the sentence. Words of a phrase are
+// separated by the space label.
+//
+// Rather than paying the boost of a phrase only once it is complete, by
+// which time the beam pruning may have dropped it, every label of a phrase
+// earns its share of the boost: the score of a beam is the boost of the
+// phrases it completed plus the potential of its current node. Leaving the
+// trie takes that credit back, except for the boost of the longest phrase
+// completed on the way, e.g. "new" when "new york" turns into "new jersey".
+class HotwordTrie {
+ public:
+  // The node of beams in the middle of a word that matches no phrase.
+  static const int32 kNoNode = -1;
+  // The node of beams at the beginning of a word.
+  static const int32 kRoot = 0;
+
+  // space_label is the label separating words, -1 if there is none.
+  HotwordTrie(int vocab_size, int space_label)
+      : vocab_size_(vocab_size), space_label_(space_label), nodes_(1) {}
+
+  // Adds a phrase spelled by labels, all in [0, vocab_size), which boosts the
+  // log-probability of the beams spelling it by boost >= 0. Phrases may not
+  // start or end with a space. A phrase added twice keeps its largest boost.
+  Status AddPhrase(const std::vector<int>& labels, float boost) {
+    if (labels.empty()) {
+      return errors::InvalidArgument("Hotword phrases must not be empty");
+    }
+    if (!std::isfinite(boost) || boost < 0) {
+      return errors::InvalidArgument("Hotword boosts must be finite and >= 0, "
+                                     "got ", boost);
+    }
+    if (labels.front() == space_label_ || labels.back() == space_label_) {
+      return errors::InvalidArgument(
+          "Hotword phrases must not start or end with a space");
+    }
+    for (const int label : labels) {
+      if (label < 0 || label >= vocab_size_) {
+        return errors::InvalidArgument("Hotword label ", label,
+                                       " is not in [0, ", vocab_size_, ")");
+      }
+    }
+    int32 node = kRoot;
+    const float length = labels.size();
+    for (size_t i = 0; i < labels.size(); ++i) {
+      int32 child = Child(node, labels[i]);
+      if (child == kNoNode) {
+        child = nodes_.size();
+        Node new_node;
+        new_node.label = labels[i];
+        new_node.parent = node;
+        new_node.first_child = kNoNode;
+        new_node.next_sibling = nodes_[node].first_child;
+        nodes_.push_back(new_node);
+        nodes_[node].first_child = child;
+      }
+      Node& child_node = nodes_[child];
+      child_node.potential =
+          std::max(child_node.potential, boost * (i + 1) / length);
+      node = child;
+    }
+    nodes_[node].is_end = true;
+    nodes_[node].boost = std::max(nodes_[node].boost, boost);
+    finalized_ = false;
+    return Status::OK();
+  }
+
+  // Resolves what leaving the trie keeps of the phrases completed on the
+  // way. Must be called after the last AddPhrase and before Next.
+  void Finalize() {
+    // Parents are added before their children.
+    for (size_t i = 1; i < nodes_.size(); ++i) {
+      Node& node = nodes_[i];
+      const Node& parent = nodes_[node.parent];
+      node.fallback = parent.is_end && node.label == space_label_
+                          ? parent.boost
+                          : parent.fallback;
+      node.potential = std::max(node.potential, node.fallback);
+    }
+    finalized_ = true;
+  }
+
+  // Follows label from node, kNoNode included, and adds the boost kept from
+  // the phrases left to *completed_boost.
+  int32 Next(int32 node, int label, float* completed_boost) const {
+    DCHECK(finalized_);
+    const bool is_space = label == space_label_;
+    if (node == kNoNode) return is_space ? kRoot : kNoNode;
+    const int32 child = Child(node, label);
+    if (child != kNoNode) return child;
+    const Node& from = nodes_[node];
+    *completed_boost += is_space && from.is_end ? from.boost : from.fallback;
+    return is_space ? kRoot : kNoNode;
+  }
+
+  // The boost kept from the phrases left at node when the sentence ends.
+  float End(int32 node) const {
+    DCHECK(finalized_);
+    if (node == kNoNode) return 0.0f;
+    const Node& from = nodes_[node];
+    return from.is_end ? from.boost : from.fallback;
+  }
+
+  // The credit of a beam at node for the phrase it is spelling.
+  float Potential(int32 node) const {
+    return node == kNoNode ? 0.0f : nodes_[node].potential;
+  }
+
+  int64 NumNodes() const { return nodes_.size(); }
+
+ private:
+  // Children are kept in a list: the trie is small and most of its nodes
+  // have a single child.
+  struct Node {
+    int32 label = -1;
+    int32 parent = kNoNode;
+    int32 first_child = kNoNode;
+    int32 next_sibling = kNoNode;
+    bool is_end = false;
+    float boost = 0.0f;
+    float fallback = 0.0f;
+    float potential = 0.0f;
+  };
+
+  int32 Child(int32 node, int label) const {
+    int32 child = nodes_[node].first_child;
+    while (child != kNoNode && nodes_[child].label != label) {
+      child = nodes_[child].next_sibling;
+    }
+    return child;
+  }
+
+  const int vocab_size_;
+  const int space_label_;
+  std::vector<Node> nodes_;
+  bool finalized_ = true;
+
+  TF_DISALLOW_COPY_AND_ASSIGN(HotwordTrie);
+};
+
+}  // namespace ctc
+}  // namespace tensorflow
+
+#endif  // TENSORFLOW_CORE_UTIL_CTC_CTC_HOTWORD_TRIE_H_
@@ -0,0 +1,213 @@
+/* Copyright 2017 The TensorFlow Authors. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#ifndef TENSORFLOW_CORE_UTIL_CTC_CTC_KENLM_MODEL_H_
+#define TENSORFLOW_CORE_UTIL_CTC_CTC_KENLM_MODEL_H_
+
+#include <exception>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "tensorflow/core/lib/core/errors.h"
+#include "tensorflow/core/lib/core/status.h"
+#include "tensorflow/core/platform/macros.h"
+#include "tensorflow/core/platform/types.h"
+#include "lm/enumerate_vocab.hh"
+#include "lm/model.hh"
+
+namespace tensorflow {
+namespace ctc {
+
+// KenLMModel hides the concrete KenLM model class behind a small interface,
+// so that the beam scorer works with every binary format KenLM can build:
+// probing hash tables as well as the (quantized, array compressed) tries,
+// which take a fraction of the memory for large models. All KenLM n-gram
+// models share the same State type.
+class KenLMModel {
+ public:
+  typedef lm::ngram::State State;
+
+  virtual ~KenLMModel() {}
+
+  // Loads the model at path. The model type is read from the header of
+  // binary files; ARPA files are loaded as probing models. load_method
+  // controls how the file is brought into memory, see util/mmap.hh:
+  // util::LAZY maps it and lets the OS page it in on demand, sharing the
+  // page cache between processes, while util::POPULATE_OR_READ reads it
+  // up front.
+  static Status Load(const string& path, util::LoadMethod load_method,
+                     std::unique_ptr<KenLMModel>* model) {
+    return Load(path, load_method, model, nullptr);
+  }
+
+  // As above, also filling *words with the vocabulary of the model, indexed
+  // by KenLM word index, if words is not null. The words are read while the
+  // model is loaded, at no extra pass over the file.
+  static Status Load(const string& path, util::LoadMethod load_method,
+                     std::unique_ptr<KenLMModel>* model,
+                     std::vector<string>* words);
+
+  // Maps an op attr value ("lazy", "populate_or_lazy", "populate_or_read",
+  // "read" or "parallel_read") to a KenLM load method.
+  static Status ParseLoadMethod(const string& name,
+                                util::LoadMethod* load_method) {
+    if (name == "lazy") {
+      *load_method = util::LAZY;
+    } else if (name == "populate_or_lazy") {
+      *load_method = util::POPULATE_OR_LAZY;
+    } else if (name == "populate_or_read") {
+      *load_method = util::POPULATE_OR_READ;
+    } else if (name == "read") {
+      *load_method = util::READ;
+    } else if (name == "parallel_read") {
+      *load_method = util::PARALLEL_READ;
+    } else {
+      return errors::InvalidArgument("Unknown KenLM load method: ", name);
+    }
+    return Status::OK();
+  }
+
+  virtual lm::ngram::ModelType Type() const = 0;
+
+  virtual float FullScore(const State& in_state, lm::WordIndex word,
+                          State* out_state) const = 0;
+
+  virtual const State& BeginSentenceState() const = 0;
+  virtual const State& NullContextState() const = 0;
+
+  virtual lm::WordIndex Index(const string& word) const = 0;
+  virtual lm::WordIndex EndSentence() const = 0;
+  virtual lm::WordIndex NotFound() const = 0;
+};
+
+template <class Model, lm::ngram::ModelType kType>
+class KenLMModelImpl : public KenLMModel {
+ public:
+  KenLMModelImpl(const string& path, const lm::ngram::Config& config)
+      : model_(path.c_str(), config) {}
+
+  lm::ngram::ModelType Type() const override { return kType; }
+
+  float FullScore(const State& in_state, lm::WordIndex word,
+                  State* out_state) const override {
+    return model_.FullScore(in_state, word, *out_state).prob;
+  }
+
+  const State& BeginSentenceState() const override {
+    return model_.BeginSentenceState();
+  }
+
+  const State& NullContextState() const override {
+    return model_.NullContextState();
+  }
+
+  lm::WordIndex Index(const string& word) const override {
+    return model_.GetVocabulary().Index(word);
+  }
+
+  lm::WordIndex EndSentence() const override {
+    return model_.GetVocabulary().EndSentence();
+  }
+
+  lm::WordIndex NotFound() const override {
+    return model_.GetVocabulary().NotFound();
+  }
+
+ private:
+  Model model_;
+
+  TF_DISALLOW_COPY_AND_ASSIGN(KenLMModelImpl);
+};
+
+namespace kenlm_model_internal {
+
+// Collects the words KenLM enumerates while loading a model.
+class WordCollector : public lm::EnumerateVocab {
+ public:
+  explicit WordCollector(std::vector<string>* words) : words_(words) {}
+
+  // KenLM's StringPiece lives in the global namespace.
+  void Add(lm::WordIndex index, const ::StringPiece& str) override {
+    if (index >= words_->size()) words_->resize(index + 1);
+    (*words_)[index].assign(str.data(), str.size());
+  }
+
+ private:
+  std::vector<string>* words_;
+
+  TF_DISALLOW_COPY_AND_ASSIGN(WordCollector);
+};
+
+}  // namespace kenlm_model_internal
+
+inline Status KenLMModel::Load(const string& path,
+                               util::LoadMethod load_method,
+                               std::unique_ptr<KenLMModel>* model,
+                               std::vector<string>* words) {
+  lm::ngram::Config config;
+  config.load_method = load_method;
+  std::unique_ptr<kenlm_model_internal::WordCollector> collector;
+  if (words != nullptr) {
+    words->clear();
+    collector.reset(new kenlm_model_internal::WordCollector(words));
+    config.enumerate_vocab = collector.get();
+  }
+  lm::ngram::ModelType type = lm::ngram::PROBING;
+  try {
+    // Leaves type untouched for ARPA files.
+    lm::ngram::RecognizeBinary(path.c_str(), type);
+    switch (type) {
+      case lm::ngram::PROBING:
+        model->reset(
+            new KenLMModelImpl<lm::ngram::ProbingModel, lm::ngram::PROBING>(
+                path, config));
+        break;
+      case lm::ngram::REST_PROBING:
+        model->reset(new KenLMModelImpl<lm::ngram::RestProbingModel,
+                                        lm::ngram::REST_PROBING>(path, config));
+        break;
+      case lm::ngram::TRIE:
+        model->reset(new KenLMModelImpl<lm::ngram::TrieModel, lm::ngram::TRIE>(
+            path, config));
+        break;
+      case lm::ngram::QUANT_TRIE:
+        model->reset(new KenLMModelImpl<lm::ngram::QuantTrieModel,
+                                        lm::ngram::QUANT_TRIE>(path, config));
+        break;
+      case lm::ngram::ARRAY_TRIE:
+        model->reset(new KenLMModelImpl<lm::ngram::ArrayTrieModel,
+                                        lm::ngram::ARRAY_TRIE>(path, config));
+        break;
+      case lm::ngram::QUANT_ARRAY_TRIE:
+        model->reset(
+            new KenLMModelImpl<lm::ngram::QuantArrayTrieModel,
+                               lm::ngram::QUANT_ARRAY_TRIE>(path, config));
+        break;
+      default:
+        return errors::InvalidArgument("Unsupported KenLM model type ", type,
+                                       " in ", path);
+    }
+  } catch (const std::exception& e) {
+    return errors::InvalidArgument("Cannot load KenLM model ", path, ": ",
+                                   e.what());
+  }
+  return Status::OK();
+}
+
+}  // namespace ctc
+}  // namespace tensorflow
+
+#endif  // TENSORFLOW_CORE_UTIL_CTC_CTC_KENLM_MODEL_H_
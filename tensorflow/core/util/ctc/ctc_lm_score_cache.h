@@ -0,0 +1,166 @@
+/* Copyright 2017 The TensorFlow Authors. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#ifndef TENSORFLOW_CORE_UTIL_CTC_CTC_LM_SCORE_CACHE_H_
+#define TENSORFLOW_CORE_UTIL_CTC_CTC_LM_SCORE_CACHE_H_
+
+#include <memory>
+#include <vector>
+
+#include "tensorflow/core/lib/hash/hash.h"
+#include "tensorflow/core/platform/logging.h"
+#include "tensorflow/core/platform/macros.h"
+#include "tensorflow/core/platform/mutex.h"
+#include "tensorflow/core/platform/prefetch.h"
+#include "tensorflow/core/platform/thread_annotations.h"
+#include "tensorflow/core/platform/types.h"
+#include "lm/model.hh"
+
+namespace tensorflow {
+namespace ctc {
+
+// Bounded cache of language model scores keyed by (context state, word).
+//
+// Beams of one utterance mostly share their recent history, so the same
+// FullScore(state, word) query is repeated many times while decoding. The
+// cache is a fixed-size open-addressed table: a query probes a few slots
+// starting at its hash, and an insert into a full neighbourhood overwrites the
+// home slot. Nothing is ever allocated after construction.
+//
+// The cache is not thread-safe; each decoder should use its own, for instance
+// one taken from an LMScoreCachePool.
+template <class State>
+class LMScoreCache {
+ public:
+  // capacity is rounded up to a power of two.
+  explicit LMScoreCache(int64 capacity) : hits_(0), misses_(0) {
+    int64 size = 1;
+    while (size < capacity) size <<= 1;
+    entries_.resize(size);
+    mask_ = size - 1;
+  }
+
+  // On a hit, stores the cached score and output state and returns true.
+  bool Lookup(const State& in_state, lm::WordIndex word, State* out_state,
+              float* prob) {
+    const uint64 hash = Hash(in_state, word);
+    for (int i = 0; i < kProbes; ++i) {
+      const Entry& e = entries_[(hash + i) & mask_];
+      if (!e.valid) break;
+      if (e.hash == hash && e.word == word && e.in_state == in_state) {
+        *out_state = e.out_state;
+        *prob = e.prob;
+        ++hits_;
+        return true;
+      }
+    }
+    ++misses_;
+    return false;
+  }
+
+  // Prefetches the home slot of (in_state, word), ahead of its Lookup.
+  void Prefetch(const State& in_state, lm::WordIndex word) const {
+    port::prefetch<port::PREFETCH_HINT_T0>(
+        &entries_[Hash(in_state, word) & mask_]);
+  }
+
+  void Insert(const State& in_state, lm::WordIndex word,
+              const State& out_state, float prob) {
+    const uint64 hash = Hash(in_state, word);
+    Entry* slot = &entries_[hash & mask_];
+    for (int i = 0; i < kProbes; ++i) {
+      Entry* e = &entries_[(hash + i) & mask_];
+      if (!e->valid) {
+        slot = e;
+        break;
+      }
+    }
+    slot->valid = true;
+    slot->hash = hash;
+    slot->word = word;
+    slot->prob = prob;
+    slot->in_state = in_state;
+    slot->out_state = out_state;
+  }
+
+  int64 hits() const { return hits_; }
+  int64 misses() const { return misses_; }
+  int64 capacity() const { return entries_.size(); }
+
+ private:
+  static const int kProbes = 4;
+
+  struct Entry {
+    Entry() : valid(false) {}
+    bool valid;
+    lm::WordIndex word;
+    float prob;
+    uint64 hash;
+    State in_state;
+    State out_state;
+  };
+
+  static uint64 Hash(const State& state, lm::WordIndex word) {
+    return Hash64Combine(hash_value(state), word);
+  }
+
+  std::vector<Entry> entries_;
+  uint64 mask_;
+  int64 hits_;
+  int64 misses_;
+
+  TF_DISALLOW_COPY_AND_ASSIGN(LMScoreCache);
+};
+
+// Free list of LMScoreCaches of one capacity, shared by the threads decoding
+// with one model. Cached scores stay valid as long as the model is loaded, so
+// a cache returned to the pool is handed out again warm rather than cleared.
+// The pool grows to the largest number of caches in use at once.
+template <class State>
+class LMScoreCachePool {
+ public:
+  explicit LMScoreCachePool(int64 capacity) : capacity_(capacity) {}
+
+  // Returns a free cache, allocating one if there is none.
+  std::unique_ptr<LMScoreCache<State>> Take() {
+    {
+      mutex_lock l(mu_);
+      if (!free_.empty()) {
+        std::unique_ptr<LMScoreCache<State>> cache = std::move(free_.back());
+        free_.pop_back();
+        return cache;
+      }
+    }
+    return std::unique_ptr<LMScoreCache<State>>(
+        new LMScoreCache<State>(capacity_));
+  }
+
+  void Return(std::unique_ptr<LMScoreCache<State>> cache) {
+    mutex_lock l(mu_);
+    free_.push_back(std::move(cache));
+  }
+
+ private:
+  const int64 capacity_;
+  mutex mu_;
+  std::vector<std::unique_ptr<LMScoreCache<State>>> free_ GUARDED_BY(mu_);
+
+  TF_DISALLOW_COPY_AND_ASSIGN(LMScoreCachePool);
+};
+
+}  // namespace ctc
+}  // namespace tensorflow
+
+#endif  // TENSORFLOW_CORE_UTIL_CTC_CTC_LM_SCORE_CACHE_H_
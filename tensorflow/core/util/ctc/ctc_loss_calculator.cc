@@ -15,117 +15,225 @@ limitations under the License.
 
 #include "tensorflow/core/util/ctc/ctc_loss_calculator.h"
 
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
 namespace tensorflow {
 namespace ctc {
 
+namespace {
+
+typedef CTCLossCalculator::Array Array;
+typedef CTCLossCalculator::Matrix Matrix;
+typedef Eigen::Ref<const Eigen::VectorXf> ConstColumn;
+typedef Eigen::Ref<Eigen::VectorXf> Column;
+
+// Sets out to log(exp(a) + exp(b) + exp(c)) elementwise, (GravesTh) Eq. 7.18
+// over three terms, vectorized with Eigen's packet exp and log. max is
+// scratch space of at least a.size() elements.
+template <typename A, typename B, typename C>
+void LogSumExp(const A& a, const B& b, const C& c, Array* max, Array* out) {
+  const int n = a.size();
+  auto m = max->head(n);
+  // Shifting by the lowest float rather than by kLogZero keeps
+  // kLogZero - kLogZero from turning into NaN when all terms are kLogZero.
+  m = a.max(b).max(c).max(std::numeric_limits<float>::lowest());
+  out->head(n) = m + ((a - m).exp() + (b - m).exp() + (c - m).exp()).log();
+}
+
+// The range of u for which alpha(u, t) and beta(u, t) are computed: if there
+// is not enough time to output the remaining labels or some labels have been
+// skipped, they stay zero.
+inline int BeginU(int U, int T, int t) { return std::max(0, U - 2 * (T - t)); }
+inline int EndU(int U, int t) { return std::min(U, 2 * (t + 1)); }
+
+// The forward and backward recursions of one batch item over T time steps,
+// in log space or in probability space, one time step at a time. alpha(u, t)
+// only depends on alpha(u, t - 1), alpha(u - 1, t - 1) and alpha(u - 2, t -
+// 1), and beta(u, t) likewise on the time step after, so each time step is
+// computed for all u at once.
+//
+// y_t are the activations y_l_prime(:, t), and can_stay and can_skip the
+// transitions, see CTCLossCalculator::GetTransitions; all of them are logs in
+// log space.
+class Recursion {
+ public:
+  Recursion(bool log_space, const Array& can_stay, const Array& can_skip,
+            int T)
+      : log_space_(log_space),
+        zero_(log_space ? kLogZero : 0),
+        U_(can_stay.size()),
+        T_(T),
+        can_stay_(can_stay),
+        can_skip_(can_skip),
+        padded_(U_ + 2),
+        stay_term_(U_),
+        skip_term_(U_),
+        max_(U_),
+        sum_(U_) {}
+
+  // Initial alpha values in (GravesTh) Eq 7.5 and Eq 7.6.
+  void FirstAlpha(const ConstColumn& y_0, Column alpha_0) {
+    alpha_0.setConstant(zero_);
+    alpha_0(0) = y_0(0);
+    // Below, l_prime[1] == labels[0]; l_prime is a single blank if there are
+    // no labels.
+    if (U_ > 1) alpha_0(1) = y_0(1);
+  }
+
+  // Sets alpha_t to alpha(:, t) from alpha_prev = alpha(:, t - 1), (GravesTh)
+  // Eq 7.9.
+  void NextAlpha(int t, const ConstColumn& alpha_prev, const ConstColumn& y_t,
+                 Column alpha_t) {
+    alpha_t.setConstant(zero_);
+    const int u_begin = BeginU(U_, T_, t);
+    const int n = EndU(U_, t) - u_begin;
+    if (n <= 0) return;
+    // alpha(:, t - 1), preceded by zeros for u = -2 and u = -1.
+    padded_.head(2).setConstant(zero_);
+    padded_.tail(U_) = alpha_prev.array();
+    // The u, t - 1 term, if the path can stay at u; the u - 1, t - 1 term;
+    // the u - 2, t - 1 term if l_prime(u) != blank or l_prime(u-2).
+    Sum(padded_.segment(u_begin + 2, n), can_stay_.segment(u_begin, n),
+        padded_.segment(u_begin + 1, n), padded_.segment(u_begin, n),
+        can_skip_.segment(u_begin, n));
+    // Multiply the summed alphas with the activation probability.
+    if (log_space_) {
+      alpha_t.segment(u_begin, n).array() =
+          y_t.segment(u_begin, n).array() + sum_.head(n);
+    } else {
+      alpha_t.segment(u_begin, n).array() =
+          y_t.segment(u_begin, n).array() * sum_.head(n);
+    }
+  }
+
+  // Initial beta values in (GravesTh) Eq 7.13: probability 1.
+  void LastBeta(Column beta_last) {
+    beta_last.setConstant(zero_);
+    beta_last.tail(std::min(U_, 2)).setConstant(log_space_ ? 0 : 1);
+  }
+
+  // Sets beta_t to beta(:, t) from beta_next = beta(:, t + 1) and y_next =
+  // y_l_prime(:, t + 1), (GravesTh) Eq 7.15.
+  void PrevBeta(int t, const ConstColumn& beta_next, const ConstColumn& y_next,
+                Column beta_t) {
+    beta_t.setConstant(zero_);
+    const int u_begin = BeginU(U_, T_, t);
+    const int n = EndU(U_, t) - u_begin;
+    if (n <= 0) return;
+    // beta(:, t + 1) times the activations at t + 1, followed by zeros for
+    // u = U and u = U + 1.
+    if (log_space_) {
+      padded_.head(U_) = beta_next.array() + y_next.array();
+    } else {
+      padded_.head(U_) = beta_next.array() * y_next.array();
+    }
+    padded_.tail(2).setConstant(zero_);
+    // The u, t + 1 term, if the path can stay at u; the u + 1, t + 1 term;
+    // the u + 2, t + 1 term if l_prime(u) != blank or l_prime(u+2).
+    Sum(padded_.segment(u_begin, n), can_stay_.segment(u_begin, n),
+        padded_.segment(u_begin + 1, n), padded_.segment(u_begin + 2, n),
+        can_skip_.segment(u_begin + 2, n));
+    beta_t.segment(u_begin, n) = sum_.head(n).matrix();
+  }
+
+ private:
+  // Sets sum_ to stay * can_stay + next + skip * can_skip.
+  template <typename Stay, typename CanStay, typename Next, typename Skip,
+            typename CanSkip>
+  void Sum(const Stay& stay, const CanStay& can_stay, const Next& next,
+           const Skip& skip, const CanSkip& can_skip) {
+    const int n = stay.size();
+    if (log_space_) {
+      stay_term_.head(n) = stay + can_stay;
+      skip_term_.head(n) = skip + can_skip;
+      LogSumExp(stay_term_.head(n), next, skip_term_.head(n), &max_, &sum_);
+    } else {
+      sum_.head(n) = stay * can_stay + next + skip * can_skip;
+    }
+  }
+
+  const bool log_space_;
+  const float zero_;
+  const int U_;
+  const int T_;
+  const Array can_stay_;
+  const Array can_skip_;
+  Array padded_, stay_term_, skip_term_, max_, sum_;
+
+  TF_DISALLOW_COPY_AND_ASSIGN(Recursion);
+};
+
+// Sets path_prob(u) to the probability of the paths through (u, t) relative
+// to p(z|x), from alpha(:, t) and beta(:, t), (GravesTh) Eq 7.26. The
+// products of the rescaled variables are normalized against rounding errors;
+// returns false if they are out of range.
+bool PathProbabilities(bool log_space, const ConstColumn& alpha_t,
+                       const ConstColumn& beta_t, float log_p_z_x,
+                       Array* path_prob) {
+  if (log_space) {
+    *path_prob = (alpha_t.array() + beta_t.array() - log_p_z_x).exp();
+    return true;
+  }
+  *path_prob = alpha_t.array() * beta_t.array();
+  const float sum = path_prob->sum();
+  if (!(sum > 0 && std::isfinite(sum))) return false;
+  *path_prob /= sum;
+  return true;
+}
+
+}  // namespace
+
+Status CTCLossCalculator::ParseAlgorithm(const string& name,
+                                         Algorithm* algorithm) {
+  if (name == "log_space") {
+    *algorithm = LOG_SPACE;
+  } else if (name == "scaled") {
+    *algorithm = SCALED;
+  } else {
+    return errors::InvalidArgument("Unknown CTC loss algorithm: ", name);
+  }
+  return Status::OK();
+}
+
 // Calculates the alpha(t, u) as described in (GravesTh) Section 7.3.
 // Starting with t = 0 instead of t = 1 used in the text.
 // Based on Kanishka's CTC.
-void CTCLossCalculator::CalculateForwardVariables(
-    const std::vector<int>& l_prime, const Matrix& y, bool ctc_merge_repeated,
-    Matrix* log_alpha) const {
+void CTCLossCalculator::CalculateForwardVariables(const Matrix& log_y_l_prime,
+                                                  const Array& log_can_stay,
+                                                  const Array& log_can_skip,
+                                                  Matrix* log_alpha) const {
   // Number of cols is the number of time steps = number of cols in target
   // after the output delay.
-  log_alpha->setConstant(kLogZero);
-
-  int U = l_prime.size();
+  int U = log_y_l_prime.rows();
   int T = log_alpha->cols();
 
   CHECK_EQ(U, log_alpha->rows());
 
-  // Initial alpha values in (GravesTh) Eq 7.5 and Eq 7.6.
-  log_alpha->coeffRef(0, 0) = log(y(blank_index_, output_delay_));
-  // Below, l_prime[1] == labels[0]
-  auto label_0 = (l_prime.size() > 1) ? l_prime[1] : blank_index_;
-  log_alpha->coeffRef(1, 0) = log(y(label_0, output_delay_));
-
+  Recursion recursion(true, log_can_stay, log_can_skip, T);
+  recursion.FirstAlpha(log_y_l_prime.col(0), log_alpha->col(0));
   for (int t = 1; t < T; ++t) {
-    // If there is not enough time to output the remaining labels or
-    // some labels have been skipped, then let log_alpha(u, t) continue to
-    // be kLogZero.
-    for (int u = std::max(0, U - (2 * (T - t))); u < std::min(U, 2 * (t + 1));
-         ++u) {
-      // Begin (GravesTh) Eq 7.9
-      // Add in the u, t - 1 term.
-      float sum_log_alpha = kLogZero;
-      if (ctc_merge_repeated || l_prime[u] == blank_index_) {
-        sum_log_alpha = log_alpha->coeff(u, t - 1);
-      }
-
-      // Add in the u - 1, t - 1 term.
-      if (u > 0) {
-        sum_log_alpha =
-            LogSumExp(sum_log_alpha, log_alpha->coeff(u - 1, t - 1));
-      }
-
-      // Add in the u - 2, t - 1 term if l_prime(u) != blank or l_prime(u-2).
-      if (u > 1) {
-        const bool matching_labels_merge =
-            ctc_merge_repeated && (l_prime[u] == l_prime[u - 2]);
-        if (l_prime[u] != blank_index_ && !matching_labels_merge) {
-          sum_log_alpha =
-              LogSumExp(sum_log_alpha, log_alpha->coeff(u - 2, t - 1));
-        }
-      }
-      // Multiply the summed alphas with the activation log probability.
-      log_alpha->coeffRef(u, t) =
-          log(y(l_prime[u], output_delay_ + t)) + sum_log_alpha;
-    }  // End (GravesTh) Eq 7.9.
+    recursion.NextAlpha(t, log_alpha->col(t - 1), log_y_l_prime.col(t),
+                        log_alpha->col(t));
   }
 }
 
 // Calculates the beta(t, u) as described in (GravesTh) Section 7.3.
-void CTCLossCalculator::CalculateBackwardVariables(
-    const std::vector<int>& l_prime, const Matrix& y, bool ctc_merge_repeated,
-    Matrix* log_beta) const {
+void CTCLossCalculator::CalculateBackwardVariables(const Matrix& log_y_l_prime,
+                                                   const Array& log_can_stay,
+                                                   const Array& log_can_skip,
+                                                   Matrix* log_beta) const {
   // Number of cols is the number of time steps =  number of cols in target.
-  // Matrix log_beta =
-  //    Matrix::Constant(l_prime.size(), y.cols() - output_delay_,
-  // kLogZero);
-  log_beta->setConstant(kLogZero);
   int T = log_beta->cols();
-  int U = l_prime.size();
+  int U = log_y_l_prime.rows();
   CHECK_EQ(U, log_beta->rows());
 
-  // Initial beta values in (GravesTh) Eq 7.13: log of probability 1.
-  for (int u = U - 2; u < U; ++u) log_beta->coeffRef(u, T - 1) = 0;
-
+  Recursion recursion(true, log_can_stay, log_can_skip, T);
+  recursion.LastBeta(log_beta->col(T - 1));
   for (int t = T - 1 - 1; t >= 0; --t) {
-    // If there is not enough time to output the remaining labels or
-    // some labels have been skipped, then let log_beta(u, t) continue to
-    // be kLogZero.
-    for (int u = std::max(0, U - (2 * (T - t))); u < std::min(U, 2 * (t + 1));
-         ++u) {
-      // Begin (GravesTh) Eq 7.15
-      // Add in the u, t + 1 term.
-      if (ctc_merge_repeated || l_prime[u] == blank_index_) {
-        log_beta->coeffRef(u, t) =
-            LogSumExp(log_beta->coeff(u, t),
-                      log_beta->coeff(u, t + 1) +
-                          log(y(l_prime[u], output_delay_ + t + 1)));
-      }
-
-      // Add in the u + 1, t + 1 term.
-      if (u + 1 < U) {
-        log_beta->coeffRef(u, t) =
-            LogSumExp(log_beta->coeff(u, t),
-                      log_beta->coeff(u + 1, t + 1) +
-                          log(y(l_prime[u + 1], output_delay_ + t + 1)));
-      }
-
-      // Add in the u + 2, t + 1 term if l_prime(u) != blank or l_prime(u+2).
-      if (u + 2 < U) {
-        const bool matching_labels_merge =
-            ctc_merge_repeated && (l_prime[u] == l_prime[u + 2]);
-        if (l_prime[u] != blank_index_ && !matching_labels_merge) {
-          // Add in u + 2 term.
-          log_beta->coeffRef(u, t) =
-              LogSumExp(log_beta->coeff(u, t),
-                        log_beta->coeff(u + 2, t + 1) +
-                            log(y(l_prime[u + 2], output_delay_ + t + 1)));
-        }
-      }  // End (GravesTh) Eq. 7.15
-    }
+    recursion.PrevBeta(t, log_beta->col(t + 1), log_y_l_prime.col(t + 1),
+                       log_beta->col(t));
   }
 }
 
@@ -146,24 +254,219 @@ void CTCLossCalculator::CalculateGradient(const std::vector<int>& l_prime,
     return;
   }
 
-  int L = y.rows();
   int T = y.cols();
   int U = l_prime.size();
 
+  Array path_prob(U);
   for (int t = 0; t < T - output_delay_; ++t) {
-    Array prob_sum(L);
-    prob_sum.setConstant(kLogZero);
+    PathProbabilities(true, log_alpha.col(t), log_beta.col(t), log_p_z_x,
+                      &path_prob);
+    dy_b.col(output_delay_ + t) = y.col(output_delay_ + t);
+    for (int u = 0; u < U; ++u) {
+      // Negative term in (GravesTh) Eq 7.28, summed over the u of label l.
+      dy_b(l_prime[u], output_delay_ + t) -= path_prob(u);
+    }
+  }
+}
+
+// The scaled recursions follow Rabiner, "A Tutorial on Hidden Markov Models
+// and Selected Applications in Speech Recognition", Section V.A: alpha(:, t)
+// is divided by its sum scales(t), and beta(:, t) by the scales of the time
+// steps after t. The sum over u of alpha(u, t) * beta(u, t) is then one at
+// every t, and the logs of the scales add up to log(p(z|x)).
+bool CTCLossCalculator::CalculateScaledForwardVariables(
+    const Matrix& y_l_prime, const Array& can_stay, const Array& can_skip,
+    Matrix* alpha, Array* scales, float* log_p_z_x) const {
+  int U = y_l_prime.rows();
+  int T = alpha->cols();
+  CHECK_EQ(U, alpha->rows());
+  scales->resize(T);
+
+  Recursion recursion(false, can_stay, can_skip, T);
+  // Summed in double over long sequences.
+  double log_p = 0;
+  for (int t = 0; t < T; ++t) {
+    if (t == 0) {
+      recursion.FirstAlpha(y_l_prime.col(0), alpha->col(0));
+    } else {
+      recursion.NextAlpha(t, alpha->col(t - 1), y_l_prime.col(t),
+                          alpha->col(t));
+    }
+    const float scale = alpha->col(t).sum();
+    if (!(scale > 0)) return false;
+    alpha->col(t) /= scale;
+    (*scales)(t) = scale;
+    log_p += std::log(scale);
+  }
+  *log_p_z_x = log_p;
+  return true;
+}
+
+bool CTCLossCalculator::CalculateScaledBackwardVariables(
+    const Matrix& y_l_prime, const Array& can_stay, const Array& can_skip,
+    const Array& scales, Matrix* beta) const {
+  int T = beta->cols();
+  int U = y_l_prime.rows();
+  CHECK_EQ(U, beta->rows());
 
+  Recursion recursion(false, can_stay, can_skip, T);
+  recursion.LastBeta(beta->col(T - 1));
+  for (int t = T - 1 - 1; t >= 0; --t) {
+    recursion.PrevBeta(t, beta->col(t + 1), y_l_prime.col(t + 1),
+                       beta->col(t));
+    beta->col(t) /= scales(t + 1);
+    // beta(u, t) grows large where alpha(u, t) is tiny.
+    if (!beta->col(t).allFinite()) return false;
+  }
+  return true;
+}
+
+bool CTCLossCalculator::CalculateScaledGradient(const std::vector<int>& l_prime,
+                                                const Matrix& y,
+                                                const Matrix& alpha,
+                                                const Matrix& beta,
+                                                Matrix* dy) const {
+  auto dy_b = dy->leftCols(y.cols());
+  int T = y.cols();
+  int U = l_prime.size();
+
+  // (GravesTh) Eq 7.28.
+  Array path_prob(U);
+  for (int t = 0; t < T - output_delay_; ++t) {
+    if (!PathProbabilities(false, alpha.col(t), beta.col(t), 0, &path_prob)) {
+      return false;
+    }
+    dy_b.col(output_delay_ + t) = y.col(output_delay_ + t);
     for (int u = 0; u < U; ++u) {
-      int l = l_prime[u];
-      prob_sum[l] = LogSumExp(prob_sum[l], log_alpha(u, t) + log_beta(u, t));
+      dy_b(l_prime[u], output_delay_ + t) -= path_prob(u);
+    }
+  }
+  return true;
+}
+
+// The forward pass keeps alpha(:, t) at every K-th time step only, K being
+// about sqrt(T). The backward pass then recomputes the alphas of one segment
+// of K time steps at a time from its checkpoint, which takes O(U * sqrt(T))
+// memory for one more forward pass.
+bool CTCLossCalculator::CalculateCheckpointedVariables(
+    Algorithm algorithm, int T, const Array& can_stay, const Array& can_skip,
+    const std::function<void(int, Eigen::VectorXf*)>& get_log_y_l_prime,
+    const std::function<void(int, const Array&)>* path_probs,
+    float* log_p_z_x) const {
+  const bool log_space = algorithm == LOG_SPACE;
+  const int U = can_stay.size();
+  const int K = std::max(1, static_cast<int>(std::sqrt(T)));
+
+  Recursion recursion(log_space,
+                      log_space ? Array(can_stay.log()) : can_stay,
+                      log_space ? Array(can_skip.log()) : can_skip, T);
+  auto get_y_l_prime = [log_space, &get_log_y_l_prime](int t,
+                                                       Eigen::VectorXf* y) {
+    get_log_y_l_prime(t, y);
+    if (!log_space) *y = y->array().exp().matrix();
+  };
+
+  Matrix checkpoints(U, (T + K - 1) / K);
+  Array scales(log_space ? 0 : T);
+  // Summed in double over long sequences.
+  double log_p = 0;
+  Eigen::VectorXf y_t(U), alpha_prev(U), alpha_t(U);
+  for (int t = 0; t < T; ++t) {
+    get_y_l_prime(t, &y_t);
+    if (t == 0) {
+      recursion.FirstAlpha(y_t, alpha_t);
+    } else {
+      recursion.NextAlpha(t, alpha_prev, y_t, alpha_t);
+    }
+    if (!log_space) {
+      const float scale = alpha_t.sum();
+      if (!(scale > 0)) return false;
+      alpha_t /= scale;
+      scales(t) = scale;
+      log_p += std::log(scale);
     }
+    if (t % K == 0) checkpoints.col(t / K) = alpha_t;
+    alpha_prev.swap(alpha_t);
+  }
+  // (GravesTh) Eq 7.14, the paths ending in the last label or blank; only in
+  // the blank if there are no labels.
+  if (!log_space) {
+    *log_p_z_x = log_p;
+  } else if (U > 1) {
+    *log_p_z_x = LogSumExp(alpha_prev(U - 2), alpha_prev(U - 1));
+  } else {
+    *log_p_z_x = alpha_prev(U - 1);
+  }
+
+  // It is possible that no valid path is found if the activations for the
+  // targets are zero.
+  if (path_probs == nullptr || *log_p_z_x == kLogZero) return true;
 
-    for (int l = 0; l < L; ++l) {
-      // Negative term in (GravesTh) Eq 7.28.
-      float negative_term = expf(prob_sum[l] - log_p_z_x);
+  // The alphas and activations of one segment.
+  Matrix alpha(U, K), y(U, K);
+  Eigen::VectorXf beta_next(U), beta_t(U), y_next(U);
+  Array path_prob(U);
+  for (int s = checkpoints.cols() - 1; s >= 0; --s) {
+    const int begin = s * K;
+    const int end = std::min(T, begin + K);
+    alpha.col(0) = checkpoints.col(s);
+    get_y_l_prime(begin, &y_t);
+    y.col(0) = y_t;
+    for (int t = begin + 1; t < end; ++t) {
+      get_y_l_prime(t, &y_t);
+      y.col(t - begin) = y_t;
+      recursion.NextAlpha(t, alpha.col(t - begin - 1), y_t,
+                          alpha.col(t - begin));
+      if (!log_space) alpha.col(t - begin) /= scales(t);
+    }
+    for (int t = end - 1; t >= begin; --t) {
+      if (t == T - 1) {
+        recursion.LastBeta(beta_t);
+      } else {
+        recursion.PrevBeta(t, beta_next, y_next, beta_t);
+        if (!log_space) {
+          beta_t /= scales(t + 1);
+          if (!beta_t.allFinite()) return false;
+        }
+      }
+      if (!PathProbabilities(log_space, alpha.col(t - begin), beta_t,
+                             *log_p_z_x, &path_prob)) {
+        return false;
+      }
+      (*path_probs)(t, path_prob);
+      beta_next.swap(beta_t);
+      y_next = y.col(t - begin);
+    }
+  }
+  return true;
+}
+
+void CTCLossCalculator::GetLPrimeActivations(const std::vector<int>& l_prime,
+                                             const Matrix& y,
+                                             Matrix* y_l_prime) const {
+  const int U = l_prime.size();
+  const int T = y.cols() - output_delay_;
+  y_l_prime->resize(U, T);
+  for (int t = 0; t < T; ++t) {
+    for (int u = 0; u < U; ++u) {
+      (*y_l_prime)(u, t) = y(l_prime[u], output_delay_ + t);
+    }
+  }
+}
 
-      dy_b(l, output_delay_ + t) = y(l, output_delay_ + t) - negative_term;
+void CTCLossCalculator::GetTransitions(const std::vector<int>& l_prime,
+                                       bool ctc_merge_repeated,
+                                       Array* can_stay, Array* can_skip) const {
+  const int U = l_prime.size();
+  can_stay->resize(U);
+  can_skip->setZero(U + 2);
+  for (int u = 0; u < U; ++u) {
+    (*can_stay)(u) = (ctc_merge_repeated || l_prime[u] == blank_index_);
+    // A path can skip the blank before u unless l_prime(u) is a blank, or
+    // repeats l_prime(u - 2) and repeats are merged.
+    if (u > 1 && l_prime[u] != blank_index_ &&
+        !(ctc_merge_repeated && l_prime[u] == l_prime[u - 2])) {
+      (*can_skip)(u) = 1;
     }
   }
 }
@@ -16,6 +16,8 @@ limitations under the License.
 #ifndef TENSORFLOW_CORE_UTIL_CTC_CTC_LOSS_CALCULATOR_H_
 #define TENSORFLOW_CORE_UTIL_CTC_CTC_LOSS_CALCULATOR_H_
 
+#include <cmath>
+#include <functional>
 #include <vector>
 
 #include "third_party/eigen3/Eigen/Core"
@@ -57,8 +59,33 @@ class CTCLossCalculator {
   typedef Eigen::Map<const Eigen::MatrixXf> InputMap;
   typedef Eigen::Map<Eigen::MatrixXf> OutputMap;
 
-  CTCLossCalculator(int blank_index, int output_delay)
-      : blank_index_(blank_index), output_delay_(output_delay) {}
+  // How the forward and backward variables are represented.
+  enum Algorithm {
+    // In log space, as in (GravesTh) Section 7.3.1. The recursions run over
+    // all of u at once, see ctc_loss_calculator.cc.
+    LOG_SPACE,
+    // As probabilities rescaled at every time step, with the logs of the
+    // scales summed into the loss, which avoids the exp and log of every
+    // LogSumExp. Batch items whose rescaled variables underflow or overflow
+    // nonetheless fall back to LOG_SPACE.
+    SCALED,
+  };
+
+  // With low_memory, batch items are computed in O(U' * sqrt(T)) memory
+  // rather than O((num_classes + U') * T), U' being the length of the label
+  // sequence with blanks and T the sequence length: the softmax is computed
+  // on the fly, the gradients are written straight into *gradients, and the
+  // forward variables are kept at checkpoints only and recomputed for the
+  // backward pass, which costs about one more forward pass.
+  CTCLossCalculator(int blank_index, int output_delay,
+                    Algorithm algorithm = LOG_SPACE, bool low_memory = false)
+      : blank_index_(blank_index),
+        output_delay_(output_delay),
+        algorithm_(algorithm),
+        low_memory_(low_memory) {}
+
+  // Maps an op attr value ("log_space" or "scaled") to an Algorithm.
+  static Status ParseAlgorithm(const string& name, Algorithm* algorithm);
 
   template <typename VectorIn, typename VectorOut, typename MatrixIn,
             typename MatrixOut>
@@ -71,18 +98,74 @@ class CTCLossCalculator {
                        DeviceBase::CpuWorkerThreads* workers = nullptr) const;
 
  private:
-  void CalculateForwardVariables(const std::vector<int>& l_prime,
-                                 const Matrix& y, bool ctc_merge_repeated,
+  // The forward and backward recursions take y_l_prime(u, t), the activation
+  // of l_prime[u] at time step output_delay_ + t, and the transitions allowed
+  // by l_prime: can_stay(u) for staying at u from one time step to the next,
+  // and can_skip(u) for moving from u - 2 to u, see GetTransitions. The log
+  // space variants take the logs of all three.
+  void CalculateForwardVariables(const Matrix& log_y_l_prime,
+                                 const Array& log_can_stay,
+                                 const Array& log_can_skip,
                                  Matrix* log_alpha) const;
 
-  void CalculateBackwardVariables(const std::vector<int>& l_prime,
-                                  const Matrix& y, bool ctc_merge_repeated,
+  void CalculateBackwardVariables(const Matrix& log_y_l_prime,
+                                  const Array& log_can_stay,
+                                  const Array& log_can_skip,
                                   Matrix* log_beta) const;
 
   void CalculateGradient(const std::vector<int>& l_prime, const Matrix& y,
                          const Matrix& log_alpha, const Matrix& log_beta,
                          float log_p_z_x, Matrix* dy) const;
 
+  // The SCALED variants return false if the rescaled variables underflow
+  // or overflow. The forward recursion yields the scale of every time step,
+  // which the backward recursion reuses, and log(p(z|x)).
+  bool CalculateScaledForwardVariables(const Matrix& y_l_prime,
+                                       const Array& can_stay,
+                                       const Array& can_skip, Matrix* alpha,
+                                       Array* scales, float* log_p_z_x) const;
+
+  bool CalculateScaledBackwardVariables(const Matrix& y_l_prime,
+                                        const Array& can_stay,
+                                        const Array& can_skip,
+                                        const Array& scales,
+                                        Matrix* beta) const;
+
+  bool CalculateScaledGradient(const std::vector<int>& l_prime,
+                               const Matrix& y, const Matrix& alpha,
+                               const Matrix& beta, Matrix* dy) const;
+
+  // The low_memory variant of the forward and backward recursions of T time
+  // steps, with algorithm. get_log_y_l_prime(t, &column) sets column to the
+  // logs of y_l_prime(:, t). Unless path_probs is null, (*path_probs)(t,
+  // path_prob) is then called for t from T - 1 down to 0 with the
+  // probabilities of the paths through (u, t) relative to p(z|x), but not if
+  // there is no valid path. Returns false if SCALED fails, possibly after
+  // some calls to path_probs.
+  bool CalculateCheckpointedVariables(
+      Algorithm algorithm, int T, const Array& can_stay, const Array& can_skip,
+      const std::function<void(int, Eigen::VectorXf*)>& get_log_y_l_prime,
+      const std::function<void(int, const Array&)>* path_probs,
+      float* log_p_z_x) const;
+
+  // Loss and gradients of batch item b with low_memory.
+  template <typename MatrixIn, typename MatrixOut>
+  void CalculateLowMemoryLoss(int b, int seq_len,
+                              const std::vector<int>& l_prime,
+                              const std::vector<MatrixIn>& inputs,
+                              bool ctc_merge_repeated, float* loss,
+                              std::vector<MatrixOut>* gradients) const;
+
+  // Gathers y_l_prime(u, t) = y(l_prime[u], output_delay_ + t).
+  void GetLPrimeActivations(const std::vector<int>& l_prime, const Matrix& y,
+                            Matrix* y_l_prime) const;
+
+  // Sets can_stay(u) and can_skip(u) to 1 where the transition is allowed
+  // and to 0 elsewhere. can_skip has two more, zero, entries past the end
+  // of l_prime for the backward recursion, which looks ahead by two.
+  void GetTransitions(const std::vector<int>& l_prime, bool ctc_merge_repeated,
+                      Array* can_stay, Array* can_skip) const;
+
   void GetLPrimeIndices(const std::vector<int>& l,
                         std::vector<int>* l_prime) const;
 
@@ -103,6 +186,10 @@ class CTCLossCalculator {
   // Delay for target labels in time steps.
   // The delay in time steps before the output sequence.
   const int output_delay_;
+
+  const Algorithm algorithm_;
+
+  const bool low_memory_;
 };
 
 template <typename VectorIn, typename VectorOut, typename MatrixIn,
@@ -186,13 +273,21 @@ Status CTCLossCalculator::CalculateLoss(
         continue;
       }
 
-      // For each batch element, log(alpha) and log(beta).
+      // For each batch element, log(alpha) and log(beta), or the rescaled
+      // alpha and beta.
       //   row size is: u_prime == l_prime.size()
       //   col size is: seq_len[b] - output_delay_
       const std::vector<int>& l_prime = l_primes[b];
 
-      Matrix log_alpha_b(l_prime.size(), seq_len(b) - this->output_delay_);
-      Matrix log_beta_b(l_prime.size(), seq_len(b) - this->output_delay_);
+      if (this->low_memory_) {
+        CalculateLowMemoryLoss(b, seq_len(b), l_prime, inputs,
+                               ctc_merge_repeated, &(*loss)(b),
+                               requires_backprop ? gradients : nullptr);
+        continue;
+      }
+
+      Matrix alpha_b(l_prime.size(), seq_len(b) - this->output_delay_);
+      Matrix beta_b(l_prime.size(), seq_len(b) - this->output_delay_);
 
       // Work matrices, pre-allocated to the size required by this batch item.
       Matrix y(num_classes, seq_len(b));
@@ -216,30 +311,55 @@ Status CTCLossCalculator::CalculateLoss(
         y_b.col(t) = y_b_col / y_b_col.sum();
       }
 
-      // Compute forward, backward.
-      // Forward variables.
-      CalculateForwardVariables(l_prime, y_b, ctc_merge_repeated, &log_alpha_b);
-      // Backward variables.
-      CalculateBackwardVariables(l_prime, y_b, ctc_merge_repeated, &log_beta_b);
+      // The activations of the labels of l_prime and the transitions between
+      // them, shared by the forward and backward recursions.
+      Matrix y_l_prime;
+      GetLPrimeActivations(l_prime, y_b, &y_l_prime);
+      Array can_stay;
+      Array can_skip;
+      GetTransitions(l_prime, ctc_merge_repeated, &can_stay, &can_skip);
 
       // The loss is computed as the log(p(z|x)) between the target and
-      // prediction. Do lazy evaluation of log_prob here.
+      // prediction.
       float log_p_z_x = kLogZero;
-      for (int u = 0; u < l_prime.size(); ++u) {
-        // (GravesTh) Eq 7.26, sum over all paths for t = 0.
-        log_p_z_x = LogSumExp(log_p_z_x, log_alpha_b(u, 0) + log_beta_b(u, 0));
+      Array scales;
+      const bool scaled =
+          this->algorithm_ == SCALED &&
+          CalculateScaledForwardVariables(y_l_prime, can_stay, can_skip,
+                                          &alpha_b, &scales, &log_p_z_x) &&
+          (!requires_backprop ||
+           (CalculateScaledBackwardVariables(y_l_prime, can_stay, can_skip,
+                                             scales, &beta_b) &&
+            CalculateScaledGradient(l_prime, y_b, alpha_b, beta_b, &dy)));
+      if (!scaled) {
+        y_l_prime = y_l_prime.array().log();
+        can_stay = can_stay.log();
+        can_skip = can_skip.log();
+        // Compute forward, backward.
+        // Forward variables.
+        CalculateForwardVariables(y_l_prime, can_stay, can_skip, &alpha_b);
+        // Backward variables.
+        CalculateBackwardVariables(y_l_prime, can_stay, can_skip, &beta_b);
+
+        // Do lazy evaluation of log_prob here.
+        log_p_z_x = kLogZero;
+        for (int u = 0; u < l_prime.size(); ++u) {
+          // (GravesTh) Eq 7.26, sum over all paths for t = 0.
+          log_p_z_x = LogSumExp(log_p_z_x, alpha_b(u, 0) + beta_b(u, 0));
+        }
+
+        // We compute the derivative if needed.
+        if (requires_backprop) {
+          // Gradients with respect to input activations.
+          // Calculate gradient.
+          dy.setZero();
+          CalculateGradient(l_prime, y_b, alpha_b, beta_b, log_p_z_x, &dy);
+        }
       }
 
       (*loss)(b) = -log_p_z_x;  // Use negative log loss for display.
 
-      // We compute the derivative if needed.
       if (requires_backprop) {
-        // Gradients with respect to input activations.
-        // Calculate gradient.
-        dy.setZero();
-        CalculateGradient(l_prime, y_b, log_alpha_b, log_beta_b, log_p_z_x,
-                          &dy);
-
         // Convert gradient for current sample to DistBelief.
         for (int t = 0; t < seq_len(b); t++) {
           (*gradients)[t].row(b).array() = dy.col(t);
@@ -276,6 +396,73 @@ Status CTCLossCalculator::CalculateLoss(
   return Status::OK();
 }
 
+template <typename MatrixIn, typename MatrixOut>
+void CTCLossCalculator::CalculateLowMemoryLoss(
+    int b, int seq_len, const std::vector<int>& l_prime,
+    const std::vector<MatrixIn>& inputs, bool ctc_merge_repeated, float* loss,
+    std::vector<MatrixOut>* gradients) const {
+  // The log of the softmax denominator of every time step.
+  Array log_normalizer(seq_len);
+  for (int t = 0; t < seq_len; ++t) {
+    const float max_coeff = inputs[t].row(b).maxCoeff();
+    log_normalizer(t) =
+        max_coeff +
+        std::log((inputs[t].row(b).array() - max_coeff).exp().sum());
+  }
+
+  const int U = l_prime.size();
+  auto get_log_y_l_prime = [this, b, U, &l_prime, &inputs, &log_normalizer](
+      int t, Eigen::VectorXf* log_y) {
+    const int s = this->output_delay_ + t;
+    for (int u = 0; u < U; ++u) {
+      (*log_y)(u) = inputs[s](b, l_prime[u]) - log_normalizer(s);
+    }
+  };
+  // Sets the gradient at output_delay_ + t to the softmax, minus path_prob
+  // if not null, (GravesTh) Eq 7.28.
+  auto set_gradient = [this, b, U, &l_prime, &inputs, &log_normalizer,
+                       gradients](int t, const Array* path_prob) {
+    const int s = this->output_delay_ + t;
+    auto dy = (*gradients)[s].row(b);
+    dy.array() = (inputs[s].row(b).array() - log_normalizer(s)).exp();
+    if (path_prob == nullptr) return;
+    for (int u = 0; u < U; ++u) dy(l_prime[u]) -= (*path_prob)(u);
+  };
+  const std::function<void(int, const Array&)> path_probs =
+      [&set_gradient](int t, const Array& path_prob) {
+        set_gradient(t, &path_prob);
+      };
+
+  Array can_stay;
+  Array can_skip;
+  GetTransitions(l_prime, ctc_merge_repeated, &can_stay, &can_skip);
+  const int T = seq_len - this->output_delay_;
+  float log_p_z_x = kLogZero;
+  if (this->algorithm_ != SCALED ||
+      !CalculateCheckpointedVariables(SCALED, T, can_stay, can_skip,
+                                      get_log_y_l_prime,
+                                      gradients ? &path_probs : nullptr,
+                                      &log_p_z_x)) {
+    CalculateCheckpointedVariables(LOG_SPACE, T, can_stay, can_skip,
+                                   get_log_y_l_prime,
+                                   gradients ? &path_probs : nullptr,
+                                   &log_p_z_x);
+  }
+
+  *loss = -log_p_z_x;  // Use negative log loss for display.
+
+  if (gradients != nullptr) {
+    if (log_p_z_x == kLogZero) {
+      LOG(WARNING) << "No valid path found.";
+      for (int t = -this->output_delay_; t < T; ++t) set_gradient(t, nullptr);
+    } else {
+      for (int s = 0; s < this->output_delay_; ++s) {
+        (*gradients)[s].row(b).setZero();
+      }
+    }
+  }
+}
+
 template <typename Vector>
 Status CTCLossCalculator::PopulateLPrimes(
     bool preprocess_collapse_repeated, bool ignore_longer_outputs_than_inputs,
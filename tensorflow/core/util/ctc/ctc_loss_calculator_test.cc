@@ -0,0 +1,351 @@
+/* Copyright 2017 The TensorFlow Authors. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#include "tensorflow/core/util/ctc/ctc_loss_calculator.h"
+
+#include <cmath>
+#include <tuple>
+#include <vector>
+
+#include "tensorflow/core/lib/core/status_test_util.h"
+#include "tensorflow/core/lib/random/simple_philox.h"
+#include "tensorflow/core/platform/denormal.h"
+#include "tensorflow/core/platform/test.h"
+#include "tensorflow/core/platform/test_benchmark.h"
+
+namespace tensorflow {
+namespace ctc {
+namespace {
+
+typedef CTCLossCalculator::LabelSequences LabelSequences;
+
+std::vector<Eigen::MatrixXf> RandomInputs(int max_time, int batch_size,
+                                          int num_classes, float scale) {
+  random::PhiloxRandom philox(301, 17);
+  random::SimplePhilox rnd(&philox);
+  std::vector<Eigen::MatrixXf> inputs(max_time);
+  for (Eigen::MatrixXf& input : inputs) {
+    input.resize(batch_size, num_classes);
+    for (int b = 0; b < batch_size; ++b) {
+      for (int c = 0; c < num_classes; ++c) {
+        input(b, c) = scale * rnd.RandFloat();
+      }
+    }
+  }
+  return inputs;
+}
+
+// Random inputs of one batch item that favour labels, like a trained acoustic
+// model does: the first frame of each of labels.size() equal segments favours
+// its label and the other frames favour the blank.
+std::vector<Eigen::MatrixXf> AlignedInputs(int max_time, int num_classes,
+                                           float scale,
+                                           const std::vector<int>& labels) {
+  std::vector<Eigen::MatrixXf> inputs =
+      RandomInputs(max_time, 1, num_classes, scale);
+  const int num_labels = labels.size();
+  for (int t = 0; t < max_time; ++t) {
+    const int segment = t * num_labels / max_time;
+    const bool first = t == 0 || (t - 1) * num_labels / max_time != segment;
+    inputs[t](0, first ? labels[segment] : num_classes - 1) += scale;
+  }
+  return inputs;
+}
+
+// Loss and gradient of batch item b, summing the probabilities of all the
+// num_classes^max_time paths that collapse to labels.
+void EnumeratePaths(const std::vector<Eigen::MatrixXf>& inputs, int b,
+                    const std::vector<int>& labels, bool ctc_merge_repeated,
+                    float* loss, Eigen::MatrixXf* gradient) {
+  const int max_time = inputs.size();
+  const int num_classes = inputs[0].cols();
+  const int blank = num_classes - 1;
+  Eigen::MatrixXd y(max_time, num_classes);
+  for (int t = 0; t < max_time; ++t) {
+    Eigen::ArrayXd row = inputs[t].row(b).cast<double>().array().exp();
+    y.row(t) = row / row.sum();
+  }
+  double p = 0;
+  Eigen::MatrixXd through(Eigen::MatrixXd::Zero(max_time, num_classes));
+  std::vector<int> path(max_time, 0);
+  while (true) {
+    std::vector<int> collapsed;
+    double path_p = 1;
+    for (int t = 0; t < max_time; ++t) {
+      path_p *= y(t, path[t]);
+      if (path[t] != blank &&
+          !(ctc_merge_repeated && t > 0 && path[t] == path[t - 1])) {
+        collapsed.push_back(path[t]);
+      }
+    }
+    if (collapsed == labels) {
+      p += path_p;
+      for (int t = 0; t < max_time; ++t) through(t, path[t]) += path_p;
+    }
+    int t = 0;
+    while (t < max_time && ++path[t] == num_classes) path[t++] = 0;
+    if (t == max_time) break;
+  }
+  *loss = -std::log(p);
+  *gradient = (y - through / p).cast<float>();
+}
+
+// Parameterized by the algorithm and low_memory.
+class CTCLossCalculatorTest
+    : public ::testing::TestWithParam<
+          std::tuple<CTCLossCalculator::Algorithm, bool>> {
+ protected:
+  CTCLossCalculator MakeCalculator(int num_classes, int output_delay = 0) {
+    return CTCLossCalculator(num_classes - 1, output_delay,
+                             std::get<0>(GetParam()), std::get<1>(GetParam()));
+  }
+};
+
+TEST_P(CTCLossCalculatorTest, MatchesPathEnumeration) {
+  const int max_time = 6;
+  const int batch_size = 3;
+  const int num_classes = 4;
+  const std::vector<Eigen::MatrixXf> inputs =
+      RandomInputs(max_time, batch_size, num_classes, 4.0f);
+  const LabelSequences labels = {{0, 1, 1}, {2}, {1, 0, 1, 2}};
+  const Eigen::VectorXi seq_len = Eigen::VectorXi::Constant(batch_size, 6);
+
+  for (bool ctc_merge_repeated : {true, false}) {
+    CTCLossCalculator calculator = MakeCalculator(num_classes);
+    Eigen::VectorXf loss(batch_size);
+    std::vector<Eigen::MatrixXf> gradients(
+        max_time, Eigen::MatrixXf::Zero(batch_size, num_classes));
+    TF_ASSERT_OK(calculator.CalculateLoss(seq_len, labels, inputs, false,
+                                          ctc_merge_repeated, false, &loss,
+                                          &gradients));
+    for (int b = 0; b < batch_size; ++b) {
+      float expected_loss;
+      Eigen::MatrixXf expected_gradient;
+      EnumeratePaths(inputs, b, labels[b], ctc_merge_repeated, &expected_loss,
+                     &expected_gradient);
+      EXPECT_NEAR(expected_loss, loss(b), 1e-4);
+      for (int t = 0; t < max_time; ++t) {
+        for (int c = 0; c < num_classes; ++c) {
+          EXPECT_NEAR(expected_gradient(t, c), gradients[t](b, c), 1e-5);
+        }
+      }
+    }
+  }
+}
+
+TEST_P(CTCLossCalculatorTest, LongSequence) {
+  // Long enough for the path probabilities to underflow a float many times
+  // over.
+  const int max_time = 2000;
+  const int num_classes = 30;
+  LabelSequences labels(1);
+  for (int i = 0; i < 300; ++i) labels[0].push_back(i % (num_classes - 1));
+  const std::vector<Eigen::MatrixXf> inputs =
+      AlignedInputs(max_time, num_classes, 8.0f, labels[0]);
+  const Eigen::VectorXi seq_len = Eigen::VectorXi::Constant(1, max_time);
+
+  std::vector<Eigen::MatrixXf> gradients[2];
+  Eigen::VectorXf loss[2];
+  for (int i = 0; i < 2; ++i) {
+    CTCLossCalculator calculator = i == 0
+                                       ? CTCLossCalculator(num_classes - 1, 0)
+                                       : MakeCalculator(num_classes);
+    loss[i].resize(1);
+    gradients[i].assign(max_time, Eigen::MatrixXf::Zero(1, num_classes));
+    TF_ASSERT_OK(calculator.CalculateLoss(seq_len, labels, inputs, false, true,
+                                          false, &loss[i], &gradients[i]));
+  }
+  EXPECT_GT(loss[0](0), 200);
+  EXPECT_NEAR(loss[0](0), loss[1](0), 1e-5 * loss[0](0));
+  // The log-space variables of magnitude log(p(z|x)) accumulate rounding
+  // errors of about 1e-3 over the 2000 steps, which bounds the absolute
+  // error of the gradients.
+  for (int t = 0; t < max_time; ++t) {
+    EXPECT_LT((gradients[0][t] - gradients[1][t]).cwiseAbs().maxCoeff(), 5e-3)
+        << t;
+  }
+}
+
+TEST_P(CTCLossCalculatorTest, OutputDelay) {
+  // The default calculator has no low_memory variant to compare with.
+  const int max_time = 23;
+  const int batch_size = 3;
+  const int num_classes = 7;
+  const int output_delay = 2;
+  const std::vector<Eigen::MatrixXf> inputs =
+      RandomInputs(max_time, batch_size, num_classes, 4.0f);
+  const LabelSequences labels = {{0, 1, 1, 5}, {2}, {3, 4, 3}};
+  Eigen::VectorXi seq_len(batch_size);
+  seq_len << 23, 10, 17;
+
+  std::vector<Eigen::MatrixXf> gradients[2];
+  Eigen::VectorXf loss[2];
+  for (int i = 0; i < 2; ++i) {
+    CTCLossCalculator calculator =
+        i == 0 ? CTCLossCalculator(num_classes - 1, output_delay)
+               : MakeCalculator(num_classes, output_delay);
+    loss[i].resize(batch_size);
+    // Garbage the calculator must overwrite up to seq_len.
+    gradients[i].assign(max_time,
+                        Eigen::MatrixXf::Constant(batch_size, num_classes, 7));
+    TF_ASSERT_OK(calculator.CalculateLoss(seq_len, labels, inputs, false, true,
+                                          false, &loss[i], &gradients[i]));
+  }
+  EXPECT_TRUE(loss[0].isApprox(loss[1], 1e-5));
+  for (int t = 0; t < max_time; ++t) {
+    EXPECT_LT((gradients[0][t] - gradients[1][t]).cwiseAbs().maxCoeff(), 1e-5)
+        << t;
+  }
+}
+
+TEST_P(CTCLossCalculatorTest, OnlyBlankLabels) {
+  // Labels of the blank index end the sequence, leaving l_prime a single
+  // blank that only the all-blank path matches.
+  const int max_time = 5;
+  const int batch_size = 2;
+  const int num_classes = 3;
+  const std::vector<Eigen::MatrixXf> inputs =
+      RandomInputs(max_time, batch_size, num_classes, 4.0f);
+  const LabelSequences labels = {{2}, {2, 2}};
+  const Eigen::VectorXi seq_len = Eigen::VectorXi::Constant(batch_size, 5);
+
+  CTCLossCalculator calculator = MakeCalculator(num_classes);
+  Eigen::VectorXf loss(batch_size);
+  std::vector<Eigen::MatrixXf> gradients(
+      max_time, Eigen::MatrixXf::Zero(batch_size, num_classes));
+  TF_ASSERT_OK(calculator.CalculateLoss(seq_len, labels, inputs, false, true,
+                                        false, &loss, &gradients));
+  for (int b = 0; b < batch_size; ++b) {
+    float expected_loss;
+    Eigen::MatrixXf expected_gradient;
+    EnumeratePaths(inputs, b, {}, true, &expected_loss, &expected_gradient);
+    EXPECT_NEAR(expected_loss, loss(b), 1e-4);
+    for (int t = 0; t < max_time; ++t) {
+      for (int c = 0; c < num_classes; ++c) {
+        EXPECT_NEAR(expected_gradient(t, c), gradients[t](b, c), 1e-5);
+      }
+    }
+  }
+}
+
+INSTANTIATE_TEST_CASE_P(
+    Algorithms, CTCLossCalculatorTest,
+    ::testing::Combine(::testing::Values(CTCLossCalculator::LOG_SPACE,
+                                         CTCLossCalculator::SCALED),
+                       ::testing::Bool()));
+
+TEST(CTCLossCalculator, ScaledFallsBackToLogSpace) {
+  // Inputs carrying no information about the labels leave the scaled
+  // backward variables out of float range, so SCALED must produce exactly the
+  // LOG_SPACE results.
+  const int max_time = 500;
+  const int num_classes = 100;
+  const std::vector<Eigen::MatrixXf> inputs =
+      RandomInputs(max_time, 1, num_classes, 8.0f);
+  LabelSequences labels(1);
+  for (int i = 0; i < 50; ++i) labels[0].push_back(i);
+  const Eigen::VectorXi seq_len = Eigen::VectorXi::Constant(1, max_time);
+
+  for (bool low_memory : {false, true}) {
+    std::vector<Eigen::MatrixXf> gradients[2];
+    Eigen::VectorXf loss[2];
+    const CTCLossCalculator::Algorithm algorithms[2] = {
+        CTCLossCalculator::LOG_SPACE, CTCLossCalculator::SCALED};
+    for (int i = 0; i < 2; ++i) {
+      CTCLossCalculator calculator(num_classes - 1, 0, algorithms[i],
+                                   low_memory);
+      loss[i].resize(1);
+      gradients[i].assign(max_time, Eigen::MatrixXf::Zero(1, num_classes));
+      TF_ASSERT_OK(calculator.CalculateLoss(seq_len, labels, inputs, false,
+                                            true, false, &loss[i],
+                                            &gradients[i]));
+    }
+    EXPECT_EQ(loss[0](0), loss[1](0));
+    for (int t = 0; t < max_time; ++t) {
+      EXPECT_EQ(gradients[0][t], gradients[1][t]) << t;
+    }
+  }
+}
+
+TEST(CTCLossCalculator, ParseAlgorithm) {
+  CTCLossCalculator::Algorithm algorithm;
+  TF_EXPECT_OK(CTCLossCalculator::ParseAlgorithm("scaled", &algorithm));
+  EXPECT_EQ(CTCLossCalculator::SCALED, algorithm);
+  TF_EXPECT_OK(CTCLossCalculator::ParseAlgorithm("log_space", &algorithm));
+  EXPECT_EQ(CTCLossCalculator::LOG_SPACE, algorithm);
+  EXPECT_FALSE(CTCLossCalculator::ParseAlgorithm("linear", &algorithm).ok());
+}
+
+// Loss and gradient of one batch item of 500 time steps over num_classes
+// classes, with num_labels labels and inputs favouring them.
+void RunCTCLoss(int iters, int algorithm, bool low_memory, int num_classes,
+                int num_labels) {
+  testing::StopTiming();
+  const int max_time = 500;
+  LabelSequences labels(1);
+  for (int i = 0; i < num_labels; ++i) {
+    labels[0].push_back(i % (num_classes - 1));
+  }
+  const std::vector<Eigen::MatrixXf> inputs =
+      AlignedInputs(max_time, num_classes, 8.0f, labels[0]);
+  const Eigen::VectorXi seq_len = Eigen::VectorXi::Constant(1, max_time);
+  CTCLossCalculator calculator(
+      num_classes - 1, 0, static_cast<CTCLossCalculator::Algorithm>(algorithm),
+      low_memory);
+  Eigen::VectorXf loss(1);
+  std::vector<Eigen::MatrixXf> gradients(
+      max_time, Eigen::MatrixXf::Zero(1, num_classes));
+  // Like the threads of the kernels.
+  port::ScopedFlushDenormal flush;
+  testing::StartTiming();
+  for (int i = 0; i < iters; ++i) {
+    TF_CHECK_OK(calculator.CalculateLoss(seq_len, labels, inputs, false, true,
+                                         false, &loss, &gradients));
+  }
+  testing::StopTiming();
+  testing::ItemsProcessed(static_cast<int64>(iters) * max_time);
+}
+
+// 100 classes.
+void BM_CTCLoss(int iters, int algorithm, int num_labels) {
+  RunCTCLoss(iters, algorithm, false, 100, num_labels);
+}
+BENCHMARK(BM_CTCLoss)
+    ->ArgPair(CTCLossCalculator::LOG_SPACE, 50)
+    ->ArgPair(CTCLossCalculator::SCALED, 50)
+    ->ArgPair(CTCLossCalculator::LOG_SPACE, 200)
+    ->ArgPair(CTCLossCalculator::SCALED, 200);
+
+// low_memory, with 100 classes and with 8000 classes (200 labels).
+void BM_CTCLossLowMemory(int iters, int algorithm, int num_classes) {
+  RunCTCLoss(iters, algorithm, true, num_classes, 200);
+}
+BENCHMARK(BM_CTCLossLowMemory)
+    ->ArgPair(CTCLossCalculator::LOG_SPACE, 100)
+    ->ArgPair(CTCLossCalculator::SCALED, 100)
+    ->ArgPair(CTCLossCalculator::LOG_SPACE, 8000)
+    ->ArgPair(CTCLossCalculator::SCALED, 8000);
+
+// 8000 classes and 200 labels, for comparison with low_memory.
+void BM_CTCLossManyClasses(int iters, int algorithm) {
+  RunCTCLoss(iters, algorithm, false, 8000, 200);
+}
+BENCHMARK(BM_CTCLossManyClasses)
+    ->Arg(CTCLossCalculator::LOG_SPACE)
+    ->Arg(CTCLossCalculator::SCALED);
+
+}  // namespace
+}  // namespace ctc
+}  // namespace tensorflow
@@ -0,0 +1,121 @@
+/* Copyright 2017 The TensorFlow Authors. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#ifndef TENSORFLOW_CORE_UTIL_CTC_CTC_NBEST_RESCORER_H_
+#define TENSORFLOW_CORE_UTIL_CTC_CTC_NBEST_RESCORER_H_
+
+#include <memory>
+#include <string>
+
+#include "tensorflow/core/lib/core/errors.h"
+#include "tensorflow/core/lib/core/status.h"
+#include "tensorflow/core/platform/env.h"
+#include "tensorflow/core/platform/macros.h"
+#include "tensorflow/core/platform/types.h"
+#include "tensorflow/core/util/ctc/ctc_kenlm_model.h"
+#include "tensorflow/core/util/ctc/ctc_vocabulary.h"
+#include "lm/model.hh"
+#include "utf8.h"
+
+namespace tensorflow {
+namespace ctc {
+
+// Scores whole transcriptions with a KenLM model, to rescore the N best
+// hypotheses of a first decoding pass with a model too large to be queried
+// on every beam expansion.
+//
+// The model and vocabulary are immutable once loaded, and scoring keeps its
+// state on the stack: a single rescorer can score from any number of threads.
+class NBestRescorer {
+ public:
+  // The language model score of one transcription.
+  struct SentenceScore {
+    // log10 probability of the words and the end of sentence.
+    float lm_score = 0.0f;
+    int num_words = 0;
+    // Words scored as <unk>.
+    int num_oov_words = 0;
+  };
+
+  // Any KenLM binary model type is accepted, see KenLMModel::Load.
+  // vocabulary_path is the vocabulary of the labels, as for KenLMBeamScorer.
+  static Status Create(const string& model_path, const string& vocabulary_path,
+                       util::LoadMethod load_method,
+                       std::unique_ptr<NBestRescorer>* rescorer) {
+    std::unique_ptr<NBestRescorer> result(new NBestRescorer);
+    TF_RETURN_IF_ERROR(
+        KenLMModel::Load(model_path, load_method, &result->model_));
+    TF_RETURN_IF_ERROR(Env::Default()->FileExists(vocabulary_path));
+    result->vocabulary_.reset(new Vocabulary(vocabulary_path.c_str()));
+    *rescorer = std::move(result);
+    return Status::OK();
+  }
+
+  // Scores the transcription spelled by labels[0, num_labels), words being
+  // separated by space labels, from the beginning to the end of sentence.
+  template <typename Label>
+  Status Score(const Label* labels, int64 num_labels,
+               SentenceScore* score) const {
+    *score = SentenceScore();
+    KenLMModel::State states[2];
+    int current = 0;
+    states[current] = model_->BeginSentenceState();
+    std::wstring word;
+    string encoded_word;
+    for (int64 i = 0; i <= num_labels; ++i) {
+      if (i < num_labels) {
+        const Label label = labels[i];
+        if (label < 0 || label >= vocabulary_->GetSize()) {
+          return errors::InvalidArgument("Label ", label, " is not in [0, ",
+                                         vocabulary_->GetSize(), ")");
+        }
+        if (!vocabulary_->IsSpaceLabel(label)) {
+          word += vocabulary_->GetCharacterFromLabel(label);
+          continue;
+        }
+      }
+      // Repeated spaces do not make empty words.
+      if (word.empty()) continue;
+      encoded_word.clear();
+      utf8::utf16to8(word.begin(), word.end(),
+                     std::back_inserter(encoded_word));
+      word.clear();
+      const lm::WordIndex index = model_->Index(encoded_word);
+      if (index == model_->NotFound()) ++score->num_oov_words;
+      ++score->num_words;
+      score->lm_score +=
+          model_->FullScore(states[current], index, &states[1 - current]);
+      current = 1 - current;
+    }
+    score->lm_score += model_->FullScore(
+        states[current], model_->EndSentence(), &states[1 - current]);
+    return Status::OK();
+  }
+
+  const Vocabulary& vocabulary() const { return *vocabulary_; }
+
+ private:
+  NBestRescorer() {}
+
+  std::unique_ptr<KenLMModel> model_;
+  std::unique_ptr<Vocabulary> vocabulary_;
+
+  TF_DISALLOW_COPY_AND_ASSIGN(NBestRescorer);
+};
+
+}  // namespace ctc
+}  // namespace tensorflow
+
+#endif  // TENSORFLOW_CORE_UTIL_CTC_CTC_NBEST_RESCORER_H_
@@ -0,0 +1,239 @@
+/* Copyright 2017 The TensorFlow Authors. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#ifndef TENSORFLOW_CORE_UTIL_CTC_CTC_TRIE_BUILDER_H_
+#define TENSORFLOW_CORE_UTIL_CTC_CTC_TRIE_BUILDER_H_
+
+#include <algorithm>
+#include <functional>
+#include <limits>
+#include <ostream>
+#include <vector>
+
+#include "tensorflow/core/lib/core/errors.h"
+#include "tensorflow/core/lib/core/status.h"
+#include "tensorflow/core/lib/core/threadpool.h"
+#include "tensorflow/core/platform/macros.h"
+#include "tensorflow/core/platform/types.h"
+#include "tensorflow/core/util/ctc/ctc_compact_trie.h"
+#include "lm/model.hh"
+
+namespace tensorflow {
+namespace ctc {
+
+// Builds a compact trie (see ctc_compact_trie.h) from a lexicon without ever
+// materializing a pointer-based trie.
+//
+// Words are added as label sequences and kept in one flat array. Write
+// scores their unigrams in parallel, sorts them and streams the nodes out
+// bottom-up: walking the words in sorted order, a node is complete as soon
+// as a word no longer shares its prefix, so only the nodes on the path of
+// the current word are held in memory. Memory is thus the size of the
+// lexicon plus one node per label of the longest word, however large the
+// alphabet, and no recursion is involved.
+//
+// The trie written is the one TrieNode::Insert followed by
+// CompactTrieWriter::Convert would build from the same words inserted in
+// sorted order, byte for byte. Words spelled by the same labels are kept
+// once, with the smallest word index.
+class CompactTrieBuilder {
+ public:
+  // Returns the unigram log10 probability of a word. Called concurrently
+  // from the threads of the pool passed to Write.
+  typedef std::function<float(lm::WordIndex)> UnigramScorer;
+
+  explicit CompactTrieBuilder(int vocab_size)
+      : vocab_size_(vocab_size), num_duplicates_(0), num_nodes_(0) {}
+
+  // Adds the word spelled by labels, all in [0, vocab_size). Empty words are
+  // ignored.
+  Status AddWord(const std::vector<int>& labels, lm::WordIndex word_index) {
+    if (labels.empty()) return Status::OK();
+    for (const int label : labels) {
+      if (label < 0 || label >= vocab_size_) {
+        return errors::InvalidArgument("Label ", label, " of word ",
+                                       word_index, " is not in [0, ",
+                                       vocab_size_, ")");
+      }
+    }
+    if (labels_.size() + labels.size() > std::numeric_limits<uint32>::max()) {
+      return errors::ResourceExhausted("Lexicon too large");
+    }
+    Word word;
+    word.begin = labels_.size();
+    word.length = labels.size();
+    word.word_index = word_index;
+    word.unigram_score = 0.0f;
+    words_.push_back(word);
+    labels_.insert(labels_.end(), labels.begin(), labels.end());
+    return Status::OK();
+  }
+
+  int64 NumWords() const { return words_.size(); }
+
+  // Scores the words with scorer, on pool if not null, and writes the trie
+  // to os. The words added are consumed.
+  Status Write(const UnigramScorer& scorer, thread::ThreadPool* pool,
+               std::ostream* os) {
+    num_duplicates_ = 0;
+    num_nodes_ = 0;
+    ScoreWords(scorer, pool);
+    SortWords();
+
+    CompactTrieWriter writer(os, vocab_size_);
+    // frames_[0] is the root, frames_[d] the node at depth d of the path of
+    // the last word. Frames beyond depth are kept to reuse their children.
+    int depth = 0;
+    Reset(0, -1);
+    const Word* previous = nullptr;
+    for (const Word& word : words_) {
+      const int32* labels = &labels_[word.begin];
+      int common = 0;
+      if (previous != nullptr) {
+        const int32* previous_labels = &labels_[previous->begin];
+        const int length = std::min(previous->length, word.length);
+        while (common < length && previous_labels[common] == labels[common]) {
+          ++common;
+        }
+        if (common == word.length && common == previous->length) {
+          ++num_duplicates_;
+          continue;
+        }
+      }
+      for (; depth > common; --depth) Pop(&writer, depth);
+      for (; depth < word.length; ++depth) Reset(depth + 1, labels[depth]);
+      for (int d = 0; d <= depth; ++d) {
+        Frame& frame = frames_[d];
+        ++frame.prefix_count;
+        if (word.unigram_score < frame.min_unigram_score) {
+          frame.min_unigram_score = word.unigram_score;
+          frame.min_score_word = word.word_index;
+        }
+      }
+      frames_[depth].word_index = word.word_index;
+      previous = &word;
+    }
+    for (; depth > 0; --depth) Pop(&writer, depth);
+    const Frame& root = frames_[0];
+    writer.Finish(writer.AddNode(root.prefix_count, root.word_index,
+                                 root.min_score_word, root.min_unigram_score,
+                                 &frames_[0].children));
+    ++num_nodes_;
+
+    words_.clear();
+    labels_.clear();
+    if (!*os) return errors::DataLoss("Cannot write the trie");
+    return Status::OK();
+  }
+
+  // Words dropped by the last Write because an earlier word was spelled by
+  // the same labels.
+  int64 NumDuplicates() const { return num_duplicates_; }
+
+  // Nodes written by the last Write, including the root.
+  int64 NumNodes() const { return num_nodes_; }
+
+ private:
+  struct Word {
+    uint32 begin;  // Into labels_.
+    int32 length;
+    lm::WordIndex word_index;
+    float unigram_score;
+  };
+
+  struct Frame {
+    int label;
+    int prefix_count;
+    lm::WordIndex word_index;
+    lm::WordIndex min_score_word;
+    float min_unigram_score;
+    std::vector<CompactTrieWriter::Child> children;
+  };
+
+  void ScoreWords(const UnigramScorer& scorer, thread::ThreadPool* pool) {
+    auto score = [this, &scorer](int64 begin, int64 end) {
+      for (int64 i = begin; i < end; ++i) {
+        words_[i].unigram_score = scorer(words_[i].word_index);
+      }
+    };
+    if (pool == nullptr) {
+      score(0, words_.size());
+    } else {
+      // An n-gram lookup is a few hash probes.
+      pool->ParallelFor(words_.size(), 1000, score);
+    }
+  }
+
+  // Sorts the words by labels, then by word index so that the first of
+  // duplicate words wins.
+  void SortWords() {
+    const int32* labels = labels_.data();
+    std::sort(words_.begin(), words_.end(),
+              [labels](const Word& a, const Word& b) {
+                const int32* a_labels = labels + a.begin;
+                const int32* b_labels = labels + b.begin;
+                const int32* a_end = a_labels + a.length;
+                const int32* b_end = b_labels + b.length;
+                if (std::lexicographical_compare(a_labels, a_end, b_labels,
+                                                 b_end)) {
+                  return true;
+                }
+                if (std::lexicographical_compare(b_labels, b_end, a_labels,
+                                                 a_end)) {
+                  return false;
+                }
+                return a.word_index < b.word_index;
+              });
+  }
+
+  // Starts a new node at depth.
+  void Reset(int depth, int label) {
+    if (frames_.size() <= static_cast<size_t>(depth)) {
+      frames_.resize(depth + 1);
+    }
+    Frame& frame = frames_[depth];
+    frame.label = label;
+    frame.prefix_count = 0;
+    frame.word_index = 0;
+    frame.min_score_word = 0;
+    frame.min_unigram_score = std::numeric_limits<float>::max();
+    frame.children.clear();
+  }
+
+  // Writes the complete node at depth and links it to its parent.
+  void Pop(CompactTrieWriter* writer, int depth) {
+    Frame& frame = frames_[depth];
+    const uint64 offset =
+        writer->AddNode(frame.prefix_count, frame.word_index,
+                        frame.min_score_word, frame.min_unigram_score,
+                        &frame.children);
+    frames_[depth - 1].children.push_back({frame.label, offset});
+    ++num_nodes_;
+  }
+
+  const int vocab_size_;
+  std::vector<Word> words_;
+  std::vector<int32> labels_;
+  std::vector<Frame> frames_;
+  int64 num_duplicates_;
+  int64 num_nodes_;
+
+  TF_DISALLOW_COPY_AND_ASSIGN(CompactTrieBuilder);
+};
+
+}  // namespace ctc
+}  // namespace tensorflow
+
+#endif  // TENSORFLOW_CORE_UTIL_CTC_CTC_TRIE_BUILDER_H_
@@ -22,14 +22,19 @@ limitations under the License.
 #include <istream>
 #include <iostream>
 #include <limits>
+#include <vector>
 
 namespace tensorflow {
 namespace ctc {
 
 class TrieNode {
 public:
+  // Maps the labels of a word to its KenLM word index.
+  typedef std::function<lm::WordIndex (const std::vector<int>&)> WordLookup;
+
   TrieNode(int vocab_size) : vocab_size(vocab_size),
                         prefixCount(0),
+                        word_index(0),
                         min_score_word(0),
                         min_unigram_score(std::numeric_limits<float>::max()) {
       children = new TrieNode*[vocab_size]();
@@ -39,7 +44,7 @@ public:
     for (int i = 0; i < vocab_size; i++) {
       delete children[i];
     }
-    delete children;
+    delete[] children;
   }
 
   void WriteToStream(std::ostream& os) {
@@ -55,7 +60,7 @@ public:
   }
 
   static void ReadFromStream(std::istream& is, TrieNode* &obj, int vocab_size) {
-    int prefixCount;
+    int prefixCount = -1;
     is >> prefixCount;
 
     if (prefixCount == -1) {
@@ -80,7 +85,9 @@ public:
       min_unigram_score = unigram_score;
       min_score_word = lm_word;
     }
-    if (wordCharacter != '\0') {
+    if (wordCharacter == '\0') {
+      word_index = lm_word;
+    } else {
       int vocabIndex = translator(wordCharacter);
       TrieNode *child = children[vocabIndex];
       if (child == nullptr)
@@ -89,10 +96,26 @@ public:
     }
   }
 
+  // The text format does not record which nodes end a word. Recovers the
+  // word index of every node at which a word ends by looking it up.
+  void ResolveWordIndices(const WordLookup& lookup) {
+    std::vector<int> labels;
+    ResolveWordIndices(lookup, &labels);
+  }
+
+  int GetVocabSize() {
+    return vocab_size;
+  }
+
   int GetFrequency() {
     return prefixCount;
   }
 
+  // Index of the word ending at this node, 0 (<unk>) if there is none.
+  lm::WordIndex GetWordIndex() {
+    return word_index;
+  }
+
   lm::WordIndex GetMinScoreWordIndex() {
     return min_score_word;
   }
@@ -108,10 +131,27 @@ public:
 private:
   int vocab_size;
   int prefixCount;
+  lm::WordIndex word_index;
   lm::WordIndex min_score_word;
   float min_unigram_score;
   TrieNode **children;
 
+  void ResolveWordIndices(const WordLookup& lookup, std::vector<int>* labels) {
+    int children_count = 0;
+    for (int i = 0; i < vocab_size; i++) {
+      if (children[i] != nullptr) {
+        children_count += children[i]->prefixCount;
+        labels->push_back(i);
+        children[i]->ResolveWordIndices(lookup, labels);
+        labels->pop_back();
+      }
+    }
+    // Every inserted word counts once on each node of its path.
+    if (prefixCount > children_count && !labels->empty()) {
+      word_index = lookup(*labels);
+    }
+  }
+
   void WriteNode(std::ostream& os) const {
     os << prefixCount << std::endl;
     os << min_score_word << std::endl;
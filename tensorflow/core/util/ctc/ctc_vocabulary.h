@@ -63,8 +63,14 @@ public:
     return char_list[label];
   }
 
-  int GetLabelFromCharacter(wchar_t c) {
-    return char_to_label[c];
+  int GetLabelFromCharacter(wchar_t c) const {
+    auto it = char_to_label.find(c);
+    return it == char_to_label.end() ? 0 : it->second;
+  }
+
+  // GetLabelFromCharacter maps characters not in the vocabulary to label 0.
+  bool HasCharacter(wchar_t c) const {
+    return char_to_label.count(c) != 0;
   }
 
   int GetSize() const {
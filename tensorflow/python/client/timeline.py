@@ -438,6 +438,9 @@ class Timeline(object):
     args = {'name': node_name, 'op': op}
     for i, iname in enumerate(inputs):
       args['input%d' % i] = iname
+    # Counters recorded by the kernel, see OpKernelContext::record_counter.
+    for counter in sorted(nodestats.counters):
+      args[counter] = nodestats.counters[counter]
     self._chrome_trace.emit_region(start, duration, pid, tid, 'Op', op, args)
 
   def _emit_tensor_snapshot(self, tensor, timestamp, pid, tid, value):
@@ -25,6 +25,7 @@ from six.moves import zip_longest
 
 from tensorflow.python.framework import errors
 from tensorflow.python.framework import ops
+from tensorflow.python.framework import sparse_tensor
 from tensorflow.python.ops import array_ops
 from tensorflow.python.ops import ctc_ops
 from tensorflow.python.platform import test
@@ -246,5 +247,62 @@ class CTCGreedyDecoderTest(test.TestCase):
           top_paths=3)
 
 
+class CTCNBestRescoreTest(test.TestCase):
+
+  _KENLM_DIRECTORY = "tensorflow/core/util/ctc/testdata"
+  # The labels of the test vocabulary, the blank being the last one.
+  _ALPHABET = "abcdefghijklmnopqrstuvwxyz' "
+
+  def _decoded(self, sentences):
+    """One batch item with a hypothesis per sentence, as the decoders."""
+    decoded = []
+    for sentence in sentences:
+      labels = [self._ALPHABET.index(c) for c in sentence]
+      decoded.append(
+          sparse_tensor.SparseTensor(
+              indices=np.array([[0, i] for i in range(len(labels))],
+                               dtype=np.int64),
+              values=np.array(labels, dtype=np.int64),
+              dense_shape=np.array([1, len(labels)], dtype=np.int64)))
+    return decoded
+
+  def _rescore(self, log_probabilities, **rescore_args):
+    decoded = self._decoded(["tomorow it will rain", "tomorrow it will rain"])
+    rescored, log_probs, lm_scores, path_indices = ctc_ops.ctc_nbest_rescore(
+        decoded, np.array([log_probabilities], dtype=np.float32),
+        self._KENLM_DIRECTORY + "/kenlm-model.binary",
+        self._KENLM_DIRECTORY + "/vocabulary", **rescore_args)
+    with self.test_session(use_gpu=False) as sess:
+      return sess.run([[st.values for st in rescored], log_probs, lm_scores,
+                       path_indices])
+
+  def testSameModelKeepsFirstPassScores(self):
+    values, log_probs, lm_scores, path_indices = self._rescore(
+        [-1.0, -1.5], first_pass_kenlm_directory_path=self._KENLM_DIRECTORY)
+    # The first pass language model is taken out before the same one is
+    # added back: the hypotheses keep their scores and order.
+    self.assertAllClose([[-1.0, -1.5]], log_probs, atol=1e-4)
+    self.assertAllEqual([[0, 1]], path_indices)
+    self.assertNear(-4.21812, lm_scores[0, 1], 1e-4)
+    self.assertLess(lm_scores[0, 0], lm_scores[0, 1])
+    self.assertEqual(20, len(values[0]))
+
+  def testWordBonusReordersHypotheses(self):
+    values, log_probs, _, path_indices = self._rescore(
+        [-1.0, -1.5], first_pass_kenlm_directory_path=self._KENLM_DIRECTORY,
+        valid_word_count_weight=1.0)
+    # "tomorow" is out of the vocabulary: the other hypothesis gets one more
+    # valid word bonus, and no bonus is counted twice.
+    self.assertAllClose([[2.5, 2.0]], log_probs, atol=1e-4)
+    self.assertAllEqual([[1, 0]], path_indices)
+    self.assertEqual(21, len(values[0]))
+
+  def testWithoutFirstPassModel(self):
+    _, log_probs, lm_scores, path_indices = self._rescore(
+        [-1.0, -1.5], first_pass_kenlm_directory_path="")
+    first_pass = np.array([-1.0, -1.5])[path_indices[0]]
+    self.assertAllClose([first_pass + lm_scores[0]], log_probs, atol=1e-4)
+
+
 if __name__ == "__main__":
   test.main()
@@ -59,14 +59,17 @@ class CTCLossTest(test.TestCase):
                    labels,
                    loss_truth,
                    grad_truth,
-                   expected_err_re=None):
+                   expected_err_re=None,
+                   algorithm="log_space",
+                   low_memory=False):
     self.assertEquals(len(inputs), len(grad_truth))
 
     inputs_t = constant_op.constant(inputs)
 
     with self.test_session(use_gpu=False) as sess:
       loss = ctc_ops.ctc_loss(
-          inputs=inputs_t, labels=labels, sequence_length=seq_lens)
+          inputs=inputs_t, labels=labels, sequence_length=seq_lens,
+          algorithm=algorithm, low_memory=low_memory)
       grad = gradients_impl.gradients(loss, [inputs_t])[0]
 
       self.assertShapeEqual(loss_truth, loss)
@@ -213,7 +216,10 @@ class CTCLossTest(test.TestCase):
     # convert grad_truth into [max_time x batch_size x depth] Tensor
     grad_truth = np.asarray(grad_truth, dtype=np.float32)
 
-    self._testCTCLoss(inputs, seq_lens, labels, loss_truth, grad_truth)
+    for algorithm in ("log_space", "scaled"):
+      for low_memory in (False, True):
+        self._testCTCLoss(inputs, seq_lens, labels, loss_truth, grad_truth,
+                          algorithm=algorithm, low_memory=low_memory)
 
   def test_time_major(self):
     """Testing time_major param.
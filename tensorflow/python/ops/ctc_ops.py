@@ -19,6 +19,8 @@ from __future__ import absolute_import
 from __future__ import division
 from __future__ import print_function
 
+from tensorflow.python.framework import constant_op
+from tensorflow.python.framework import dtypes
 from tensorflow.python.framework import ops
 from tensorflow.python.framework import sparse_tensor
 
@@ -31,7 +33,8 @@ from tensorflow.python.ops.nn_grad import _BroadcastMul
 def ctc_loss(labels, inputs, sequence_length,
              preprocess_collapse_repeated=False,
              ctc_merge_repeated=True,
-             ignore_longer_outputs_than_inputs=False, time_major=True):
+             ignore_longer_outputs_than_inputs=False, time_major=True,
+             algorithm="log_space", low_memory=False):
   """Computes the CTC (Connectionist Temporal Classification) Loss.
 
   This op implements the CTC loss as presented in the article:
@@ -126,6 +129,15 @@ def ctc_loss(labels, inputs, sequence_length,
       transposes at the beginning of the ctc_loss calculation.  However, most
       TensorFlow data is batch-major, so by this function also accepts inputs
       in batch-major form.
+    algorithm: String, `"log_space"` (the default) or `"scaled"`.
+      `"scaled"` computes the CTC recursions on probabilities rescaled at
+      every time step instead of on log-probabilities, which is faster.
+      Batch items whose rescaled probabilities underflow are computed in
+      log space.
+    low_memory: Boolean.  If True, the memory taken by each batch item grows
+      with the square root of its sequence length rather than linearly and
+      does not depend on the number of classes, for about one more pass
+      over the sequence.
 
   Returns:
     A 1-D `float` `Tensor`, size `[batch]`, containing the negative log probabilities.
@@ -149,7 +161,9 @@ def ctc_loss(labels, inputs, sequence_length,
       sequence_length,
       preprocess_collapse_repeated=preprocess_collapse_repeated,
       ctc_merge_repeated=ctc_merge_repeated,
-      ignore_longer_outputs_than_inputs=ignore_longer_outputs_than_inputs)
+      ignore_longer_outputs_than_inputs=ignore_longer_outputs_than_inputs,
+      algorithm=algorithm,
+      low_memory=low_memory)
 
   return loss
 
@@ -227,7 +241,15 @@ def ctc_greedy_decoder(inputs, sequence_length, merge_repeated=True):
 def ctc_beam_search_decoder(inputs, sequence_length, kenlm_directory_path,
                             kenlm_weight=1.0, word_count_weight=0.0,
                             valid_word_count_weight=0.0, beam_width=100,
-                            top_paths=1, merge_repeated=True):
+                            top_paths=1, merge_repeated=True,
+                            lm_score_cache_size=0,
+                            kenlm_load_method="populate_or_read",
+                            blank_skip_threshold=0.0,
+                            beam_threshold=0.0,
+                            return_decode_stats=False,
+                            hotwords=None, hotword_boosts=None,
+                            strict_lexicon=False, decoder_threads=0,
+                            decoder_pool=""):
   """Performs beam search decoding on the logits given in input.
 
   **Note** The `ctc_greedy_decoder` is a special case of the
@@ -243,17 +265,56 @@ def ctc_beam_search_decoder(inputs, sequence_length, kenlm_directory_path,
     * `A B B B B` if `merge_repeated = False`.
 
   Args:
-    inputs: 3-D `float` `Tensor`, size
+    inputs: 3-D `float` or `float16` `Tensor`, size
       `[max_time x batch_size x num_classes]`.  The logits.
     sequence_length: 1-D `int32` vector containing sequence lengths,
       having size `[batch_size]`.
     kenlm_directory_path: String. Directory path to KenLM language model files `kenlm-model.binary`, `vocabulary`, `trie`.
+      Any KenLM binary model type (probing, trie, quantized trie) is accepted.
     kenlm_weight: Float tensor. A scalar that weights the significance of the language model.
     word_count_weight: Float tensor. A scalar that weights the significance of the transcription word count.
     valid_word_count_weight: Float tensor. A scalar that weights the significance of the valid transcription word count.
     beam_width: An int scalar >= 0 (beam search beam width).
     top_paths: An int scalar >= 0, <= beam_width (controls output size).
     merge_repeated: Boolean.  Default: True.
+    lm_score_cache_size: An int scalar >= 0. Number of language model scores
+      cached per decoding thread; the caches are kept across calls. 0 (the
+      default) disables the cache.
+    kenlm_load_method: String, one of `"lazy"`, `"populate_or_lazy"`,
+      `"populate_or_read"` (the default), `"read"` or `"parallel_read"`.
+      `"lazy"` memory maps the language model and shares its pages between
+      processes.
+    blank_skip_threshold: Float >= 0.  If positive, frames whose most likely
+      label is the blank, with a log-probability above
+      `-blank_skip_threshold`, only update the current beams, without
+      considering new labels or querying the language model.  E.g. 0.05
+      skips frames with a blank probability above 0.95.  Default: 0 (off).
+    beam_threshold: Float >= 0.  If positive, beams whose log-probability
+      falls more than `beam_threshold` below the best beam are dropped, so
+      that fewer than `beam_width` beams are carried on easy frames.
+      Default: 0 (off).
+    return_decode_stats: Boolean.  If `True`, also return the work done
+      decoding each batch item.  Default: False.  The same counters, summed
+      over the batch, are recorded in the `RunMetadata` step stats (and thus
+      timelines) when tracing.
+    hotwords: Optional 1-D `string` `Tensor` or list of phrases to boost for
+      this call only, e.g. product or customer names: UTF-8 words of the
+      vocabulary separated by single spaces.  They are built into a small
+      trie for the call, leaving the loaded language model untouched.
+    hotword_boosts: 1-D `float` `Tensor` or list of log-probabilities >= 0,
+      the boost of each of `hotwords`, not weighted by `kenlm_weight`.
+      Required with `hotwords`.
+    strict_lexicon: Boolean.  If `True`, only words of the `trie` known to
+      the language model are decoded: labels leaving the trie are never
+      considered rather than penalized, which suits closed vocabularies.
+      Default: False.
+    decoder_threads: An int scalar >= 0.  If positive, the batch items are
+      decoded on a dedicated pool of `decoder_threads` threads, and the
+      inter-op threads run other ops (e.g. the acoustic models of concurrent
+      steps) meanwhile.  Default: 0, decode on the intra-op threads.
+    decoder_pool: String, the name of the decoder pool, shared by all the
+      decoders of the device naming it, which must give the same
+      `decoder_threads`.  Ignored if `decoder_threads` is 0.
 
   Returns:
     A tuple `(decoded, log_probabilities)` where
@@ -267,22 +328,219 @@ def ctc_beam_search_decoder(inputs, sequence_length, kenlm_directory_path,
         The shape values are: `[batch_size, max_decoded_length[j]]`.
     log_probability: A `float` matrix `(batch_size x top_paths)` containing
         sequence log-probabilities.
+    If `return_decode_stats` is `True`, the tuple also holds
+    decode_stats: An `int64` matrix `(batch_size x 10)`, whose columns are the
+        frames decoded, the frames skipped, the beams expanded, the children
+        expanded by the scorer, the children pruned by label selection or
+        `strict_lexicon`, the language model queries (cache hits excluded),
+        the out of vocabulary words, the labels leaving the trie, and the
+        microseconds spent in the scorer and in the rest of the beam update.
   """
 
-  decoded_ixs, decoded_vals, decoded_shapes, log_probabilities = (
-      gen_ctc_ops._ctc_beam_search_decoder(
-          inputs, sequence_length, kenlm_weight, word_count_weight,
-          valid_word_count_weight,
+  attrs = dict(beam_width=beam_width, top_paths=top_paths,
+               merge_repeated=merge_repeated,
+               lm_score_cache_size=lm_score_cache_size,
+               kenlm_load_method=kenlm_load_method,
+               blank_skip_threshold=blank_skip_threshold,
+               beam_threshold=beam_threshold)
+  # CTCBeamSearchDecoder has neither the hotwords inputs, the decode_stats
+  # output nor strict_lexicon: CTCBeamSearchDecoderV2 and
+  # CTCAsyncBeamSearchDecoder do.
+  use_v2 = (return_decode_stats or strict_lexicon or hotwords is not None or
+            hotword_boosts is not None)
+  if hotwords is None:
+    hotwords = constant_op.constant([], dtype=dtypes.string)
+  if hotword_boosts is None:
+    hotword_boosts = constant_op.constant([], dtype=dtypes.float32)
+  if decoder_threads > 0:
+    outputs = gen_ctc_ops._ctc_async_beam_search_decoder(
+        inputs, sequence_length, kenlm_weight, word_count_weight,
+        valid_word_count_weight, hotwords, hotword_boosts,
+        kenlm_directory_path, output_decode_stats=return_decode_stats,
+        strict_lexicon=strict_lexicon, decoder_threads=decoder_threads,
+        decoder_pool=decoder_pool, **attrs)
+  elif use_v2:
+    outputs = gen_ctc_ops._ctc_beam_search_decoder_v2(
+        inputs, sequence_length, kenlm_weight, word_count_weight,
+        valid_word_count_weight, hotwords, hotword_boosts,
+        kenlm_directory_path, output_decode_stats=return_decode_stats,
+        strict_lexicon=strict_lexicon, **attrs)
+  else:
+    outputs = gen_ctc_ops._ctc_beam_search_decoder(
+        inputs, sequence_length, kenlm_weight, word_count_weight,
+        valid_word_count_weight, kenlm_directory_path, **attrs)
+  decoded_ixs, decoded_vals, decoded_shapes, log_probabilities = outputs[:4]
+
+  decoded = [sparse_tensor.SparseTensor(ix, val, shape) for (ix, val, shape)
+             in zip(decoded_ixs, decoded_vals, decoded_shapes)]
+  if return_decode_stats:
+    return decoded, log_probabilities, outputs[4]
+  return decoded, log_probabilities
+
+
+def ctc_beam_search_stream_decoder(inputs, sequence_length, stream_ids,
+                                   finalize, kenlm_directory_path,
+                                   kenlm_weight=1.0, word_count_weight=0.0,
+                                   valid_word_count_weight=0.0, beam_width=100,
+                                   top_paths=1, merge_repeated=True,
+                                   lm_score_cache_size=0,
+                                   kenlm_load_method="populate_or_read",
+                                   stream_idle_timeout_secs=600,
+                                   blank_skip_threshold=0.0,
+                                   beam_threshold=0.0,
+                                   return_decode_stats=False,
+                                   strict_lexicon=False):
+  """Performs beam search decoding on successive chunks of logits.
+
+  Like `ctc_beam_search_decoder`, but each batch item continues the stream
+  named by `stream_ids`: the beams of a stream are kept between calls (of
+  the same op), so that each call only decodes the new chunk and returns the
+  best hypotheses so far. Set `finalize` for the last chunk of a stream to
+  score its end of sentence and release it. A stream that is never finalized
+  is released after `stream_idle_timeout_secs` without a chunk.
+
+  Args:
+    inputs: 3-D `float` or `float16` `Tensor`, size
+      `[max_time x batch_size x num_classes]`.  The logits of the next chunk.
+    sequence_length: 1-D `int32` vector containing chunk lengths,
+      having size `[batch_size]`.  Lengths may be 0.
+    stream_ids: 1-D `string` vector of distinct stream ids, size
+      `[batch_size]`.
+    finalize: 1-D `bool` vector, size `[batch_size]`.  True for the last
+      chunk of a stream.
+    kenlm_directory_path: String. Directory path to KenLM language model files `kenlm-model.binary`, `vocabulary`, `trie`.
+    kenlm_weight: Float tensor. A scalar that weights the significance of the language model.
+    word_count_weight: Float tensor. A scalar that weights the significance of the transcription word count.
+    valid_word_count_weight: Float tensor. A scalar that weights the significance of the valid transcription word count.
+    beam_width: An int scalar >= 0 (beam search beam width).
+    top_paths: An int scalar >= 0, <= beam_width (controls output size).
+    merge_repeated: Boolean.  Default: True.
+    lm_score_cache_size: An int scalar >= 0. Number of language model scores
+      cached per decoding thread; the caches are kept across calls. 0 (the
+      default) disables the cache.
+    kenlm_load_method: String, see `ctc_beam_search_decoder`.
+    stream_idle_timeout_secs: An int scalar >= 0. Streams that are not fed
+      for this long are discarded; a later chunk with the same id starts a
+      new stream. 0 keeps them until the session is closed.
+    blank_skip_threshold: Float >= 0, see `ctc_beam_search_decoder`.
+    beam_threshold: Float >= 0, see `ctc_beam_search_decoder`.
+    return_decode_stats: Boolean, see `ctc_beam_search_decoder`.  The stats
+      count the work done on the chunk of each stream.
+    strict_lexicon: Boolean, see `ctc_beam_search_decoder`.
+
+  Returns:
+    A tuple `(decoded, log_probabilities)` as for `ctc_beam_search_decoder`,
+    holding the hypotheses of each stream so far, and the `decode_stats` if
+    `return_decode_stats` is `True`.
+  """
+
+  decoded_ixs, decoded_vals, decoded_shapes, log_probabilities, stats = (
+      gen_ctc_ops._ctc_beam_search_stream_decoder(
+          inputs, sequence_length, stream_ids, finalize, kenlm_weight,
+          word_count_weight, valid_word_count_weight,
           kenlm_directory_path, beam_width=beam_width, top_paths=top_paths,
-          merge_repeated=merge_repeated))
+          merge_repeated=merge_repeated,
+          lm_score_cache_size=lm_score_cache_size,
+          kenlm_load_method=kenlm_load_method,
+          stream_idle_timeout_secs=stream_idle_timeout_secs,
+          blank_skip_threshold=blank_skip_threshold,
+          beam_threshold=beam_threshold,
+          output_decode_stats=return_decode_stats,
+          strict_lexicon=strict_lexicon))
+
+  decoded = [sparse_tensor.SparseTensor(ix, val, shape) for (ix, val, shape)
+             in zip(decoded_ixs, decoded_vals, decoded_shapes)]
+  if return_decode_stats:
+    return decoded, log_probabilities, stats
+  return decoded, log_probabilities
+
+
+def ctc_nbest_rescore(decoded, log_probabilities, kenlm_model_path,
+                      vocabulary_path, first_pass_kenlm_directory_path,
+                      kenlm_weight=1.0, word_count_weight=0.0,
+                      valid_word_count_weight=0.0,
+                      first_pass_kenlm_weight=1.0,
+                      first_pass_word_count_weight=0.0,
+                      first_pass_valid_word_count_weight=0.0,
+                      kenlm_load_method="lazy",
+                      first_pass_kenlm_load_method="populate_or_read"):
+  """Rescores the N best hypotheses of a CTC decoder with a KenLM model.
+
+  The second pass of a two-pass decoder: `ctc_beam_search_decoder` decodes
+  with a language model small enough to be queried on every expansion, and
+  this op rescores the whole sentences it returns with a larger one, in
+  parallel over the batch and the hypotheses.
+
+  The score the first pass language model and word bonuses gave a hypothesis
+  is recomputed from the `first_pass_*` arguments, which must be those of the
+  decoder, and taken out of its `log_probabilities` entry.  The new
+  log-probability adds `kenlm_weight * lm_score + word_count_weight * words +
+  valid_word_count_weight * words_in_vocabulary` instead.
+
+  Args:
+    decoded: The list of `top_paths` `SparseTensor`s returned by
+      `ctc_beam_search_decoder`.
+    log_probabilities: The `float` matrix `(batch_size x top_paths)` returned
+      by `ctc_beam_search_decoder`.
+    kenlm_model_path: String. Path of the KenLM model, any binary model type.
+    vocabulary_path: String. Path of the vocabulary of the labels, as in the
+      `kenlm_directory_path` of `ctc_beam_search_decoder`.
+    first_pass_kenlm_directory_path: String. The `kenlm_directory_path` of
+      the decoder, or empty if it did not use a language model.
+    kenlm_weight: Float tensor. A scalar that weights the significance of the language model.
+    word_count_weight: Float tensor. A scalar that weights the significance of the transcription word count.
+    valid_word_count_weight: Float tensor. A scalar that weights the significance of the valid transcription word count.
+    first_pass_kenlm_weight: Float tensor. The `kenlm_weight` of the decoder.
+    first_pass_word_count_weight: Float tensor. The `word_count_weight` of
+      the decoder.
+    first_pass_valid_word_count_weight: Float tensor. The
+      `valid_word_count_weight` of the decoder.
+    kenlm_load_method: String, see `ctc_beam_search_decoder`.  Default:
+      `"lazy"`, which memory maps the model so that only the pages queried
+      are read.
+    first_pass_kenlm_load_method: String. The `kenlm_load_method` of the
+      decoder, so that its model is not loaded again.
+
+  Returns:
+    A tuple `(decoded, log_probabilities, lm_scores, path_indices)` where
+    decoded: The hypotheses of `decoded`, best first for each batch item.
+    log_probabilities: A `float` matrix `(batch_size x top_paths)`, the
+      rescored sequence log-probabilities.
+    lm_scores: A `float` matrix `(batch_size x top_paths)`, the log10
+      probability of each hypothesis under the model.
+    path_indices: An `int32` matrix `(batch_size x top_paths)`, the index in
+      `decoded` of each hypothesis.
+  """
 
-  return (
-      [sparse_tensor.SparseTensor(ix, val, shape) for (ix, val, shape)
-       in zip(decoded_ixs, decoded_vals, decoded_shapes)],
-      log_probabilities)
+  decoded_ixs, decoded_vals, decoded_shapes, log_probs, lm_scores, indices = (
+      gen_ctc_ops._ctcn_best_rescore(
+          [d.indices for d in decoded], [d.values for d in decoded],
+          [d.dense_shape for d in decoded], log_probabilities, kenlm_weight,
+          word_count_weight, valid_word_count_weight, first_pass_kenlm_weight,
+          first_pass_word_count_weight, first_pass_valid_word_count_weight,
+          kenlm_model_path=kenlm_model_path, vocabulary_path=vocabulary_path,
+          first_pass_kenlm_directory_path=first_pass_kenlm_directory_path,
+          kenlm_load_method=kenlm_load_method,
+          first_pass_kenlm_load_method=first_pass_kenlm_load_method))
+
+  rescored = [sparse_tensor.SparseTensor(ix, val, shape) for (ix, val, shape)
+              in zip(decoded_ixs, decoded_vals, decoded_shapes)]
+  return rescored, log_probs, lm_scores, indices
 
 
 ops.NotDifferentiable("CTCGreedyDecoder")
 
 
 ops.NotDifferentiable("CTCBeamSearchDecoder")
+
+
+ops.NotDifferentiable("CTCBeamSearchDecoderV2")
+
+
+ops.NotDifferentiable("CTCAsyncBeamSearchDecoder")
+
+
+ops.NotDifferentiable("CTCBeamSearchStreamDecoder")
+
+
+ops.NotDifferentiable("CTCNBestRescore")
@@ -84,6 +84,8 @@ See the @{$python/nn} guide.
 @@ctc_loss
 @@ctc_greedy_decoder
 @@ctc_beam_search_decoder
+@@ctc_beam_search_stream_decoder
+@@ctc_nbest_rescore
 @@top_k
 @@in_top_k
 @@nce_loss